@@ -22,11 +22,21 @@ extern "C" {
 #endif
 
 #include "common.h"
+#include "pool.h"
 
 void random_pts_in_box(uint, uint, float *, float *, float *);
 void perturbate(uint, uint, float *, float, float *);
 void multi_eval(uint, uint, void (*)(float *, float *),
                 uint, float *, float*);
+void multi_eval_pool(struct cn_pool *, uint, uint,
+                     void (*)(float *, float *, void *), void *,
+                     uint, float *, float *);
+void multi_eval_batch(struct cn_pool *, uint, uint,
+                      void (*)(uint, float *, float *, void *), void *,
+                      uint, uint, float *, float *);
+void multi_eval_warm(struct cn_pool *, uint, uint,
+                     void (*)(float *, float *, void *, void *), void *,
+                     size_t, void *, uint, float *, float *);
 void pinv_ls(uint, uint, float *, uint, float *, float *);
 void normal_ls(uint, uint, float *, uint, float *, float *);
 void minimum_norm(uint, uint, float *, uint, float *, float *);
@@ -34,6 +44,70 @@ void minimum_norm(uint, uint, float *, uint, float *, float *);
 void cluster_newton(uint, uint, void (*)(float *, float *), float *,
                     float *, float *, uint, float, uint, float *, float *);
 
+/**
+ * struct cn_fidelity - fidelity schedule of cluster_newton_ws()
+ * @nlevels:            Number of fidelity levels.
+ * @levels:             Vector of size nlevels: the fidelity of each level,
+ *                      in (0, 1], increasing, with levels(nlevels) = 1 for
+ *                      the full accuracy of the model.
+ * @start:              Vector of size nlevels: level j is used from
+ *                      iteration start(j) on, with start(1) = 0.
+ * @stall:              If positive, the solver moves to the next level
+ *                      as soon as the relative residual of the linear fit
+ *                      of step 2.2 is more than stall times the one of
+ *                      the previous iteration.
+ * @current:            Written by the solver with the fidelity of the
+ *                      iteration, before the cluster is evaluated.
+ *
+ * The last iteration always runs at the highest level, so that the
+ * residuals are those of the full model.
+ */
+struct cn_fidelity {
+	uint nlevels;
+	const float *levels;
+	const uint *start;
+	float stall;
+	float *current;
+};
+
+/**
+ * struct cn_active - active set options of cluster_newton_ws()
+ * @tol:               A point has converged once the relative distance
+ *                     from its image to its perturbed target is at most
+ *                     tol. Zero components of the target are compared
+ *                     absolutely.
+ * @frac:              The iterations stop once this fraction of the
+ *                     points have converged, or once they all have if
+ *                     frac is zero.
+ * @iters:             Vector of size l, or NULL. Output: the number of
+ *                     evaluations of each point.
+ */
+struct cn_active {
+	float tol;
+	float frac;
+	uint *iters;
+};
+
+struct cn_workspace;
+
+size_t cn_workspace_size(uint, uint, uint);
+struct cn_workspace *cn_workspace_create(uint, uint, uint);
+void cn_workspace_destroy(struct cn_workspace *);
+void cn_workspace_set_pool(struct cn_workspace *, struct cn_pool *);
+void cn_workspace_set_batch(struct cn_workspace *,
+                            void (*)(uint, float *, float *, void *), uint);
+void cn_workspace_set_warm(struct cn_workspace *,
+                           void (*)(float *, float *, void *, void *),
+                           size_t);
+void cn_workspace_set_fidelity(struct cn_workspace *,
+                               const struct cn_fidelity *);
+void cn_workspace_set_active(struct cn_workspace *,
+                             const struct cn_active *);
+void cluster_newton_ws(struct cn_workspace *,
+                       void (*)(float *, float *, void *), void *,
+                       float *, float *, float *, float, uint,
+                       float *, float *);
+
 #ifdef __cplusplus
 }
 #endif
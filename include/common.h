@@ -92,7 +92,7 @@ void m_scale_cols(uint, uint, float *, float *);
 void m_scale_rows_inv(uint, uint, float *, float *);
 void m_replicate(uint, float *, uint, float *);
 void m_transpose(uint, uint, float *, float *);
-float v_norm(uint, float *);
+float v_norm(uint, const float *);
 
 #ifdef __cplusplus
 }
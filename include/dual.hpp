@@ -0,0 +1,427 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef DUAL_HPP
+#define DUAL_HPP
+
+/*
+ * Forward-mode automatic differentiation for the right-hand sides of the
+ * integrators of integrate.h.
+ *
+ * A model is written once, as a template over the number type, and
+ * struct ode_ad turns it into the f, df and dfdx callbacks expected by
+ * the C integrators. The Jacobian is computed by a single evaluation of
+ * the model on dual numbers with one derivative lane per state, which
+ * the compiler vectorizes: it is exact, and costs about one multi-lane
+ * evaluation of f.
+ */
+
+#include "common.h"
+
+#include <cmath>
+
+namespace cn {
+
+/**
+ * struct dual - a value and N partial derivatives
+ * @v:            The value.
+ * @d:            The derivatives with respect to N independent variables,
+ *                d[0] to d[N - 1].
+ *
+ * Arithmetic between duals and with scalars of type T propagates the
+ * derivatives by the chain rule. Constants must have type T: write
+ * 2.0f * u rather than 2 * u.
+ */
+template <typename T, uint N>
+struct dual {
+	T v;
+	T d[N];
+
+	dual() {}
+
+	dual(T a) : v(a)
+	{
+		#pragma omp simd
+		for (uint k = 0; k < N; k++) {
+			d[k] = T(0);
+		}
+	}
+
+	/* the k-th independent variable, 1 <= k <= N, with value a */
+	static dual variable(T a, uint k)
+	{
+		dual r(a);
+		r.d[k - 1] = T(1);
+		return r;
+	}
+
+	dual &operator+=(const dual &b) { return *this = *this + b; }
+	dual &operator-=(const dual &b) { return *this = *this - b; }
+	dual &operator*=(const dual &b) { return *this = *this * b; }
+	dual &operator/=(const dual &b) { return *this = *this / b; }
+	dual &operator+=(T b) { v += b; return *this; }
+	dual &operator-=(T b) { v -= b; return *this; }
+	dual &operator*=(T b) { return *this = *this * b; }
+	dual &operator/=(T b) { return *this = *this / b; }
+};
+
+/* r = a x' + b y', with value v, the building block of the rules below */
+template <typename T, uint N>
+inline dual<T, N> dual_lin(T v, T a, const dual<T, N> &x,
+                           T b, const dual<T, N> &y)
+{
+	dual<T, N> r;
+	r.v = v;
+	#pragma omp simd
+	for (uint k = 0; k < N; k++) {
+		r.d[k] = a * x.d[k] + b * y.d[k];
+	}
+	return r;
+}
+
+/* r = a x', with value v */
+template <typename T, uint N>
+inline dual<T, N> dual_scale(T v, T a, const dual<T, N> &x)
+{
+	dual<T, N> r;
+	r.v = v;
+	#pragma omp simd
+	for (uint k = 0; k < N; k++) {
+		r.d[k] = a * x.d[k];
+	}
+	return r;
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator+(const dual<T, N> &x)
+{
+	return x;
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator-(const dual<T, N> &x)
+{
+	return dual_scale(-x.v, T(-1), x);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator+(const dual<T, N> &x, const dual<T, N> &y)
+{
+	return dual_lin(x.v + y.v, T(1), x, T(1), y);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator-(const dual<T, N> &x, const dual<T, N> &y)
+{
+	return dual_lin(x.v - y.v, T(1), x, T(-1), y);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator*(const dual<T, N> &x, const dual<T, N> &y)
+{
+	return dual_lin(x.v * y.v, y.v, x, x.v, y);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator/(const dual<T, N> &x, const dual<T, N> &y)
+{
+	T q = x.v / y.v;
+	return dual_lin(q, T(1) / y.v, x, -q / y.v, y);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator+(const dual<T, N> &x, T b)
+{
+	return dual_scale(x.v + b, T(1), x);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator+(T a, const dual<T, N> &y)
+{
+	return dual_scale(a + y.v, T(1), y);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator-(const dual<T, N> &x, T b)
+{
+	return dual_scale(x.v - b, T(1), x);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator-(T a, const dual<T, N> &y)
+{
+	return dual_scale(a - y.v, T(-1), y);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator*(const dual<T, N> &x, T b)
+{
+	return dual_scale(x.v * b, b, x);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator*(T a, const dual<T, N> &y)
+{
+	return dual_scale(a * y.v, a, y);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator/(const dual<T, N> &x, T b)
+{
+	return dual_scale(x.v / b, T(1) / b, x);
+}
+
+template <typename T, uint N>
+inline dual<T, N> operator/(T a, const dual<T, N> &y)
+{
+	T q = a / y.v;
+	return dual_scale(q, -q / y.v, y);
+}
+
+/* comparisons only look at the values, for models with branches */
+template <typename T, uint N>
+inline bool operator<(const dual<T, N> &x, const dual<T, N> &y)
+{
+	return x.v < y.v;
+}
+
+template <typename T, uint N>
+inline bool operator>(const dual<T, N> &x, const dual<T, N> &y)
+{
+	return x.v > y.v;
+}
+
+template <typename T, uint N>
+inline bool operator<=(const dual<T, N> &x, const dual<T, N> &y)
+{
+	return x.v <= y.v;
+}
+
+template <typename T, uint N>
+inline bool operator>=(const dual<T, N> &x, const dual<T, N> &y)
+{
+	return x.v >= y.v;
+}
+
+template <typename T, uint N>
+inline bool operator==(const dual<T, N> &x, const dual<T, N> &y)
+{
+	return x.v == y.v;
+}
+
+template <typename T, uint N>
+inline bool operator!=(const dual<T, N> &x, const dual<T, N> &y)
+{
+	return x.v != y.v;
+}
+
+template <typename T, uint N>
+inline bool operator<(const dual<T, N> &x, T b)
+{
+	return x.v < b;
+}
+
+template <typename T, uint N>
+inline bool operator>(const dual<T, N> &x, T b)
+{
+	return x.v > b;
+}
+
+template <typename T, uint N>
+inline bool operator<=(const dual<T, N> &x, T b)
+{
+	return x.v <= b;
+}
+
+template <typename T, uint N>
+inline bool operator>=(const dual<T, N> &x, T b)
+{
+	return x.v >= b;
+}
+
+template <typename T, uint N>
+inline bool operator==(const dual<T, N> &x, T b)
+{
+	return x.v == b;
+}
+
+template <typename T, uint N>
+inline bool operator!=(const dual<T, N> &x, T b)
+{
+	return x.v != b;
+}
+
+template <typename T, uint N>
+inline bool operator<(T a, const dual<T, N> &y)
+{
+	return a < y.v;
+}
+
+template <typename T, uint N>
+inline bool operator>(T a, const dual<T, N> &y)
+{
+	return a > y.v;
+}
+
+template <typename T, uint N>
+inline bool operator<=(T a, const dual<T, N> &y)
+{
+	return a <= y.v;
+}
+
+template <typename T, uint N>
+inline bool operator>=(T a, const dual<T, N> &y)
+{
+	return a >= y.v;
+}
+
+template <typename T, uint N>
+inline bool operator==(T a, const dual<T, N> &y)
+{
+	return a == y.v;
+}
+
+template <typename T, uint N>
+inline bool operator!=(T a, const dual<T, N> &y)
+{
+	return a != y.v;
+}
+
+template <typename T, uint N>
+inline dual<T, N> exp(const dual<T, N> &x)
+{
+	T e = std::exp(x.v);
+	return dual_scale(e, e, x);
+}
+
+template <typename T, uint N>
+inline dual<T, N> log(const dual<T, N> &x)
+{
+	return dual_scale(std::log(x.v), T(1) / x.v, x);
+}
+
+template <typename T, uint N>
+inline dual<T, N> sqrt(const dual<T, N> &x)
+{
+	T s = std::sqrt(x.v);
+	return dual_scale(s, T(0.5) / s, x);
+}
+
+template <typename T, uint N>
+inline dual<T, N> sin(const dual<T, N> &x)
+{
+	return dual_scale(std::sin(x.v), std::cos(x.v), x);
+}
+
+template <typename T, uint N>
+inline dual<T, N> cos(const dual<T, N> &x)
+{
+	return dual_scale(std::cos(x.v), -std::sin(x.v), x);
+}
+
+template <typename T, uint N>
+inline dual<T, N> pow(const dual<T, N> &x, T p)
+{
+	T r = std::pow(x.v, p);
+	return dual_scale(r, p * std::pow(x.v, p - T(1)), x);
+}
+
+template <typename T, uint N>
+inline dual<T, N> fabs(const dual<T, N> &x)
+{
+	return (x.v < T(0) ? -x : x);
+}
+
+/* the plain functions, so that models can call them unqualified */
+using std::exp;
+using std::log;
+using std::sqrt;
+using std::sin;
+using std::cos;
+using std::pow;
+using std::fabs;
+
+/**
+ * struct ode_ad - integrator callbacks generated from a model
+ * @M:              The model, a class with the members
+ *                    static const uint n;    dimension of the state
+ *                    static const uint np;   number of parameters
+ *                    template <typename T, typename P>
+ *                    static void rhs(float t, const T *y, T *d,
+ *                                    const P *x);
+ *                  where rhs() writes f(t,y) into d, for the parameters
+ *                  x. Vectors are read with V_IDX() as in C.
+ *
+ * The callbacks take the parameters x, a vector of size np, as their
+ * context:
+ *   f(t, y, d, x)      d = f(t,y), a vector of size n, like F_influenza().
+ *   df(t, y, J, x)     J = Df(t,y), an n-by-n matrix, like dF_influenza().
+ *   dfdx(t, y, Jx, x)  Jx = df/dx(t,y), an n-by-np matrix, the parameter
+ *                      sensitivities of f.
+ *
+ * The duals live on the stack: this is meant for the small dense models
+ * of the forward problems, not for discretized PDEs.
+ */
+template <class M>
+struct ode_ad {
+	static void f(float t, float *y, float *d, void *ctx)
+	{
+		M::template rhs<float, float>(t, y, d, (const float *)ctx);
+	}
+
+	static void df(float t, float *y, float *J, void *ctx)
+	{
+		typedef dual<float, M::n> D;
+		D yd[M::n];
+		D dd[M::n];
+
+		for (uint j = 1; j <= M::n; j++) {
+			V_IDX(yd, j) = D::variable(V_IDX(y, j), j);
+		}
+		M::template rhs<D, float>(t, yd, dd, (const float *)ctx);
+		for (uint j = 1; j <= M::n; j++) {
+			for (uint i = 1; i <= M::n; i++) {
+				M_IDX(J, M::n, i, j) = V_IDX(dd, i).d[j - 1];
+			}
+		}
+	}
+
+	static void dfdx(float t, float *y, float *Jx, void *ctx)
+	{
+		typedef dual<float, M::np> D;
+		const float *x = (const float *)ctx;
+		D yd[M::n];
+		D xd[M::np];
+		D dd[M::n];
+
+		for (uint i = 1; i <= M::n; i++) {
+			V_IDX(yd, i) = D(V_IDX(y, i));
+		}
+		for (uint j = 1; j <= M::np; j++) {
+			V_IDX(xd, j) = D::variable(V_IDX(x, j), j);
+		}
+		M::template rhs<D, D>(t, yd, dd, xd);
+		for (uint j = 1; j <= M::np; j++) {
+			for (uint i = 1; i <= M::n; i++) {
+				M_IDX(Jx, M::n, i, j) = V_IDX(dd, i).d[j - 1];
+			}
+		}
+	}
+};
+
+} /* namespace cn */
+
+#endif /* DUAL_HPP */
@@ -24,13 +24,313 @@ extern "C" {
 
 #include "common.h"
 
-void rk4(uint, void (*)(float, float *, float *), float, float *,
-         float, uint);
+/**
+ * struct ode_stats - work done by an adaptive integrator
+ * @nsteps:            Number of accepted steps.
+ * @nreject:           Number of rejected steps.
+ * @nfev:              Number of evaluations of the right-hand side.
+ * @njev:              Number of evaluations of the Jacobian.
+ * @ndecomp:           Number of LU factorizations.
+ * @nniter:            Number of Newton iterations.
+ */
+struct ode_stats {
+	uint nsteps;
+	uint nreject;
+	uint nfev;
+	uint njev;
+	uint ndecomp;
+	uint nniter;
+};
+
+/**
+ * struct ode_guard - conditions for stopping an integration early
+ * @ymin:              Vector of size n, lower bounds on the state, or NULL.
+ * @ymax:              Vector of size n, upper bounds on the state, or NULL.
+ * @ss_tol:            If positive, the integration stops at a steady state
+ *                     once ||f(t,y)|| <= ss_tol, and the remaining outputs
+ *                     are set to y.
+ * @maxit:             Maximum number of Newton iterations per step of an
+ *                     implicit method, or zero for BDF1_MAXIT.
+ *
+ * A state that is not finite always stops the integration.
+ */
+struct ode_guard {
+	const float *ymin;
+	const float *ymax;
+	float ss_tol;
+	uint maxit;
+};
+
+/**
+ * struct ode_warm - state handed by an adaptive integrator to the next
+ *                   solve of a nearby problem
+ * @valid:             Zero until a solve has succeeded with this state.
+ * @h0:                First step accepted by the last solve.
+ * @h:                 Vector of size nout, or NULL: h(k) is the last step
+ *                     accepted before the output time tout(k).
+ * @order:             Order in use at the end of the last solve (bdf).
+ * @jac_age:           Number of solves since J was evaluated (bdf).
+ * @J:                 n-by-n matrix, or NULL: Jacobian evaluated in the
+ *                     first step of a solve (bdf).
+ *
+ * The caller owns h and J, and zeroes the structure before the first
+ * solve. The same output times must be used by every solve.
+ */
+struct ode_warm {
+	int valid;
+	float h0;
+	float *h;
+	uint order;
+	uint jac_age;
+	float *J;
+};
+
+/*
+ * Sizes of the workspaces of rk4_work(), rk4_sweep_work(), bdf1_work()
+ * and bdf1_sweep_work(): floats in work, integers in iwork. Systems of
+ * order at most 4 are factored in a padded 4-by-4 matrix.
+ */
+#define RK4_WORK_SIZE(n) (6 * (n))
+#define BDF1_WORK_SIZE(n) (3 * (n) + ((n) > 4 ? (n) * (n) : 16))
+#define BDF1_IWORK_SIZE(n) ((n) > 4 ? (n) : 4)
+
+/*
+ * Newton iterations allowed per step of the backward Euler methods when
+ * the caller sets no limit: a step that needs more has failed.
+ */
+#define BDF1_MAXIT 50
+
+void rk4(uint, void (*)(float, float *, float *, void *), void *,
+         float, float *, float, uint);
+
+void rk4_work(uint, void (*)(float, float *, float *, void *), void *,
+              float, float *, float, uint, float *);
+
+void rk4_sweep(uint, void (*)(float, float *, float *, void *), void *,
+               float, float *, uint, const float *, float *, uint);
+
+void rk4_sweep_work(uint, void (*)(float, float *, float *, void *), void *,
+                    float, float *, uint, const float *, float *, uint,
+                    float *);
+
+int rk4_guarded(uint, void (*)(float, float *, float *, void *),
+                const struct ode_guard *, void *,
+                float, float *, uint, const float *, float *, uint);
+
+int dopri5(uint, void (*)(float, float *, float *, void *), void *,
+           float, float *, uint, const float *, float *, float, float,
+           struct ode_stats *);
+
+int dopri5_warm(uint, void (*)(float, float *, float *, void *), void *,
+                float, float *, uint, const float *, float *, float, float,
+                struct ode_warm *, struct ode_stats *);
+
+/**
+ * enum jac_kind - storage of a Jacobian
+ * @JAC_DENSE:     n-by-n matrix.
+ * @JAC_BANDED:    (ml + mu + 1)-by-n matrix in LAPACK band storage:
+ *                 Df(i,j) is in row mu + 1 + i - j of column j, for
+ *                 max(1, j - mu) <= i <= min(n, j + ml).
+ * @JAC_SPARSE:    Vector of size nnz: the values of the nonzeros of Df,
+ *                 in the order of ja.
+ * @JAC_MATRIX_FREE: No matrix: df is not called, and products Df v are
+ *                 approximated by differences of f.
+ */
+enum jac_kind {
+	JAC_DENSE,
+	JAC_BANDED,
+	JAC_SPARSE,
+	JAC_MATRIX_FREE
+};
+
+/**
+ * struct jac_structure - structure of the Jacobian of an ODE
+ * @kind:                 Storage of the matrices written by df.
+ * @ml:                   Lower bandwidth (JAC_BANDED).
+ * @mu:                   Upper bandwidth (JAC_BANDED).
+ * @ia:                   Vector of size n + 1 (JAC_SPARSE). The nonzeros
+ *                        of column j are in the rows ja(k), for
+ *                        ia(j) <= k < ia(j + 1), with ia(1) = 1.
+ *                        With JAC_DENSE, the pattern may be given as
+ *                        well, or ia set to NULL: it is only used to
+ *                        group the columns of finite differences when
+ *                        df is NULL.
+ * @ja:                   Row indices, a vector of size ia(n + 1) - 1
+ *                        (JAC_SPARSE, JAC_DENSE).
+ * @psetup:               Called as psetup(t, y, h, ctx) before each
+ *                        Newton iteration at y, or NULL
+ *                        (JAC_MATRIX_FREE).
+ * @psolve:               Preconditioner, called as psolve(t, y, h, b, ctx)
+ *                        to overwrite b, a vector of size n, with an
+ *                        approximation of (1 - hDf(t,y))^-1 b, or NULL
+ *                        (JAC_MATRIX_FREE).
+ * @krylov:               Dimension of the Krylov space at which GMRES
+ *                        restarts, or 0 for the default (JAC_MATRIX_FREE).
+ */
+struct jac_structure {
+	enum jac_kind kind;
+	uint ml;
+	uint mu;
+	const int *ia;
+	const int *ja;
+	void (*psetup)(float, float *, float, void *);
+	void (*psolve)(float, float *, float, float *, void *);
+	uint krylov;
+};
 
-void bdf1(uint, void (*)(float, float *, float *),
-	  void (*)(float, float *, float *),
+void bdf1(uint, void (*)(float, float *, float *, void *),
+	  void (*)(float, float *, float *, void *), void *,
           float, float *, float, uint, float);
 
+void bdf1_work(uint, void (*)(float, float *, float *, void *),
+               void (*)(float, float *, float *, void *), void *,
+               float, float *, float, uint, float, float *, int *);
+
+void bdf1_sweep(uint, void (*)(float, float *, float *, void *),
+                void (*)(float, float *, float *, void *), void *,
+                float, float *, uint, const float *, float *, uint, float);
+
+int bdf1_sweep_work(uint, void (*)(float, float *, float *, void *),
+                    void (*)(float, float *, float *, void *), void *,
+                    float, float *, uint, const float *, float *, uint,
+                    float, float *, int *);
+
+void bdf1_structured(uint, void (*)(float, float *, float *, void *),
+                     void (*)(float, float *, float *, void *),
+                     const struct jac_structure *, void *,
+                     float, float *, float, uint, float);
+
+void bdf1_structured_sweep(uint, void (*)(float, float *, float *, void *),
+                           void (*)(float, float *, float *, void *),
+                           const struct jac_structure *, void *,
+                           float, float *, uint, const float *, float *,
+                           uint, float);
+
+int bdf1_guarded(uint, void (*)(float, float *, float *, void *),
+                 void (*)(float, float *, float *, void *),
+                 const struct jac_structure *, const struct ode_guard *,
+                 void *, float, float *, uint, const float *, float *,
+                 uint, float);
+
+void rk4_sens_sweep(uint, uint, void (*)(float, float *, float *, void *),
+                    void (*)(float, float *, float *, void *),
+                    void (*)(float, float *, float *, void *), void *,
+                    float, float *, float *, uint, const float *, float *,
+                    float *, uint);
+
+int bdf1_sens_sweep(uint, uint, void (*)(float, float *, float *, void *),
+                    void (*)(float, float *, float *, void *),
+                    void (*)(float, float *, float *, void *), void *,
+                    float, float *, float *, uint, const float *, float *,
+                    float *, uint, float);
+
+int bdf1_modified(uint, void (*)(float, float *, float *, void *),
+                  void (*)(float, float *, float *, void *), void *,
+                  float, float *, uint, const float *, float *, uint,
+                  float, uint, struct ode_stats *);
+
+int bdf(uint, void (*)(float, float *, float *, void *),
+        void (*)(float, float *, float *, void *), void *,
+        float, float *, uint, const float *, float *, float, float,
+        struct ode_stats *);
+
+int bdf_warm(uint, void (*)(float, float *, float *, void *),
+             void (*)(float, float *, float *, void *), void *,
+             float, float *, uint, const float *, float *, float, float,
+             struct ode_warm *, struct ode_stats *);
+
+int rosenbrock(uint, void (*)(float, float *, float *, void *),
+               void (*)(float, float *, float *, void *), void *,
+               float, float *, uint, const float *, float *, float, float,
+               struct ode_stats *);
+
+/**
+ * enum lsode_method - method used by the LSODE backend
+ * @LSODE_ADAMS:       Adams-Moulton, for non-stiff problems (SLSODE).
+ * @LSODE_BDF:         BDF with a dense Jacobian (SLSODE).
+ * @LSODE_AUTO:        Automatic switching between the two (SLSODA).
+ * @LSODE_SPARSE:      BDF with a sparse Jacobian (SLSODES).
+ * @LSODE_KRYLOV:      BDF with preconditioned GMRES (SLSODPK).
+ */
+enum lsode_method {
+	LSODE_ADAMS,
+	LSODE_BDF,
+	LSODE_AUTO,
+	LSODE_SPARSE,
+	LSODE_KRYLOV
+};
+
+/**
+ * struct lsode_error - an error or warning reported by ODEPACK
+ * @msg:                Message.
+ * @nerr:               Error number.
+ * @level:              1 for a recoverable error, 2 for a fatal one.
+ * @ni:                 Number of integers attached to the message.
+ * @i1:                 First integer.
+ * @i2:                 Second integer.
+ * @nr:                 Number of reals attached to the message.
+ * @r1:                 First real.
+ * @r2:                 Second real.
+ */
+struct lsode_error {
+	const char *msg;
+	int nerr;
+	int level;
+	int ni;
+	long i1;
+	long i2;
+	int nr;
+	float r1;
+	float r2;
+};
+
+struct lsode_workspace;
+
+size_t lsode_workspace_size(uint, enum lsode_method);
+struct lsode_workspace *lsode_workspace_create(uint, enum lsode_method);
+size_t lsode_workspace_size_sparse(uint, uint);
+struct lsode_workspace *lsode_workspace_create_sparse(uint, uint);
+void lsode_workspace_destroy(struct lsode_workspace *);
+void lsode_set_sparsity(struct lsode_workspace *, const int *, const int *,
+                        void (*)(float, float *, uint, float *, void *));
+void lsode_set_precond(struct lsode_workspace *,
+                       int (*)(float, float *, float *, float, void *),
+                       int (*)(float, float *, float *, float, float *,
+                               void *));
+void lsode_init(struct lsode_workspace *,
+                void (*)(float, float *, float *, void *),
+                void (*)(float, float *, float *, void *), void *,
+                float, float *, float, float);
+void lsode_reset(struct lsode_workspace *, float, float *);
+int lsode_advance(struct lsode_workspace *, float, float *);
+void lsode_stats(struct lsode_workspace *, struct ode_stats *);
+void lsode_set_error_handler(struct lsode_workspace *,
+                             void (*)(const struct lsode_error *, void *),
+                             void *);
+int lsode(struct lsode_workspace *, void (*)(float, float *, float *, void *),
+          void (*)(float, float *, float *, void *), void *,
+          float, float *, uint, const float *, float *, float, float,
+          struct ode_stats *);
+
+void rk4_ens(uint, uint, void (*)(uint, float, float *, float *, void *),
+             void *, float, float *, float, uint);
+
+void bdf1_ens(uint, uint, void (*)(uint, float, float *, float *, void *),
+              void (*)(uint, float, float *, float *, void *), void *,
+              float, float *, float, uint, float);
+
+void bdf1_ens_sweep(uint, uint,
+                    void (*)(uint, float, float *, float *, void *),
+                    void (*)(uint, float, float *, float *, void *),
+                    void *, float, float *, uint, const float *, float *,
+                    uint, float);
+
+void bdf1_ens_shared_sweep(uint, uint,
+                           void (*)(uint, float, float *, float *, void *),
+                           void (*)(uint, float, float *, float *, void *),
+                           void *, float, float *, uint, const float *,
+                           float *, uint, float, struct ode_stats *);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,293 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef INTEGRATE_HPP
+#define INTEGRATE_HPP
+
+/*
+ * Integrators specialized for a model known at compile time.
+ *
+ * The C integrators of integrate.h take the dimension at run time and
+ * call the right-hand side through a function pointer. For the small
+ * forward models of the inverse problems that indirection dominates: the
+ * templates below take the model as a parameter, with the interface of
+ * struct ode_ad, so that the dimension is a constant, the state lives in
+ * fixed-size arrays on the stack and the right-hand side is inlined. They
+ * follow the same steps as their C counterparts.
+ */
+
+#include "common.h"
+#include "dual.hpp"
+#include "integrate.h"
+
+#include <cmath>
+
+namespace cn {
+
+/*
+ * lu_factor_n() - in-place LU factorization with partial pivoting of an
+ *                 n-by-n matrix
+ *
+ * Return: 0 on success, nonzero if A is singular.
+ */
+template <uint n>
+inline int lu_factor_n(float *A, uint *ipiv)
+{
+	for (uint k = 1; k <= n; k++) {
+		uint p = k;
+		for (uint i = k + 1; i <= n; i++) {
+			if (std::fabs(M_IDX(A, n, i, k))
+			    > std::fabs(M_IDX(A, n, p, k))) {
+				p = i;
+			}
+		}
+		V_IDX(ipiv, k) = p;
+		if (M_IDX(A, n, p, k) == 0.0f) {
+			return k;
+		}
+		for (uint j = 1; j <= n; j++) {
+			float a = M_IDX(A, n, k, j);
+			M_IDX(A, n, k, j) = M_IDX(A, n, p, j);
+			M_IDX(A, n, p, j) = a;
+		}
+		for (uint i = k + 1; i <= n; i++) {
+			float c = M_IDX(A, n, i, k) / M_IDX(A, n, k, k);
+			M_IDX(A, n, i, k) = c;
+			for (uint j = k + 1; j <= n; j++) {
+				M_IDX(A, n, i, j) -= c * M_IDX(A, n, k, j);
+			}
+		}
+	}
+	return 0;
+}
+
+/* lu_solve_n() - overwrite b with the solution of Ax = b */
+template <uint n>
+inline void lu_solve_n(const float *A, const uint *ipiv, float *b)
+{
+	for (uint k = 1; k <= n; k++) {
+		uint p = V_IDX(ipiv, k);
+		float a = V_IDX(b, k);
+		V_IDX(b, k) = V_IDX(b, p);
+		V_IDX(b, p) = a;
+	}
+	for (uint k = 1; k <= n; k++) {
+		for (uint i = k + 1; i <= n; i++) {
+			V_IDX(b, i) -= M_IDX(A, n, i, k) * V_IDX(b, k);
+		}
+	}
+	for (uint i = n; i >= 1; i--) {
+		float s = V_IDX(b, i);
+		for (uint j = i + 1; j <= n; j++) {
+			s -= M_IDX(A, n, i, j) * V_IDX(b, j);
+		}
+		V_IDX(b, i) = s / M_IDX(A, n, i, i);
+	}
+}
+
+/**
+ * rk4_sweep() - rk4_sweep() of integrate.h, for the model M
+ * @M:           The model, see struct ode_ad.
+ * @x:           The parameters of the model.
+ * @t0, @y:      See rk4_sweep() of integrate.h, with n = M::n.
+ * @nout, @tout: See rk4_sweep() of integrate.h.
+ * @Yout, @N:    See rk4_sweep() of integrate.h.
+ */
+template <class M>
+void rk4_sweep(const float *x, float t0, float *y, uint nout,
+               const float *tout, float *Yout, uint N)
+{
+	const uint n = M::n;
+	float ka[n], kb[n], k2[n], k3[n], k4[n], z[n], y0[n];
+	float *k1 = ka;
+	float *k5 = kb;
+
+	float tend = V_IDX(tout, nout);
+	float h = (tend - t0) / N;
+	float t = t0;
+	uint k = 1;
+
+	/* outputs at t0 */
+	for (; k <= nout && V_IDX(tout, k) <= t0; k++) {
+		for (uint j = 1; j <= n; j++) {
+			M_IDX(Yout, n, j, k) = V_IDX(y, j);
+		}
+	}
+
+	M::template rhs<float, float>(t, y, k1, x);
+
+	for (uint i = 1; i <= N && k <= nout; i++) {
+		float t1 = (i == N ? tend : t0 + i * h);
+		float hi = t1 - t;
+
+		for (uint j = 1; j <= n; j++) {
+			V_IDX(y0, j) = V_IDX(y, j);
+			V_IDX(z, j) = V_IDX(y, j) + 0.5f * hi * V_IDX(k1, j);
+		}
+		M::template rhs<float, float>(t + 0.5f * hi, z, k2, x);
+		for (uint j = 1; j <= n; j++) {
+			V_IDX(z, j) = V_IDX(y, j) + 0.5f * hi * V_IDX(k2, j);
+		}
+		M::template rhs<float, float>(t + 0.5f * hi, z, k3, x);
+		for (uint j = 1; j <= n; j++) {
+			V_IDX(z, j) = V_IDX(y, j) + hi * V_IDX(k3, j);
+		}
+		M::template rhs<float, float>(t + hi, z, k4, x);
+		for (uint j = 1; j <= n; j++) {
+			V_IDX(y, j) += (V_IDX(k1, j) + 2.0f * V_IDX(k2, j)
+			                + 2.0f * V_IDX(k3, j)
+			                + V_IDX(k4, j)) * hi / 6.0f;
+		}
+
+		/* f(t1, y(t1)), the next k1 */
+		M::template rhs<float, float>(t1, y, k5, x);
+
+		/* cubic Hermite interpolation inside [t, t1] */
+		for (; k <= nout && V_IDX(tout, k) <= t1; k++) {
+			float s = (V_IDX(tout, k) - t) / hi;
+			float h00 = (1.0f + 2.0f * s) * (1.0f - s) * (1.0f - s);
+			float h10 = s * (1.0f - s) * (1.0f - s);
+			float h01 = s * s * (3.0f - 2.0f * s);
+			float h11 = s * s * (s - 1.0f);
+			for (uint j = 1; j <= n; j++) {
+				M_IDX(Yout, n, j, k) =
+					h00 * V_IDX(y0, j)
+					+ h10 * hi * V_IDX(k1, j)
+					+ h01 * V_IDX(y, j)
+					+ h11 * hi * V_IDX(k5, j);
+			}
+		}
+
+		float *tmp = k1;
+		k1 = k5;
+		k5 = tmp;
+		t = t1;
+	}
+}
+
+/**
+ * bdf1_sweep() - bdf1_sweep() of integrate.h, for the model M
+ * @M:           The model, see struct ode_ad.
+ * @x:           The parameters of the model.
+ * @t0, @y:      See bdf1_sweep() of integrate.h, with n = M::n.
+ * @nout, @tout: See bdf1_sweep() of integrate.h.
+ * @Yout, @N:    See bdf1_sweep() of integrate.h.
+ * @tol:         See bdf1_sweep() of integrate.h.
+ *
+ * The Jacobian is computed with dual numbers, by ode_ad<M>::df(). As in
+ * bdf1_sweep_work(), Newton's method is capped at BDF1_MAXIT iterations
+ * per step, and the outputs after a failed step are NaN.
+ *
+ * Return: 0 on success, -1 if Newton's method did not converge, -2 if
+ * 1 - hDf was singular or the state stopped being finite.
+ */
+template <class M>
+int bdf1_sweep(const float *x, float t0, float *y, uint nout,
+               const float *tout, float *Yout, uint N, float tol)
+{
+	const uint n = M::n;
+	float xn[n], z[n], y0[n], D[n * n];
+	uint ipiv[n];
+
+	float tend = V_IDX(tout, nout);
+	float h = (tend - t0) / (float)N;
+	float t = t0;
+	uint k = 1;
+
+	/* outputs at t0 */
+	for (; k <= nout && V_IDX(tout, k) <= t0; k++) {
+		for (uint j = 1; j <= n; j++) {
+			M_IDX(Yout, n, j, k) = V_IDX(y, j);
+		}
+	}
+
+	for (uint i = 1; i <= N && k <= nout; i++) {
+		float t1 = (i == N ? tend : t0 + i * h);
+		float hi = t1 - t;
+
+		/* Newton's method on x - y - hf(t1,x) = 0, from x = y */
+		float nz;
+		uint it = 0;
+		int status = 0;
+		for (uint j = 1; j <= n; j++) {
+			V_IDX(y0, j) = V_IDX(y, j);
+			V_IDX(xn, j) = V_IDX(y, j);
+		}
+		do {
+			if (it++ == BDF1_MAXIT) {
+				status = -1;
+				break;
+			}
+
+			/* D = 1 - hDf(t1,x) */
+			ode_ad<M>::df(t1, xn, D, (void *)x);
+			for (uint j = 1; j <= n * n; j++) {
+				V_IDX(D, j) *= -hi;
+			}
+			for (uint j = 1; j <= n; j++) {
+				M_IDX(D, n, j, j) += 1.0f;
+			}
+			if (lu_factor_n<n>(D, ipiv)) {
+				status = -2;
+				break;
+			}
+
+			M::template rhs<float, float>(t1, xn, z, x);
+			for (uint j = 1; j <= n; j++) {
+				V_IDX(z, j) = V_IDX(xn, j) - V_IDX(y, j)
+				              - hi * V_IDX(z, j);
+			}
+			lu_solve_n<n>(D, ipiv, z);
+
+			nz = 0.0f;
+			for (uint j = 1; j <= n; j++) {
+				V_IDX(xn, j) -= V_IDX(z, j);
+				nz += V_IDX(z, j) * V_IDX(z, j);
+			}
+			nz = std::sqrt(nz);
+		} while (nz > tol);
+		if (!status && !std::isfinite(nz)) {
+			status = -2;
+		}
+		if (status) {
+			for (; k <= nout; k++) {
+				for (uint j = 1; j <= n; j++) {
+					M_IDX(Yout, n, j, k) = NAN;
+				}
+			}
+			return status;
+		}
+		for (uint j = 1; j <= n; j++) {
+			V_IDX(y, j) = V_IDX(xn, j);
+		}
+
+		/* linear interpolation inside [t, t1] */
+		for (; k <= nout && V_IDX(tout, k) <= t1; k++) {
+			float s = (V_IDX(tout, k) - t) / hi;
+			for (uint j = 1; j <= n; j++) {
+				M_IDX(Yout, n, j, k) =
+					(1.0f - s) * V_IDX(y0, j)
+					+ s * V_IDX(y, j);
+			}
+		}
+		t = t1;
+	}
+	return 0;
+}
+
+} /* namespace cn */
+
+#endif /* INTEGRATE_HPP */
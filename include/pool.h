@@ -0,0 +1,38 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef POOL_H
+#define POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "common.h"
+
+struct cn_pool;
+
+struct cn_pool *cn_pool_create(uint);
+void cn_pool_destroy(struct cn_pool *);
+uint cn_pool_size(struct cn_pool *);
+void cn_pool_run(struct cn_pool *, uint,
+                 void (*)(void *, uint, uint, uint), void *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POOL_H */
@@ -0,0 +1,115 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Inline replacements for the libf2c helpers used by the translated
+ * ODEPACK routines. lsode/Makefile includes this header right after
+ * f2c.h in every translated file, so that plain arithmetic does not go
+ * through libf2c. The semantics are those of libf2c.
+ */
+#ifndef F2C_INLINE_H
+#define F2C_INLINE_H
+
+#include <math.h>
+#include <string.h>
+
+/* <stdlib.h> clashes with the abs() macro of f2c.h */
+void abort(void);
+
+#define pow_dd f2c_pow_dd
+#define pow_ri f2c_pow_ri
+#define pow_ii f2c_pow_ii
+#define r_sign f2c_r_sign
+#define i_sign f2c_i_sign
+#define s_copy f2c_s_copy
+#define s_stop f2c_s_stop
+
+static inline double f2c_pow_dd(doublereal *a, doublereal *b)
+{
+	return pow(*a, *b);
+}
+
+/* real ** integer, by repeated squaring */
+static inline double f2c_pow_ri(real *a, integer *b)
+{
+	double p = 1.0;
+	double x = *a;
+	integer n = *b;
+	if (n < 0) {
+		n = -n;
+		x = 1.0 / x;
+	}
+	for (unsigned long u = n; u; u >>= 1) {
+		if (u & 1) {
+			p *= x;
+		}
+		x *= x;
+	}
+	return p;
+}
+
+static inline integer f2c_pow_ii(integer *a, integer *b)
+{
+	integer p = 1;
+	integer x = *a;
+	integer n = *b;
+	if (n <= 0) {
+		if (n == 0 || x == 1) {
+			return 1;
+		}
+		return (x != -1 ? 0 : (n & 1 ? -1 : 1));
+	}
+	for (unsigned long u = n; u; u >>= 1) {
+		if (u & 1) {
+			p *= x;
+		}
+		x *= x;
+	}
+	return p;
+}
+
+static inline double f2c_r_sign(real *a, real *b)
+{
+	double x = (*a >= 0 ? *a : -*a);
+	return (*b >= 0 ? x : -x);
+}
+
+static inline integer f2c_i_sign(integer *a, integer *b)
+{
+	integer x = (*a >= 0 ? *a : -*a);
+	return (*b >= 0 ? x : -x);
+}
+
+/* Fortran character assignment: copy, then pad with blanks */
+static inline int f2c_s_copy(char *a, char *b, ftnlen la, ftnlen lb)
+{
+	if (la <= lb) {
+		memmove(a, b, la);
+	} else {
+		memmove(a, b, lb);
+		memset(a + lb, ' ', la - lb);
+	}
+	return 0;
+}
+
+static inline int f2c_s_stop(char *s, ftnlen n)
+{
+	abort();
+	return 0;
+}
+
+#endif /* F2C_INLINE_H */
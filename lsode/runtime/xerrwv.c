@@ -0,0 +1,69 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * C replacement for the ODEPACK message handler XERRWV, which otherwise
+ * pulls in the formatted I/O of libf2c. Messages are handed to a
+ * thread-local hook, installed by the caller of the solver (see
+ * src/lsode.c), and dropped when no hook is set.
+ */
+#include <stdlib.h>
+
+#include "f2c.h"
+
+_Thread_local void (*lsode_xerrwv_hook)(void *, const char *, integer,
+                                        integer, integer, integer,
+                                        integer, integer, real, real);
+_Thread_local void *lsode_xerrwv_ctx;
+
+/**
+ * xerrwv_() - report an error or a warning
+ * @msg:       Message, not nul-terminated.
+ * @nmes:      Length of msg.
+ * @nerr:      Error number, unused by ODEPACK itself.
+ * @level:     1 for a recoverable error, 2 for a fatal one.
+ * @ni:        Number of integers (0, 1 or 2) to report with the message.
+ * @i1:        First integer.
+ * @i2:        Second integer.
+ * @nr:        Number of reals (0, 1 or 2) to report with the message.
+ * @r1:        First real.
+ * @r2:        Second real.
+ * @msg_len:   Length of msg, as passed by f2c.
+ *
+ * Fatal errors, raised by the solvers only after repeated illegal input,
+ * abort as STOP did in the Fortran version.
+ */
+int xerrwv_(char *msg, integer *nmes, integer *nerr, integer *level,
+            integer *ni, integer *i1, integer *i2, integer *nr,
+            real *r1, real *r2, ftnlen msg_len)
+{
+	if (lsode_xerrwv_hook) {
+		char buf[128];
+		integer len = (*nmes < (integer)sizeof(buf) - 1
+		               ? *nmes : (integer)sizeof(buf) - 1);
+		for (integer k = 0; k < len; k++) {
+			buf[k] = msg[k];
+		}
+		buf[len] = '\0';
+		lsode_xerrwv_hook(lsode_xerrwv_ctx, buf, *nerr, *level,
+		                  *ni, *i1, *i2, *nr, *r1, *r2);
+	}
+	if (*level == 2) {
+		abort();
+	}
+	return 0;
+}
@@ -1,17 +1,16 @@
 #include "lsode.h"
 
 #include <stdlib.h>
+#include <string.h>
 
-int odesolve(fct f, int neq, float *y, float ti, float tf,
-             int itol, float *rtol, float *atol,
-             jacfct jac, int stiff)
+/*
+ * Start a problem at (ti, y). The tolerances are not copied, and must
+ * outlive the solver. Returns NULL if out of memory.
+ */
+struct odesolve *odesolve_init(fct f, int neq, float ti, float *y,
+                               int itol, float *rtol, float *atol,
+                               jacfct jac, int stiff)
 {
-	/* setting parameters up */
-	int itask = 1;
-	int istate = 1;
-	int iopt = 0;
-	int mf = (stiff ? 21 : 10);
-
 	/* compute how much memory we need */
 	int lrw;
 	int liw;
@@ -24,25 +23,84 @@ int odesolve(fct f, int neq, float *y, float ti, float tf,
 		liw = 20;
 	}
 
-	/* memory allocation */
-	float *rwork = (float *)malloc(sizeof(float) * lrw);
-	if (!rwork) {
-		return 1;
+	/* memory allocation, in one block */
+	struct odesolve *s = (struct odesolve *)malloc(sizeof(*s)
+		+ sizeof(float) * (neq + lrw) + sizeof(int) * liw);
+	if (!s) {
+		return NULL;
 	}
-	int *iwork = (int *)malloc(sizeof(int) * liw);
-	if (!iwork) {
-		free(rwork);
+	s->y = (float *)(s + 1);
+	s->rwork = s->y + neq;
+	s->iwork = (int *)(s->rwork + lrw);
+
+	/* setting parameters up */
+	s->f = f;
+	s->jac = jac;
+	s->neq = neq;
+	s->itol = itol;
+	s->rtol = rtol;
+	s->atol = atol;
+	s->mf = (stiff ? 21 : 10);
+	s->lrw = lrw;
+	s->liw = liw;
+	odesolve_reset(s, ti, y);
+
+	return s;
+}
+
+/* Restart from (ti, y), forgetting the step size and order history */
+void odesolve_reset(struct odesolve *s, float ti, float *y)
+{
+	s->istate = 1;
+	s->t = ti;
+	memcpy(s->y, y, sizeof(float) * s->neq);
+}
+
+/*
+ * Integrate up to tout, and copy the solution there to y. The first call
+ * after odesolve_init() or odesolve_reset() starts with ISTATE = 1, the
+ * next ones continue with ISTATE = 2, keeping the step size, order and
+ * Jacobian. Returns nonzero if LSODE failed, after which the solver must
+ * be reset.
+ */
+int odesolve_advance(struct odesolve *s, float tout, float *y)
+{
+	int itask = 1;
+	int iopt = 0;
+
+	if (s->istate < 0) {
 		return 1;
 	}
 
 	/* solve the ODE */
-	slsode_(f, &neq, y, &ti, &tf, &itol, rtol, atol,
-	        &itask, &istate, &iopt,
-	        rwork, &lrw, iwork, &liw, jac, &mf);
+	slsode_(s->f, &s->neq, s->y, &s->t, &tout, &s->itol, s->rtol,
+	        s->atol, &itask, &s->istate, &iopt,
+	        s->rwork, &s->lrw, s->iwork, &s->liw, s->jac, &s->mf);
+	if (s->istate < 0) {
+		return 1;
+	}
+
+	memcpy(y, s->y, sizeof(float) * s->neq);
+	return 0;
+}
+
+void odesolve_free(struct odesolve *s)
+{
+	free(s);
+}
 
-	/* clean up */
-	free(iwork);
-	free(rwork);
+/* One integration from ti to tf, with a solver of its own */
+int odesolve(fct f, int neq, float *y, float ti, float tf,
+             int itol, float *rtol, float *atol,
+             jacfct jac, int stiff)
+{
+	struct odesolve *s = odesolve_init(f, neq, ti, y, itol, rtol, atol,
+	                                   jac, stiff);
+	if (!s) {
+		return 1;
+	}
+	int status = odesolve_advance(s, tf, y);
+	odesolve_free(s);
 
-	return (istate < 0);
+	return status;
 }
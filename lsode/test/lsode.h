@@ -11,6 +11,30 @@ int slsode_(fct f, int *neq, float *y, float *t, float *tout,
             float *rwork, int *lrw, int *iwork, int *liw,
             jacfct jac, int *mf);
 
+/* A solver that continues its integration from one call to the next */
+struct odesolve {
+	fct f;
+	jacfct jac;
+	int neq;
+	int itol;
+	float *rtol;
+	float *atol;
+	int mf;
+	int istate;
+	float t;
+	float *y;
+	int lrw;
+	int liw;
+	float *rwork;
+	int *iwork;
+};
+
+struct odesolve *odesolve_init(fct, int, float, float *, int, float *,
+                               float *, jacfct, int);
+void odesolve_reset(struct odesolve *, float, float *);
+int odesolve_advance(struct odesolve *, float, float *);
+void odesolve_free(struct odesolve *);
+
 int odesolve(fct, int, float *, float, float, int, float *, float *,
              jacfct, int);
 
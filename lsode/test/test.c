@@ -30,13 +30,27 @@ int main(void)
 	float rtol = 1e-4f;
 	float atol[3] = { 1e-6f, 1e-10f, 1e-6f };
 	int iout;
+	int status = 0;
 
+	/* a single integration, continued from one output to the next */
+	struct odesolve *s = odesolve_init(f, 3, 0.0f, y, 2, &rtol, atol,
+	                                   jac, 1);
+	if (!s) {
+		return 1;
+	}
 	for (iout = 1; iout <= 12; iout++) {
-		odesolve(f, 3, y, 0.0f, tout, 2, &rtol, atol, jac, 1);
+		if (odesolve_advance(s, tout, y)) {
+			printf(" Error at t=%.4e\n", s->t);
+			status = 1;
+			break;
+		}
 		printf(" At t=%.4e   y=%.6e, %.6e, %.6e\n",
 		       tout, y[0], y[1], y[2]);
 		tout = tout * 10.0f;
 	}
+	printf(" No. steps = %d   No. f-s = %d   No. J-s = %d\n",
+	       s->iwork[10], s->iwork[11], s->iwork[12]);
+	odesolve_free(s);
 
-	return 0;
+	return status;
 }
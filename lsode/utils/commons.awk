@@ -0,0 +1,92 @@
+# Make the COMMON blocks declared by the f2c output thread-local. f2c
+# declares a COMMON block as
+#
+#	struct {
+#	    ...
+#	} name_;
+#
+#	#define name_1 name_
+#
+# at file scope in every file using it, with the members that this file
+# gives it: SLSODE sees SLS001 as named variables, SSRCOM as two arrays.
+# Such declarations of one object with different types are undefined, so
+# each block becomes a single thread-local union of all its layouts,
+# declared in out/commons.h and defined in out/commons.c, and every file
+# reads the block through the member of its own layout:
+#
+#	#define name_ (lsode_name_.vK)
+#
+# Each input file is rewritten as FILENAME.tmp. Run as
+#
+#	awk -v out=DIR -f commons.awk DIR/*.c
+
+/^#include "f2c\.h"$/ {
+	print > (FILENAME ".tmp")
+	print "#include \"commons.h\"" > (FILENAME ".tmp")
+	next
+}
+
+/^struct \{$/ {
+	inblock = 1
+	body = ""
+	next
+}
+
+inblock && /^\} [a-z0-9_]+;$/ {
+	inblock = 0
+	name = substr($2, 1, length($2) - 1)
+	if (!(name in nlayouts)) {
+		nlayouts[name] = 0
+		names[++nnames] = name
+	}
+	for (k = 0; k < nlayouts[name]; k++) {
+		if (layout[name, k] == body) {
+			break
+		}
+	}
+	if (k == nlayouts[name]) {
+		layout[name, k] = body
+		nlayouts[name]++
+	}
+	printf "#define %s (lsode_%s.v%d)\n", name, name, k > (FILENAME ".tmp")
+	next
+}
+
+inblock {
+	body = body "\t" $0 "\n"
+	next
+}
+
+{
+	print > (FILENAME ".tmp")
+}
+
+END {
+	h = out "/commons.h"
+	c = out "/commons.c"
+
+	print "/* Generated by lsode/utils/commons.awk */" > h
+	print "#ifndef LSODE_COMMONS_H" > h
+	print "#define LSODE_COMMONS_H" > h
+	for (i = 1; i <= nnames; i++) {
+		name = names[i]
+		printf "\nunion lsode_%s {\n", name > h
+		for (k = 0; k < nlayouts[name]; k++) {
+			printf "\tstruct {\n%s\t} v%d;\n", layout[name, k], k > h
+		}
+		print "};" > h
+		printf "extern _Thread_local union lsode_%s lsode_%s;\n",
+		       name, name > h
+	}
+	print "\n#endif" > h
+
+	print "/* Generated by lsode/utils/commons.awk */" > c
+	print "#include \"f2c.h\"" > c
+	print "#include \"commons.h\"" > c
+	print "" > c
+	for (i = 1; i <= nnames; i++) {
+		name = names[i]
+		printf "_Thread_local union lsode_%s lsode_%s;\n",
+		       name, name > c
+	}
+}
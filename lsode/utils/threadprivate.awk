@@ -0,0 +1,46 @@
+# Make the COMMON blocks of fixed-form Fortran thread-local, for the
+# gfortran build (see lsode/Makefile): every COMMON statement is followed
+# by an OpenMP THREADPRIVATE directive naming its blocks, which gfortran
+# -fopenmp turns into thread-local storage.
+
+function flush() {
+	for (k = 1; k <= nblocks; k++) {
+		printf "C$OMP THREADPRIVATE(/%s/)\n", blocks[k]
+	}
+	nblocks = 0
+}
+
+function collect(line) {
+	while (match(line, /\/[A-Za-z0-9_]+\//)) {
+		blocks[++nblocks] = substr(line, RSTART + 1, RLENGTH - 2)
+		line = substr(line, RSTART + RLENGTH)
+	}
+}
+
+# comments
+/^[Cc*!]/ {
+	print
+	next
+}
+
+# continuation lines
+/^     [^ 0]/ {
+	if (incommon) {
+		collect($0)
+	}
+	print
+	next
+}
+
+{
+	flush()
+	incommon = (toupper(substr($0, 7)) ~ /^ *COMMON/)
+	if (incommon) {
+		collect(substr($0, 7))
+	}
+	print
+}
+
+END {
+	flush()
+}
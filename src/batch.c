@@ -0,0 +1,43 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "common.h"
+
+#include <math.h>
+
+/**
+ * f_batch() - batched version of f()
+ * @count:       Number of points.
+ * @X:           The points, with leading dimension 3.
+ * @Y:           Output, the images of the points.
+ * @ctx:         Unused.
+ *
+ * Reference model for multi_eval_batch(): one SIMD lane per point. The
+ * loop only vectorizes with -O2 -ffast-math -fopenmp-simd, which lets gcc
+ * call the vector sinf() of libmvec. It lives in a file of its own,
+ * which the Makefile builds with these flags, so that they do not apply
+ * to the rest of the program.
+ */
+void f_batch(uint count, float *X, float *Y, void *ctx)
+{
+	#pragma omp simd
+	for (uint j = 1; j <= count; j++) {
+		float x1 = M_IDX(X, 3, 1, j);
+		float x2 = M_IDX(X, 3, 2, j);
+		V_IDX(Y, j) = (x1 * x1 + x2 * x2);
+		V_IDX(Y, j) += sinf(10000.f * x1) * sinf(10000.f * x2) / 100.f;
+	}
+}
@@ -17,9 +17,11 @@
 #include "cn.h"
 
 #include "common.h"
+#include "pool.h"
 #include <cblas.h>
 #include <lapacke.h>
 #include <math.h>
+#include <string.h>
 
 /**
  * random_pts_in_box - samples random points in a box
@@ -121,22 +123,37 @@ void pinv_ls(uint m, uint n, float *A, uint l, float *B, float *X)
 }
 
 /**
- * normal_ls() - solve an overdetermined linear system
- * @m:                 Row dimension of A.
- * @n:                 Column dimension of A.
- * @A:                 An m-by-n matrix.
- * @l:                 Column dimension of B.
- * @B:                 An l-by-n matrix.
- * @X:                 An l-by-m matrix in which to store the result.
+ * sysv_lwork() - optimal workspace size for LAPACKE_ssysv_work()
+ * @m:               Order of the symmetric matrix.
+ * @l:               Number of right-hand sides.
  *
- * Computes the least-squares solution of an overdetermined linear system,
- * by solving the normal equations. Solves XA = B for X.
+ * Performs a workspace query. No memory is allocated, and the matrices
+ * are not referenced.
+ *
+ * Return: the optimal length of the work array, at least 1.
  */
-void normal_ls(uint m, uint n, float *A, uint l, float *B, float *X)
+static int sysv_lwork(uint m, uint l)
 {
-	float *C = create_matrix(m, m);
-	float *D = create_matrix(m, l);
+	float C, B, query;
+	int ipiv;
+	LAPACKE_ssysv_work(LAPACK_COL_MAJOR, 'l', m, l, &C, m, &ipiv, &B, m,
+	                   &query, -1);
+	return (query >= 1.0f ? (int)query : 1);
+}
 
+/**
+ * normal_ls_() - allocation-free version of normal_ls()
+ * @m, @n, @A, @l, @B, @X: See normal_ls().
+ * @C:                     Scratch m-by-m matrix.
+ * @D:                     Scratch m-by-l matrix.
+ * @ipiv:                  Scratch integer vector of size m.
+ * @work:                  Scratch vector of size lwork.
+ * @lwork:                 See sysv_lwork().
+ */
+static void normal_ls_(uint m, uint n, float *A, uint l, float *B, float *X,
+                       float *C, float *D, int *ipiv,
+                       float *work, int lwork)
+{
 	/*
 	 * Dimensions:
 	 *   - A is m by n.
@@ -153,13 +170,68 @@ void normal_ls(uint m, uint n, float *A, uint l, float *B, float *X)
 	            m, l, n, 1.0f, A, m, B, l, 0.0f, D, m);
 	/* solve CX=D for X
 	 * this overrides D */
-	int *ipiv = (int*)malloc(sizeof(int) * m);
-	assert(ipiv);
-	LAPACKE_ssysv(LAPACK_COL_MAJOR, 'l', m, l, C, m, ipiv, D, m);
+	LAPACKE_ssysv_work(LAPACK_COL_MAJOR, 'l', m, l, C, m, ipiv, D, m,
+	                   work, lwork);
 
 	/* transpose the result */
 	m_transpose(m, l, X, D);
+}
 
+/**
+ * minimum_norm_() - allocation-free version of minimum_norm()
+ * @m, @n, @A, @l, @B, @X: See minimum_norm().
+ * @C:                     Scratch m-by-m matrix.
+ * @ipiv:                  Scratch integer vector of size m.
+ * @work:                  Scratch vector of size lwork.
+ * @lwork:                 See sysv_lwork().
+ */
+static void minimum_norm_(uint m, uint n, float *A, uint l, float *B,
+                          float *X, float *C, int *ipiv,
+                          float *work, int lwork)
+{
+	/*
+	 * Dimensions
+	 *   - A is m by n.
+	 *   - B is m by l.
+	 *   - C is m by m.
+	 */
+
+	/* C = AA' */
+	cblas_ssyrk(CblasColMajor, CblasUpper, CblasNoTrans,
+	            m, n, 1.0f, A, m, 0.0f, C, m);
+	/* solve CX = B */
+	LAPACKE_ssysv_work(LAPACK_COL_MAJOR, 'u', m, l, C, m, ipiv, B, m,
+	                   work, lwork);
+
+	/* multiply the result by A' on the left */
+	cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans,
+	            n, l, m, 1.0f, A, m, B, m, 0.0f, X, n);
+}
+
+/**
+ * normal_ls() - solve an overdetermined linear system
+ * @m:                 Row dimension of A.
+ * @n:                 Column dimension of A.
+ * @A:                 An m-by-n matrix.
+ * @l:                 Column dimension of B.
+ * @B:                 An l-by-n matrix.
+ * @X:                 An l-by-m matrix in which to store the result.
+ *
+ * Computes the least-squares solution of an overdetermined linear system,
+ * by solving the normal equations. Solves XA = B for X.
+ */
+void normal_ls(uint m, uint n, float *A, uint l, float *B, float *X)
+{
+	float *C = create_matrix(m, m);
+	float *D = create_matrix(m, l);
+	int *ipiv = (int*)malloc(sizeof(int) * m);
+	assert(ipiv);
+	int lwork = sysv_lwork(m, l);
+	float *work = create_vector(lwork);
+
+	normal_ls_(m, n, A, l, B, X, C, D, ipiv, work, lwork);
+
+	free(work);
 	free(ipiv);
 	free(D);
 	free(C);
@@ -179,27 +251,14 @@ void normal_ls(uint m, uint n, float *A, uint l, float *B, float *X)
 void minimum_norm(uint m, uint n, float *A, uint l, float *B, float *X)
 {
 	float *C = create_matrix(m, m);
-
-	/*
-	 * Dimensions
-	 *   - A is m by n.
-	 *   - B is m by l.
-	 *   - C is m by m.
-	 */
-
-	/* C = AA' */
-	cblas_ssyrk(CblasColMajor, CblasUpper, CblasNoTrans,
-	            m, n, 1.0f, A, m, 0.0f, C, m);
-	/* solve CX = B */
 	int *ipiv = (int*)malloc(sizeof(int) * m);
 	assert(ipiv);
-	LAPACKE_ssysv(LAPACK_COL_MAJOR, 'u', m, l, C, m, ipiv, B, m);
+	int lwork = sysv_lwork(m, l);
+	float *work = create_vector(lwork);
 
-	/* multiply the result by A' on the left */
-	cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans,
-	            n, l, m, 1.0f, A, m, B, m, 0.0f, X, n);
+	minimum_norm_(m, n, A, l, B, X, C, ipiv, work, lwork);
 
-	/* clean up */
+	free(work);
 	free(ipiv);
 	free(C);
 }
@@ -222,50 +281,606 @@ void multi_eval(uint m, uint n, void (*f)(float *, float *),
 	}
 }
 
+struct multi_eval_job {
+	uint m, n;
+	void (*f)(float *, float *, void *);
+	void *ctx;
+	float *X, *Y;
+};
+
+static void multi_eval_chunk(void *arg, uint begin, uint end, uint id)
+{
+	struct multi_eval_job *job = (struct multi_eval_job *)arg;
+	for (uint j = begin; j < end; j++) {
+		job->f(M_COL(job->X, job->m + 1, j), M_COL(job->Y, job->n, j),
+		       job->ctx);
+	}
+}
+
 /**
- * cluster_newton() - the cluster Newton method to solve inverse problems
- * @m:      Dimension of the parameter space.
- * @n:      Dimension of the result space.
- * @f:      A function that maps vectors of size m to vectors of size n.
+ * multi_eval_pool() - evaluates a function at multiple points, in parallel
+ * @pool:                A worker pool, or NULL to evaluate sequentially.
+ * @m:                   Number of parameters of the function.
+ * @n:                   Dimension of the result.
+ * @f:                   The function to evaluate. Called as f(x, y, ctx).
+ * @ctx:                 User data passed to f.
+ * @l:                   Number of points.
+ * @X:                   Coordinates of the points, one point per column.
+ * @Y:                   Matrix in which to store the result.
+ *
+ * Same as multi_eval(), but the points are spread over the workers of
+ * @pool, so f must be reentrant: it may be called concurrently, with the
+ * same ctx, from several threads. This function assumes COLUMN-MAJOR
+ * ORDER.
+ */
+void multi_eval_pool(struct cn_pool *pool, uint m, uint n,
+                     void (*f)(float *, float *, void *), void *ctx,
+                     uint l, float *X, float *Y)
+{
+	struct multi_eval_job job = { m, n, f, ctx, X, Y };
+	cn_pool_run(pool, l, multi_eval_chunk, &job);
+}
+
+struct multi_eval_batch_job {
+	uint m, n;
+	void (*fb)(uint, float *, float *, void *);
+	void *ctx;
+	uint tile;
+	float *X, *Y;
+};
+
+static void multi_eval_batch_chunk(void *arg, uint begin, uint end, uint id)
+{
+	struct multi_eval_batch_job *job = (struct multi_eval_batch_job *)arg;
+	for (uint j = begin; j < end; j += job->tile) {
+		uint count = (end - j < job->tile ? end - j : job->tile);
+		job->fb(count, M_COL(job->X, job->m + 1, j),
+		        M_COL(job->Y, job->n, j), job->ctx);
+	}
+}
+
+/**
+ * multi_eval_batch() - evaluates a batched function at multiple points
+ * @pool:                 A worker pool, or NULL to evaluate sequentially.
+ * @m:                    Number of parameters of the function.
+ * @n:                    Dimension of the result.
+ * @fb:                   The function to evaluate, on a tile of points.
+ *                        Called as fb(count, X, Y, ctx), where X holds
+ *                        count points with leading dimension m + 1, and
+ *                        Y the count results, with leading dimension n.
+ * @ctx:                  User data passed to fb.
+ * @tile:                 Maximum number of points per call to fb.
+ * @l:                    Number of points.
+ * @X:                    Coordinates of the points, one point per column.
+ * @Y:                    Matrix in which to store the result.
+ *
+ * Same as multi_eval_pool(), but fb is handed contiguous tiles of points
+ * so that it can vectorize across them (one SIMD lane per point). This
+ * function assumes COLUMN-MAJOR ORDER.
+ */
+void multi_eval_batch(struct cn_pool *pool, uint m, uint n,
+                      void (*fb)(uint, float *, float *, void *), void *ctx,
+                      uint tile, uint l, float *X, float *Y)
+{
+	assert(tile > 0);
+	struct multi_eval_batch_job job = { m, n, fb, ctx, tile, X, Y };
+	cn_pool_run(pool, l, multi_eval_batch_chunk, &job);
+}
+
+struct multi_eval_warm_job {
+	uint m, n;
+	void (*fw)(float *, float *, void *, void *);
+	void *ctx;
+	size_t size;
+	char *W;
+	float *X, *Y;
+};
+
+static void multi_eval_warm_chunk(void *arg, uint begin, uint end, uint id)
+{
+	struct multi_eval_warm_job *job = (struct multi_eval_warm_job *)arg;
+	for (uint j = begin; j < end; j++) {
+		job->fw(M_COL(job->X, job->m + 1, j), M_COL(job->Y, job->n, j),
+		        job->W + (j - 1) * job->size, job->ctx);
+	}
+}
+
+/**
+ * multi_eval_warm() - evaluates a stateful function at multiple points
+ * @pool:                A worker pool, or NULL to evaluate sequentially.
+ * @m:                   Number of parameters of the function.
+ * @n:                   Dimension of the result.
+ * @fw:                  The function to evaluate. Called as
+ *                       fw(x, y, state, ctx), where state is the block
+ *                       of @size bytes of the point.
+ * @ctx:                 User data passed to fw.
+ * @size:                Size in bytes of the state of a point.
+ * @W:                   The l states, one after the other.
+ * @l:                   Number of points.
+ * @X:                   Coordinates of the points, one point per column.
+ * @Y:                   Matrix in which to store the result.
+ *
+ * Same as multi_eval_pool(), but each point comes with a state that fw
+ * may read and update, typically to warm start an integrator from the
+ * previous evaluation at a nearby point. This function assumes
+ * COLUMN-MAJOR ORDER.
+ */
+void multi_eval_warm(struct cn_pool *pool, uint m, uint n,
+                     void (*fw)(float *, float *, void *, void *), void *ctx,
+                     size_t size, void *W, uint l, float *X, float *Y)
+{
+	struct multi_eval_warm_job job = { m, n, fw, ctx, size, (char *)W,
+	                                   X, Y };
+	cn_pool_run(pool, l, multi_eval_warm_chunk, &job);
+}
+
+/**
+ * struct cn_workspace - memory used by cluster_newton_ws()
+ * @m, @n, @l:     Dimensions the workspace was created for.
+ * @X:             Cluster points, (m + 1)-by-l.
+ * @Ys:            Perturbed targets, n-by-l.
+ * @Y:             Images of the cluster points, n-by-l.
+ * @A_y0:          Linear approximation [A y0], n-by-(m + 1).
+ * @Y0:            Right-hand side of the minimum norm problem, n-by-l.
+ * @S:             Steps, m-by-l.
+ * @C:             Scratch for normal_ls_(), (m + 1)-by-(m + 1).
+ * @D:             Scratch for normal_ls_(), (m + 1)-by-n.
+ * @E:             Scratch for minimum_norm_(), n-by-n.
+ * @ipiv:          Pivots, of size m + 1.
+ * @work:          LAPACK work array, of size lwork.
+ * @lwork:         See sysv_lwork().
+ * @pool:          Workers used in step 2.1, or NULL. Not owned.
+ * @fb:            Batched forward model, or NULL.
+ * @tile:          Maximum number of points per call to fb.
+ * @fw:            Forward model with per-point state, or NULL.
+ * @warm_size:     Size in bytes of the state of a point.
+ * @warm:          The l states of the points, or NULL.
+ * @fs:            Fidelity schedule, or NULL. Not owned.
+ * @as:            Active set options, or NULL. Not owned.
+ * @perm:          Vector of size l, or NULL: column j of X, Ys and Y
+ *                 holds the cluster point perm(j).
+ *
+ * All buffers but @warm and @perm live in the same allocation as the
+ * structure itself.
+ */
+struct cn_workspace {
+	uint m, n, l;
+	float *X, *Ys, *Y, *A_y0, *Y0, *S;
+	float *C, *D, *E;
+	int *ipiv;
+	float *work;
+	int lwork;
+	struct cn_pool *pool;
+	void (*fb)(uint, float *, float *, void *);
+	uint tile;
+	void (*fw)(float *, float *, void *, void *);
+	size_t warm_size;
+	void *warm;
+	const struct cn_fidelity *fs;
+	const struct cn_active *as;
+	uint *perm;
+};
+
+/* Number of floats in each buffer of a workspace, in layout order. */
+#define CN_WS_FLOATS(m, n, l, lwork) \
+	((m + 1) * l + n * l + n * l + n * (m + 1) + n * l + m * l \
+	 + (m + 1) * (m + 1) + (m + 1) * n + n * n + lwork)
+
+static int cn_workspace_lwork(uint m, uint n, uint l)
+{
+	int lw1 = sysv_lwork(m + 1, n);
+	int lw2 = sysv_lwork(n, l);
+	return (lw1 > lw2 ? lw1 : lw2);
+}
+
+/**
+ * cn_workspace_size() - memory needed by a workspace
+ * @m:                   Dimension of the parameter space.
+ * @n:                   Dimension of the result space.
+ * @l:                   Number of cluster points.
+ *
+ * Return: the size in bytes of a workspace created by
+ * cn_workspace_create() for the same dimensions.
+ */
+size_t cn_workspace_size(uint m, uint n, uint l)
+{
+	size_t lwork = cn_workspace_lwork(m, n, l);
+	return sizeof(struct cn_workspace)
+	       + sizeof(float) * CN_WS_FLOATS(m, n, l, lwork)
+	       + sizeof(int) * (m + 1);
+}
+
+/**
+ * cn_workspace_create() - allocate a workspace for cluster_newton_ws()
+ * @m:                     Dimension of the parameter space.
+ * @n:                     Dimension of the result space.
+ * @l:                     Number of cluster points.
+ *
+ * Every buffer needed by cluster_newton_ws(), including the LAPACK work
+ * arrays, is carved out of a single allocation. The workspace can be
+ * reused for any number of calls with the same dimensions.
+ *
+ * Return: a workspace, to be released with cn_workspace_destroy().
+ */
+struct cn_workspace *cn_workspace_create(uint m, uint n, uint l)
+{
+	assert(m > n);
+	assert(n > 0);
+	assert(l > 0);
+
+	int lwork = cn_workspace_lwork(m, n, l);
+	struct cn_workspace *ws =
+		(struct cn_workspace *)malloc(cn_workspace_size(m, n, l));
+	assert(ws);
+
+	ws->m = m;
+	ws->n = n;
+	ws->l = l;
+	ws->lwork = lwork;
+	ws->pool = NULL;
+	ws->fb = NULL;
+	ws->tile = 0;
+	ws->fw = NULL;
+	ws->warm_size = 0;
+	ws->warm = NULL;
+	ws->fs = NULL;
+	ws->as = NULL;
+	ws->perm = NULL;
+
+	float *p = (float *)(ws + 1);
+	ws->X = p;     p += (m + 1) * l;
+	ws->Ys = p;    p += n * l;
+	ws->Y = p;     p += n * l;
+	ws->A_y0 = p;  p += n * (m + 1);
+	ws->Y0 = p;    p += n * l;
+	ws->S = p;     p += m * l;
+	ws->C = p;     p += (m + 1) * (m + 1);
+	ws->D = p;     p += (m + 1) * n;
+	ws->E = p;     p += n * n;
+	ws->work = p;  p += lwork;
+	ws->ipiv = (int *)p;
+
+	return ws;
+}
+
+/**
+ * cn_workspace_destroy() - release a workspace
+ * @ws:                      Workspace created by cn_workspace_create().
+ */
+void cn_workspace_destroy(struct cn_workspace *ws)
+{
+	free(ws->perm);
+	free(ws->warm);
+	free(ws);
+}
+
+/**
+ * cn_workspace_set_pool() - evaluate the cluster points in parallel
+ * @ws:                        A workspace.
+ * @pool:                      Worker pool, or NULL for sequential
+ *                             evaluation. The workspace does not take
+ *                             ownership of it.
+ *
+ * The pool is used by cluster_newton_ws() to evaluate the forward model
+ * with multi_eval_pool().
+ */
+void cn_workspace_set_pool(struct cn_workspace *ws, struct cn_pool *pool)
+{
+	ws->pool = pool;
+}
+
+/**
+ * cn_workspace_set_batch() - use a batched forward model
+ * @ws:                         A workspace.
+ * @fb:                         Batched forward model, see
+ *                              multi_eval_batch(), or NULL to go back to
+ *                              the point-wise model.
+ * @tile:                       Maximum number of points per call to fb.
+ *
+ * When set, cluster_newton_ws() evaluates the cluster with
+ * multi_eval_batch() and ignores its point-wise model argument. The
+ * context passed to cluster_newton_ws() is handed to fb.
+ */
+void cn_workspace_set_batch(struct cn_workspace *ws,
+                            void (*fb)(uint, float *, float *, void *),
+                            uint tile)
+{
+	assert(!fb || tile > 0);
+	ws->fb = fb;
+	ws->tile = tile;
+}
+
+/**
+ * cn_workspace_set_warm() - use a forward model with per-point state
+ * @ws:                        A workspace.
+ * @fw:                        Forward model, see multi_eval_warm(), or
+ *                             NULL to go back to the point-wise model.
+ * @size:                      Size in bytes of the state of a point.
+ *
+ * The workspace allocates a state of @size bytes for each cluster point.
+ * cluster_newton_ws() zeroes the states when it samples the cluster, and
+ * hands each point its state at every iteration, so that a model which
+ * integrates an ODE can keep its step sizes and Jacobian from one
+ * iteration to the next (see struct ode_warm). When set, fw takes
+ * precedence over the point-wise and batched models.
+ */
+void cn_workspace_set_warm(struct cn_workspace *ws,
+                           void (*fw)(float *, float *, void *, void *),
+                           size_t size)
+{
+	assert(!fw || size > 0);
+	free(ws->warm);
+	ws->warm = NULL;
+	if (fw) {
+		ws->warm = malloc(size * ws->l);
+		assert(ws->warm);
+	}
+	ws->fw = fw;
+	ws->warm_size = size;
+}
+
+/**
+ * cn_workspace_set_fidelity() - raise the accuracy of the model with the
+ *                               iterations
+ * @ws:                            A workspace.
+ * @fs:                            Fidelity schedule, or NULL to always
+ *                                 evaluate at full fidelity. The workspace
+ *                                 keeps the pointer: fs must outlive it,
+ *                                 or be unset.
+ *
+ * The first iterations of cluster_newton_ws() only need a coarse linear
+ * model of f, so they can afford a cheaper f. Before each evaluation of
+ * the cluster, the fidelity of the current level is written to
+ * *fs->current, which the model reads through its context: see
+ * fwd_influenza() for an example.
+ */
+void cn_workspace_set_fidelity(struct cn_workspace *ws,
+                               const struct cn_fidelity *fs)
+{
+	if (fs) {
+		assert(fs->nlevels > 0);
+		assert(V_IDX(fs->start, 1) == 0);
+		assert(fs->current);
+	}
+	ws->fs = fs;
+}
+
+/**
+ * cn_workspace_set_active() - stop iterating on the points that have
+ *                             converged
+ * @ws:                          A workspace.
+ * @as:                          Active set options, or NULL to iterate on
+ *                               every point. The workspace keeps the
+ *                               pointer: as must outlive it, or be unset.
+ *
+ * After each evaluation of the cluster, cluster_newton_ws() freezes the
+ * points whose image is within as->tol of their perturbed target: they
+ * are no longer evaluated nor moved, but their last image stays in the
+ * linear fit of the remaining points. The distance is relative, except
+ * in the components where the target is zero, where it is absolute. With a fidelity schedule, points
+ * are only frozen at the highest level.
+ */
+void cn_workspace_set_active(struct cn_workspace *ws,
+                             const struct cn_active *as)
+{
+	free(ws->perm);
+	ws->perm = NULL;
+	if (as) {
+		assert(as->tol > 0.0f);
+		assert(as->frac >= 0.0f && as->frac <= 1.0f);
+		ws->perm = (uint *)malloc(sizeof(uint) * ws->l);
+		assert(ws->perm);
+	}
+	ws->as = as;
+}
+
+/*
+ * cn_swap_points() - swap the columns a and b of the cluster, along with
+ *                    their targets, images and states
+ */
+static void cn_swap_points(struct cn_workspace *ws, uint a, uint b)
+{
+	uint m = ws->m;
+	uint n = ws->n;
+
+	for (uint i = 1; i <= m + 1; i++) {
+		float t = M_IDX(ws->X, m + 1, i, a);
+		M_IDX(ws->X, m + 1, i, a) = M_IDX(ws->X, m + 1, i, b);
+		M_IDX(ws->X, m + 1, i, b) = t;
+	}
+	for (uint i = 1; i <= n; i++) {
+		float t = M_IDX(ws->Ys, n, i, a);
+		M_IDX(ws->Ys, n, i, a) = M_IDX(ws->Ys, n, i, b);
+		M_IDX(ws->Ys, n, i, b) = t;
+		t = M_IDX(ws->Y, n, i, a);
+		M_IDX(ws->Y, n, i, a) = M_IDX(ws->Y, n, i, b);
+		M_IDX(ws->Y, n, i, b) = t;
+	}
+	if (ws->fw) {
+		char *pa = (char *)ws->warm + (a - 1) * ws->warm_size;
+		char *pb = (char *)ws->warm + (b - 1) * ws->warm_size;
+		for (size_t k = 0; k < ws->warm_size; k++) {
+			char t = pa[k];
+			pa[k] = pb[k];
+			pb[k] = t;
+		}
+	}
+	uint t = V_IDX(ws->perm, a);
+	V_IDX(ws->perm, a) = V_IDX(ws->perm, b);
+	V_IDX(ws->perm, b) = t;
+}
+
+/*
+ * point_residual() - relative distance from y to the target ys, two
+ *                    vectors of size n
+ *
+ * The components whose target is zero are measured absolutely.
+ */
+static float point_residual(uint n, const float *y, const float *ys)
+{
+	float acc = 0.0f;
+	for (uint i = 1; i <= n; i++) {
+		float s = fabsf(V_IDX(ys, i));
+		float rel = (V_IDX(y, i) - V_IDX(ys, i)) / (s > 0.0f ? s : 1.0f);
+		acc += rel * rel;
+	}
+	return sqrtf(acc);
+}
+
+/*
+ * cn_fidelity_level() - level of iteration k of K, given the level of the
+ *                       previous iteration
+ */
+static uint cn_fidelity_level(const struct cn_fidelity *fs, uint k, uint K,
+                              uint level)
+{
+	if (k == K) {
+		return fs->nlevels;
+	}
+	while (level < fs->nlevels && V_IDX(fs->start, level + 1) <= k) {
+		level++;
+	}
+	return level;
+}
+
+/*
+ * fit_residual() - relative residual ||Y - AX - y0|| / ||Y|| of the linear
+ *                  model, from Y0 = Ys - AX - y0
+ *
+ * If Y is zero, the residual is absolute.
+ */
+static float fit_residual(uint n, uint l, const float *Y0, const float *Ys,
+                          const float *Y)
+{
+	float num = 0.0f;
+	float den = 0.0f;
+	for (uint j = 1; j <= n * l; j++) {
+		float e = V_IDX(Y0, j) - V_IDX(Ys, j) + V_IDX(Y, j);
+		num += e * e;
+		den += V_IDX(Y, j) * V_IDX(Y, j);
+	}
+	return sqrtf(den > 0.0f ? num / den : num);
+}
+
+/**
+ * cluster_newton_ws() - cluster_newton() with a preallocated workspace
+ * @ws:     Workspace created by cn_workspace_create(m, n, l).
+ * @f:      A function that maps vectors of size m to vectors of size n,
+ *          called as f(x, y, ctx). It must be reentrant if a pool has
+ *          been attached to the workspace. Can be NULL if a batched
+ *          model has been set with cn_workspace_set_batch(), or a
+ *          stateful one with cn_workspace_set_warm().
+ * @ctx:    User data passed to the forward model.
  * @ys:     Target vector, of dimension n.
  * @xh:     Center of the initial box. Vector of size m.
  * @v:      Relative size of the initial box. Vector of size m.
- * @l:      Number of candidates to generate.
  * @eta:    Target accuracy.
  * @K:      Number of iterations.
  * @Xf:     Where to store the result. Matrix of size l by m.
  * @r:      Where to store the residuals. Vector of size l. Can also be
  *          set to NULL, if the user does not need to compute them.
+ *
+ * Same as cluster_newton(), but performs no heap allocation: all the
+ * intermediate results live in @ws. The points are evaluated on the pool
+ * attached with cn_workspace_set_pool(), if any, and with the model set
+ * with cn_workspace_set_warm() or cn_workspace_set_batch(), if any, at
+ * the fidelity set with cn_workspace_set_fidelity(), if any. Points that
+ * have converged are frozen, and the iterations stop early, as set with
+ * cn_workspace_set_active(), if at all.
  */
-void cluster_newton(uint m, uint n, void (*f)(float *, float *), float *ys,
-                    float *xh, float *v,
-                    uint l, float eta, uint K, float *Xf, float * r)
+void cluster_newton_ws(struct cn_workspace *ws,
+                       void (*f)(float *, float *, void *), void *ctx,
+                       float *ys, float *xh, float *v,
+                       float eta, uint K, float *Xf, float *r)
 {
-	/* safety checks */
-	assert(m > n);
-	assert(n > 0);
-	assert(l > 0);
+	uint m = ws->m;
+	uint n = ws->n;
+	uint l = ws->l;
 
-	/* 1.1 */ float *X = create_matrix(m + 1, l);
+	/* 1.1 */ float *X = ws->X;
 	random_pts_in_box(m, l, xh, v, X);
 
-	/* 1.2 */ float *Ys = create_matrix(n, l);
+	/* 1.2 */ float *Ys = ws->Ys;
 	perturbate(l, n, ys, eta, Ys);
 
-	float *Y = create_matrix(n, l);
+	/* a new cluster: the models start cold */
+	if (ws->fw) {
+		memset(ws->warm, 0, ws->warm_size * l);
+	}
+
+	/* the active points are the first na columns */
+	const struct cn_active *as = ws->as;
+	uint na = l;
+	uint nstop = l + 1;
+	if (as) {
+		for (uint j = 1; j <= l; j++) {
+			V_IDX(ws->perm, j) = j;
+		}
+		nstop = (uint)ceilf(as->frac * l);
+		if (as->frac == 0.0f) {
+			nstop = l + 1;
+		}
+	}
+
+	float *Y = ws->Y;
 
 	/* A and y0 are stored in the same matrix
 	 * handy when solving the overdetermined linear system in 2.2 */
-	float *A_y0 = create_matrix(n, m + 1);
+	float *A_y0 = ws->A_y0;
 	float *A = A_y0;
 	float *y0 = M_COL(A_y0, n, m + 1);
-	float *Y0 = create_matrix(n, l);
-	float *S = create_matrix(m, l);
+	float *Y0 = ws->Y0;
+	float *S = ws->S;
+
+	const struct cn_fidelity *fs = ws->fs;
+	uint level = 1;
+	float fit_old = INFINITY;
+	uint evals = 0;
 
 	for (uint k = 0; k <= K; k++) {
-		/* 2.1 */ multi_eval(m, n, f, l, X, Y);
+		if (fs) {
+			uint next = cn_fidelity_level(fs, k, K, level);
+			if (next != level) {
+				fit_old = INFINITY;
+			}
+			level = next;
+			*fs->current = V_IDX(fs->levels, level);
+		}
+
+		/* 2.1 */
+		if (ws->fw) {
+			multi_eval_warm(ws->pool, m, n, ws->fw, ctx,
+			                ws->warm_size, ws->warm, na, X, Y);
+		} else if (ws->fb) {
+			multi_eval_batch(ws->pool, m, n, ws->fb, ctx,
+			                 ws->tile, na, X, Y);
+		} else {
+			multi_eval_pool(ws->pool, m, n, f, ctx, na, X, Y);
+		}
+		evals++;
+
+		/* freeze the points that have converged */
+		if (as && (!fs || level == fs->nlevels)) {
+			for (uint j = 1; j <= na;) {
+				if (point_residual(n, M_COL(Y, n, j),
+				                   M_COL(Ys, n, j)) > as->tol) {
+					j++;
+					continue;
+				}
+				if (as->iters) {
+					V_IDX(as->iters,
+					      V_IDX(ws->perm, j)) = evals;
+				}
+				cn_swap_points(ws, j, na);
+				na--;
+			}
+			if (na == 0 || l - na >= nstop) {
+				break;
+			}
+		}
 
-		/* 2.2 */ normal_ls(m + 1, l, X, n, Y, A_y0);
+		/* 2.2 */ normal_ls_(m + 1, l, X, n, Y, A_y0, ws->C, ws->D,
+		                     ws->ipiv, ws->work, ws->lwork);
 		/* 2.2 */ //pinv_ls(m + 1, l, X, n, Y, A_y0);
 		m_replicate(n, y0, l, Y0);
 
@@ -275,12 +890,23 @@ void cluster_newton(uint m, uint n, void (*f)(float *, float *), float *ys,
 			    n, l, m, -1.0f, A, n, X, m + 1, -1.0f, Y0, n);
 		m_add(n, l, n, Y0, n, Ys);
 
+		/* escalate when the linear model stops improving */
+		if (fs && fs->stall > 0.0f && level < fs->nlevels) {
+			float fit = fit_residual(n, l, Y0, Ys, Y);
+			if (fit > fs->stall * fit_old) {
+				level++;
+				fit = INFINITY;
+			}
+			fit_old = fit;
+		}
+
 		m_scale_cols(n, m, A, xh);
-		minimum_norm(n, m, A, l, Y0, S);
-		m_scale_rows_inv(m, l, S, xh);
+		minimum_norm_(n, m, A, na, Y0, S, ws->E, ws->ipiv,
+		              ws->work, ws->lwork);
+		m_scale_rows_inv(m, na, S, xh);
 
 		/* 2.4 */
-		for (uint j = 1; j <= l; j++) {
+		for (uint j = 1; j <= na; j++) {
 			/* FIXME */
 			while (0) {
 				for (uint i = 1; i <= m; i++) {
@@ -288,30 +914,62 @@ void cluster_newton(uint m, uint n, void (*f)(float *, float *), float *ys,
 				}
 			}
 		}
-		m_add(m, l, m + 1, X, m, S);
+		m_add(m, na, m + 1, X, m, S);
 	}
 
-	/* copy the result */
-	m_copy(m, l, m, Xf, m + 1, X);
+	/* the points left active were evaluated at every iteration */
+	if (as && as->iters) {
+		for (uint j = 1; j <= na; j++) {
+			V_IDX(as->iters, V_IDX(ws->perm, j)) = evals;
+		}
+	}
 
-	/* compute the residuals */
-	if (r) {
-		for (uint j = 1; j <= l; j++) {
-			V_IDX(r, j) = 0.0f;
-			for (uint i = 1; i <= n; i++) {
-				float rel = (M_IDX(Y, n, i, j) - V_IDX(ys, i))
-				            / V_IDX(ys, i);
-				V_IDX(r, j) += pow(fabs(rel), 2.0f);
-			}
-			V_IDX(r, j) = sqrt(V_IDX(r, j));
+	/* copy the result, in the original order of the points */
+	for (uint j = 1; j <= l; j++) {
+		uint p = (as ? V_IDX(ws->perm, j) : j);
+		m_copy(m, 1, m, M_COL(Xf, m, p), m + 1, M_COL(X, m + 1, j));
+
+		/* compute the residuals */
+		if (r) {
+			V_IDX(r, p) = point_residual(n, M_COL(Y, n, j), ys);
 		}
 	}
+}
 
-	/* cleaning up */
-	free(S);
-	free(Y0);
-	free(A_y0);
-	free(Y);
-	free(Ys);
-	free(X);
+/* Adapter that lets cluster_newton() call a function without context. */
+struct plain_fct {
+	void (*f)(float *, float *);
+};
+
+static void call_plain_fct(float *x, float *y, void *ctx)
+{
+	((struct plain_fct *)ctx)->f(x, y);
+}
+
+/**
+ * cluster_newton() - the cluster Newton method to solve inverse problems
+ * @m:      Dimension of the parameter space.
+ * @n:      Dimension of the result space.
+ * @f:      A function that maps vectors of size m to vectors of size n.
+ * @ys:     Target vector, of dimension n.
+ * @xh:     Center of the initial box. Vector of size m.
+ * @v:      Relative size of the initial box. Vector of size m.
+ * @l:      Number of candidates to generate.
+ * @eta:    Target accuracy.
+ * @K:      Number of iterations.
+ * @Xf:     Where to store the result. Matrix of size l by m.
+ * @r:      Where to store the residuals. Vector of size l. Can also be
+ *          set to NULL, if the user does not need to compute them.
+ *
+ * Callers that solve many problems of the same size should use
+ * cluster_newton_ws() instead, to avoid allocating memory on each call.
+ */
+void cluster_newton(uint m, uint n, void (*f)(float *, float *), float *ys,
+                    float *xh, float *v,
+                    uint l, float eta, uint K, float *Xf, float * r)
+{
+	struct plain_fct pf = { f };
+	struct cn_workspace *ws = cn_workspace_create(m, n, l);
+	cluster_newton_ws(ws, call_plain_fct, &pf, ys, xh, v, eta, K, Xf, r);
+	cn_workspace_destroy(ws);
 }
@@ -229,7 +229,7 @@ void m_transpose(uint n, uint m, float *A, float *B)
  *
  * Returns ||v||_2.
  */
-float v_norm(uint n, float *v)
+float v_norm(uint n, const float *v)
 {
 	return LAPACKE_slange(LAPACK_COL_MAJOR, 'F', n, 1, v, n);
 }
@@ -18,30 +18,41 @@
 #include "cn.h"
 #include "integrate.h"
 
-/* For the sake of clarity, we'll ignore x[0]. */
-static float x[14];
+#include <math.h>
 
 /** F_HIV() - Forward problem for HIV Kinetics model
  * @u:                Vector of size 4.
  * @d:                Output, vector of size 4.
+ * @ctx:              The parameters of the model, a vector of size 13.
  *
  * The HIV Kinetics model (Miao et al.) is given by the differential
  * system: u' = F_HIV(t, u).
  */
-static void F_HIV(float t, float *u, float *d)
+static void F_HIV(float t, float *u, float *d, void *ctx)
 {
+	float *x = (float *)ctx;
+	float x1 = V_IDX(x, 1);
+	float x2 = V_IDX(x, 2);
+	float x3 = V_IDX(x, 3);
+	float x4 = V_IDX(x, 4);
+	float x5 = V_IDX(x, 5);
+	float x6 = V_IDX(x, 6);
+	float x7 = V_IDX(x, 7);
+	float x8 = V_IDX(x, 8);
+	float x9 = V_IDX(x, 9);
+
 	float u1 = V_IDX(u, 1);
 	float u2 = V_IDX(u, 2);
 	float u3 = V_IDX(u, 3);
 	float u4 = V_IDX(u, 4);
 
-	V_IDX(d, 1) = (x[1] - x[5] * u2 - x[6] * u3 - x[7] * u4) * u1;
-	V_IDX(d, 2) = (x[2] + x[5] * u1 - x[8] * u3) * u2
-	               + x[7] * u4 * u1 / 4.0f;
-	V_IDX(d, 3) = (x[3] + x[6] * u1 - x[9] * u2) * u3
-	               + x[7] * u4 * u1 / 4.0f;
-	V_IDX(d, 4) = (x[4] + x[7] * u1 / 2.0f) * u4
-	               + (x[8] + x[9]) * u3 * u2;
+	V_IDX(d, 1) = (x1 - x5 * u2 - x6 * u3 - x7 * u4) * u1;
+	V_IDX(d, 2) = (x2 + x5 * u1 - x8 * u3) * u2
+	               + x7 * u4 * u1 / 4.0f;
+	V_IDX(d, 3) = (x3 + x6 * u1 - x9 * u2) * u3
+	               + x7 * u4 * u1 / 4.0f;
+	V_IDX(d, 4) = (x4 + x7 * u1 / 2.0f) * u4
+	               + (x8 + x9) * u3 * u2;
 }
 
 /* Times at which experimental data have been gathered. */
@@ -54,35 +65,92 @@ static const float target[5] = {
 	0.0f
 };
 
-/* Number of steps in the RK4 scheme */
-static const uint N[22] = {
-	20, 20, 20, 20, 20, 20, 20, 20,
-	20, 20, 20, 20, 20, 20, 20, 20,
-	20, 20, 20, 20, 20, 20
-};
+/* Tolerances of the adaptive integrator */
+static const float RTOL = 1e-4f;
+static const float ATOL = 1e-6f;
 
-void fwd_HIV(float *X, float *Y)
+/*
+ * hiv_rtol() - relative tolerance at the fidelity pointed to by ctx, see
+ *              cn_workspace_set_fidelity()
+ */
+static float hiv_rtol(void *ctx)
 {
-	/* set up the parameters so that F_HIV() can access them */
-	for (uint i = 1; i <= 13; i++) {
-		x[i] = V_IDX(X, i);
+	return (ctx ? RTOL / *(const float *)ctx : RTOL);
+}
+
+/*
+ * hiv_init() - initial state u of the system of parameters X, and the
+ *              outputs Y set to NaN, so that the observations the
+ *              integrator fails to reach are not left stale
+ */
+static void hiv_init(const float *X, float *u, float *Y)
+{
+	V_IDX(u, 1) = V_IDX(X, 10);
+	V_IDX(u, 2) = V_IDX(X, 11);
+	V_IDX(u, 3) = V_IDX(X, 12);
+	V_IDX(u, 4) = V_IDX(X, 13);
+	for (uint i = 1; i <= 4 * 5; i++) {
+		V_IDX(Y, i) = NAN;
 	}
+}
 
-	/* for each possible final time, simulate the system */
+/**
+ * fwd_HIV() - the forward problem
+ * @X:           Parameters of the model, a vector of size 13.
+ * @Y:           Output, 4-by-5 matrix: the state at each of the times tf.
+ * @ctx:         NULL, or a pointer to a fidelity in (0, 1]: the relative
+ *               tolerance is then divided by it. See
+ *               cn_workspace_set_fidelity().
+ *
+ * The parameters are handed to the integrator as its context, so this
+ * function is reentrant and can be used with multi_eval_pool(). If the
+ * integration fails, the states at the times it did not reach are NaN.
+ */
+void fwd_HIV(float *X, float *Y, void *ctx)
+{
+	/* simulate the system once, recording every observation time */
 	float u[4];
-	for (uint i = 1; i <= 5; i++) {
-		V_IDX(u, 1) = x[10];
-		V_IDX(u, 2) = x[11];
-		V_IDX(u, 3) = x[12];
-		V_IDX(u, 4) = x[13];
-
-		rk4(4, F_HIV, 0.0f, u, V_IDX(tf, i), V_IDX(N, i));
-
-		M_IDX(Y, 4, 1, i) = V_IDX(u, 1);
-		M_IDX(Y, 4, 2, i) = V_IDX(u, 2);
-		M_IDX(Y, 4, 3, i) = V_IDX(u, 3);
-		M_IDX(Y, 4, 4, i) = V_IDX(u, 4);
-	}
+	hiv_init(X, u, Y);
+
+	dopri5(4, F_HIV, X, 0.0f, u, 5, tf, Y, hiv_rtol(ctx), ATOL, NULL);
+}
+
+/* State kept by fwd_HIV_warm() between two evaluations. */
+struct hiv_warm {
+	struct ode_warm w;
+	float h[5];
+};
+
+/**
+ * fwd_HIV_warm_size() - size of the state of fwd_HIV_warm()
+ *
+ * Return: the size in bytes to pass to cn_workspace_set_warm().
+ */
+size_t fwd_HIV_warm_size(void)
+{
+	return sizeof(struct hiv_warm);
+}
+
+/**
+ * fwd_HIV_warm() - fwd_HIV(), warm started from the previous evaluation
+ * @X, @Y:           See fwd_HIV().
+ * @state:           Zeroed before the first evaluation, then left as this
+ *                   function wrote it, see multi_eval_warm().
+ * @ctx:             See fwd_HIV().
+ *
+ * The integrator starts from the step sizes it accepted at the previous
+ * point, see dopri5_warm().
+ */
+void fwd_HIV_warm(float *X, float *Y, void *state, void *ctx)
+{
+	struct hiv_warm *s = (struct hiv_warm *)state;
+	s->w.h = s->h;
+
+	float u[4];
+	hiv_init(X, u, Y);
+
+	dopri5_warm(4, F_HIV, X, 0.0f, u, 5, tf, Y, hiv_rtol(ctx), ATOL,
+	            &s->w, NULL);
 }
 
 void hiv(void)
@@ -92,6 +160,6 @@ void hiv(void)
 		0.5f, 3.3f, 0.2f, 1.4f, 0.1f, 3.7f
 	};
 	float Y[5 * 4] = { 0.0f };
-	fwd_HIV(X, Y);
+	fwd_HIV(X, Y, NULL);
 	print_vector(5, Y);
 }
@@ -18,59 +18,156 @@
 #include "cn.h"
 #include "integrate.h"
 
-/* For the sake of clarity, we'll ignore x[0]. */
-static float x[8];
+#include <math.h>
 
 /** F_influenza() - Forward problem for Influenza Kinetics model
  * @t:                Time (unused here).
  * @u:                Vector of size 4.
  * @d:                Output, vector of size 4.
+ * @ctx:              The parameters of the model, a vector of size 7.
  *
  * The Influenza Kinetics model (Baccam et al.) is given by the differential
  * system: u' = F_influenza(t, u).
  */
-void F_influenza(float t, float *u, float *d)
+void F_influenza(float t, float *u, float *d, void *ctx)
 {
+	float *x = (float *)ctx;
+	float x1 = V_IDX(x, 1);
+	float x2 = V_IDX(x, 2);
+	float x3 = V_IDX(x, 3);
+	float x4 = V_IDX(x, 4);
+	float x5 = V_IDX(x, 5);
+	float x6 = V_IDX(x, 6);
+
 	float u1 = V_IDX(u, 1);
 	float u2 = V_IDX(u, 2);
 	float u3 = V_IDX(u, 3);
 	float u4 = V_IDX(u, 4);
 
-	V_IDX(d, 1) = -x[1] * u1 * u4;
-	V_IDX(d, 2) = x[1] * u1 * u4 - u2 / x[2];
-	V_IDX(d, 3) = u2 / x[2] - u3 / x[3];
-	V_IDX(d, 4) = x[4] * u3 / x[5] - x[6] * u4;
+	V_IDX(d, 1) = -x1 * u1 * u4;
+	V_IDX(d, 2) = x1 * u1 * u4 - u2 / x2;
+	V_IDX(d, 3) = u2 / x2 - u3 / x3;
+	V_IDX(d, 4) = x4 * u3 / x5 - x6 * u4;
 }
 
 /** dF_influenza() - Jacobian of F_influenza()
  * @t:                Time (unused here).
  * @u:                Vector of size 4.
  * @J:                Output, 4-by-4 matrix.
+ * @ctx:              The parameters of the model, a vector of size 7.
  */
-void dF_influenza(float t, float *u, float *J)
+void dF_influenza(float t, float *u, float *J, void *ctx)
 {
+	float *x = (float *)ctx;
+	float x1 = V_IDX(x, 1);
+	float x2 = V_IDX(x, 2);
+	float x3 = V_IDX(x, 3);
+	float x4 = V_IDX(x, 4);
+	float x5 = V_IDX(x, 5);
+	float x6 = V_IDX(x, 6);
+
 	float u1 = V_IDX(u, 1);
 	float u4 = V_IDX(u, 4);
 
-	M_IDX(J, 4, 1, 1) = -x[1] * u4;
-	M_IDX(J, 4, 2, 1) = x[1] * u4;
+	M_IDX(J, 4, 1, 1) = -x1 * u4;
+	M_IDX(J, 4, 2, 1) = x1 * u4;
 	M_IDX(J, 4, 3, 1) = 0.0f;
 	M_IDX(J, 4, 4, 1) = 0.0f;
 
 	M_IDX(J, 4, 1, 2) = 0.0f;
-	M_IDX(J, 4, 2, 2) = -1.0f / x[2];
-	M_IDX(J, 4, 3, 2) = 1.0f / x[2];
+	M_IDX(J, 4, 2, 2) = -1.0f / x2;
+	M_IDX(J, 4, 3, 2) = 1.0f / x2;
 	M_IDX(J, 4, 4, 2) = 0.0f;
 
 	M_IDX(J, 4, 1, 3) = 0.0f;
 	M_IDX(J, 4, 2, 3) = 0.0f;
-	M_IDX(J, 4, 3, 3) = -1.0f / x[3];
-	M_IDX(J, 4, 4, 3) = x[4] / x[5];
+	M_IDX(J, 4, 3, 3) = -1.0f / x3;
+	M_IDX(J, 4, 4, 3) = x4 / x5;
 
-	M_IDX(J, 4, 1, 4) = -x[1] * u1;
-	M_IDX(J, 4, 2, 4) = x[1] * u1;
+	M_IDX(J, 4, 1, 4) = -x1 * u1;
+	M_IDX(J, 4, 2, 4) = x1 * u1;
 	M_IDX(J, 4, 3, 4) = 0.0f;
-	M_IDX(J, 4, 4, 4) = -x[6];
+	M_IDX(J, 4, 4, 4) = -x6;
+}
+
+/** F_influenza_ens() - F_influenza() on an ensemble of W systems
+ * @W:                    Number of systems.
+ * @t:                    Time (unused here).
+ * @U:                    W-by-4 matrix, the W states.
+ * @D:                    Output, W-by-4 matrix.
+ * @ctx:                  The parameters of the W systems, one per column
+ *                        of an 8-by-W matrix.
+ *
+ * See rk4_ens() for the layout.
+ */
+void F_influenza_ens(uint W, float t, float *U, float *D, void *ctx)
+{
+	float *X = (float *)ctx;
+
+	#pragma omp simd
+	for (uint w = 1; w <= W; w++) {
+		float x1 = M_IDX(X, 8, 1, w);
+		float x2 = M_IDX(X, 8, 2, w);
+		float x3 = M_IDX(X, 8, 3, w);
+		float x4 = M_IDX(X, 8, 4, w);
+		float x5 = M_IDX(X, 8, 5, w);
+		float x6 = M_IDX(X, 8, 6, w);
+
+		float u1 = M_IDX(U, W, w, 1);
+		float u2 = M_IDX(U, W, w, 2);
+		float u3 = M_IDX(U, W, w, 3);
+		float u4 = M_IDX(U, W, w, 4);
+
+		M_IDX(D, W, w, 1) = -x1 * u1 * u4;
+		M_IDX(D, W, w, 2) = x1 * u1 * u4 - u2 / x2;
+		M_IDX(D, W, w, 3) = u2 / x2 - u3 / x3;
+		M_IDX(D, W, w, 4) = x4 * u3 / x5 - x6 * u4;
+	}
+}
+
+/** dF_influenza_ens() - dF_influenza() on an ensemble of W systems
+ * @W:                     Number of systems.
+ * @t:                     Time (unused here).
+ * @U:                     W-by-4 matrix, the W states.
+ * @J:                     Output, W-by-16 matrix, the W Jacobians.
+ * @ctx:                   See F_influenza_ens().
+ */
+void dF_influenza_ens(uint W, float t, float *U, float *J, void *ctx)
+{
+	float *X = (float *)ctx;
+
+	#pragma omp simd
+	for (uint w = 1; w <= W; w++) {
+		float x1 = M_IDX(X, 8, 1, w);
+		float x2 = M_IDX(X, 8, 2, w);
+		float x3 = M_IDX(X, 8, 3, w);
+		float x4 = M_IDX(X, 8, 4, w);
+		float x5 = M_IDX(X, 8, 5, w);
+		float x6 = M_IDX(X, 8, 6, w);
+
+		float u1 = M_IDX(U, W, w, 1);
+		float u4 = M_IDX(U, W, w, 4);
+
+		M_IDX(J, W, w, 1) = -x1 * u4;
+		M_IDX(J, W, w, 2) = x1 * u4;
+		M_IDX(J, W, w, 3) = 0.0f;
+		M_IDX(J, W, w, 4) = 0.0f;
+
+		M_IDX(J, W, w, 5) = 0.0f;
+		M_IDX(J, W, w, 6) = -1.0f / x2;
+		M_IDX(J, W, w, 7) = 1.0f / x2;
+		M_IDX(J, W, w, 8) = 0.0f;
+
+		M_IDX(J, W, w, 9) = 0.0f;
+		M_IDX(J, W, w, 10) = 0.0f;
+		M_IDX(J, W, w, 11) = -1.0f / x3;
+		M_IDX(J, W, w, 12) = x4 / x5;
+
+		M_IDX(J, W, w, 13) = -x1 * u1;
+		M_IDX(J, W, w, 14) = x1 * u1;
+		M_IDX(J, W, w, 15) = 0.0f;
+		M_IDX(J, W, w, 16) = -x6;
+	}
 }
 
 /* Times at which experimental data have been gathered. */
@@ -87,38 +184,127 @@ static const float target[22] = {
 	1.0f,  2.10f, 1.12f, 0.79f, 0.17f, 0.19f
 };
 
-/* Number of steps in the RK4 scheme */
-static const uint N[22] = {
-	200, 200, 200, 200, 200, 200, 200, 200,
-	200, 200, 200, 200, 200, 200, 200, 200,
-	200, 200, 200, 200, 200, 200
-};
+/* Number of steps from t = 0 to the last observation time */
+static const uint N = 800;
 
-void fwd_influenza(float *X, float *Y)
+/*
+ * influenza_steps() - number of steps at the fidelity pointed to by ctx,
+ *                     see cn_workspace_set_fidelity()
+ */
+static uint influenza_steps(void *ctx)
 {
-	/* set up the parameters so that F_influenza() can access them */
-	for (uint i = 1; i <= 7; i++) {
-		x[i] = V_IDX(X, i);
+	if (!ctx) {
+		return N;
 	}
+	uint steps = (uint)ceilf(*(const float *)ctx * N);
+	return (steps > 0 ? steps : 1);
+}
 
-	/* for each possible final time, simulate the system */
+/**
+ * fwd_influenza() - the forward problem
+ * @X:                 Parameters of the model, a vector of size 7.
+ * @Y:                 Output, the viral titer at each of the 22 times tf.
+ * @ctx:               NULL, or a pointer to a fidelity in (0, 1]: the
+ *                     system is then integrated with that fraction of
+ *                     the steps. See cn_workspace_set_fidelity().
+ *
+ * The parameters are handed to the integrator as its context, so this
+ * function is reentrant and can be used with multi_eval_pool(). The
+ * integrator works on the stack, so that evaluating a cluster does not
+ * touch the heap. If a step fails, the titers from then on are NaN.
+ */
+void fwd_influenza(float *X, float *Y, void *ctx)
+{
+	/* simulate the system once, recording every observation time */
 	float u[4];
+	float U[4 * 22];
+	float work[BDF1_WORK_SIZE(4)];
+	int iwork[BDF1_IWORK_SIZE(4)];
+	V_IDX(u, 1) = V_IDX(X, 5);
+	V_IDX(u, 2) = 0.0f;
+	V_IDX(u, 3) = 0.0f;
+	V_IDX(u, 4) = V_IDX(X, 7);
+	//rk4_sweep_work(4, F_influenza, X, 0.0f, u, 22, tf, U, N, work);
+	bdf1_sweep_work(4, F_influenza, dF_influenza, X, 0.0f, u, 22, tf, U,
+	                influenza_steps(ctx), 0.001, work, iwork);
 	for (uint i = 1; i <= 22; i++) {
-		V_IDX(u, 1) = x[5];
-		V_IDX(u, 2) = 0.0f;
-		V_IDX(u, 3) = 0.0f;
-		V_IDX(u, 4) = x[7];
-		//rk4(4, F_influenza, 0.0f, u, V_IDX(tf, i), V_IDX(N, i));
-		bdf1(4, F_influenza, dF_influenza,
-		     0.0f, u, V_IDX(tf, i), V_IDX(N, i), 0.001);
-		V_IDX(Y, i) = V_IDX(u, 4);
+		V_IDX(Y, i) = M_IDX(U, 4, 4, i);
 	}
 }
 
+/*
+ * influenza_batch() - fwd_influenza_batch(), with the Newton matrices of
+ *                     bdf1_ens_sweep() or bdf1_ens_shared_sweep()
+ */
+static void influenza_batch(uint count, float *X, float *Y, uint steps,
+                            int shared)
+{
+	float *U = create_matrix(count, 4);
+	float *Uout = create_matrix(count, 4 * 22);
+
+	/* simulate the systems once, recording every observation time */
+	for (uint w = 1; w <= count; w++) {
+		M_IDX(U, count, w, 1) = M_IDX(X, 8, 5, w);
+		M_IDX(U, count, w, 2) = 0.0f;
+		M_IDX(U, count, w, 3) = 0.0f;
+		M_IDX(U, count, w, 4) = M_IDX(X, 8, 7, w);
+	}
+	if (shared) {
+		bdf1_ens_shared_sweep(4, count, F_influenza_ens,
+		                      dF_influenza_ens, X, 0.0f, U, 22, tf,
+		                      Uout, steps, 0.001, NULL);
+	} else {
+		bdf1_ens_sweep(4, count, F_influenza_ens, dF_influenza_ens, X,
+		               0.0f, U, 22, tf, Uout, steps, 0.001);
+	}
+	for (uint i = 1; i <= 22; i++) {
+		for (uint w = 1; w <= count; w++) {
+			M_IDX(Y, 22, i, w) = M_IDX(Uout, count, w, 4 * i);
+		}
+	}
+
+	free(Uout);
+	free(U);
+}
+
+/**
+ * fwd_influenza_batch() - the forward problem, on a tile of points
+ * @count:                   Number of points.
+ * @X:                       8-by-count matrix, the parameters of the
+ *                           model, padded as in cluster_newton().
+ * @Y:                       Output, 22-by-count matrix.
+ * @ctx:                     See fwd_influenza().
+ *
+ * Batched version of fwd_influenza(), for multi_eval_batch(): the count
+ * systems are integrated in lockstep with bdf1_ens_sweep(). The titers of
+ * a point whose Newton iteration fails are NaN from then on. Unlike
+ * fwd_influenza(), this allocates the states of the tile, and the
+ * integrator its scratch, on the heap for each call.
+ */
+void fwd_influenza_batch(uint count, float *X, float *Y, void *ctx)
+{
+	influenza_batch(count, X, Y, influenza_steps(ctx), 0);
+}
+
+/**
+ * fwd_influenza_batch_shared() - fwd_influenza_batch(), sharing one
+ *                                Newton matrix across the tile
+ * @count, @X, @Y, @ctx:          See fwd_influenza_batch().
+ *
+ * The points of a tile are integrated with bdf1_ens_shared_sweep(), which
+ * factors a single matrix for all of them. This is much cheaper when the
+ * points are close, as they are once the cluster has contracted, at the
+ * price of differences of the order of the Newton tolerance.
+ */
+void fwd_influenza_batch_shared(uint count, float *X, float *Y, void *ctx)
+{
+	influenza_batch(count, X, Y, influenza_steps(ctx), 1);
+}
+
 void influenza(void)
 {
 	float X[7] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f };
 	float Y[22] = { 0.0f };
-	fwd_influenza(X, Y);
+	fwd_influenza(X, Y, NULL);
 	print_vector(22, Y);
 }
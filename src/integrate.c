@@ -14,61 +14,3295 @@
  *    You should have received a copy of the GNU General Public License
  *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include "integrate.h"
+
 #include "common.h"
 
-#include <lapacke.h>
+#include <cblas.h>
+#include <float.h>
+#include <lapacke.h>
+#include <math.h>
+#include <string.h>
+
+/**
+ * rk4_step() - one step of the fourth-order Runge-Kutta method
+ * @n, @f, @ctx:    See rk4().
+ * @t:              Current time.
+ * @y:              Vector of size n. Input: y(t). Output: y(t + h).
+ * @h:              Step size.
+ * @k1:             f(t, y), already evaluated by the caller.
+ * @k2, @k3, @k4:   Scratch vectors of size n.
+ * @z:              Scratch vector of size n.
+ */
+static void rk4_step(uint n, void (*f)(float, float *, float *, void *),
+                     void *ctx, float t, float *y, float h,
+                     float *k1, float *k2, float *k3, float *k4, float *z)
+{
+	/* k2 = f(t + h/2, y + h/2 k1) */
+	for (uint j = 1; j <= n; j++) {
+		V_IDX(z, j) = V_IDX(y, j) + 0.5f * h * V_IDX(k1, j);
+	}
+	f(t + 0.5f * h, z, k2, ctx);
+
+	/* k3 = f(t + h/2, y + h/2 k2) */
+	for (uint j = 1; j <= n; j++) {
+		V_IDX(z, j) = V_IDX(y, j) + 0.5f * h * V_IDX(k2, j);
+	}
+	f(t + 0.5f * h, z, k3, ctx);
+
+	/* k4 = f(t + h, y + h k3) */
+	for (uint j = 1; j <= n; j++) {
+		V_IDX(z, j) = V_IDX(y, j) + h * V_IDX(k3, j);
+	}
+	f(t + h, z, k4, ctx);
+
+	/* y <- y + h/6 (k1 + 2k2 + 2k3 + k4) */
+	for (uint j = 1; j <= n; j++) {
+		V_IDX(y, j) += (V_IDX(k1, j) + 2.0f * V_IDX(k2, j)
+		                + 2.0f * V_IDX(k3, j)
+		                + V_IDX(k4, j)) * h / 6.0f;
+	}
+}
+
+/**
+ * rk4() - Fourth-order Runge-Kutta method
+ * @n:         A positive integer.
+ * @f:         f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @ctx:       User data passed to f.
+ * @t0:        Initial time.
+ * @y:         Vector of size n. Input: y(t0). Output: y(t1).
+ * @t1:        Final time.
+ * @N:         Number of steps.
+ *
+ * Computes y(t1), where y' = f(t,y) and y(t0) = y0.
+ */
+void rk4(uint n, void (*f)(float, float *, float *, void *), void *ctx,
+         float t0, float *y, float t1, uint N)
+{
+	float *work = create_vector(RK4_WORK_SIZE(n));
+	rk4_work(n, f, ctx, t0, y, t1, N, work);
+	free(work);
+}
+
+/**
+ * rk4_work() - rk4(), with a workspace supplied by the caller
+ * @n, @f, @ctx, @t0, @y, @t1, @N:   See rk4().
+ * @work:                            Vector of size RK4_WORK_SIZE(n).
+ *
+ * Performs no heap allocation, so that a forward model can keep its
+ * workspace on the stack.
+ */
+void rk4_work(uint n, void (*f)(float, float *, float *, void *), void *ctx,
+              float t0, float *y, float t1, uint N, float *work)
+{
+	assert(t0 < t1);
+
+	float *k1 = work;
+	float *k2 = k1 + n;
+	float *k3 = k2 + n;
+	float *k4 = k3 + n;
+	float *z = k4 + n;
+
+	float h = (t1 - t0) / N;
+	float t = t0;
+
+	for (uint i = 1; i <= N; i++) {
+		/* k1 = f(t,y) */
+		f(t, y, k1, ctx);
+		rk4_step(n, f, ctx, t, y, h, k1, k2, k3, k4, z);
+		t += h;
+	}
+}
+
+/*
+ * ode_guard_check() - check the state y against a guard
+ *
+ * Return: 0 if y may be integrated further, -2 if it is not finite, -3 if
+ * it is out of the bounds of g.
+ */
+static int ode_guard_check(uint n, const struct ode_guard *g, const float *y)
+{
+	for (uint i = 1; i <= n; i++) {
+		float yi = V_IDX(y, i);
+		if (!isfinite(yi)) {
+			return -2;
+		}
+		if ((g->ymin && yi < V_IDX(g->ymin, i))
+		    || (g->ymax && yi > V_IDX(g->ymax, i))) {
+			return -3;
+		}
+	}
+	return 0;
+}
+
+/*
+ * ode_guard_fill() - outputs k to nout after a steady state y was reached
+ */
+static void ode_guard_fill(uint n, const float *y, uint k, uint nout,
+                           float *Yout)
+{
+	for (; k <= nout; k++) {
+		m_copy(n, 1, n, M_COL(Yout, n, k), n, (float *)y);
+	}
+}
+
+/**
+ * rk4_sweep() - Fourth-order Runge-Kutta method, with several outputs
+ * @n:               A positive integer.
+ * @f:               f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @ctx:             User data passed to f.
+ * @t0:              Initial time.
+ * @y:               Vector of size n. Input: y(t0). Output: y(tout(nout)).
+ * @nout:            Number of output times.
+ * @tout:            Output times, sorted, with t0 <= tout(1) and
+ *                   t0 < tout(nout).
+ * @Yout:            n-by-nout matrix. Output: y(tout(k)) in column k.
+ * @N:               Number of steps from t0 to tout(nout).
+ *
+ * Same as rk4(), but records the solution at every output time during a
+ * single sweep from t0 to tout(nout). Outputs that fall inside a step
+ * are computed with the cubic Hermite interpolant built from y and f at
+ * both ends of the step, which is as accurate as the method itself. The
+ * value of f at the end of a step is reused as k1 for the next one, so
+ * the interpolation is free. Outputs at t0 are y(t0), and equal output
+ * times give equal columns, but the sweep itself cannot be empty: an
+ * assertion rejects t0 = tout(nout).
+ */
+void rk4_sweep(uint n, void (*f)(float, float *, float *, void *), void *ctx,
+               float t0, float *y, uint nout, const float *tout,
+               float *Yout, uint N)
+{
+	rk4_guarded(n, f, NULL, ctx, t0, y, nout, tout, Yout, N);
+}
+
+/*
+ * rk4_guarded_() - rk4_guarded(), with a workspace of RK4_WORK_SIZE(n)
+ *                  floats
+ */
+static int rk4_guarded_(uint n, void (*f)(float, float *, float *, void *),
+                        const struct ode_guard *g, void *ctx,
+                        float t0, float *y, uint nout, const float *tout,
+                        float *Yout, uint N, float *work)
+{
+	assert(nout > 0);
+	assert(t0 <= V_IDX(tout, 1));
+	assert(V_IDX(tout, 1) <= V_IDX(tout, nout));
+	assert(t0 < V_IDX(tout, nout));
+
+	float *k1 = work;
+	float *k2 = k1 + n;
+	float *k3 = k2 + n;
+	float *k4 = k3 + n;
+	float *z = k4 + n;
+	float *y0 = z + n;
+
+	float tend = V_IDX(tout, nout);
+	float h = (tend - t0) / N;
+	float t = t0;
+	uint k = 1;
+	int status = 0;
+
+	/* outputs at t0 */
+	for (; k <= nout && V_IDX(tout, k) <= t0; k++) {
+		m_copy(n, 1, n, M_COL(Yout, n, k), n, y);
+	}
+
+	/* k1 = f(t,y) */
+	f(t, y, k1, ctx);
+
+	for (uint i = 1; i <= N && k <= nout; i++) {
+		/* recompute the step to avoid drifting away from tend */
+		float t1 = (i == N ? tend : t0 + i * h);
+		float hi = t1 - t;
+
+		m_copy(n, 1, n, y0, n, y);
+		rk4_step(n, f, ctx, t, y, hi, k1, k2, k3, k4, z);
+
+		/* k2 = f(t1, y(t1)), the next k1 */
+		f(t1, y, k2, ctx);
+
+		/* cubic Hermite interpolation inside [t, t1] */
+		for (; k <= nout && V_IDX(tout, k) <= t1; k++) {
+			float s = (V_IDX(tout, k) - t) / hi;
+			float h00 = (1.0f + 2.0f * s) * (1.0f - s) * (1.0f - s);
+			float h10 = s * (1.0f - s) * (1.0f - s);
+			float h01 = s * s * (3.0f - 2.0f * s);
+			float h11 = s * s * (s - 1.0f);
+			for (uint j = 1; j <= n; j++) {
+				M_IDX(Yout, n, j, k) =
+					h00 * V_IDX(y0, j)
+					+ h10 * hi * V_IDX(k1, j)
+					+ h01 * V_IDX(y, j)
+					+ h11 * hi * V_IDX(k2, j);
+			}
+		}
+
+		if (g) {
+			status = ode_guard_check(n, g, y);
+			if (status) {
+				break;
+			}
+			if (g->ss_tol > 0.0f && v_norm(n, k2) <= g->ss_tol) {
+				ode_guard_fill(n, y, k, nout, Yout);
+				status = 1;
+				break;
+			}
+		}
+
+		/* swap k1 and k2 */
+		float *tmp = k1;
+		k1 = k2;
+		k2 = tmp;
+		t = t1;
+	}
+
+	return status;
+}
+
+/**
+ * rk4_guarded() - rk4_sweep(), with early termination
+ * @n, @f, @ctx:               See rk4_sweep().
+ * @g:                         Conditions for stopping early, or NULL.
+ * @t0, @y, @nout, @tout:      See rk4_sweep().
+ * @Yout, @N:                  See rk4_sweep().
+ *
+ * After every step, the state is checked against g: the integration stops
+ * as soon as it is not finite or leaves the bounds of g, and once
+ * ||f(t,y)|| <= g->ss_tol, the remaining outputs are set to y without
+ * integrating further. On failure, y holds the last state computed, and
+ * the outputs beyond it are left untouched.
+ *
+ * Return: 0 on success, 1 if a steady state was reached, -2 if the state
+ * stopped being finite, -3 if it left the bounds.
+ */
+int rk4_guarded(uint n, void (*f)(float, float *, float *, void *),
+                const struct ode_guard *g, void *ctx,
+                float t0, float *y, uint nout, const float *tout,
+                float *Yout, uint N)
+{
+	float *work = create_vector(RK4_WORK_SIZE(n));
+	int status = rk4_guarded_(n, f, g, ctx, t0, y, nout, tout, Yout, N,
+	                          work);
+	free(work);
+	return status;
+}
+
+/**
+ * rk4_sweep_work() - rk4_sweep(), with a workspace supplied by the caller
+ * @n, @f, @ctx, @t0, @y:      See rk4_sweep().
+ * @nout, @tout, @Yout, @N:    See rk4_sweep().
+ * @work:                      Vector of size RK4_WORK_SIZE(n).
+ *
+ * Performs no heap allocation, see rk4_work().
+ */
+void rk4_sweep_work(uint n, void (*f)(float, float *, float *, void *),
+                    void *ctx, float t0, float *y, uint nout,
+                    const float *tout, float *Yout, uint N, float *work)
+{
+	rk4_guarded_(n, f, NULL, ctx, t0, y, nout, tout, Yout, N, work);
+}
+
+/* Dormand-Prince 5(4) coefficients */
+static const float dp_c[7] = {
+	0.0f, 1.0f / 5.0f, 3.0f / 10.0f, 4.0f / 5.0f, 8.0f / 9.0f, 1.0f, 1.0f
+};
+static const float dp_a[7][6] = {
+	{ 0.0f },
+	{ 1.0f / 5.0f },
+	{ 3.0f / 40.0f, 9.0f / 40.0f },
+	{ 44.0f / 45.0f, -56.0f / 15.0f, 32.0f / 9.0f },
+	{ 19372.0f / 6561.0f, -25360.0f / 2187.0f, 64448.0f / 6561.0f,
+	  -212.0f / 729.0f },
+	{ 9017.0f / 3168.0f, -355.0f / 33.0f, 46732.0f / 5247.0f,
+	  49.0f / 176.0f, -5103.0f / 18656.0f },
+	{ 35.0f / 384.0f, 0.0f, 500.0f / 1113.0f, 125.0f / 192.0f,
+	  -2187.0f / 6784.0f, 11.0f / 84.0f }
+};
+/* difference between the fifth and fourth order solutions */
+static const float dp_e[7] = {
+	71.0f / 57600.0f, 0.0f, -71.0f / 16695.0f, 71.0f / 1920.0f,
+	-17253.0f / 339200.0f, 22.0f / 525.0f, -1.0f / 40.0f
+};
+/* fourth order continuous extension */
+static const float dp_d[7] = {
+	-12715105075.0f / 11282082432.0f, 0.0f,
+	87487479700.0f / 32700410799.0f, -10690763975.0f / 1880347072.0f,
+	701980252875.0f / 199316789632.0f, -1453857185.0f / 822651844.0f,
+	69997945.0f / 29380423.0f
+};
+
+/* Maximum number of steps taken by dopri5() in a single call. */
+#define DOPRI5_MAXSTEPS 100000
+
+/*
+ * A warm started integrator does not let its step grow past
+ * ODE_WARM_GROWTH times the last step that the previous solve accepted in
+ * the same output interval.
+ */
+#define ODE_WARM_GROWTH 2.0f
+
+/*
+ * ode_warm_cap() - step size h, capped by the warm start data of the
+ *                  output interval o
+ * @h_acc:          The step that was just accepted: h is never capped
+ *                  below it.
+ */
+static float ode_warm_cap(const struct ode_warm *warm, uint nout, uint o,
+                          float h, float h_acc)
+{
+	if (!warm || !warm->valid || !warm->h || o > nout) {
+		return h;
+	}
+	return fminf(h, fmaxf(h_acc, ODE_WARM_GROWTH * V_IDX(warm->h, o)));
+}
+
+/*
+ * wrms_norm() - weighted root-mean-square norm used for error control
+ *
+ * Each component of v is scaled by atol + rtol * max(|a|, |b|).
+ */
+static float wrms_norm(uint n, float *v, float *a, float *b,
+                       float rtol, float atol)
+{
+	float sum = 0.0f;
+	for (uint i = 1; i <= n; i++) {
+		float ya = fabsf(V_IDX(a, i));
+		float yb = fabsf(V_IDX(b, i));
+		float sc = atol + rtol * (ya > yb ? ya : yb);
+		float r = V_IDX(v, i) / sc;
+		sum += r * r;
+	}
+	return sqrtf(sum / n);
+}
+
+/**
+ * dopri5() - adaptive Runge-Kutta method of Dormand and Prince
+ * @n:            A positive integer.
+ * @f:            f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @ctx:          User data passed to f.
+ * @t0:           Initial time.
+ * @y:            Vector of size n. Input: y(t0). Output: y(tout(nout)),
+ *                or the last accepted state on failure.
+ * @nout:         Number of output times.
+ * @tout:         Output times, sorted, with t0 <= tout(1) and
+ *                t0 < tout(nout).
+ * @Yout:         n-by-nout matrix. Output: y(tout(k)) in column k.
+ * @rtol:         Relative tolerance.
+ * @atol:         Absolute tolerance.
+ * @stats:        If not NULL, receives the step statistics.
+ *
+ * Fifth order method with an embedded fourth order error estimate. The
+ * step size is chosen so that the local error, measured in the weighted
+ * RMS norm with weights atol + rtol |y|, stays below one. The first step
+ * is estimated from the derivatives at t0. Outputs inside a step use the
+ * fourth order continuous extension of the method. The last stage is
+ * reused as the first stage of the next step, so that an accepted step
+ * costs six evaluations of f.
+ *
+ * Return: 0 on success, -1 if the step size underflowed or the step
+ * limit was reached, -2 if the solution stopped being finite. Outputs
+ * beyond the point of failure are left untouched.
+ */
+int dopri5(uint n, void (*f)(float, float *, float *, void *), void *ctx,
+           float t0, float *y, uint nout, const float *tout, float *Yout,
+           float rtol, float atol, struct ode_stats *stats)
+{
+	return dopri5_warm(n, f, ctx, t0, y, nout, tout, Yout, rtol, atol,
+	                   NULL, stats);
+}
+
+/**
+ * dopri5_warm() - dopri5(), warm started from a previous solve
+ * @n, @f, @ctx, @t0, @y, @nout, @tout, @Yout, @rtol, @atol:
+ *                See dopri5().
+ * @warm:         State left by the previous solve of a nearby problem with
+ *                the same output times, or NULL. Updated on success, and
+ *                invalidated on failure.
+ * @stats:        See dopri5().
+ *
+ * When @warm is valid, the first step is the one the previous solve
+ * accepted, instead of being estimated at the cost of an evaluation of f,
+ * and in each output interval the step is not allowed to grow far beyond
+ * the last one accepted there, which avoids most of the rejected steps
+ * of a cold start.
+ *
+ * Return: see dopri5().
+ */
+int dopri5_warm(uint n, void (*f)(float, float *, float *, void *),
+                void *ctx, float t0, float *y, uint nout, const float *tout,
+                float *Yout, float rtol, float atol, struct ode_warm *warm,
+                struct ode_stats *stats)
+{
+	assert(nout > 0);
+	assert(t0 <= V_IDX(tout, 1));
+	assert(V_IDX(tout, 1) <= V_IDX(tout, nout));
+	assert(t0 < V_IDX(tout, nout));
+	assert(rtol > 0.0f || atol > 0.0f);
+
+	/* allocate memory */
+	float *k = create_vector(7 * n);
+	float *y1 = create_vector(n);
+	float *z = create_vector(n);
+	float *err = create_vector(n);
+
+	struct ode_stats st = { 0 };
+	float tend = V_IDX(tout, nout);
+	float t = t0;
+	uint o = 1;
+	int status = 0;
+
+	/* outputs at t0 */
+	for (; o <= nout && V_IDX(tout, o) <= t0; o++) {
+		m_copy(n, 1, n, M_COL(Yout, n, o), n, y);
+	}
+
+	/* k1 = f(t,y) */
+	float *k1 = M_COL(k, n, 1);
+	float *k7 = M_COL(k, n, 7);
+	f(t, y, k1, ctx);
+	st.nfev++;
+
+	float h;
+	if (warm && warm->valid) {
+		h = fminf(warm->h0, tend - t0);
+	} else {
+		/* initial step, following Hairer, Norsett and Wanner */
+		float d0 = wrms_norm(n, y, y, y, rtol, atol);
+		float d1 = wrms_norm(n, k1, y, y, rtol, atol);
+		h = (d0 < 1e-5f || d1 < 1e-5f ? 1e-6f : 0.01f * d0 / d1);
+		h = fminf(h, tend - t0);
+		for (uint i = 1; i <= n; i++) {
+			V_IDX(z, i) = V_IDX(y, i) + h * V_IDX(k1, i);
+		}
+		f(t + h, z, err, ctx);
+		st.nfev++;
+		for (uint i = 1; i <= n; i++) {
+			V_IDX(err, i) = (V_IDX(err, i) - V_IDX(k1, i)) / h;
+		}
+		float d2 = wrms_norm(n, err, y, y, rtol, atol);
+		float dm = fmaxf(d1, d2);
+		float h1 = (dm <= 1e-15f ? fmaxf(1e-6f, h * 1e-3f)
+		                         : powf(0.01f / dm, 0.2f));
+		h = fminf(fminf(100.0f * h, h1), tend - t0);
+	}
+
+	float h0 = h;
+	int rejected = 0;
+	float eold = 1e-4f;
+	while (o <= nout) {
+		if (st.nsteps + st.nreject >= DOPRI5_MAXSTEPS
+		    || t + h == t) {
+			status = -1;
+			break;
+		}
+		int last = (t + h >= tend);
+		if (last) {
+			h = tend - t;
+		}
+
+		/* stages 2 to 7 */
+		for (uint s = 2; s <= 7; s++) {
+			for (uint i = 1; i <= n; i++) {
+				float acc = 0.0f;
+				for (uint r = 1; r < s; r++) {
+					acc += dp_a[s - 1][r - 1]
+					       * M_IDX(k, n, i, r);
+				}
+				V_IDX(z, i) = V_IDX(y, i) + h * acc;
+			}
+			f(t + dp_c[s - 1] * h, z, M_COL(k, n, s), ctx);
+		}
+		st.nfev += 6;
+		/* the last stage was evaluated at the new solution */
+		m_copy(n, 1, n, y1, n, z);
+
+		/* error estimate */
+		for (uint i = 1; i <= n; i++) {
+			float acc = 0.0f;
+			for (uint r = 1; r <= 7; r++) {
+				acc += dp_e[r - 1] * M_IDX(k, n, i, r);
+			}
+			V_IDX(err, i) = h * acc;
+		}
+		float e = wrms_norm(n, err, y, y1, rtol, atol);
+		if (!isfinite(e)) {
+			if (!isfinite(v_norm(n, y1)) && h < 1e-6f * (tend - t0)) {
+				status = -2;
+				break;
+			}
+			e = 1e10f;
+		}
+
+		/* step size controller, with Lund's stabilization */
+		float fac = 0.9f * powf(fmaxf(e, 1e-10f), -0.17f)
+		            * powf(eold, 0.04f);
+		if (e > 1.0f) {
+			st.nreject++;
+			rejected = 1;
+			h *= fmaxf(0.2f, fminf(1.0f, fac));
+			continue;
+		}
+		st.nsteps++;
+		float t1 = (last ? tend : t + h);
+		if (st.nsteps == 1) {
+			h0 = h;
+		}
+
+		/* dense output inside [t, t1] */
+		for (; o <= nout && V_IDX(tout, o) <= t1; o++) {
+			if (warm && warm->h) {
+				V_IDX(warm->h, o) = h;
+			}
+			float th = (V_IDX(tout, o) - t) / h;
+			float th1 = 1.0f - th;
+			for (uint i = 1; i <= n; i++) {
+				float y0i = V_IDX(y, i);
+				float dy = V_IDX(y1, i) - y0i;
+				float bspl = h * V_IDX(k1, i) - dy;
+				float r4 = dy - h * V_IDX(k7, i) - bspl;
+				float r5 = 0.0f;
+				for (uint r = 1; r <= 7; r++) {
+					r5 += dp_d[r - 1] * M_IDX(k, n, i, r);
+				}
+				r5 *= h;
+				M_IDX(Yout, n, i, o) =
+					y0i + th * (dy + th1 * (bspl
+					+ th * (r4 + th1 * r5)));
+			}
+		}
+
+		/* accept the step: y <- y1, k1 <- k7 */
+		m_copy(n, 1, n, y, n, y1);
+		m_copy(n, 1, n, k1, n, k7);
+		t = t1;
+
+		float h_acc = h;
+		h *= fminf(rejected ? 1.0f : 5.0f, fmaxf(0.2f, fac));
+		h = ode_warm_cap(warm, nout, o, h, h_acc);
+		eold = fmaxf(e, 1e-4f);
+		rejected = 0;
+	}
+
+	if (warm) {
+		warm->valid = (status == 0);
+		warm->h0 = h0;
+	}
+	if (stats) {
+		*stats = st;
+	}
+
+	/* clean up */
+	free(err);
+	free(z);
+	free(y1);
+	free(k);
+
+	return status;
+}
+
+/*
+ * Dense linear algebra for the implicit methods
+ *
+ * Systems of order at most SMALL_N are padded with the identity to a
+ * SMALL_N-by-SMALL_N matrix and factored by code whose loops have
+ * constant bounds, so that the compiler can unroll them: for such tiny
+ * systems the overhead of a LAPACK call outweighs the arithmetic. Larger
+ * systems go through sgetrf/sgetrs. Buffers passed to lu_factor() must
+ * hold LU_SIZE(n) floats and LU_IPIV(n) pivots.
+ */
+#define SMALL_N 4
+#define LU_SIZE(n) ((n) > SMALL_N ? (n) * (n) : SMALL_N * SMALL_N)
+#define LU_IPIV(n) ((n) > SMALL_N ? (n) : SMALL_N)
+
+static int lu_small_factor(float *A, int *ipiv)
+{
+	for (uint k = 1; k <= SMALL_N; k++) {
+		/* pivot search */
+		uint p = k;
+		for (uint i = k + 1; i <= SMALL_N; i++) {
+			if (fabsf(M_IDX(A, SMALL_N, i, k))
+			    > fabsf(M_IDX(A, SMALL_N, p, k))) {
+				p = i;
+			}
+		}
+		V_IDX(ipiv, k) = p;
+		if (M_IDX(A, SMALL_N, p, k) == 0.0f) {
+			return k;
+		}
+		for (uint j = 1; j <= SMALL_N; j++) {
+			float a = M_IDX(A, SMALL_N, k, j);
+			M_IDX(A, SMALL_N, k, j) = M_IDX(A, SMALL_N, p, j);
+			M_IDX(A, SMALL_N, p, j) = a;
+		}
+
+		/* elimination, keeping the multipliers below the diagonal */
+		for (uint i = k + 1; i <= SMALL_N; i++) {
+			float c = M_IDX(A, SMALL_N, i, k)
+			          / M_IDX(A, SMALL_N, k, k);
+			M_IDX(A, SMALL_N, i, k) = c;
+			for (uint j = k + 1; j <= SMALL_N; j++) {
+				M_IDX(A, SMALL_N, i, j) -=
+					c * M_IDX(A, SMALL_N, k, j);
+			}
+		}
+	}
+	return 0;
+}
+
+static void lu_small_solve(const float *A, const int *ipiv, float *b)
+{
+	/* row swaps */
+	for (uint k = 1; k <= SMALL_N; k++) {
+		uint p = V_IDX(ipiv, k);
+		float a = V_IDX(b, k);
+		V_IDX(b, k) = V_IDX(b, p);
+		V_IDX(b, p) = a;
+	}
+
+	/* forward substitution */
+	for (uint k = 1; k <= SMALL_N; k++) {
+		for (uint i = k + 1; i <= SMALL_N; i++) {
+			V_IDX(b, i) -= M_IDX(A, SMALL_N, i, k) * V_IDX(b, k);
+		}
+	}
+
+	/* back substitution */
+	for (uint i = SMALL_N; i >= 1; i--) {
+		float s = V_IDX(b, i);
+		for (uint j = i + 1; j <= SMALL_N; j++) {
+			s -= M_IDX(A, SMALL_N, i, j) * V_IDX(b, j);
+		}
+		V_IDX(b, i) = s / M_IDX(A, SMALL_N, i, i);
+	}
+}
+
+/**
+ * lu_factor() - LU factorization with partial pivoting
+ * @n:              Order of the matrix.
+ * @D:              Input: n-by-n matrix. Output: its factors, in a
+ *                  format only meaningful to lu_solve(). Must hold
+ *                  LU_SIZE(n) floats.
+ * @ipiv:           Output: pivots. Must hold LU_IPIV(n) integers.
+ *
+ * Return: 0 on success, nonzero if D is singular.
+ */
+static int lu_factor(uint n, float *D, int *ipiv)
+{
+	if (n > SMALL_N) {
+		return LAPACKE_sgetrf(LAPACK_COL_MAJOR, n, n, D, n, ipiv);
+	}
+
+	/* pad with the identity, back to front since D is overwritten */
+	for (uint j = SMALL_N; j >= 1; j--) {
+		for (uint i = SMALL_N; i >= 1; i--) {
+			M_IDX(D, SMALL_N, i, j) = (i <= n && j <= n
+			                           ? M_IDX(D, n, i, j)
+			                           : (float)(i == j));
+		}
+	}
+	return lu_small_factor(D, ipiv);
+}
+
+/**
+ * lu_solve() - solve a linear system factored by lu_factor()
+ * @n:             Order of the matrix.
+ * @D, @ipiv:      Output of lu_factor().
+ * @z:             Vector of size n. Input: right-hand side. Output:
+ *                 the solution.
+ */
+static void lu_solve(uint n, const float *D, const int *ipiv, float *z)
+{
+	if (n > SMALL_N) {
+		LAPACKE_sgetrs(LAPACK_COL_MAJOR, 'N', n, 1, D, n, ipiv, z, n);
+		return;
+	}
+
+	float b[SMALL_N] = { 0.0f };
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(b, i) = V_IDX(z, i);
+	}
+	lu_small_solve(D, ipiv, b);
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(z, i) = V_IDX(b, i);
+	}
+}
+
+/*
+ * Banded and sparse linear algebra for bdf1_structured()
+ *
+ * Banded matrices are factored by sgbtrf/sgbtrs in O(n ml (ml + mu))
+ * operations instead of O(n^3). Sparse patterns are renumbered by the
+ * reverse Cuthill-McKee ordering, which reduces their bandwidth, and then
+ * handled as banded with the bandwidth of the renumbered pattern: the
+ * fill-in of the LU factors stays inside that band. RCM does not bound
+ * the bandwidth in general. It stays bounded for chains of unknowns, such
+ * as method-of-lines models in one space dimension, which then scale
+ * linearly in n whatever their numbering, but grows as sqrt(n) on a
+ * two-dimensional grid.
+ */
+
+/*
+ * rcm_order() - reverse Cuthill-McKee ordering of a sparsity pattern
+ * @n:            Order of the matrix.
+ * @ia, @ja:      Pattern, see struct jac_structure.
+ * @perm:         Output, vector of size n: the unknown numbered k in the
+ *                new ordering is perm(k).
+ *
+ * The pattern is symmetrized. Each connected component is numbered by a
+ * breadth-first search from its lowest numbered unknown, which visits the
+ * neighbours of each unknown by increasing degree.
+ */
+static void rcm_order(uint n, const int *ia, const int *ja, uint *perm)
+{
+	uint nnz = V_IDX(ia, n + 1) - 1;
+	uint *ptr = (uint *)calloc(n + 1, sizeof(uint));
+	uint *next = (uint *)malloc(sizeof(uint) * n);
+	uint *adj = (uint *)malloc(sizeof(uint) * (2 * nnz + 1));
+	uint *seen = (uint *)calloc(n, sizeof(uint));
+	assert(ptr && next && adj && seen);
+
+	/* adjacency lists of the symmetrized pattern, without the diagonal:
+	 * the neighbours of i are adj(ptr(i)..ptr(i + 1) - 1) */
+	for (uint j = 1; j <= n; j++) {
+		for (int k = V_IDX(ia, j); k < V_IDX(ia, j + 1); k++) {
+			uint i = V_IDX(ja, k);
+			if (i != j) {
+				V_IDX(ptr, i + 1)++;
+				V_IDX(ptr, j + 1)++;
+			}
+		}
+	}
+	V_IDX(ptr, 1) = 1;
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(ptr, i + 1) += V_IDX(ptr, i);
+		V_IDX(next, i) = V_IDX(ptr, i);
+	}
+	for (uint j = 1; j <= n; j++) {
+		for (int k = V_IDX(ia, j); k < V_IDX(ia, j + 1); k++) {
+			uint i = V_IDX(ja, k);
+			if (i != j) {
+				V_IDX(adj, V_IDX(next, i)++) = j;
+				V_IDX(adj, V_IDX(next, j)++) = i;
+			}
+		}
+	}
+
+	/* the cursors are done with, keep the degrees instead */
+	uint *deg = next;
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(deg, i) = V_IDX(ptr, i + 1) - V_IDX(ptr, i);
+	}
+
+	/* Cuthill-McKee, perm doubling as the queue */
+	uint head = 0;
+	uint tail = 0;
+	uint root = 1;
+	while (tail < n) {
+		while (V_IDX(seen, root)) {
+			root++;
+		}
+		V_IDX(seen, root) = 1;
+		V_IDX(perm, ++tail) = root;
+
+		while (head < tail) {
+			uint v = V_IDX(perm, ++head);
+			uint last = V_IDX(ptr, v + 1);
+			uint first = tail + 1;
+			for (uint k = V_IDX(ptr, v); k < last; k++) {
+				uint w = V_IDX(adj, k);
+				if (!V_IDX(seen, w)) {
+					V_IDX(seen, w) = 1;
+					V_IDX(perm, ++tail) = w;
+				}
+			}
+
+			/* sort the new unknowns by degree */
+			for (uint k = first + 1; k <= tail; k++) {
+				uint w = V_IDX(perm, k);
+				uint l = k;
+				for (; l > first; l--) {
+					uint u = V_IDX(perm, l - 1);
+					if (V_IDX(deg, u) <= V_IDX(deg, w)) {
+						break;
+					}
+					V_IDX(perm, l) = u;
+				}
+				V_IDX(perm, l) = w;
+			}
+		}
+	}
+
+	/* reverse */
+	for (uint k = 1; k <= n / 2; k++) {
+		uint w = V_IDX(perm, k);
+		V_IDX(perm, k) = V_IDX(perm, n + 1 - k);
+		V_IDX(perm, n + 1 - k) = w;
+	}
+
+	free(seen);
+	free(adj);
+	free(next);
+	free(ptr);
+}
+
+/*
+ * Finite-difference Jacobians
+ *
+ * When df is NULL, the Jacobian is approximated by forward differences of
+ * f. Columns whose nonzeros lie in disjoint rows are perturbed together
+ * (Curtis, Powell and Reid, 1974), so that a Jacobian costs one
+ * evaluation of f per group of columns rather than one per column. The
+ * groups are found once, by a greedy coloring of the columns in their
+ * natural order, which for a banded matrix gives ml + mu + 1 groups.
+ */
+
+/**
+ * struct jac_fd - finite-difference approximation of a Jacobian
+ * @kind:           Storage of the approximation, see enum jac_kind.
+ * @ml, @mu:        Bandwidths (JAC_BANDED).
+ * @ia, @ja:        Sparsity pattern, as in struct jac_structure, or NULL
+ *                  if J is dense.
+ * @ngroups:        Number of groups of columns.
+ * @cols:           Vector of size n, the columns sorted by group.
+ * @gptr:           Vector of size ngroups + 1: group g is made of the
+ *                  columns cols(gptr(g)) to cols(gptr(g + 1) - 1).
+ * @fx:             f(t,x), a vector of size n.
+ * @xe:             Scratch vector of size n, for the perturbed x.
+ * @fe:             Scratch vector of size n, for f at xe.
+ * @dx:             Vector of size n, the perturbation of each column.
+ */
+struct jac_fd {
+	enum jac_kind kind;
+	uint ml;
+	uint mu;
+	int *ia;
+	int *ja;
+	uint ngroups;
+	uint *cols;
+	uint *gptr;
+	float *fx;
+	float *xe;
+	float *fe;
+	float *dx;
+};
+
+/*
+ * jac_fd_color() - group the columns of the pattern of fd
+ * @color:          Output, vector of size n: the group of each column.
+ *
+ * Return: the number of groups.
+ */
+static uint jac_fd_color(uint n, const struct jac_fd *fd, uint *color)
+{
+	const int *ia = fd->ia;
+	const int *ja = fd->ja;
+	uint nnz = V_IDX(ia, n + 1) - 1;
+
+	/* the transposed pattern: the columns of each row */
+	uint *rptr = (uint *)calloc(n + 1, sizeof(uint));
+	uint *rcols = (uint *)malloc(sizeof(uint) * (nnz ? nnz : 1));
+	uint *mark = (uint *)calloc(n + 1, sizeof(uint));
+	assert(rptr && rcols && mark);
+
+	for (uint k = 1; k <= nnz; k++) {
+		V_IDX(rptr, V_IDX(ja, k))++;
+	}
+	for (uint i = 2; i <= n; i++) {
+		V_IDX(rptr, i) += V_IDX(rptr, i - 1);
+	}
+	V_IDX(rptr, n + 1) = nnz;
+	for (uint j = n; j >= 1; j--) {
+		for (int k = V_IDX(ia, j); k < V_IDX(ia, j + 1); k++) {
+			V_IDX(rcols, V_IDX(rptr, V_IDX(ja, k))--) = j;
+		}
+	}
+	/* rptr(i) + 1 .. rptr(i + 1) are the columns of row i */
+
+	uint ngroups = 0;
+	for (uint j = 1; j <= n; j++) {
+		V_IDX(color, j) = 0;
+	}
+	for (uint j = 1; j <= n; j++) {
+		/* the groups of the columns sharing a row with j */
+		for (int k = V_IDX(ia, j); k < V_IDX(ia, j + 1); k++) {
+			uint i = V_IDX(ja, k);
+			for (uint l = V_IDX(rptr, i) + 1;
+			     l <= V_IDX(rptr, i + 1); l++) {
+				uint c = V_IDX(color, V_IDX(rcols, l));
+				if (c) {
+					V_IDX(mark, c) = j;
+				}
+			}
+		}
+		uint c = 1;
+		while (V_IDX(mark, c) == j) {
+			c++;
+		}
+		V_IDX(color, j) = c;
+		if (c > ngroups) {
+			ngroups = c;
+		}
+	}
+
+	free(mark);
+	free(rcols);
+	free(rptr);
+
+	return ngroups;
+}
+
+/*
+ * jac_fd_init() - prepare to approximate a Jacobian of structure js
+ *
+ * With JAC_DENSE, js->ia and js->ja may give the pattern of J, or be
+ * NULL, in which case every column is a group of its own.
+ */
+static void jac_fd_init(struct jac_fd *fd, uint n,
+                        const struct jac_structure *js)
+{
+	enum jac_kind kind = (js ? js->kind : JAC_DENSE);
+
+	assert(kind != JAC_MATRIX_FREE);
+	memset(fd, 0, sizeof(struct jac_fd));
+	fd->kind = kind;
+	fd->fx = create_vector(n);
+	fd->xe = create_vector(n);
+	fd->fe = create_vector(n);
+	fd->dx = create_vector(n);
+	fd->cols = (uint *)malloc(sizeof(uint) * n);
+	assert(fd->cols);
+
+	if (kind == JAC_BANDED) {
+		fd->ml = js->ml;
+		fd->mu = js->mu;
+		fd->ia = (int *)malloc(sizeof(int) * (n + 1));
+		fd->ja = (int *)malloc(sizeof(int)
+		                       * n * (js->ml + js->mu + 1));
+		assert(fd->ia && fd->ja);
+		V_IDX(fd->ia, 1) = 1;
+		for (uint j = 1; j <= n; j++) {
+			uint i0 = (j > js->mu ? j - js->mu : 1);
+			uint i1 = (j + js->ml < n ? j + js->ml : n);
+			int k = V_IDX(fd->ia, j);
+			for (uint i = i0; i <= i1; i++) {
+				V_IDX(fd->ja, k++) = i;
+			}
+			V_IDX(fd->ia, j + 1) = k;
+		}
+	} else if (js && js->ia) {
+		uint nnz = V_IDX(js->ia, n + 1) - 1;
+		assert(V_IDX(js->ia, 1) == 1);
+		fd->ia = (int *)malloc(sizeof(int) * (n + 1));
+		fd->ja = (int *)malloc(sizeof(int) * (nnz ? nnz : 1));
+		assert(fd->ia && fd->ja);
+		memcpy(fd->ia, js->ia, sizeof(int) * (n + 1));
+		memcpy(fd->ja, js->ja, sizeof(int) * nnz);
+	} else {
+		assert(kind == JAC_DENSE);
+	}
+
+	/* sort the columns by group */
+	uint *color = (uint *)malloc(sizeof(uint) * n);
+	assert(color);
+	if (fd->ia) {
+		fd->ngroups = jac_fd_color(n, fd, color);
+	} else {
+		fd->ngroups = n;
+		for (uint j = 1; j <= n; j++) {
+			V_IDX(color, j) = j;
+		}
+	}
+	fd->gptr = (uint *)calloc(fd->ngroups + 2, sizeof(uint));
+	assert(fd->gptr);
+	for (uint j = 1; j <= n; j++) {
+		V_IDX(fd->gptr, V_IDX(color, j) + 1)++;
+	}
+	V_IDX(fd->gptr, 1) = 1;
+	for (uint g = 1; g <= fd->ngroups; g++) {
+		V_IDX(fd->gptr, g + 1) += V_IDX(fd->gptr, g);
+	}
+	for (uint j = 1; j <= n; j++) {
+		V_IDX(fd->cols, V_IDX(fd->gptr, V_IDX(color, j))++) = j;
+	}
+	for (uint g = fd->ngroups; g >= 1; g--) {
+		V_IDX(fd->gptr, g + 1) = V_IDX(fd->gptr, g);
+	}
+	V_IDX(fd->gptr, 1) = 1;
+	free(color);
+}
+
+static void jac_fd_free(struct jac_fd *fd)
+{
+	free(fd->gptr);
+	free(fd->cols);
+	free(fd->ja);
+	free(fd->ia);
+	free(fd->dx);
+	free(fd->fe);
+	free(fd->xe);
+	free(fd->fx);
+}
+
+/*
+ * jac_fd_eval() - approximate Df(t,x) by forward differences
+ * @fx:             f(t,x), if the caller has it, or NULL.
+ * @J:              Output, in the storage of fd->kind, as written by df.
+ *
+ * Return: the number of evaluations of f.
+ */
+static uint jac_fd_eval(uint n, struct jac_fd *fd,
+                        void (*f)(float, float *, float *, void *),
+                        void *ctx, float t, float *x, const float *fx,
+                        float *J)
+{
+	uint ldj = fd->ml + fd->mu + 1;
+	uint mu1 = fd->mu + 1;
+
+	if (fd->kind == JAC_DENSE && fd->ia) {
+		memset(J, 0, sizeof(float) * n * n);
+	}
+
+	if (fx) {
+		memcpy(fd->fx, fx, sizeof(float) * n);
+	} else {
+		f(t, x, fd->fx, ctx);
+	}
+	m_copy(n, 1, n, fd->xe, n, x);
+	for (uint g = 1; g <= fd->ngroups; g++) {
+		uint k0 = V_IDX(fd->gptr, g);
+		uint k1 = V_IDX(fd->gptr, g + 1);
+
+		for (uint k = k0; k < k1; k++) {
+			uint j = V_IDX(fd->cols, k);
+			float xj = V_IDX(x, j);
+			float e = sqrtf(FLT_EPSILON) * fmaxf(fabsf(xj), 1.0f);
+			V_IDX(fd->xe, j) = xj + e;
+			V_IDX(fd->dx, j) = V_IDX(fd->xe, j) - xj;
+		}
+		f(t, fd->xe, fd->fe, ctx);
+		m_sub(n, 1, n, fd->fe, n, fd->fx);
+
+		for (uint k = k0; k < k1; k++) {
+			uint j = V_IDX(fd->cols, k);
+			float e = V_IDX(fd->dx, j);
+			V_IDX(fd->xe, j) = V_IDX(x, j);
+			if (!fd->ia) {
+				for (uint i = 1; i <= n; i++) {
+					M_IDX(J, n, i, j) = V_IDX(fd->fe, i) / e;
+				}
+				continue;
+			}
+			for (int l = V_IDX(fd->ia, j); l < V_IDX(fd->ia, j + 1);
+			     l++) {
+				uint i = V_IDX(fd->ja, l);
+				float d = V_IDX(fd->fe, i) / e;
+				switch (fd->kind) {
+				case JAC_DENSE:
+					M_IDX(J, n, i, j) = d;
+					break;
+				case JAC_BANDED:
+					M_IDX(J, ldj, mu1 + i - j, j) = d;
+					break;
+				default:
+					V_IDX(J, l) = d;
+					break;
+				}
+			}
+		}
+	}
+
+	return fd->ngroups + (fx ? 0 : 1);
+}
+
+/*
+ * Matrix-free Newton-Krylov
+ *
+ * With JAC_MATRIX_FREE, the Newton systems (1 - hJ) u = b are solved by
+ * restarted GMRES, preconditioned on the right. Products Jv are
+ * approximated by the directional difference (f(t, x + ev) - f(t,x)) / e,
+ * so that neither J nor 1 - hJ is ever formed. GMRES stops once it has
+ * reduced the residual by JFNK_ETA, which is enough for the Newton
+ * iteration to converge linearly at that rate.
+ */
+#define JFNK_KRYLOV 20
+#define JFNK_RESTARTS 10
+#define JFNK_ETA 1e-3f
+
+/**
+ * struct jac_solver - linear solver for 1 - hJ, for a Jacobian structure
+ * @js:             Structure of J, or NULL if J is dense.
+ * @kl:             Lower bandwidth of the factored matrix.
+ * @ku:             Upper bandwidth of the factored matrix.
+ * @ldab:           Leading dimension of D, 2 kl + ku + 1 (LAPACK band
+ *                  storage, with room for the fill-in).
+ * @J:              J as written by df (JAC_BANDED, JAC_SPARSE).
+ * @D:              Factors. For JAC_DENSE, see lu_factor().
+ * @ipiv:           Pivots.
+ * @perm:           New ordering of the unknowns, see rcm_order()
+ *                  (JAC_SPARSE).
+ * @iperm:          Its inverse (JAC_SPARSE).
+ * @w:              Scratch vector of size n (JAC_SPARSE,
+ *                  JAC_MATRIX_FREE).
+ * @m:              Dimension of the Krylov subspaces (JAC_MATRIX_FREE).
+ * @t, @x, @h:      Point of the linearization (JAC_MATRIX_FREE).
+ * @xnorm:          ||x||.
+ * @fx:             f(t,x), a vector of size n.
+ * @xe:             Scratch vector of size n, for x + ev.
+ * @u:              Scratch vector of size n, for the solution.
+ * @V:              n-by-(m + 1) matrix, the Arnoldi basis.
+ * @H:              (m + 1)-by-m matrix, the Hessenberg matrix, reduced
+ *                  to triangular form by Givens rotations.
+ * @g:              Vector of size m + 1, the rotated right-hand side.
+ * @cs, @sn:        Vectors of size m, the rotations.
+ * @fd:             Finite differences, if df is NULL.
+ */
+struct jac_solver {
+	const struct jac_structure *js;
+	uint kl;
+	uint ku;
+	uint ldab;
+	float *J;
+	float *D;
+	int *ipiv;
+	uint *perm;
+	uint *iperm;
+	float *w;
+	uint m;
+	float t;
+	float *x;
+	float h;
+	float xnorm;
+	float *fx;
+	float *xe;
+	float *u;
+	float *V;
+	float *H;
+	float *g;
+	float *cs;
+	float *sn;
+	struct jac_fd *fd;
+};
+
+static void jac_solver_init(struct jac_solver *s, uint n,
+                            const struct jac_structure *js,
+                            void (*df)(float, float *, float *, void *))
+{
+	enum jac_kind kind = (js ? js->kind : JAC_DENSE);
+
+	memset(s, 0, sizeof(struct jac_solver));
+	s->js = js;
+
+	if (!df && kind != JAC_MATRIX_FREE) {
+		s->fd = (struct jac_fd *)malloc(sizeof(struct jac_fd));
+		assert(s->fd);
+		jac_fd_init(s->fd, n, js);
+	}
+
+	switch (kind) {
+	case JAC_DENSE:
+		s->D = create_vector(LU_SIZE(n));
+		s->ipiv = (int *)malloc(sizeof(int) * LU_IPIV(n));
+		assert(s->ipiv);
+		return;
+	case JAC_BANDED:
+		assert(js->ml < n && js->mu < n);
+		s->kl = js->ml;
+		s->ku = js->mu;
+		s->J = create_matrix(js->ml + js->mu + 1, n);
+		break;
+	case JAC_SPARSE:
+		assert(V_IDX(js->ia, 1) == 1);
+		s->J = create_vector(V_IDX(js->ia, n + 1) - 1);
+		s->w = create_vector(n);
+		s->perm = (uint *)malloc(sizeof(uint) * n);
+		s->iperm = (uint *)malloc(sizeof(uint) * n);
+		assert(s->perm && s->iperm);
+
+		rcm_order(n, js->ia, js->ja, s->perm);
+		for (uint k = 1; k <= n; k++) {
+			V_IDX(s->iperm, V_IDX(s->perm, k)) = k;
+		}
+
+		/* bandwidths in the new ordering */
+		for (uint j = 1; j <= n; j++) {
+			uint jj = V_IDX(s->iperm, j);
+			for (int k = V_IDX(js->ia, j); k < V_IDX(js->ia, j + 1);
+			     k++) {
+				uint ii = V_IDX(s->iperm, V_IDX(js->ja, k));
+				if (ii > jj && ii - jj > s->kl) {
+					s->kl = ii - jj;
+				}
+				if (jj > ii && jj - ii > s->ku) {
+					s->ku = jj - ii;
+				}
+			}
+		}
+		break;
+	case JAC_MATRIX_FREE:
+		s->m = (js->krylov ? js->krylov : JFNK_KRYLOV);
+		s->m = (n < s->m ? n : s->m);
+		s->w = create_vector(n);
+		s->fx = create_vector(n);
+		s->xe = create_vector(n);
+		s->u = create_vector(n);
+		s->V = create_matrix(n, s->m + 1);
+		s->H = create_matrix(s->m + 1, s->m);
+		s->g = create_vector(s->m + 1);
+		s->cs = create_vector(s->m);
+		s->sn = create_vector(s->m);
+		return;
+	}
+
+	s->ldab = 2 * s->kl + s->ku + 1;
+	s->D = create_matrix(s->ldab, n);
+	s->ipiv = (int *)malloc(sizeof(int) * n);
+	assert(s->ipiv);
+}
+
+/*
+ * jac_solver_dense() - dense solver on buffers of the caller
+ * @D:                  Vector of size LU_SIZE(n).
+ * @ipiv:               Vector of size LU_IPIV(n).
+ *
+ * Unlike jac_solver_init(), allocates nothing: the Jacobian must be given
+ * by df, and the solver must not be passed to jac_solver_free().
+ */
+static void jac_solver_dense(struct jac_solver *s, float *D, int *ipiv)
+{
+	memset(s, 0, sizeof(struct jac_solver));
+	s->D = D;
+	s->ipiv = ipiv;
+}
+
+static void jac_solver_free(struct jac_solver *s)
+{
+	if (s->fd) {
+		jac_fd_free(s->fd);
+		free(s->fd);
+	}
+	free(s->sn);
+	free(s->cs);
+	free(s->g);
+	free(s->H);
+	free(s->V);
+	free(s->u);
+	free(s->xe);
+	free(s->fx);
+	free(s->w);
+	free(s->iperm);
+	free(s->perm);
+	free(s->ipiv);
+	free(s->D);
+	free(s->J);
+}
+
+/*
+ * jac_solver_setup() - prepare to solve with 1 - hJ(t,x)
+ *
+ * Evaluates the Jacobian at (t,x), or approximates it by differences if
+ * df is NULL, and factors 1 - hJ, or for
+ * JAC_MATRIX_FREE, records the point and sets up the preconditioner.
+ * fx is f(t,x) if the caller has it, which saves an evaluation of f for
+ * the differences, or NULL.
+ *
+ * Return: 0 on success, nonzero if the matrix is singular.
+ */
+static int jac_solver_setup(uint n, struct jac_solver *s,
+                            void (*f)(float, float *, float *, void *),
+                            void (*df)(float, float *, float *, void *),
+                            void *ctx, float t, float *x, const float *fx,
+                            float h)
+{
+	const struct jac_structure *js = s->js;
+
+	if (!js || js->kind == JAC_DENSE) {
+		if (s->fd) {
+			jac_fd_eval(n, s->fd, f, ctx, t, x, fx, s->D);
+		} else {
+			df(t, x, s->D, ctx);
+		}
+		m_scale(n, n, n, s->D, -h);
+		for (uint i = 1; i <= n; i++) {
+			M_IDX(s->D, n, i, i) += 1.0f;
+		}
+		return lu_factor(n, s->D, s->ipiv);
+	}
+
+	if (js->kind == JAC_MATRIX_FREE) {
+		s->t = t;
+		s->x = x;
+		s->h = h;
+		s->xnorm = v_norm(n, x);
+		if (fx) {
+			memcpy(s->fx, fx, sizeof(float) * n);
+		} else {
+			f(t, x, s->fx, ctx);
+		}
+		if (js->psetup) {
+			js->psetup(t, x, h, ctx);
+		}
+		return 0;
+	}
+
+	/* in D, (i,j) is in row d + i - j of column j */
+	uint ldab = s->ldab;
+	uint d = s->kl + s->ku + 1;
+
+	if (s->fd) {
+		jac_fd_eval(n, s->fd, f, ctx, t, x, fx, s->J);
+	} else {
+		df(t, x, s->J, ctx);
+	}
+	memset(s->D, 0, sizeof(float) * ldab * n);
+	if (js->kind == JAC_BANDED) {
+		uint ldj = js->ml + js->mu + 1;
+		for (uint j = 1; j <= n; j++) {
+			uint i0 = (j > js->mu ? j - js->mu : 1);
+			uint i1 = (j + js->ml < n ? j + js->ml : n);
+			for (uint i = i0; i <= i1; i++) {
+				M_IDX(s->D, ldab, d + i - j, j) =
+					-h * M_IDX(s->J, ldj,
+					           js->mu + 1 + i - j, j);
+			}
+		}
+	} else {
+		for (uint j = 1; j <= n; j++) {
+			uint jj = V_IDX(s->iperm, j);
+			for (int k = V_IDX(js->ia, j); k < V_IDX(js->ia, j + 1);
+			     k++) {
+				uint ii = V_IDX(s->iperm, V_IDX(js->ja, k));
+				M_IDX(s->D, ldab, d + ii - jj, jj) -=
+					h * V_IDX(s->J, k);
+			}
+		}
+	}
+	for (uint j = 1; j <= n; j++) {
+		M_IDX(s->D, ldab, d, j) += 1.0f;
+	}
+
+	return LAPACKE_sgbtrf(LAPACK_COL_MAJOR, n, n, s->kl, s->ku,
+	                      s->D, ldab, s->ipiv);
+}
+
+/*
+ * jfnk_product() - Av = (1 - hJ) v, with J approximated along v
+ */
+static void jfnk_product(uint n, struct jac_solver *s,
+                         void (*f)(float, float *, float *, void *),
+                         void *ctx, const float *v, float *Av)
+{
+	float vnorm = v_norm(n, v);
+	if (vnorm == 0.0f) {
+		memset(Av, 0, sizeof(float) * n);
+		return;
+	}
+	float e = sqrtf(FLT_EPSILON) * (1.0f + s->xnorm) / vnorm;
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(s->xe, i) = V_IDX(s->x, i) + e * V_IDX(v, i);
+	}
+	f(s->t, s->xe, Av, ctx);
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(Av, i) = V_IDX(v, i)
+		               - s->h * (V_IDX(Av, i) - V_IDX(s->fx, i)) / e;
+	}
+}
+
+/*
+ * jfnk_apply() - Av = (1 - hJ) P^-1 v, with J approximated along P^-1 v
+ *
+ * v is overwritten by P^-1 v.
+ */
+static void jfnk_apply(uint n, struct jac_solver *s,
+                       void (*f)(float, float *, float *, void *),
+                       void *ctx, float *v, float *Av)
+{
+	const struct jac_structure *js = s->js;
+
+	if (js->psolve) {
+		js->psolve(s->t, s->x, s->h, v, ctx);
+	}
+	jfnk_product(n, s, f, ctx, v, Av);
+}
+
+/*
+ * jfnk_solve() - solve (1 - hJ) u = z by restarted GMRES
+ *
+ * z is overwritten by u.
+ */
+static void jfnk_solve(uint n, struct jac_solver *s,
+                       void (*f)(float, float *, float *, void *),
+                       void *ctx, float *z)
+{
+	uint m = s->m;
+	float *V = s->V;
+	float *H = s->H;
+	float bnorm = v_norm(n, z);
+
+	memset(s->u, 0, sizeof(float) * n);
+	for (uint cycle = 1; cycle <= JFNK_RESTARTS && bnorm > 0.0f;
+	     cycle++) {
+		/* residual z - (1 - hJ)u, with u = 0 in the first cycle: u
+		 * is already preconditioned */
+		float *v1 = M_COL(V, n, 1);
+		if (cycle == 1) {
+			m_copy(n, 1, n, v1, n, z);
+		} else {
+			jfnk_product(n, s, f, ctx, s->u, v1);
+			for (uint i = 1; i <= n; i++) {
+				V_IDX(v1, i) = V_IDX(z, i) - V_IDX(v1, i);
+			}
+		}
+		float beta = v_norm(n, v1);
+		if (beta == 0.0f) {
+			break;
+		}
+		cblas_sscal(n, 1.0f / beta, v1, 1);
+		memset(s->g, 0, sizeof(float) * (m + 1));
+		V_IDX(s->g, 1) = beta;
+
+		/* Arnoldi, with the QR factorization of H kept up to date */
+		uint k = 0;
+		int done = 0;
+		while (k < m && !done) {
+			uint j = ++k;
+			float *vj = M_COL(V, n, j);
+			float *vn = M_COL(V, n, j + 1);
+
+			m_copy(n, 1, n, s->w, n, vj);
+			jfnk_apply(n, s, f, ctx, s->w, vn);
+			for (uint i = 1; i <= j; i++) {
+				float *vi = M_COL(V, n, i);
+				float hij = cblas_sdot(n, vn, 1, vi, 1);
+				M_IDX(H, m + 1, i, j) = hij;
+				cblas_saxpy(n, -hij, vi, 1, vn, 1);
+			}
+			float hn = v_norm(n, vn);
+			if (hn > 0.0f) {
+				cblas_sscal(n, 1.0f / hn, vn, 1);
+			}
+
+			/* previous rotations, then a new one to zero hn */
+			for (uint i = 1; i < j; i++) {
+				float a = M_IDX(H, m + 1, i, j);
+				float b = M_IDX(H, m + 1, i + 1, j);
+				float c = V_IDX(s->cs, i);
+				float sn = V_IDX(s->sn, i);
+				M_IDX(H, m + 1, i, j) = c * a + sn * b;
+				M_IDX(H, m + 1, i + 1, j) = -sn * a + c * b;
+			}
+			float a = M_IDX(H, m + 1, j, j);
+			float r = hypotf(a, hn);
+			V_IDX(s->cs, j) = a / r;
+			V_IDX(s->sn, j) = hn / r;
+			M_IDX(H, m + 1, j, j) = r;
+			V_IDX(s->g, j + 1) = -V_IDX(s->sn, j) * V_IDX(s->g, j);
+			V_IDX(s->g, j) *= V_IDX(s->cs, j);
+
+			float res = fabsf(V_IDX(s->g, j + 1));
+			done = (hn == 0.0f || res <= JFNK_ETA * bnorm);
+		}
+
+		/* u += P^-1 V y, where H y = g */
+		for (uint i = k; i >= 1; i--) {
+			float gi = V_IDX(s->g, i);
+			for (uint l = i + 1; l <= k; l++) {
+				gi -= M_IDX(H, m + 1, i, l) * V_IDX(s->g, l);
+			}
+			V_IDX(s->g, i) = gi / M_IDX(H, m + 1, i, i);
+		}
+		cblas_sgemv(CblasColMajor, CblasNoTrans, n, k, 1.0f, V, n,
+		            s->g, 1, 0.0f, s->w, 1);
+		if (s->js->psolve) {
+			s->js->psolve(s->t, s->x, s->h, s->w, ctx);
+		}
+		m_add(n, 1, n, s->u, n, s->w);
+
+		if (done) {
+			break;
+		}
+	}
+	m_copy(n, 1, n, z, n, s->u);
+}
+
+/*
+ * jac_solver_solve() - solve a linear system prepared by jac_solver_setup()
+ *
+ * z is overwritten by the solution.
+ */
+static void jac_solver_solve(uint n, struct jac_solver *s,
+                             void (*f)(float, float *, float *, void *),
+                             void *ctx, float *z)
+{
+	const struct jac_structure *js = s->js;
+
+	if (!js || js->kind == JAC_DENSE) {
+		lu_solve(n, s->D, s->ipiv, z);
+		return;
+	}
+	if (js->kind == JAC_MATRIX_FREE) {
+		jfnk_solve(n, s, f, ctx, z);
+		return;
+	}
+	if (js->kind == JAC_BANDED) {
+		LAPACKE_sgbtrs(LAPACK_COL_MAJOR, 'N', n, s->kl, s->ku, 1,
+		               s->D, s->ldab, s->ipiv, z, n);
+		return;
+	}
+
+	for (uint k = 1; k <= n; k++) {
+		V_IDX(s->w, k) = V_IDX(z, V_IDX(s->perm, k));
+	}
+	LAPACKE_sgbtrs(LAPACK_COL_MAJOR, 'N', n, s->kl, s->ku, 1,
+	               s->D, s->ldab, s->ipiv, s->w, n);
+	for (uint k = 1; k <= n; k++) {
+		V_IDX(z, V_IDX(s->perm, k)) = V_IDX(s->w, k);
+	}
+}
+
+/**
+ * bdf1_step() - one step of the backwards Euler method
+ * @n, @f, @df, @ctx, @tol:   See bdf1().
+ * @t:                        Time at the end of the step.
+ * @y:                        Vector of size n. Input: y(t - h).
+ *                            Output: y(t).
+ * @h:                        Step size.
+ * @maxit:                    Maximum number of Newton iterations, or zero
+ *                            for BDF1_MAXIT.
+ * @x, @z:                    Scratch vectors of size n.
+ * @ls:                       Linear solver, see jac_solver_setup().
+ *
+ * Return: 0 on success, -1 if Newton's method did not converge within
+ * maxit iterations, in which case y is unchanged, -2 if it produced a
+ * non-finite iterate, which is copied to y, or if 1 - hJ was singular,
+ * in which case y is unchanged.
+ */
+static int bdf1_step(uint n, void (*f)(float, float *, float *, void *),
+                     void (*df)(float, float *, float *, void *),
+                     void *ctx, float t, float *y, float h, float tol,
+                     uint maxit, float *x, float *z, struct jac_solver *ls)
+{
+	/* F(t,x) = x - y - hf(t,x)
+	 * J(t,x) = 1 - hDf(t,x)
+	 *
+	 * Newton iteration:
+	 *   x0 = y
+	 *   x_{i+1} = x_i - inv(J(t,x_i))F(t,x_i)
+	 */
+
+	uint it = 0;
+	float nz;
+
+	if (!maxit) {
+		maxit = BDF1_MAXIT;
+	}
+
+	/* x <- y */
+	m_copy(n, 1, n, x, n, y);
+
+	do {
+		if (it++ == maxit) {
+			return -1;
+		}
+
+		/* factor D = 1 - hJ(t,x), or prepare to solve with it,
+		 * reusing f(t,x) */
+		f(t, x, z, ctx);
+		if (jac_solver_setup(n, ls, f, df, ctx, t, x, z, h)) {
+			return -2;
+		}
+
+		/* z = x - y - hf(t,x) */
+		for (uint i = 1; i <= n; i++) {
+			V_IDX(z, i) = V_IDX(x, i) - V_IDX(y, i)
+			              - h * V_IDX(z, i);
+		}
+
+		/* Replace z with D^(-1)z */
+		jac_solver_solve(n, ls, f, ctx, z);
+
+		/* x -= z */
+		m_sub(n, 1, n, x, n, z);
+		nz = v_norm(n, z);
+	} while (nz > tol);
+
+	/* y <- x */
+	m_copy(n, 1, n, y, n, x);
+	return (isfinite(nz) ? 0 : -2);
+}
+
+/*
+ * bdf1_run() - N steps of bdf1_step() from t0 to t1
+ * @ls:         Linear solver.
+ * @work:       Scratch space of 2n floats.
+ *
+ * If a step fails, y is set to NaN.
+ */
+static void bdf1_run(uint n, void (*f)(float, float *, float *, void *),
+                     void (*df)(float, float *, float *, void *),
+                     struct jac_solver *ls, void *ctx, float t0, float *y,
+                     float t1, uint N, float tol, float *work)
+{
+	assert(t0 < t1);
+
+	float h = (t1 - t0) / (float)N;
+	float t = t0;
+
+	for (uint i = 1; i <= N; i++) {
+		t += h;
+		if (bdf1_step(n, f, df, ctx, t, y, h, tol, 0, work, work + n,
+		              ls)) {
+			for (uint j = 1; j <= n; j++) {
+				V_IDX(y, j) = NAN;
+			}
+			return;
+		}
+	}
+}
+
+/**
+ * bdf1() - Backwards Euler method
+ * @n:          Dimension of the problem.
+ * @f:          f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @df:         The Jacobian of f, called as df(t, y, Df(t,y), ctx), or
+ *              NULL to approximate it by differences of f.
+ * @ctx:        User data passed to f and df.
+ * @t0:         Initial time.
+ * @y:          Vector of size n. Input: y(t0). Output: y(t1).
+ * @t1:         Final time.
+ * @N:          Number of steps.
+ * @tol:        Tolerance internally used in Newton's method.
+ *
+ * Computes y(t1), where y' = f(t,y) and y(t0) = y0. A step whose Newton
+ * iteration does not converge within BDF1_MAXIT iterations, or meets a
+ * singular matrix, ends the integration with y set to NaN.
+ */
+void bdf1(uint n, void (*f)(float, float *, float *, void *),
+	  void (*df)(float, float *, float *, void *), void *ctx,
+          float t0, float *y, float t1, uint N, float tol)
+{
+	bdf1_structured(n, f, df, NULL, ctx, t0, y, t1, N, tol);
+}
+
+/**
+ * bdf1_structured() - Backwards Euler method, with a structured Jacobian
+ * @n:                  Dimension of the problem.
+ * @f:                  f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @df:                 The Jacobian of f, called as df(t, y, Df(t,y), ctx),
+ *                      stored as described by js. Unused, and may be NULL,
+ *                      with JAC_MATRIX_FREE. If NULL otherwise, Df is
+ *                      approximated by differences of f, grouping the
+ *                      columns that the structure allows to be perturbed
+ *                      together: see jac_fd_init().
+ * @js:                 Structure of Df, or NULL if it is dense.
+ * @ctx:                User data passed to f and df.
+ * @t0:                 Initial time.
+ * @y:                  Vector of size n. Input: y(t0). Output: y(t1).
+ * @t1:                 Final time.
+ * @N:                  Number of steps.
+ * @tol:                Tolerance internally used in Newton's method.
+ *
+ * Same as bdf1(), but the Newton systems are solved with banded LU
+ * factors when Df is banded or sparse, so that the cost of each
+ * iteration grows linearly with n as long as the band, after the
+ * renumbering of a sparse pattern, stays narrow. With
+ * JAC_MATRIX_FREE, they are solved by GMRES on differences of f, and the
+ * Jacobian is never formed.
+ */
+void bdf1_structured(uint n, void (*f)(float, float *, float *, void *),
+                     void (*df)(float, float *, float *, void *),
+                     const struct jac_structure *js, void *ctx,
+                     float t0, float *y, float t1, uint N, float tol)
+{
+	/* allocate memory */
+	float *work = create_vector(2 * n);
+	struct jac_solver ls;
+	jac_solver_init(&ls, n, js, df);
+
+	bdf1_run(n, f, df, &ls, ctx, t0, y, t1, N, tol, work);
+
+	jac_solver_free(&ls);
+	free(work);
+}
+
+/**
+ * bdf1_work() - bdf1(), with a workspace supplied by the caller
+ * @n, @f, @df, @ctx, @t0:    See bdf1(). df must not be NULL.
+ * @y, @t1, @N, @tol:         See bdf1().
+ * @work:                     Vector of size BDF1_WORK_SIZE(n).
+ * @iwork:                    Vector of size BDF1_IWORK_SIZE(n).
+ *
+ * Performs no heap allocation, so that a forward model can keep its
+ * workspace on the stack.
+ */
+void bdf1_work(uint n, void (*f)(float, float *, float *, void *),
+               void (*df)(float, float *, float *, void *), void *ctx,
+               float t0, float *y, float t1, uint N, float tol,
+               float *work, int *iwork)
+{
+	assert(df);
+	struct jac_solver ls;
+	jac_solver_dense(&ls, work + 3 * n, iwork);
+	bdf1_run(n, f, df, &ls, ctx, t0, y, t1, N, tol, work);
+}
+
+/**
+ * bdf1_sweep() - Backwards Euler method, with several outputs
+ * @n:                Dimension of the problem.
+ * @f:                f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @df:               The Jacobian of f, called as df(t, y, Df(t,y), ctx),
+ *                    or NULL to approximate it by differences of f.
+ * @ctx:              User data passed to f and df.
+ * @t0:               Initial time.
+ * @y:                Vector of size n. Input: y(t0).
+ *                    Output: y(tout(nout)).
+ * @nout:             Number of output times.
+ * @tout:             Output times, sorted, with t0 <= tout(1) and
+ *                    t0 < tout(nout).
+ * @Yout:             n-by-nout matrix. Output: y(tout(k)) in column k.
+ * @N:                Number of steps from t0 to tout(nout).
+ * @tol:              Tolerance internally used in Newton's method.
+ *
+ * Same as bdf1(), but records the solution at every output time during a
+ * single sweep from t0 to tout(nout). Outputs that fall inside a step are
+ * linearly interpolated between both ends of the step, which matches the
+ * order of the method. The outputs after a failed step are NaN.
+ */
+void bdf1_sweep(uint n, void (*f)(float, float *, float *, void *),
+                void (*df)(float, float *, float *, void *), void *ctx,
+                float t0, float *y, uint nout, const float *tout,
+                float *Yout, uint N, float tol)
+{
+	bdf1_structured_sweep(n, f, df, NULL, ctx, t0, y, nout, tout, Yout,
+	                      N, tol);
+}
+
+/**
+ * bdf1_structured_sweep() - bdf1_sweep() with a structured Jacobian
+ * @n, @f, @df, @js, @ctx:   See bdf1_structured().
+ * @t0, @y, @nout, @tout:    See bdf1_sweep().
+ * @Yout, @N, @tol:          See bdf1_sweep().
+ */
+void bdf1_structured_sweep(uint n,
+                           void (*f)(float, float *, float *, void *),
+                           void (*df)(float, float *, float *, void *),
+                           const struct jac_structure *js, void *ctx,
+                           float t0, float *y, uint nout, const float *tout,
+                           float *Yout, uint N, float tol)
+{
+	bdf1_guarded(n, f, df, js, NULL, ctx, t0, y, nout, tout, Yout, N,
+	             tol);
+}
+
+/*
+ * bdf1_guarded_() - bdf1_guarded(), with the linear solver ls and a
+ *                   workspace of 3n floats
+ *
+ * Without g, a failed step sets the remaining outputs to NaN.
+ */
+static int bdf1_guarded_(uint n, void (*f)(float, float *, float *, void *),
+                         void (*df)(float, float *, float *, void *),
+                         struct jac_solver *ls, const struct ode_guard *g,
+                         void *ctx, float t0, float *y, uint nout,
+                         const float *tout, float *Yout, uint N, float tol,
+                         float *work)
+{
+	assert(nout > 0);
+	assert(t0 <= V_IDX(tout, 1));
+	assert(V_IDX(tout, 1) <= V_IDX(tout, nout));
+	assert(t0 < V_IDX(tout, nout));
+
+	float *x = work;
+	float *z = x + n;
+	float *y0 = z + n;
+
+	float tend = V_IDX(tout, nout);
+	float h = (tend - t0) / (float)N;
+	float t = t0;
+	uint k = 1;
+	uint maxit = (g ? g->maxit : 0);
+	int status = 0;
+
+	/* outputs at t0 */
+	for (; k <= nout && V_IDX(tout, k) <= t0; k++) {
+		m_copy(n, 1, n, M_COL(Yout, n, k), n, y);
+	}
+
+	for (uint i = 1; i <= N && k <= nout; i++) {
+		/* recompute the step to avoid drifting away from tend */
+		float t1 = (i == N ? tend : t0 + i * h);
+		float hi = t1 - t;
+
+		m_copy(n, 1, n, y0, n, y);
+		status = bdf1_step(n, f, df, ctx, t1, y, hi, tol, maxit,
+		                   x, z, ls);
+		if (g && !status) {
+			status = ode_guard_check(n, g, y);
+		}
+		if (status) {
+			if (!g) {
+				for (; k <= nout; k++) {
+					for (uint j = 1; j <= n; j++) {
+						M_IDX(Yout, n, j, k) = NAN;
+					}
+				}
+			}
+			break;
+		}
+
+		/* linear interpolation inside [t, t1] */
+		for (; k <= nout && V_IDX(tout, k) <= t1; k++) {
+			float s = (V_IDX(tout, k) - t) / hi;
+			for (uint j = 1; j <= n; j++) {
+				M_IDX(Yout, n, j, k) =
+					(1.0f - s) * V_IDX(y0, j)
+					+ s * V_IDX(y, j);
+			}
+		}
+		t = t1;
+
+		if (g && g->ss_tol > 0.0f) {
+			m_sub(n, 1, n, y0, n, y);
+			if (v_norm(n, y0) <= g->ss_tol * hi) {
+				ode_guard_fill(n, y, k, nout, Yout);
+				status = 1;
+				break;
+			}
+		}
+	}
+
+	return status;
+}
+
+/**
+ * bdf1_guarded() - bdf1_structured_sweep(), with early termination
+ * @n, @f, @df, @js:           See bdf1_structured().
+ * @g:                         Conditions for stopping early, or NULL.
+ * @ctx, @t0, @y:              See bdf1_structured().
+ * @nout, @tout, @Yout:        See bdf1_sweep().
+ * @N, @tol:                   See bdf1_sweep().
+ *
+ * As rk4_guarded(), with the Newton iterations of each step capped at
+ * g->maxit. The norm of f(t,y) at the end of a step, for the steady
+ * state test, is taken from the step itself: backward Euler makes it
+ * ||y(t) - y(t - h)|| / h.
+ *
+ * Return: 0 on success, 1 if a steady state was reached, -1 if Newton's
+ * method did not converge, -2 if the state stopped being finite, -3 if
+ * it left the bounds.
+ */
+int bdf1_guarded(uint n, void (*f)(float, float *, float *, void *),
+                 void (*df)(float, float *, float *, void *),
+                 const struct jac_structure *js, const struct ode_guard *g,
+                 void *ctx, float t0, float *y, uint nout,
+                 const float *tout, float *Yout, uint N, float tol)
+{
+	/* allocate memory */
+	float *work = create_vector(3 * n);
+	struct jac_solver ls;
+	jac_solver_init(&ls, n, js, df);
+
+	int status = bdf1_guarded_(n, f, df, &ls, g, ctx, t0, y, nout, tout,
+	                           Yout, N, tol, work);
+
+	jac_solver_free(&ls);
+	free(work);
+
+	return status;
+}
+
+/**
+ * bdf1_sweep_work() - bdf1_sweep(), with a workspace supplied by the
+ *                     caller
+ * @n, @f, @df, @ctx, @t0, @y:     See bdf1_sweep(). df must not be NULL.
+ * @nout, @tout, @Yout, @N, @tol:  See bdf1_sweep().
+ * @work:                          Vector of size BDF1_WORK_SIZE(n).
+ * @iwork:                         Vector of size BDF1_IWORK_SIZE(n).
+ *
+ * Performs no heap allocation, see bdf1_work().
+ *
+ * Return: 0 on success, or the status of the failed step, as in
+ * bdf1_guarded(), in which case the remaining outputs are NaN.
+ */
+int bdf1_sweep_work(uint n, void (*f)(float, float *, float *, void *),
+                    void (*df)(float, float *, float *, void *), void *ctx,
+                    float t0, float *y, uint nout, const float *tout,
+                    float *Yout, uint N, float tol, float *work, int *iwork)
+{
+	assert(df);
+	struct jac_solver ls;
+	jac_solver_dense(&ls, work + 3 * n, iwork);
+	return bdf1_guarded_(n, f, df, &ls, NULL, ctx, t0, y, nout, tout,
+	                     Yout, N, tol, work);
+}
+
+/*
+ * Forward sensitivities
+ *
+ * The sensitivities S = dy/dp of the solution with respect to np
+ * parameters p satisfy the variational equation S' = Df(t,y) S + df/dp,
+ * with S(t0) = dy0/dp. rk4_sens_sweep() integrates it together with y,
+ * as one augmented system of size n (np + 1). bdf1_sens_sweep() uses the
+ * staggered direct method: once Newton's method has converged at the end
+ * of a step, the backward Euler step of the (linear) variational
+ * equation is solved with 1 - hJ factored at the new state, which gives
+ * the exact derivatives of the discrete solution.
+ */
+
+/**
+ * struct sens_ctx - the augmented system of the sensitivities
+ * @n, @np:           Dimension of y and number of parameters.
+ * @f, @df, @dfdp:    See rk4_sens_sweep().
+ * @ctx:              User data passed to f, df and dfdp.
+ * @J:                n-by-n matrix, Df(t,y).
+ * @fd:               Finite differences, if df is NULL.
+ */
+struct sens_ctx {
+	uint n;
+	uint np;
+	void (*f)(float, float *, float *, void *);
+	void (*df)(float, float *, float *, void *);
+	void (*dfdp)(float, float *, float *, void *);
+	void *ctx;
+	float *J;
+	struct jac_fd *fd;
+};
+
+/* (y, S)' = (f(t,y), Df(t,y) S + df/dp(t,y)) */
+static void sens_f(float t, float *Y, float *D, void *ctx)
+{
+	struct sens_ctx *sc = (struct sens_ctx *)ctx;
+	uint n = sc->n;
+	uint np = sc->np;
+	float *S = Y + n;
+	float *DS = D + n;
+
+	sc->f(t, Y, D, sc->ctx);
+	if (sc->fd) {
+		jac_fd_eval(n, sc->fd, sc->f, sc->ctx, t, Y, NULL, sc->J);
+	} else {
+		sc->df(t, Y, sc->J, sc->ctx);
+	}
+	if (sc->dfdp) {
+		sc->dfdp(t, Y, DS, sc->ctx);
+	} else {
+		memset(DS, 0, sizeof(float) * n * np);
+	}
+	cblas_sgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, n, np, n,
+	            1.0f, sc->J, n, S, n, 1.0f, DS, n);
+}
+
+/**
+ * rk4_sens_sweep() - rk4_sweep(), with forward sensitivities
+ * @n:                 Dimension of the problem.
+ * @np:                Number of parameters.
+ * @f:                 f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @df:                The Jacobian of f, called as df(t, y, Df(t,y), ctx),
+ *                     or NULL to approximate it by differences of f.
+ * @dfdp:              The derivatives of f with respect to the parameters,
+ *                     called as dfdp(t, y, df/dp(t,y), ctx) to set an
+ *                     n-by-np matrix, or NULL if only y0 depends on them.
+ * @ctx:               User data passed to f, df and dfdp.
+ * @t0:                Initial time.
+ * @y:                 Vector of size n. Input: y(t0). Output: y(tout(nout)).
+ * @S:                 n-by-np matrix. Input: dy/dp(t0). Output:
+ *                     dy/dp(tout(nout)).
+ * @nout, @tout, @Yout: Output times and values, see rk4_sweep().
+ * @Sout:              n-by-(np nout) matrix. Output: dy/dp(tout(k)) in
+ *                     columns (k - 1) np + 1 to k np.
+ * @N:                 Number of steps from t0 to tout(nout).
+ *
+ * The sensitivities are integrated with y, as described above; each
+ * evaluation of the augmented system costs one evaluation of f, df and
+ * dfdp.
+ */
+void rk4_sens_sweep(uint n, uint np,
+                    void (*f)(float, float *, float *, void *),
+                    void (*df)(float, float *, float *, void *),
+                    void (*dfdp)(float, float *, float *, void *),
+                    void *ctx, float t0, float *y, float *S,
+                    uint nout, const float *tout, float *Yout,
+                    float *Sout, uint N)
+{
+	uint na = n * (np + 1);
+	struct sens_ctx sc = { n, np, f, df, dfdp, ctx, NULL, NULL };
+	struct jac_fd fd;
+
+	/* allocate memory */
+	float *Y = create_vector(na);
+	float *Ya = create_matrix(na, nout);
+	sc.J = create_matrix(n, n);
+	if (!df) {
+		jac_fd_init(&fd, n, NULL);
+		sc.fd = &fd;
+	}
+
+	m_copy(n, 1, n, Y, n, y);
+	m_copy(n, np, n, Y + n, n, S);
+	rk4_sweep(na, sens_f, &sc, t0, Y, nout, tout, Ya, N);
+
+	m_copy(n, 1, n, y, n, Y);
+	m_copy(n, np, n, S, n, Y + n);
+	for (uint k = 1; k <= nout; k++) {
+		float *Yk = M_COL(Ya, na, k);
+		m_copy(n, 1, n, M_COL(Yout, n, k), n, Yk);
+		m_copy(n, np, n, M_COL(Sout, n, (k - 1) * np + 1), n, Yk + n);
+	}
+
+	if (!df) {
+		jac_fd_free(&fd);
+	}
+	free(sc.J);
+	free(Ya);
+	free(Y);
+}
+
+/**
+ * bdf1_sens_sweep() - bdf1_sweep(), with forward sensitivities
+ * @n, @np, @f, @df, @dfdp, @ctx:  See rk4_sens_sweep().
+ * @t0, @y, @S:                    See rk4_sens_sweep().
+ * @nout, @tout, @Yout, @Sout:     See rk4_sens_sweep().
+ * @N:                             Number of steps from t0 to tout(nout).
+ * @tol:                           Tolerance internally used in Newton's
+ *                                 method.
+ *
+ * After each step of bdf1_step(), the sensitivities are advanced by
+ *   (1 - hDf(t,y)) S(t) = S(t - h) + h df/dp(t,y),
+ * which costs one more factorization and np solves per step. Outputs
+ * inside a step are interpolated linearly, as in bdf1_sweep().
+ *
+ * Return: 0 on success, or the status of the failed step, as in
+ * bdf1_sweep_work(), in which case the remaining outputs are NaN.
+ */
+int bdf1_sens_sweep(uint n, uint np,
+                    void (*f)(float, float *, float *, void *),
+                    void (*df)(float, float *, float *, void *),
+                    void (*dfdp)(float, float *, float *, void *),
+                    void *ctx, float t0, float *y, float *S,
+                    uint nout, const float *tout, float *Yout,
+                    float *Sout, uint N, float tol)
+{
+	assert(nout > 0);
+	assert(t0 <= V_IDX(tout, 1));
+	assert(V_IDX(tout, 1) <= V_IDX(tout, nout));
+	assert(t0 < V_IDX(tout, nout));
+
+	/* allocate memory */
+	float *x = create_vector(n);
+	float *z = create_vector(n);
+	float *y0 = create_vector(n);
+	float *S0 = create_matrix(n, np);
+	float *Jp = create_matrix(n, np);
+	struct jac_solver ls;
+	jac_solver_init(&ls, n, NULL, df);
+
+	float tend = V_IDX(tout, nout);
+	float h = (tend - t0) / (float)N;
+	float t = t0;
+	uint k = 1;
+	int status = 0;
+
+	/* outputs at t0 */
+	for (; k <= nout && V_IDX(tout, k) <= t0; k++) {
+		m_copy(n, 1, n, M_COL(Yout, n, k), n, y);
+		m_copy(n, np, n, M_COL(Sout, n, (k - 1) * np + 1), n, S);
+	}
+
+	for (uint i = 1; i <= N && k <= nout; i++) {
+		/* recompute the step to avoid drifting away from tend */
+		float t1 = (i == N ? tend : t0 + i * h);
+		float hi = t1 - t;
+
+		m_copy(n, 1, n, y0, n, y);
+		m_copy(n, np, n, S0, n, S);
+		status = bdf1_step(n, f, df, ctx, t1, y, hi, tol, 0, x, z, &ls);
+
+		/* S <- (1 - hDf(t1,y))^(-1) (S + h df/dp(t1,y)) */
+		if (!status
+		    && jac_solver_setup(n, &ls, f, df, ctx, t1, y, NULL, hi)) {
+			status = -2;
+		}
+		if (status) {
+			for (; k <= nout; k++) {
+				float *Sk = M_COL(Sout, n, (k - 1) * np + 1);
+				for (uint j = 1; j <= n; j++) {
+					M_IDX(Yout, n, j, k) = NAN;
+				}
+				for (uint j = 1; j <= n * np; j++) {
+					V_IDX(Sk, j) = NAN;
+				}
+			}
+			break;
+		}
+		if (dfdp) {
+			dfdp(t1, y, Jp, ctx);
+			m_scale(n, np, n, Jp, hi);
+			m_add(n, np, n, S, n, Jp);
+		}
+		for (uint j = 1; j <= np; j++) {
+			jac_solver_solve(n, &ls, f, ctx, M_COL(S, n, j));
+		}
+
+		/* linear interpolation inside [t, t1] */
+		for (; k <= nout && V_IDX(tout, k) <= t1; k++) {
+			float s = (V_IDX(tout, k) - t) / hi;
+			float *Sk = M_COL(Sout, n, (k - 1) * np + 1);
+			for (uint j = 1; j <= n; j++) {
+				M_IDX(Yout, n, j, k) =
+					(1.0f - s) * V_IDX(y0, j)
+					+ s * V_IDX(y, j);
+			}
+			for (uint l = 1; l <= np; l++) {
+				for (uint j = 1; j <= n; j++) {
+					M_IDX(Sk, n, j, l) =
+						(1.0f - s) * M_IDX(S0, n, j, l)
+						+ s * M_IDX(S, n, j, l);
+				}
+			}
+		}
+		t = t1;
+	}
+
+	jac_solver_free(&ls);
+	free(Jp);
+	free(S0);
+	free(y0);
+	free(z);
+	free(x);
+	return status;
+}
+
+/*
+ * Modified Newton iterations reuse the factorization of 1 - hJ until their
+ * contraction rate exceeds BDF1_RATE_SLOW, after which the next step
+ * starts with a fresh Jacobian. An iteration whose rate exceeds
+ * BDF1_RATE_FAIL is abandoned.
+ */
+#define BDF1_RATE_SLOW 0.5f
+#define BDF1_RATE_FAIL 0.9f
+
+/**
+ * struct bdf1_newton - state of the modified Newton method
+ * @D, @ipiv:          Factors of 1 - hJ, see lu_factor().
+ * @h:                 Step size the factors were computed with, or zero
+ *                     if there are none.
+ * @stats:             Counters, updated as the method proceeds.
+ * @fd:                Finite differences, if df is NULL.
+ */
+struct bdf1_newton {
+	float *D;
+	int *ipiv;
+	float h;
+	struct ode_stats *stats;
+	struct jac_fd *fd;
+};
+
+/*
+ * bdf1_refresh() - evaluate the Jacobian at (t,x) and factor 1 - hJ
+ *
+ * Return: 0 on success, nonzero if the matrix is singular.
+ */
+static int bdf1_refresh(uint n, void (*f)(float, float *, float *, void *),
+                        void (*df)(float, float *, float *, void *),
+                        void *ctx, float t, float *x, float h,
+                        struct bdf1_newton *nw)
+{
+	/* D = 1 - hJ(t,x), with leading dimension n */
+	if (nw->fd) {
+		nw->stats->nfev += jac_fd_eval(n, nw->fd, f, ctx, t, x, NULL,
+		                               nw->D);
+	} else {
+		df(t, x, nw->D, ctx);
+	}
+	m_scale(n, n, n, nw->D, -h);
+	for (uint i = 1; i <= n; i++) {
+		M_IDX(nw->D, n, i, i) += 1.0f;
+	}
+	nw->stats->njev++;
+	nw->stats->ndecomp++;
+
+	if (lu_factor(n, nw->D, nw->ipiv)) {
+		nw->h = 0.0f;
+		return 1;
+	}
+	nw->h = h;
+	return 0;
+}
+
+/**
+ * bdf1_modified_step() - one step of backwards Euler, with modified Newton
+ * @n, @f, @df, @ctx:        See bdf1_modified().
+ * @t:                       Time at the end of the step.
+ * @y:                       Vector of size n. Input: y(t - h). Output:
+ *                           y(t) on success, unchanged on failure.
+ * @h:                       Step size.
+ * @tol, @maxit:             See bdf1_modified().
+ * @x, @z:                   Scratch vectors of size n.
+ * @nw:                      State of the modified Newton method.
+ *
+ * The factorization held in nw is reused if it was computed with about
+ * the same step size. If the iteration fails to converge with it, it is
+ * recomputed at y and the iteration restarted once.
+ *
+ * Return: 0 on success, -1 if Newton's method failed, -2 if 1 - hJ is
+ * singular.
+ */
+static int bdf1_modified_step(uint n,
+                              void (*f)(float, float *, float *, void *),
+                              void (*df)(float, float *, float *, void *),
+                              void *ctx, float t, float *y, float h,
+                              float tol, uint maxit, float *x, float *z,
+                              struct bdf1_newton *nw)
+{
+	int fresh = 0;
+
+	if (nw->h == 0.0f || fabsf(h - nw->h) > 0.2f * nw->h) {
+		if (bdf1_refresh(n, f, df, ctx, t, y, h, nw)) {
+			return -2;
+		}
+		fresh = 1;
+	}
+
+	for (;;) {
+		/* x <- y */
+		m_copy(n, 1, n, x, n, y);
+
+		float nold = 0.0f;
+		float rate = 0.0f;
+		int converged = 0;
+		for (uint k = 1; k <= maxit; k++) {
+			/* z = x - y - hf(t,x) */
+			f(t, x, z, ctx);
+			nw->stats->nfev++;
+			for (uint i = 1; i <= n; i++) {
+				V_IDX(z, i) = V_IDX(x, i) - V_IDX(y, i)
+				              - h * V_IDX(z, i);
+			}
+
+			/* x -= D^(-1)z */
+			lu_solve(n, nw->D, nw->ipiv, z);
+			m_sub(n, 1, n, x, n, z);
+			nw->stats->nniter++;
+
+			float nz = v_norm(n, z);
+			if (!isfinite(nz)) {
+				break;
+			}
+			if (nz <= tol) {
+				converged = 1;
+				break;
+			}
+			if (k > 1) {
+				rate = fmaxf(rate, nz / nold);
+				if (rate > BDF1_RATE_FAIL) {
+					break;
+				}
+			}
+			nold = nz;
+		}
+
+		if (converged) {
+			/* refresh the Jacobian at the next step if slow */
+			if (rate > BDF1_RATE_SLOW) {
+				nw->h = 0.0f;
+			}
+			m_copy(n, 1, n, y, n, x);
+			return 0;
+		}
+		if (fresh) {
+			nw->h = 0.0f;
+			return -1;
+		}
+
+		/* the factorization was stale, retry with a fresh one */
+		if (bdf1_refresh(n, f, df, ctx, t, y, h, nw)) {
+			return -2;
+		}
+		fresh = 1;
+	}
+}
+
+/**
+ * bdf1_modified() - Backwards Euler method, with modified Newton iterations
+ * @n:                   Dimension of the problem.
+ * @f:                   f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @df:                  The Jacobian of f, called as df(t, y, Df(t,y), ctx),
+ *                       or NULL to approximate it by differences of f.
+ * @ctx:                 User data passed to f and df.
+ * @t0:                  Initial time.
+ * @y:                   Vector of size n. Input: y(t0). Output:
+ *                       y(tout(nout)), or the last computed state on
+ *                       failure.
+ * @nout, @tout, @Yout:  Output times and values, see bdf1_sweep().
+ * @N:                   Number of steps from t0 to tout(nout).
+ * @tol:                 Tolerance internally used in Newton's method.
+ * @maxit:               Maximum number of Newton iterations per attempt.
+ * @stats:               If not NULL, receives the work statistics.
+ *
+ * Same as bdf1_sweep(), but the Jacobian is neither evaluated nor
+ * factored at every Newton iteration: the LU factors of 1 - hJ are kept
+ * across iterations and steps for as long as Newton's method contracts
+ * quickly with them. When it slows down, the Jacobian is refreshed at
+ * the next step; when it fails, the current step is retried once with a
+ * fresh Jacobian. Iterations are capped at maxit per attempt.
+ *
+ * Return: 0 on success, -1 if Newton's method failed even with a fresh
+ * Jacobian, -2 if 1 - hJ is singular. Outputs beyond the point of
+ * failure are left untouched.
+ */
+int bdf1_modified(uint n, void (*f)(float, float *, float *, void *),
+                  void (*df)(float, float *, float *, void *), void *ctx,
+                  float t0, float *y, uint nout, const float *tout,
+                  float *Yout, uint N, float tol, uint maxit,
+                  struct ode_stats *stats)
+{
+	assert(nout > 0);
+	assert(t0 <= V_IDX(tout, 1));
+	assert(V_IDX(tout, 1) <= V_IDX(tout, nout));
+	assert(t0 < V_IDX(tout, nout));
+	assert(maxit > 0);
+
+	/* allocate memory */
+	float *x = create_vector(n);
+	float *z = create_vector(n);
+	float *y0 = create_vector(n);
+	struct ode_stats st = { 0 };
+	struct bdf1_newton nw;
+	nw.D = create_vector(LU_SIZE(n));
+	nw.ipiv = (int *)malloc(sizeof(int) * LU_IPIV(n));
+	assert(nw.ipiv);
+	nw.h = 0.0f;
+	nw.stats = &st;
+	nw.fd = NULL;
+	if (!df) {
+		nw.fd = (struct jac_fd *)malloc(sizeof(struct jac_fd));
+		assert(nw.fd);
+		jac_fd_init(nw.fd, n, NULL);
+	}
+
+	float tend = V_IDX(tout, nout);
+	float h = (tend - t0) / (float)N;
+	float t = t0;
+	uint k = 1;
+	int status = 0;
+
+	/* outputs at t0 */
+	for (; k <= nout && V_IDX(tout, k) <= t0; k++) {
+		m_copy(n, 1, n, M_COL(Yout, n, k), n, y);
+	}
+
+	for (uint i = 1; i <= N && k <= nout; i++) {
+		/* recompute the step to avoid drifting away from tend */
+		float t1 = (i == N ? tend : t0 + i * h);
+		float hi = t1 - t;
+
+		m_copy(n, 1, n, y0, n, y);
+		status = bdf1_modified_step(n, f, df, ctx, t1, y, hi, tol,
+		                            maxit, x, z, &nw);
+		if (status) {
+			break;
+		}
+		st.nsteps++;
+
+		/* linear interpolation inside [t, t1] */
+		for (; k <= nout && V_IDX(tout, k) <= t1; k++) {
+			float s = (V_IDX(tout, k) - t) / hi;
+			for (uint j = 1; j <= n; j++) {
+				M_IDX(Yout, n, j, k) =
+					(1.0f - s) * V_IDX(y0, j)
+					+ s * V_IDX(y, j);
+			}
+		}
+		t = t1;
+	}
+
+	if (stats) {
+		*stats = st;
+	}
+
+	if (nw.fd) {
+		jac_fd_free(nw.fd);
+		free(nw.fd);
+	}
+	free(nw.ipiv);
+	free(nw.D);
+	free(y0);
+	free(z);
+	free(x);
+
+	return status;
+}
+
+/*
+ * Variable-order, variable-step BDF
+ *
+ * The solution is represented by its backward differences on an equally
+ * spaced grid of step h: column k + 1 of the n-by-(BDF_MAXORDER + 3)
+ * matrix D holds the k-th difference, so that the predictor at t + h is
+ * the sum of the first order + 1 columns. Changing the step size
+ * re-samples the interpolating polynomial on the new grid, following
+ * Shampine and Reichelt, "The MATLAB ODE suite" (1997).
+ */
+#define BDF_MAXORDER 5
+#define BDF_NEWTON_MAXITER 4
+#define BDF_MAXSTEPS 100000
+#define BDF_MIN_FACTOR 0.2f
+#define BDF_MAX_FACTOR 10.0f
+/* number of solves after which bdf_warm() re-evaluates a kept Jacobian */
+#define BDF_WARM_JAC_AGE 8
+
+/* bdf_gamma[k] = 1 + 1/2 + ... + 1/k */
+static const float bdf_gamma[BDF_MAXORDER + 2] = {
+	0.0f, 1.0f, 1.5f, 11.0f / 6.0f, 25.0f / 12.0f, 137.0f / 60.0f,
+	49.0f / 20.0f
+};
+
+/* leading coefficient of the local error of the order k formula */
+static const float bdf_error_const[BDF_MAXORDER + 2] = {
+	1.0f, 1.0f / 2.0f, 1.0f / 3.0f, 1.0f / 4.0f, 1.0f / 5.0f,
+	1.0f / 6.0f, 1.0f / 7.0f
+};
+
+/*
+ * bdf_compute_R() - (order + 1)-by-(order + 1) matrix R used to re-sample
+ *                   the differences when the step is multiplied by factor
+ */
+static void bdf_compute_R(uint order, float factor, float *R)
+{
+	uint m = order + 1;
+	for (uint j = 1; j <= m; j++) {
+		M_IDX(R, m, 1, j) = 1.0f;
+		for (uint i = 2; i <= m; i++) {
+			float M = (j == 1 ? 0.0f
+			           : ((float)(i - 2) - factor * (float)(j - 1))
+			             / (float)(i - 1));
+			M_IDX(R, m, i, j) = M_IDX(R, m, i - 1, j) * M;
+		}
+	}
+}
+
+/*
+ * bdf_change_D() - re-sample the differences after the step has been
+ *                  multiplied by factor
+ * @work:           Scratch space of 3 (order + 1)^2 + n (order + 1) floats.
+ */
+static void bdf_change_D(uint n, float *D, uint order, float factor,
+                         float *work)
+{
+	uint m = order + 1;
+	float *R = work;
+	float *U = R + m * m;
+	float *RU = U + m * m;
+	float *T = RU + m * m;
+
+	bdf_compute_R(order, factor, R);
+	bdf_compute_R(order, 1.0f, U);
+	for (uint i = 1; i <= m; i++) {
+		for (uint j = 1; j <= m; j++) {
+			float acc = 0.0f;
+			for (uint k = 1; k <= m; k++) {
+				acc += M_IDX(R, m, i, k) * M_IDX(U, m, k, j);
+			}
+			M_IDX(RU, m, i, j) = acc;
+		}
+	}
+
+	/* D(:, k) <- sum_j RU(j, k) D(:, j) */
+	for (uint k = 1; k <= m; k++) {
+		for (uint i = 1; i <= n; i++) {
+			float acc = 0.0f;
+			for (uint j = 1; j <= m; j++) {
+				acc += M_IDX(RU, m, j, k) * M_IDX(D, n, i, j);
+			}
+			M_IDX(T, n, i, k) = acc;
+		}
+	}
+	m_copy(n, m, n, D, n, T);
+}
+
+/* root-mean-square of v ./ scale */
+static float bdf_norm(uint n, float *v, float *scale)
+{
+	float sum = 0.0f;
+	for (uint i = 1; i <= n; i++) {
+		float r = V_IDX(v, i) / V_IDX(scale, i);
+		sum += r * r;
+	}
+	return sqrtf(sum / n);
+}
+
+/**
+ * bdf() - variable-order, variable-step BDF method
+ * @n:            Dimension of the problem.
+ * @f:            f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @df:           The Jacobian of f, called as df(t, y, Df(t,y), ctx), or
+ *                NULL to approximate it by differences of f.
+ * @ctx:          User data passed to f and df.
+ * @t0:           Initial time.
+ * @y:            Vector of size n. Input: y(t0). Output: y(tout(nout)),
+ *                or the last accepted state on failure.
+ * @nout:         Number of output times.
+ * @tout:         Output times, sorted, with t0 <= tout(1) and
+ *                t0 < tout(nout).
+ * @Yout:         n-by-nout matrix. Output: y(tout(k)) in column k.
+ * @rtol:         Relative tolerance.
+ * @atol:         Absolute tolerance.
+ * @stats:        If not NULL, receives the work statistics.
+ *
+ * Backward differentiation formulas of orders 1 to 5. The local error of
+ * each step is estimated from the Newton correction and kept below one
+ * in the weighted RMS norm with weights atol + rtol |y|. After order + 1
+ * steps of equal size, the errors of the neighbouring orders are
+ * estimated as well and the order and step size that allow the largest
+ * next step are chosen. The Jacobian is reused across steps and only
+ * re-evaluated when Newton's method fails to converge; the matrix
+ * 1 - hJ/alpha is re-factored when the step size or the order changes.
+ * Outputs are interpolated with the polynomial held in the difference
+ * array.
+ *
+ * Return: 0 on success, -1 if the step size underflowed or the step
+ * limit was reached. Outputs beyond the point of failure are left
+ * untouched.
+ */
+int bdf(uint n, void (*f)(float, float *, float *, void *),
+        void (*df)(float, float *, float *, void *), void *ctx,
+        float t0, float *y, uint nout, const float *tout, float *Yout,
+        float rtol, float atol, struct ode_stats *stats)
+{
+	return bdf_warm(n, f, df, ctx, t0, y, nout, tout, Yout, rtol, atol,
+	                NULL, stats);
+}
+
+/**
+ * bdf_warm() - bdf(), warm started from a previous solve
+ * @n, @f, @df, @ctx, @t0, @y, @nout, @tout, @Yout, @rtol, @atol:
+ *                See bdf().
+ * @warm:         State left by the previous solve of a nearby problem with
+ *                the same output times, or NULL. Updated on success, and
+ *                invalidated on failure.
+ * @stats:        See bdf().
+ *
+ * When @warm is valid, the first step is the one the previous solve
+ * accepted, and in each output interval the step is not allowed to grow
+ * far beyond the last one accepted there. If @warm holds a Jacobian that
+ * is less than BDF_WARM_JAC_AGE solves old, it is used for the first
+ * Newton iterations; it is refreshed as usual if they fail. The method
+ * still starts at order one, since the difference array is not kept.
+ *
+ * Return: see bdf().
+ */
+int bdf_warm(uint n, void (*f)(float, float *, float *, void *),
+             void (*df)(float, float *, float *, void *), void *ctx,
+             float t0, float *y, uint nout, const float *tout, float *Yout,
+             float rtol, float atol, struct ode_warm *warm,
+             struct ode_stats *stats)
+{
+	assert(nout > 0);
+	assert(t0 <= V_IDX(tout, 1));
+	assert(V_IDX(tout, 1) <= V_IDX(tout, nout));
+	assert(t0 < V_IDX(tout, nout));
+	assert(rtol > 0.0f || atol > 0.0f);
+
+	const uint nd = BDF_MAXORDER + 3;
+	const uint m = BDF_MAXORDER + 1;
+
+	/* allocate memory */
+	float *D = create_matrix(n, nd);
+	float *J = create_matrix(n, n);
+	float *LU = create_vector(LU_SIZE(n));
+	int *ipiv = (int *)malloc(sizeof(int) * LU_IPIV(n));
+	assert(ipiv);
+	float *yp = create_vector(n);
+	float *yn = create_vector(n);
+	float *psi = create_vector(n);
+	float *d = create_vector(n);
+	float *dy = create_vector(n);
+	float *fv = create_vector(n);
+	float *scale = create_vector(n);
+	float *work = create_vector(3 * m * m + n * m);
+	struct jac_fd fd;
+	if (!df) {
+		jac_fd_init(&fd, n, NULL);
+	}
+
+	struct ode_stats st = { 0 };
+	float tend = V_IDX(tout, nout);
+	float t = t0;
+	uint o = 1;
+	int status = 0;
+
+	float newton_tol = fmaxf(10.0f * 1.2e-7f / rtol,
+	                         fminf(0.03f, sqrtf(rtol)));
+
+	/* outputs at t0 */
+	for (; o <= nout && V_IDX(tout, o) <= t0; o++) {
+		m_copy(n, 1, n, M_COL(Yout, n, o), n, y);
+	}
+
+	f(t, y, fv, ctx);
+	st.nfev++;
+	float h;
+	if (warm && warm->valid) {
+		h = fminf(warm->h0, tend - t0);
+	} else {
+		/* initial step, as in dopri5() but for a first order method */
+		for (uint i = 1; i <= n; i++) {
+			V_IDX(scale, i) = atol + rtol * fabsf(V_IDX(y, i));
+		}
+		float d0 = bdf_norm(n, y, scale);
+		float d1 = bdf_norm(n, fv, scale);
+		h = (d0 < 1e-5f || d1 < 1e-5f ? 1e-6f : 0.01f * d0 / d1);
+		h = fminf(h, tend - t0);
+		for (uint i = 1; i <= n; i++) {
+			V_IDX(yn, i) = V_IDX(y, i) + h * V_IDX(fv, i);
+		}
+		f(t + h, yn, dy, ctx);
+		st.nfev++;
+		for (uint i = 1; i <= n; i++) {
+			V_IDX(dy, i) = (V_IDX(dy, i) - V_IDX(fv, i)) / h;
+		}
+		float d2 = bdf_norm(n, dy, scale);
+		float dm = fmaxf(d1, d2);
+		float h1 = (dm <= 1e-15f ? fmaxf(1e-6f, h * 1e-3f)
+		                         : sqrtf(0.01f / dm));
+		h = fminf(fminf(100.0f * h, h1), tend - t0);
+	}
+
+	/* D(:,1) = y, D(:,2) = h f(t0, y), the rest is zero */
+	for (uint k = 1; k <= nd; k++) {
+		for (uint i = 1; i <= n; i++) {
+			M_IDX(D, n, i, k) = (k == 1 ? V_IDX(y, i)
+			                     : k == 2 ? h * V_IDX(fv, i) : 0.0f);
+		}
+	}
+
+	uint order = 1;
+	uint n_equal_steps = 0;
+	int have_jac = 0;
+	int have_lu = 0;
+	float h0 = h;
+
+	/* reuse the Jacobian kept by the previous solve, if recent enough */
+	if (warm && warm->J && warm->valid
+	    && warm->jac_age < BDF_WARM_JAC_AGE) {
+		m_copy(n, n, n, J, n, warm->J);
+		warm->jac_age++;
+		have_jac = 1;
+	}
+
+	while (o <= nout) {
+		float min_step = 10.0f * 1.2e-7f * fabsf(t);
+		int current_jac = 0;
+		int accepted = 0;
+		float error_norm = 0.0f;
+		float safety = 0.9f;
+		float t_new = t;
+
+		while (!accepted) {
+			if (h < min_step || t + h == t
+			    || st.nsteps + st.nreject >= BDF_MAXSTEPS) {
+				status = -1;
+				goto done;
+			}
+
+			t_new = t + h;
+			if (t_new >= tend) {
+				t_new = tend;
+				bdf_change_D(n, D, order, (t_new - t) / h, work);
+				n_equal_steps = 0;
+				have_lu = 0;
+				h = t_new - t;
+			}
+
+			/* predictor */
+			for (uint i = 1; i <= n; i++) {
+				float acc = 0.0f;
+				float ps = 0.0f;
+				for (uint k = 1; k <= order + 1; k++) {
+					acc += M_IDX(D, n, i, k);
+				}
+				for (uint k = 2; k <= order + 1; k++) {
+					ps += bdf_gamma[k - 1] * M_IDX(D, n, i, k);
+				}
+				V_IDX(yp, i) = acc;
+				V_IDX(psi, i) = ps / bdf_gamma[order];
+				V_IDX(scale, i) = atol + rtol * fabsf(acc);
+			}
+			float c = h / bdf_gamma[order];
+
+			/* corrector */
+			int converged = 0;
+			uint n_iter = 0;
+			for (;;) {
+				if (!have_jac) {
+					if (df) {
+						df(t_new, yp, J, ctx);
+					} else {
+						st.nfev += jac_fd_eval(
+							n, &fd, f, ctx,
+							t_new, yp, NULL, J);
+					}
+					st.njev++;
+					have_jac = 1;
+					current_jac = 1;
+					have_lu = 0;
+					/* keep the one of the first step */
+					if (warm && warm->J && !st.nsteps) {
+						m_copy(n, n, n, warm->J, n, J);
+						warm->jac_age = 0;
+					}
+				}
+				if (!have_lu) {
+					/* LU = 1 - cJ */
+					for (uint j = 1; j <= n; j++) {
+						for (uint i = 1; i <= n; i++) {
+							M_IDX(LU, n, i, j) =
+								(i == j) - c
+								* M_IDX(J, n, i, j);
+						}
+					}
+					st.ndecomp++;
+					have_lu = !lu_factor(n, LU, ipiv);
+				}
+
+				/* simplified Newton iterations */
+				float dy_norm_old = -1.0f;
+				m_copy(n, 1, n, yn, n, yp);
+				for (uint i = 1; i <= n; i++) {
+					V_IDX(d, i) = 0.0f;
+				}
+				for (n_iter = 1; have_lu
+				     && n_iter <= BDF_NEWTON_MAXITER; n_iter++) {
+					f(t_new, yn, fv, ctx);
+					st.nfev++;
+					st.nniter++;
+					if (!isfinite(v_norm(n, fv))) {
+						break;
+					}
+					for (uint i = 1; i <= n; i++) {
+						V_IDX(dy, i) = c * V_IDX(fv, i)
+						               - V_IDX(psi, i)
+						               - V_IDX(d, i);
+					}
+					lu_solve(n, LU, ipiv, dy);
+					float dy_norm = bdf_norm(n, dy, scale);
+					float rate = (dy_norm_old < 0.0f ? -1.0f
+					              : dy_norm / dy_norm_old);
+					if (rate >= 0.0f
+					    && (rate >= 1.0f
+					        || powf(rate, BDF_NEWTON_MAXITER
+					                      - n_iter + 1)
+					           / (1.0f - rate) * dy_norm
+					           > newton_tol)) {
+						break;
+					}
+					m_add(n, 1, n, yn, n, dy);
+					m_add(n, 1, n, d, n, dy);
+					if (dy_norm == 0.0f
+					    || (rate >= 0.0f
+					        && rate / (1.0f - rate) * dy_norm
+					           < newton_tol)) {
+						converged = 1;
+						break;
+					}
+					dy_norm_old = dy_norm;
+				}
+
+				if (converged || current_jac) {
+					break;
+				}
+				/* the Jacobian may be stale: refresh it */
+				have_jac = 0;
+			}
+
+			if (!converged) {
+				st.nreject++;
+				h *= 0.5f;
+				bdf_change_D(n, D, order, 0.5f, work);
+				n_equal_steps = 0;
+				have_lu = 0;
+				continue;
+			}
+
+			/* local error estimate */
+			safety = 0.9f * (2.0f * BDF_NEWTON_MAXITER + 1.0f)
+			         / (2.0f * BDF_NEWTON_MAXITER + n_iter);
+			for (uint i = 1; i <= n; i++) {
+				V_IDX(scale, i) = atol + rtol
+				                  * fabsf(V_IDX(yn, i));
+				V_IDX(dy, i) = bdf_error_const[order]
+				               * V_IDX(d, i);
+			}
+			error_norm = bdf_norm(n, dy, scale);
+			if (error_norm > 1.0f) {
+				st.nreject++;
+				float factor = fmaxf(BDF_MIN_FACTOR, safety
+				               * powf(error_norm,
+				                      -1.0f / (order + 1)));
+				h *= factor;
+				bdf_change_D(n, D, order, factor, work);
+				n_equal_steps = 0;
+				have_lu = 0;
+			} else {
+				accepted = 1;
+			}
+		}
+
+		st.nsteps++;
+		n_equal_steps++;
+		float h_acc = t_new - t;
+		if (st.nsteps == 1) {
+			h0 = h_acc;
+		}
+		t = t_new;
+		m_copy(n, 1, n, y, n, yn);
+
+		/* update the differences */
+		for (uint i = 1; i <= n; i++) {
+			M_IDX(D, n, i, order + 3) = V_IDX(d, i)
+			                            - M_IDX(D, n, i, order + 2);
+			M_IDX(D, n, i, order + 2) = V_IDX(d, i);
+		}
+		for (uint k = order + 1; k >= 1; k--) {
+			for (uint i = 1; i <= n; i++) {
+				M_IDX(D, n, i, k) += M_IDX(D, n, i, k + 1);
+			}
+		}
+
+		/* order and step size selection */
+		if (n_equal_steps >= order + 1) {
+			float err_m = INFINITY;
+			float err_p = INFINITY;
+			if (order > 1) {
+				for (uint i = 1; i <= n; i++) {
+					V_IDX(dy, i) = bdf_error_const[order - 1]
+					               * M_IDX(D, n, i, order + 1);
+				}
+				err_m = bdf_norm(n, dy, scale);
+			}
+			if (order < BDF_MAXORDER) {
+				for (uint i = 1; i <= n; i++) {
+					V_IDX(dy, i) = bdf_error_const[order + 1]
+					               * M_IDX(D, n, i, order + 3);
+				}
+				err_p = bdf_norm(n, dy, scale);
+			}
+			float fm = powf(err_m, -1.0f / order);
+			float f0 = powf(error_norm, -1.0f / (order + 1));
+			float fp = powf(err_p, -1.0f / (order + 2));
+			float best = f0;
+			if (fm > best) {
+				best = fm;
+			}
+			if (fp > best) {
+				best = fp;
+			}
+			if (best == fm) {
+				order--;
+			} else if (best == fp && best != f0) {
+				order++;
+			}
+			float factor = fminf(BDF_MAX_FACTOR, safety * best);
+			uint oi = o;
+			while (oi <= nout && V_IDX(tout, oi) <= t) {
+				oi++;
+			}
+			factor = ode_warm_cap(warm, nout, oi, h * factor, h)
+			         / h;
+			h *= factor;
+			bdf_change_D(n, D, order, factor, work);
+			n_equal_steps = 0;
+			have_lu = 0;
+		}
+
+		/* dense output: interpolate with the differences */
+		for (; o <= nout && V_IDX(tout, o) <= t; o++) {
+			if (warm && warm->h) {
+				V_IDX(warm->h, o) = h_acc;
+			}
+			for (uint i = 1; i <= n; i++) {
+				float p = 1.0f;
+				float acc = M_IDX(D, n, i, 1);
+				for (uint k = 1; k <= order; k++) {
+					p *= (V_IDX(tout, o) - (t - h * (k - 1)))
+					     / (h * k);
+					acc += M_IDX(D, n, i, k + 1) * p;
+				}
+				M_IDX(Yout, n, i, o) = acc;
+			}
+		}
+	}
+
+done:
+	if (warm) {
+		warm->valid = (status == 0);
+		warm->h0 = h0;
+		warm->order = order;
+	}
+	if (stats) {
+		*stats = st;
+	}
+
+	/* clean up */
+	if (!df) {
+		jac_fd_free(&fd);
+	}
+	free(work);
+	free(scale);
+	free(fv);
+	free(dy);
+	free(d);
+	free(psi);
+	free(yn);
+	free(yp);
+	free(ipiv);
+	free(LU);
+	free(J);
+	free(D);
+
+	return status;
+}
+
+/*
+ * Rodas3 coefficients (Sandu et al., 1997), in the formulation of Hairer
+ * and Wanner where the stages solve (1/(h gamma) - J) k_s = ... without
+ * any matrix-vector product. The method is stiffly accurate, of order 3
+ * with an embedded method of order 2.
+ */
+#define ROS_STAGES 4
+#define ROS_MAXSTEPS 100000
+static const float ros_gamma = 0.5f;
+static const float ros_alpha[ROS_STAGES] = { 0.0f, 0.0f, 1.0f, 1.0f };
+static const float ros_gammas[ROS_STAGES] = { 0.5f, 1.5f, 0.0f, 0.0f };
+static const float ros_a[ROS_STAGES][ROS_STAGES - 1] = {
+	{ 0.0f },
+	{ 0.0f },
+	{ 2.0f, 0.0f },
+	{ 2.0f, 0.0f, 1.0f }
+};
+static const float ros_c[ROS_STAGES][ROS_STAGES - 1] = {
+	{ 0.0f },
+	{ 4.0f },
+	{ 1.0f, -1.0f },
+	{ 1.0f, -1.0f, -8.0f / 3.0f }
+};
+static const float ros_m[ROS_STAGES] = { 2.0f, 0.0f, 1.0f, 1.0f };
+static const float ros_e[ROS_STAGES] = { 0.0f, 0.0f, 0.0f, 1.0f };
 
 /**
- * rk4() - Fourth-order Runge-Kutta method
- * @n:         A positive integer.
- * @f:         f : R x R^n -> R^n.
- * @t0:        Initial time.
- * @y:         Vector of size n. Input: y(t0). Output: y(t1).
- * @t1:        Final time.
- * @N:         Number of steps.
+ * rosenbrock() - adaptive Rosenbrock method
+ * @n:                 Dimension of the problem.
+ * @f:                 f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @df:                The Jacobian of f, called as df(t, y, Df(t,y), ctx),
+ *                     or NULL to approximate it by differences of f.
+ * @ctx:               User data passed to f and df.
+ * @t0:                Initial time.
+ * @y:                 Vector of size n. Input: y(t0). Output:
+ *                     y(tout(nout)), or the last accepted state on failure.
+ * @nout:              Number of output times.
+ * @tout:              Output times, sorted, with t0 <= tout(1) and
+ *                     t0 < tout(nout).
+ * @Yout:              n-by-nout matrix. Output: y(tout(k)) in column k.
+ * @rtol:              Relative tolerance.
+ * @atol:              Absolute tolerance.
+ * @stats:             If not NULL, receives the work statistics.
  *
- * Computes y(t1), where y' = f(t,y) and y(t0) = y0.
+ * Linearly implicit method Rodas3: each step evaluates the Jacobian once,
+ * factors 1/(h gamma) - J once and solves four linear systems, with no
+ * Newton iteration. The time derivative of f is approximated by a finite
+ * difference. The step size keeps the embedded error estimate below one
+ * in the weighted RMS norm with weights atol + rtol |y|. Outputs inside a
+ * step use cubic Hermite interpolation.
+ *
+ * Return: 0 on success, -1 if the step size underflowed or the step
+ * limit was reached, -2 if the solution stopped being finite. Outputs
+ * beyond the point of failure are left untouched.
  */
-void rk4(uint n, void (*f)(float, float *, float *),
-         float t0, float *y, float t1, uint N)
+int rosenbrock(uint n, void (*f)(float, float *, float *, void *),
+               void (*df)(float, float *, float *, void *), void *ctx,
+               float t0, float *y, uint nout, const float *tout,
+               float *Yout, float rtol, float atol,
+               struct ode_stats *stats)
 {
-	assert(t0 < t1);
+	assert(nout > 0);
+	assert(t0 <= V_IDX(tout, 1));
+	assert(V_IDX(tout, 1) <= V_IDX(tout, nout));
+	assert(t0 < V_IDX(tout, nout));
+	assert(rtol > 0.0f || atol > 0.0f);
 
 	/* allocate memory */
-	float *k1 = create_vector(n);
-	float *k2 = create_vector(n);
-	float *k3 = create_vector(n);
-	float *k4 = create_vector(n);
+	float *k = create_matrix(n, ROS_STAGES);
+	float *J = create_matrix(n, n);
+	float *LU = create_vector(LU_SIZE(n));
+	int *ipiv = (int *)malloc(sizeof(int) * LU_IPIV(n));
+	assert(ipiv);
+	float *f0 = create_vector(n);
+	float *f1 = create_vector(n);
+	float *ft = create_vector(n);
+	float *y1 = create_vector(n);
 	float *z = create_vector(n);
+	float *err = create_vector(n);
+	struct jac_fd fd;
+	if (!df) {
+		jac_fd_init(&fd, n, NULL);
+	}
+
+	struct ode_stats st = { 0 };
+	float tend = V_IDX(tout, nout);
+	float t = t0;
+	uint o = 1;
+	int status = 0;
+
+	/* outputs at t0 */
+	for (; o <= nout && V_IDX(tout, o) <= t0; o++) {
+		m_copy(n, 1, n, M_COL(Yout, n, o), n, y);
+	}
+
+	f(t, y, f0, ctx);
+	st.nfev++;
+
+	/* initial step, as in dopri5() but for a third order method */
+	float d0 = wrms_norm(n, y, y, y, rtol, atol);
+	float d1 = wrms_norm(n, f0, y, y, rtol, atol);
+	float h = (d0 < 1e-5f || d1 < 1e-5f ? 1e-6f : 0.01f * d0 / d1);
+	h = fminf(h, tend - t0);
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(z, i) = V_IDX(y, i) + h * V_IDX(f0, i);
+	}
+	f(t + h, z, err, ctx);
+	st.nfev++;
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(err, i) = (V_IDX(err, i) - V_IDX(f0, i)) / h;
+	}
+	float d2 = wrms_norm(n, err, y, y, rtol, atol);
+	float dm = fmaxf(d1, d2);
+	float h1 = (dm <= 1e-15f ? fmaxf(1e-6f, h * 1e-3f)
+	                         : cbrtf(0.01f / dm));
+	h = fminf(fminf(100.0f * h, h1), tend - t0);
+
+	int rejected = 0;
+	int have_jac = 0;
+	while (o <= nout) {
+		if (st.nsteps + st.nreject >= ROS_MAXSTEPS || t + h == t) {
+			status = -1;
+			break;
+		}
+		int last = (t + h >= tend);
+		if (last) {
+			h = tend - t;
+		}
+
+		/* Jacobian and time derivative at (t, y), once per step */
+		if (!have_jac) {
+			if (df) {
+				df(t, y, J, ctx);
+			} else {
+				st.nfev += jac_fd_eval(n, &fd, f, ctx, t, y,
+				                       f0, J);
+			}
+			st.njev++;
+			float dt = sqrtf(1.2e-7f) * fmaxf(1e-5f, fabsf(t));
+			f(t + dt, y, ft, ctx);
+			st.nfev++;
+			for (uint i = 1; i <= n; i++) {
+				V_IDX(ft, i) = (V_IDX(ft, i) - V_IDX(f0, i)) / dt;
+			}
+			have_jac = 1;
+		}
+
+		/* LU = 1/(h gamma) - J */
+		for (uint j = 1; j <= n; j++) {
+			for (uint i = 1; i <= n; i++) {
+				M_IDX(LU, n, i, j) = (i == j) / (h * ros_gamma)
+				                     - M_IDX(J, n, i, j);
+			}
+		}
+		st.ndecomp++;
+		if (lu_factor(n, LU, ipiv)) {
+			st.nreject++;
+			rejected = 1;
+			h *= 0.5f;
+			continue;
+		}
+
+		/* stages */
+		for (uint s = 1; s <= ROS_STAGES; s++) {
+			float *ks = M_COL(k, n, s);
+			if (s <= 2) {
+				/* both stages evaluate f at (t, y) */
+				m_copy(n, 1, n, ks, n, f0);
+			} else {
+				for (uint i = 1; i <= n; i++) {
+					float acc = 0.0f;
+					for (uint r = 1; r < s; r++) {
+						acc += ros_a[s - 1][r - 1]
+						       * M_IDX(k, n, i, r);
+					}
+					V_IDX(z, i) = V_IDX(y, i) + acc;
+				}
+				f(t + ros_alpha[s - 1] * h, z, ks, ctx);
+				st.nfev++;
+			}
+			for (uint i = 1; i <= n; i++) {
+				float acc = 0.0f;
+				for (uint r = 1; r < s; r++) {
+					acc += ros_c[s - 1][r - 1]
+					       * M_IDX(k, n, i, r);
+				}
+				V_IDX(ks, i) += acc / h
+				                + h * ros_gammas[s - 1]
+				                  * V_IDX(ft, i);
+			}
+			lu_solve(n, LU, ipiv, ks);
+		}
+
+		/* new solution and error estimate */
+		for (uint i = 1; i <= n; i++) {
+			float acc = 0.0f;
+			float e = 0.0f;
+			for (uint r = 1; r <= ROS_STAGES; r++) {
+				acc += ros_m[r - 1] * M_IDX(k, n, i, r);
+				e += ros_e[r - 1] * M_IDX(k, n, i, r);
+			}
+			V_IDX(y1, i) = V_IDX(y, i) + acc;
+			V_IDX(err, i) = e;
+		}
+		float e = wrms_norm(n, err, y, y1, rtol, atol);
+		if (!isfinite(e)) {
+			if (!isfinite(v_norm(n, y1)) && h < 1e-6f * (tend - t0)) {
+				status = -2;
+				break;
+			}
+			e = 1e10f;
+		}
+
+		float fac = 0.9f * cbrtf(1.0f / fmaxf(e, 1e-10f));
+		if (e > 1.0f) {
+			st.nreject++;
+			rejected = 1;
+			h *= fmaxf(0.2f, fminf(1.0f, fac));
+			continue;
+		}
+		st.nsteps++;
+		float t1 = (last ? tend : t + h);
+		f(t1, y1, f1, ctx);
+		st.nfev++;
+
+		/* cubic Hermite interpolation inside [t, t1] */
+		for (; o <= nout && V_IDX(tout, o) <= t1; o++) {
+			float th = (V_IDX(tout, o) - t) / h;
+			for (uint i = 1; i <= n; i++) {
+				float y0i = V_IDX(y, i);
+				float dy = V_IDX(y1, i) - y0i;
+				M_IDX(Yout, n, i, o) =
+					y0i + th * dy + th * (th - 1.0f)
+					* ((1.0f - 2.0f * th) * dy
+					   + (th - 1.0f) * h * V_IDX(f0, i)
+					   + th * h * V_IDX(f1, i));
+			}
+		}
+
+		/* accept the step */
+		m_copy(n, 1, n, y, n, y1);
+		m_copy(n, 1, n, f0, n, f1);
+		t = t1;
+		have_jac = 0;
+
+		h *= fminf(rejected ? 1.0f : 6.0f, fmaxf(0.2f, fac));
+		rejected = 0;
+	}
+
+	if (stats) {
+		*stats = st;
+	}
+
+	/* clean up */
+	if (!df) {
+		jac_fd_free(&fd);
+	}
+	free(err);
+	free(z);
+	free(y1);
+	free(ft);
+	free(f1);
+	free(f0);
+	free(ipiv);
+	free(LU);
+	free(J);
+	free(k);
+
+	return status;
+}
+
+/*
+ * Ensemble integrators
+ *
+ * The functions below integrate W copies of the same system at once, one
+ * SIMD lane per copy. States are stored in structure-of-arrays layout: the
+ * W states form a W-by-n column-major matrix Y, so that component i of
+ * system w is M_IDX(Y, W, w, i) and the inner loops run over w with unit
+ * stride. Jacobians are stored as W-by-(n * n) matrices: entry (i,j) of
+ * the Jacobian of system w is M_IDX(J, W, w, (j - 1) * n + i).
+ */
+
+/* Entry (i,j) of the n-by-n matrix of lane w in the SoA array A. */
+#define E_IDX(A, W, n, w, i, j) M_IDX(A, W, w, ((j) - 1) * (n) + (i))
+
+/**
+ * rk4_ens() - Fourth-order Runge-Kutta method on an ensemble of systems
+ * @n:             Dimension of each system.
+ * @W:             Number of systems.
+ * @f:             Called as f(W, t, Y, F, ctx). Sets F(., i) to the right-
+ *                 hand side of system i evaluated at (t, Y(., i)).
+ * @ctx:           User data passed to f.
+ * @t0:            Initial time.
+ * @Y:             W-by-n matrix. Input: the W initial states. Output: the
+ *                 W states at t1.
+ * @t1:            Final time.
+ * @N:             Number of steps.
+ *
+ * Same as rk4(), in lockstep on W systems. See the layout notes above.
+ */
+void rk4_ens(uint n, uint W, void (*f)(uint, float, float *, float *, void *),
+             void *ctx, float t0, float *Y, float t1, uint N)
+{
+	assert(t0 < t1);
+
+	uint size = n * W;
+
+	/* allocate memory */
+	float *k1 = create_vector(size);
+	float *k2 = create_vector(size);
+	float *k3 = create_vector(size);
+	float *k4 = create_vector(size);
+	float *z = create_vector(size);
 
 	float h = (t1 - t0) / N;
 	float t = t0;
 
 	for (uint i = 1; i <= N; i++) {
-		/* k1 = f(t,y) */
-		f(t, y, k1);
+		f(W, t, Y, k1, ctx);
 
-		/* k2 = f(t + h/2, y + h/2 k1) */
-		for (uint j = 1; j <= n; j++) {
-			V_IDX(z, j) = V_IDX(y, j) + 0.5f * h * V_IDX(k1, j);
+		#pragma omp simd
+		for (uint j = 1; j <= size; j++) {
+			V_IDX(z, j) = V_IDX(Y, j) + 0.5f * h * V_IDX(k1, j);
 		}
-		f(t + 0.5f * h, z, k2);
+		f(W, t + 0.5f * h, z, k2, ctx);
 
-		/* k2 = f(t + h/2, y + h/2 k2) */
-		for (uint j = 1; j <= n; j++) {
-			V_IDX(z, j) = V_IDX(y, j) + 0.5f * h * V_IDX(k2, j);
+		#pragma omp simd
+		for (uint j = 1; j <= size; j++) {
+			V_IDX(z, j) = V_IDX(Y, j) + 0.5f * h * V_IDX(k2, j);
 		}
-		f(t + 0.5f * h, z, k3);
+		f(W, t + 0.5f * h, z, k3, ctx);
 
-		/* k2 = f(t + h, y + h k3) */
-		for (uint j = 1; j <= n; j++) {
-			V_IDX(z, j) = V_IDX(y, j) + h * V_IDX(k3, j);
+		#pragma omp simd
+		for (uint j = 1; j <= size; j++) {
+			V_IDX(z, j) = V_IDX(Y, j) + h * V_IDX(k3, j);
 		}
-		f(t + h, z, k4);
+		f(W, t + h, z, k4, ctx);
 
-		/* y <- y + h/6 (k1 + 2k2 + 2k3 + k4) */
-		for (uint j = 1; j <= n; j++) {
-			V_IDX(y, j) += (V_IDX(k1, j) + 2.0f * V_IDX(k2, j)
+		#pragma omp simd
+		for (uint j = 1; j <= size; j++) {
+			V_IDX(Y, j) += (V_IDX(k1, j) + 2.0f * V_IDX(k2, j)
 			                + 2.0f * V_IDX(k3, j)
 			                + V_IDX(k4, j)) * h / 6.0f;
 		}
@@ -84,75 +3318,625 @@ void rk4(uint n, void (*f)(float, float *, float *),
 }
 
 /**
- * bdf1() - Backwards Euler method
- * @n:          Dimension of the problem.
- * @f:          f : R x R^n -> R^n.
- * @df:         The Jacobian of f.
- * @t0:         Initial time.
- * @y:          Vector of size n. Input: y(t0). Output: y(t1).
- * @t1:         Final time.
- * @N:          Number of steps.
- * @tol:        Tolerance internally used in Newton's method.
+ * ens_solve() - solve W linear systems in lockstep
+ * @n:             Dimension of each system.
+ * @W:             Number of systems.
+ * @D:             W-by-(n * n) matrix, the W matrices. Overwritten.
+ * @z:             W-by-n matrix. Input: the W right-hand sides. Output:
+ *                 the W solutions.
+ * @p:             Scratch vector of size W.
  *
- * Computes y(t1), where y' = f(t,y) and y(t0) = y0.
+ * Gaussian elimination with partial pivoting. The pivot is chosen per
+ * lane, and rows are swapped with masked selects, so that every loop
+ * over w stays branch-free.
  */
-void bdf1(uint n, void (*f)(float, float *, float *),
-	  void (*df)(float, float *, float *),
-          float t0, float *y, float t1, uint N, float tol)
+static void ens_solve(uint n, uint W, float *D, float *z, uint *p)
+{
+	for (uint k = 1; k <= n; k++) {
+		/* pivot search */
+		#pragma omp simd
+		for (uint w = 1; w <= W; w++) {
+			float best = fabsf(E_IDX(D, W, n, w, k, k));
+			uint piv = k;
+			for (uint i = k + 1; i <= n; i++) {
+				float a = fabsf(E_IDX(D, W, n, w, i, k));
+				piv = (a > best ? i : piv);
+				best = (a > best ? a : best);
+			}
+			V_IDX(p, w) = piv;
+		}
+
+		/* row swaps */
+		for (uint i = k + 1; i <= n; i++) {
+			for (uint j = k; j <= n; j++) {
+				#pragma omp simd
+				for (uint w = 1; w <= W; w++) {
+					int s = (V_IDX(p, w) == i);
+					float a = E_IDX(D, W, n, w, k, j);
+					float b = E_IDX(D, W, n, w, i, j);
+					E_IDX(D, W, n, w, k, j) = (s ? b : a);
+					E_IDX(D, W, n, w, i, j) = (s ? a : b);
+				}
+			}
+			#pragma omp simd
+			for (uint w = 1; w <= W; w++) {
+				int s = (V_IDX(p, w) == i);
+				float a = M_IDX(z, W, w, k);
+				float b = M_IDX(z, W, w, i);
+				M_IDX(z, W, w, k) = (s ? b : a);
+				M_IDX(z, W, w, i) = (s ? a : b);
+			}
+		}
+
+		/* elimination */
+		for (uint i = k + 1; i <= n; i++) {
+			#pragma omp simd
+			for (uint w = 1; w <= W; w++) {
+				float c = E_IDX(D, W, n, w, i, k)
+				          / E_IDX(D, W, n, w, k, k);
+				for (uint j = k + 1; j <= n; j++) {
+					E_IDX(D, W, n, w, i, j) -=
+						c * E_IDX(D, W, n, w, k, j);
+				}
+				M_IDX(z, W, w, i) -= c * M_IDX(z, W, w, k);
+			}
+		}
+	}
+
+	/* back substitution */
+	for (uint i = n; i >= 1; i--) {
+		#pragma omp simd
+		for (uint w = 1; w <= W; w++) {
+			float s = M_IDX(z, W, w, i);
+			for (uint j = i + 1; j <= n; j++) {
+				s -= E_IDX(D, W, n, w, i, j) * M_IDX(z, W, w, j);
+			}
+			M_IDX(z, W, w, i) = s / E_IDX(D, W, n, w, i, i);
+		}
+	}
+}
+
+/**
+ * bdf1_ens_step() - one step of bdf1_ens()
+ * @n, @W, @f, @df, @ctx, @tol:   See bdf1_ens().
+ * @t:                            Time at the end of the step.
+ * @Y:                            W-by-n matrix. Input: the states at
+ *                                t - h. Output: the states at t.
+ * @h:                            Step size.
+ * @x, @z:                        Scratch W-by-n matrices.
+ * @D:                            Scratch W-by-(n * n) matrix.
+ * @p:                            Scratch vector of size W.
+ * @active:                       Scratch vector of size W.
+ *
+ * The lanes whose Newton iteration has not converged after BDF1_MAXIT
+ * iterations are set to NaN.
+ *
+ * Return: the number of Newton iterations, each of which evaluates f and
+ * df once on the whole ensemble.
+ */
+static uint bdf1_ens_step(uint n, uint W,
+                          void (*f)(uint, float, float *, float *, void *),
+                          void (*df)(uint, float, float *, float *, void *),
+                          void *ctx, float t, float *Y, float h, float tol,
+                          float *x, float *z, float *D, uint *p, int *active)
+{
+	uint size = n * W;
+
+	/* x <- y */
+	m_copy(size, 1, size, x, size, Y);
+	for (uint w = 1; w <= W; w++) {
+		V_IDX(active, w) = 1;
+	}
+
+	int nactive;
+	uint it = 0;
+	do {
+		if (it == BDF1_MAXIT) {
+			for (uint w = 1; w <= W; w++) {
+				for (uint k = 1; V_IDX(active, w) && k <= n;
+				     k++) {
+					M_IDX(x, W, w, k) = NAN;
+				}
+			}
+			break;
+		}
+		it++;
+
+		/* D = 1 - hJ(t,x) */
+		df(W, t, x, D, ctx);
+		#pragma omp simd
+		for (uint j = 1; j <= size * n; j++) {
+			V_IDX(D, j) *= -h;
+		}
+		for (uint k = 1; k <= n; k++) {
+			#pragma omp simd
+			for (uint w = 1; w <= W; w++) {
+				E_IDX(D, W, n, w, k, k) += 1.0f;
+			}
+		}
+
+		/* z = x - y - hf(t,x) */
+		f(W, t, x, z, ctx);
+		#pragma omp simd
+		for (uint j = 1; j <= size; j++) {
+			V_IDX(z, j) = V_IDX(x, j) - V_IDX(Y, j)
+			              - h * V_IDX(z, j);
+		}
+
+		/* Replace z with D^(-1)z */
+		ens_solve(n, W, D, z, p);
+
+		/* x -= z on active lanes, then update the mask */
+		nactive = 0;
+		for (uint w = 1; w <= W; w++) {
+			if (!V_IDX(active, w)) {
+				continue;
+			}
+			float nz = 0.0f;
+			for (uint k = 1; k <= n; k++) {
+				float zk = M_IDX(z, W, w, k);
+				M_IDX(x, W, w, k) -= zk;
+				nz += zk * zk;
+			}
+			V_IDX(active, w) = (sqrtf(nz) > tol);
+			nactive += V_IDX(active, w);
+		}
+	} while (nactive > 0);
+
+	/* y <- x */
+	m_copy(size, 1, size, Y, size, x);
+	return it;
+}
+
+/**
+ * bdf1_ens() - Backwards Euler method on an ensemble of systems
+ * @n:              Dimension of each system.
+ * @W:              Number of systems.
+ * @f:              Called as f(W, t, Y, F, ctx). See rk4_ens().
+ * @df:             Called as df(W, t, Y, J, ctx). Sets J to the W
+ *                  Jacobians, in the layout described above.
+ * @ctx:            User data passed to f and df.
+ * @t0:             Initial time.
+ * @Y:              W-by-n matrix. Input: the W initial states. Output: the
+ *                  W states at t1.
+ * @t1:             Final time.
+ * @N:              Number of steps.
+ * @tol:            Tolerance internally used in Newton's method.
+ *
+ * Same as bdf1(), in lockstep on W systems. Newton's method is run until
+ * every lane has converged; lanes that converge early are masked and no
+ * longer updated, so each lane gets the same iterates as bdf1() would
+ * give it, up to the pivoting strategy of the linear solver.
+ */
+void bdf1_ens(uint n, uint W, void (*f)(uint, float, float *, float *, void *),
+              void (*df)(uint, float, float *, float *, void *), void *ctx,
+              float t0, float *Y, float t1, uint N, float tol)
 {
 	assert(t0 < t1);
 
+	uint size = n * W;
+
 	/* allocate memory */
-	float *x = create_vector(n);
-	float *z = create_vector(n);
-	float *D = create_matrix(n, n);
-	int *ipiv = (int*)malloc(sizeof(int) * n);
-	assert(ipiv);
+	float *x = create_vector(size);
+	float *z = create_vector(size);
+	float *D = create_vector(size * n);
+	uint *p = (uint *)malloc(sizeof(uint) * W);
+	assert(p);
+	int *active = (int *)malloc(sizeof(int) * W);
+	assert(active);
 
 	float h = (t1 - t0) / (float)N;
 	float t = t0;
 
 	for (uint i = 1; i <= N; i++) {
 		t += h;
+		bdf1_ens_step(n, W, f, df, ctx, t, Y, h, tol,
+		              x, z, D, p, active);
+	}
+
+	free(active);
+	free(p);
+	free(D);
+	free(z);
+	free(x);
+}
 
-		/* F(t,x) = x - y - hf(t,x)
-		 * J(t,x) = 1 - hDf(t,x)
-		 *
-		 * Newton iteration:
-		 *   x0 = y
-		 *   x_{i+1} = x_i - inv(J(t,x_i))F(t,x_i)
-		 */
+/**
+ * bdf1_ens_sweep() - bdf1_sweep() on an ensemble of systems
+ * @n, @W, @f, @df, @ctx:    See bdf1_ens().
+ * @t0:                      Initial time.
+ * @Y:                       W-by-n matrix. Input: the W initial states.
+ *                           Output: the W states at tout(nout).
+ * @nout, @tout, @N, @tol:   See bdf1_sweep().
+ * @Yout:                    W-by-(n * nout) matrix. Output: the W states
+ *                           at tout(k) in columns (k - 1) * n + 1 to
+ *                           k * n.
+ */
+void bdf1_ens_sweep(uint n, uint W,
+                    void (*f)(uint, float, float *, float *, void *),
+                    void (*df)(uint, float, float *, float *, void *),
+                    void *ctx, float t0, float *Y, uint nout,
+                    const float *tout, float *Yout, uint N, float tol)
+{
+	assert(nout > 0);
+	assert(t0 <= V_IDX(tout, 1));
+	assert(V_IDX(tout, 1) <= V_IDX(tout, nout));
+	assert(t0 < V_IDX(tout, nout));
 
-		/* x <- y */
-		m_copy(n, 1, n, x, n, y);
+	uint size = n * W;
 
-		do {
-			/* D = 1 - hJ(t,x) */
-			df(t, x, D);
-			m_scale(n, n, n, D, -h);
-			for (uint i = 1; i <= n; i++) {
-				M_IDX(D, n, i, i) += 1.0f;
+	/* allocate memory */
+	float *x = create_vector(size);
+	float *z = create_vector(size);
+	float *D = create_vector(size * n);
+	float *Y0 = create_vector(size);
+	uint *p = (uint *)malloc(sizeof(uint) * W);
+	assert(p);
+	int *active = (int *)malloc(sizeof(int) * W);
+	assert(active);
+
+	float tend = V_IDX(tout, nout);
+	float h = (tend - t0) / (float)N;
+	float t = t0;
+	uint k = 1;
+
+	/* outputs at t0 */
+	for (; k <= nout && V_IDX(tout, k) <= t0; k++) {
+		m_copy(size, 1, size, M_COL(Yout, size, k), size, Y);
+	}
+
+	for (uint i = 1; i <= N && k <= nout; i++) {
+		/* recompute the step to avoid drifting away from tend */
+		float t1 = (i == N ? tend : t0 + i * h);
+		float hi = t1 - t;
+
+		m_copy(size, 1, size, Y0, size, Y);
+		bdf1_ens_step(n, W, f, df, ctx, t1, Y, hi, tol,
+		              x, z, D, p, active);
+
+		/* linear interpolation inside [t, t1] */
+		for (; k <= nout && V_IDX(tout, k) <= t1; k++) {
+			float s = (V_IDX(tout, k) - t) / hi;
+			float *out = M_COL(Yout, size, k);
+			#pragma omp simd
+			for (uint j = 1; j <= size; j++) {
+				V_IDX(out, j) = (1.0f - s) * V_IDX(Y0, j)
+				                + s * V_IDX(Y, j);
 			}
+		}
+		t = t1;
+	}
 
-			/* z = x - y - hf(t,x) */
-			f(t, x, z);
-			for (uint i = 1; i <= n; i++) {
-				V_IDX(z, i) = V_IDX(x, i) - V_IDX(y, i)
-				              - h * V_IDX(z, i);
+	free(active);
+	free(p);
+	free(Y0);
+	free(D);
+	free(z);
+	free(x);
+}
+
+/*
+ * Shared Newton matrix
+ *
+ * The systems of an ensemble are often close to each other, as the points
+ * of a cluster are, and so are their Jacobians. bdf1_ens_shared_sweep()
+ * factors a single matrix 1 - hJ, where J is the mean of the W Jacobians
+ * (to first order, the Jacobian at the centroid), and uses it for the
+ * simplified Newton iterations of every lane. The factors are kept across
+ * iterations and steps, and refreshed only when a lane contracts slower
+ * than BDF1_RATE_FAIL or needs more than BDF1_ENS_MAXIT iterations. A
+ * step falls back to the exact Jacobian of each lane, as in
+ * bdf1_ens_step(), after BDF1_ENS_REFRESH refreshes, or when the
+ * Jacobians are too far apart for their mean to stand for all of them:
+ * the norms of the iterates do not reveal that reliably, as the
+ * components on which the lanes agree converge at once and hide the
+ * others. A spread that large does not go away in one step, so the next
+ * BDF1_ENS_BACKOFF steps fall back at once, without evaluating the mean.
+ */
+#define BDF1_ENS_MAXIT 8
+#define BDF1_ENS_REFRESH 2
+#define BDF1_ENS_SPREAD 0.5f
+#define BDF1_ENS_BACKOFF 8
+
+/**
+ * struct ens_newton - state of the shared Newton matrix
+ * @LU, @ipiv:          Factors of 1 - hJ, see lu_factor().
+ * @h:                  Step size the factors were computed with, or zero
+ *                      if there are none.
+ * @skip:               Number of steps left to fall back to one matrix per
+ *                      lane without trying the shared one.
+ * @b:                  Scratch vector of size n.
+ * @nold:               Vector of size W, the last correction of each lane.
+ * @dev:                Scratch vector of size W.
+ * @stats:              Counters, updated as the method proceeds.
+ */
+struct ens_newton {
+	float *LU;
+	int *ipiv;
+	float h;
+	uint skip;
+	float *b;
+	float *nold;
+	float *dev;
+	struct ode_stats *stats;
+};
+
+/*
+ * ens_refresh() - factor 1 - hJ, with J the mean Jacobian at the states X
+ *
+ * Return: 0 on success, nonzero if the matrix is singular or if the
+ * Jacobian of a lane is further than BDF1_ENS_SPREAD from the mean,
+ * relative to its Frobenius norm, in which case the next BDF1_ENS_BACKOFF
+ * steps are set to fall back.
+ */
+static int ens_refresh(uint n, uint W,
+                       void (*df)(uint, float, float *, float *, void *),
+                       void *ctx, float t, float *X, float h, float *D,
+                       struct ens_newton *en)
+{
+	float *dev = en->dev;
+	float norm = 0.0f;
+
+	df(W, t, X, D, ctx);
+	en->stats->njev++;
+	for (uint w = 1; w <= W; w++) {
+		V_IDX(dev, w) = 0.0f;
+	}
+	for (uint j = 1; j <= n; j++) {
+		for (uint i = 1; i <= n; i++) {
+			float s = 0.0f;
+			#pragma omp simd reduction(+:s)
+			for (uint w = 1; w <= W; w++) {
+				s += E_IDX(D, W, n, w, i, j);
 			}
+			s /= W;
+			#pragma omp simd
+			for (uint w = 1; w <= W; w++) {
+				float d = E_IDX(D, W, n, w, i, j) - s;
+				V_IDX(dev, w) += d * d;
+			}
+			norm += s * s;
+			M_IDX(en->LU, n, i, j) = (i == j) - h * s;
+		}
+	}
+	for (uint w = 1; w <= W; w++) {
+		if (V_IDX(dev, w) > BDF1_ENS_SPREAD * BDF1_ENS_SPREAD * norm) {
+			en->h = 0.0f;
+			en->skip = BDF1_ENS_BACKOFF;
+			return 1;
+		}
+	}
 
-			/* Replace z with D^(-1)z */
-			LAPACKE_sgesv(LAPACK_COL_MAJOR, n, 1, D, n, ipiv,
-			              z, n);
+	en->stats->ndecomp++;
+	if (lu_factor(n, en->LU, en->ipiv)) {
+		en->h = 0.0f;
+		return 1;
+	}
+	en->h = h;
+	return 0;
+}
 
-			/* x -= z */
-			m_sub(n, 1, n, x, n, z);
-		} while (v_norm(n, z) > tol);
+/**
+ * bdf1_ens_shared_step() - one step of bdf1_ens_shared_sweep()
+ * @n, @W, @f, @df, @ctx, @tol:   See bdf1_ens().
+ * @t, @Y, @h:                    See bdf1_ens_step().
+ * @x, @z, @D, @p, @active:       See bdf1_ens_step().
+ * @en:                           State of the shared Newton matrix.
+ */
+static void bdf1_ens_shared_step(uint n, uint W,
+                                 void (*f)(uint, float, float *, float *,
+                                           void *),
+                                 void (*df)(uint, float, float *, float *,
+                                            void *),
+                                 void *ctx, float t, float *Y, float h,
+                                 float tol, float *x, float *z, float *D,
+                                 uint *p, int *active, struct ens_newton *en)
+{
+	uint size = n * W;
+	uint refreshes = 0;
+	uint it = 0;
+	float rate = 0.0f;
+
+	if (en->skip > 0) {
+		en->skip--;
+		goto fallback;
+	}
+
+	/* x <- y */
+	m_copy(size, 1, size, x, size, Y);
+	for (uint w = 1; w <= W; w++) {
+		V_IDX(active, w) = 1;
+	}
+
+	if (en->h == 0.0f || fabsf(h - en->h) > 0.2f * en->h) {
+		if (ens_refresh(n, W, df, ctx, t, x, h, D, en)) {
+			goto fallback;
+		}
+		refreshes++;
+	}
+
+	for (;;) {
+		/* z = x - y - hf(t,x) */
+		f(W, t, x, z, ctx);
+		en->stats->nfev++;
+		en->stats->nniter++;
+		#pragma omp simd
+		for (uint j = 1; j <= size; j++) {
+			V_IDX(z, j) = V_IDX(x, j) - V_IDX(Y, j)
+			              - h * V_IDX(z, j);
+		}
+
+		/* x -= (1 - hJ)^(-1) z on active lanes */
+		int nactive = 0;
+		int slow = 0;
+		it++;
+		for (uint w = 1; w <= W; w++) {
+			if (!V_IDX(active, w)) {
+				continue;
+			}
+			for (uint k = 1; k <= n; k++) {
+				V_IDX(en->b, k) = M_IDX(z, W, w, k);
+			}
+			lu_solve(n, en->LU, en->ipiv, en->b);
+			for (uint k = 1; k <= n; k++) {
+				M_IDX(x, W, w, k) -= V_IDX(en->b, k);
+			}
+
+			/* small corrections only mean convergence if they
+			 * also shrink quickly, which takes two of them */
+			float nz = v_norm(n, en->b);
+			int done = (nz == 0.0f);
+			if (!isfinite(nz)) {
+				slow = 1;
+			} else if (it > 1) {
+				float r = nz / V_IDX(en->nold, w);
+				rate = fmaxf(rate, r);
+				slow |= (r > BDF1_RATE_FAIL);
+				done |= (r < 1.0f && r / (1.0f - r) * nz <= tol);
+			}
+			V_IDX(en->nold, w) = nz;
+			V_IDX(active, w) = !done;
+			nactive += V_IDX(active, w);
+		}
+		if (nactive == 0) {
+			break;
+		}
+
+		/* stagnation: restart the step from y, with the matrix
+		 * refreshed there */
+		if (slow || it >= BDF1_ENS_MAXIT) {
+			if (refreshes == BDF1_ENS_REFRESH) {
+				goto fallback;
+			}
+			m_copy(size, 1, size, x, size, Y);
+			for (uint w = 1; w <= W; w++) {
+				V_IDX(active, w) = 1;
+			}
+			if (ens_refresh(n, W, df, ctx, t, x, h, D, en)) {
+				goto fallback;
+			}
+			refreshes++;
+			it = 0;
+			rate = 0.0f;
+		}
+	}
+
+	/* refresh at the next step if slow */
+	if (rate > BDF1_RATE_SLOW) {
+		en->h = 0.0f;
+	}
+	m_copy(size, 1, size, Y, size, x);
+	return;
+
+fallback:
+	en->h = 0.0f;
+	en->stats->nreject++;
+	it = bdf1_ens_step(n, W, f, df, ctx, t, Y, h, tol, x, z, D, p, active);
+	en->stats->nfev += it;
+	en->stats->nniter += it;
+}
+
+/**
+ * bdf1_ens_shared_sweep() - bdf1_ens_sweep(), with a shared Newton matrix
+ * @n, @W, @f, @df, @ctx:         See bdf1_ens().
+ * @t0, @Y, @nout, @tout, @Yout:  See bdf1_ens_sweep().
+ * @N, @tol:                      See bdf1_sweep().
+ * @stats:                        If not NULL, receives the work statistics:
+ *                                evaluations of f and Newton iterations
+ *                                count whole ensembles, including those of
+ *                                the steps that fell back to one matrix
+ *                                per lane, which nreject counts.
+ *                                Evaluations of df and factorizations
+ *                                count the shared matrices only.
+ *
+ * Same as bdf1_ens_sweep(), but the Newton iterations of all the lanes use
+ * one factorization of 1 - hJ, with J the mean of their Jacobians, kept
+ * for as long as it makes every lane converge quickly: see above. The
+ * lanes converge to the same tolerance, but take simplified Newton
+ * iterations, so the results differ from bdf1_ens_sweep() by about tol.
+ * Steps where the systems are too far apart for one matrix fall back to
+ * bdf1_ens_sweep().
+ */
+void bdf1_ens_shared_sweep(uint n, uint W,
+                           void (*f)(uint, float, float *, float *, void *),
+                           void (*df)(uint, float, float *, float *, void *),
+                           void *ctx, float t0, float *Y, uint nout,
+                           const float *tout, float *Yout, uint N, float tol,
+                           struct ode_stats *stats)
+{
+	assert(nout > 0);
+	assert(t0 <= V_IDX(tout, 1));
+	assert(V_IDX(tout, 1) <= V_IDX(tout, nout));
+	assert(t0 < V_IDX(tout, nout));
+
+	uint size = n * W;
+
+	/* allocate memory */
+	float *x = create_vector(size);
+	float *z = create_vector(size);
+	float *D = create_vector(size * n);
+	float *Y0 = create_vector(size);
+	uint *p = (uint *)malloc(sizeof(uint) * W);
+	assert(p);
+	int *active = (int *)malloc(sizeof(int) * W);
+	assert(active);
+	struct ode_stats st = { 0 };
+	struct ens_newton en;
+	en.LU = create_vector(LU_SIZE(n));
+	en.ipiv = (int *)malloc(sizeof(int) * LU_IPIV(n));
+	assert(en.ipiv);
+	en.h = 0.0f;
+	en.skip = 0;
+	en.b = create_vector(n);
+	en.nold = create_vector(W);
+	en.dev = create_vector(W);
+	en.stats = &st;
+
+	float tend = V_IDX(tout, nout);
+	float h = (tend - t0) / (float)N;
+	float t = t0;
+	uint k = 1;
+
+	/* outputs at t0 */
+	for (; k <= nout && V_IDX(tout, k) <= t0; k++) {
+		m_copy(size, 1, size, M_COL(Yout, size, k), size, Y);
+	}
+
+	for (uint i = 1; i <= N && k <= nout; i++) {
+		/* recompute the step to avoid drifting away from tend */
+		float t1 = (i == N ? tend : t0 + i * h);
+		float hi = t1 - t;
+
+		m_copy(size, 1, size, Y0, size, Y);
+		bdf1_ens_shared_step(n, W, f, df, ctx, t1, Y, hi, tol,
+		                     x, z, D, p, active, &en);
+		st.nsteps++;
+
+		/* linear interpolation inside [t, t1] */
+		for (; k <= nout && V_IDX(tout, k) <= t1; k++) {
+			float s = (V_IDX(tout, k) - t) / hi;
+			float *out = M_COL(Yout, size, k);
+			#pragma omp simd
+			for (uint j = 1; j <= size; j++) {
+				V_IDX(out, j) = (1.0f - s) * V_IDX(Y0, j)
+				                + s * V_IDX(Y, j);
+			}
+		}
+		t = t1;
+	}
 
-		/* y <- x */
-		m_copy(n, 1, n, y, n, x);
+	if (stats) {
+		*stats = st;
 	}
 
+	free(en.dev);
+	free(en.nold);
+	free(en.b);
+	free(en.ipiv);
+	free(en.LU);
+	free(active);
+	free(p);
+	free(Y0);
 	free(D);
 	free(z);
 	free(x);
@@ -0,0 +1,721 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Backend for the f2c translation of SLSODE, SLSODA, SLSODES and SLSODPK
+ * (ODEPACK), built by lsode/Makefile, or for the same routines compiled
+ * with gfortran when f2c is not available. It is only compiled when the
+ * tree is built with LSODE=1.
+ *
+ * Both builds are reentrant: local variables are automatic (f2c -a, or
+ * gfortran -fopenmp), and the COMMON blocks holding the solver state
+ * (SLS001, SLSA01, SLSS01, SLPK01) are thread-local, through
+ * lsode/utils/commons.awk or OpenMP THREADPRIVATE directives. Each thread
+ * must use its own lsode_workspace.
+ *
+ * The translation does not depend on libf2c: XERRWV is replaced by a C
+ * version that forwards the messages to a thread-local hook, and the
+ * arithmetic helpers of libf2c are inlined (lsode/runtime).
+ */
+#ifdef HAVE_LSODE
+
+#include "cn.h"
+#include "integrate.h"
+
+#include "f2c.h"
+
+#include <string.h>
+
+/* Maximum number of steps between two output times */
+#define LSODE_MAXSTEPS 100000
+
+int slsode_(U_fp, integer *, real *, real *, real *, integer *, real *,
+            real *, integer *, integer *, integer *, real *, integer *,
+            integer *, integer *, U_fp, integer *);
+int slsoda_(U_fp, integer *, real *, real *, real *, integer *, real *,
+            real *, integer *, integer *, integer *, real *, integer *,
+            integer *, integer *, U_fp, integer *);
+int slsodes_(U_fp, integer *, real *, real *, real *, integer *, real *,
+             real *, integer *, integer *, integer *, real *, integer *,
+             integer *, integer *, U_fp, integer *);
+int slsodpk_(U_fp, integer *, real *, real *, real *, integer *, real *,
+             real *, integer *, integer *, integer *, real *, integer *,
+             integer *, integer *, U_fp, U_fp, integer *);
+int ssrcom_(real *, integer *, integer *);
+int ssrcma_(real *, integer *, integer *);
+int ssrcms_(real *, integer *, integer *);
+int ssrcpk_(real *, integer *, integer *);
+
+/* Message hook of lsode/runtime/xerrwv.c */
+extern _Thread_local void (*lsode_xerrwv_hook)(void *, const char *, integer,
+                                               integer, integer, integer,
+                                               integer, integer, real,
+                                               real);
+extern _Thread_local void *lsode_xerrwv_ctx;
+
+/*
+ * Length of the COMMON blocks saved by SSRCOM (SLSODE: 218, 37), SSRCMA
+ * (SLSODA: 240, 46), SSRCMS (SLSODES: 224, 71) and SSRCPK (SLSODPK: 222,
+ * 50)
+ */
+#define LSODE_RSAV 240
+#define LSODE_ISAV 71
+
+/* IWORK(1..30) holds the optional inputs and outputs */
+#define LSODE_IOPT 30
+
+/**
+ * struct lsode_call - what the Fortran callbacks see as NEQ
+ * @neq:               Dimension of the problem, read by ODEPACK.
+ * @f:                 Right-hand side.
+ * @df:                Its Jacobian, or NULL.
+ * @dfj:               Columns of the Jacobian (LSODE_SPARSE), or NULL.
+ * @psetup:            Preconditioner setup (LSODE_KRYLOV), or NULL.
+ * @psolve:            Preconditioner solve (LSODE_KRYLOV), or NULL.
+ * @ctx:               User data passed to all the above.
+ *
+ * ODEPACK passes NEQ through to F and JAC untouched, and documents that
+ * it may be an array carrying user data after its first element. The
+ * callbacks recover the C functions and their context from it.
+ */
+struct lsode_call {
+	integer neq;
+	void (*f)(float, float *, float *, void *);
+	void (*df)(float, float *, float *, void *);
+	void (*dfj)(float, float *, uint, float *, void *);
+	int (*psetup)(float, float *, float *, float, void *);
+	int (*psolve)(float, float *, float *, float, float *, void *);
+	void *ctx;
+};
+
+/**
+ * struct lsode_workspace - persistent state of the solver
+ * @n:                      Dimension of the problem.
+ * @method:                 Integration method.
+ * @call:                   Callbacks, handed to ODEPACK as NEQ.
+ * @nnz:                    Capacity of the sparsity structure
+ *                          (LSODE_SPARSE).
+ * @structure:              Whether the sparsity structure is given in
+ *                          IWORK(31..) (LSODE_SPARSE).
+ * @mf:                     MF, or JT for SLSODA.
+ * @istate:                 ISTATE: 1 before the first step, 2 afterwards,
+ *                          negative after a failure.
+ * @t:                      Current time.
+ * @rtol:                   Relative tolerance.
+ * @atol:                   Absolute tolerance.
+ * @y:                      Current state, a vector of size n.
+ * @lrw:                    Length of rwork.
+ * @liw:                    Length of iwork.
+ * @rwork:                  RWORK.
+ * @iwork:                  IWORK.
+ * @rsav:                   Real part of the saved COMMON blocks.
+ * @isav:                   Integer part of the saved COMMON blocks.
+ * @err:                    Error handler, or NULL.
+ * @err_ctx:                User data passed to err.
+ *
+ * The COMMON blocks are saved after each call to ODEPACK and restored
+ * before the next one, so that handles can be interleaved on a thread.
+ */
+struct lsode_workspace {
+	uint n;
+	enum lsode_method method;
+	struct lsode_call call;
+	uint nnz;
+	int structure;
+	integer mf;
+	integer istate;
+	real t;
+	real rtol;
+	real atol;
+	real *y;
+	integer lrw;
+	integer liw;
+	real *rwork;
+	integer *iwork;
+	real *rsav;
+	integer *isav;
+	void (*err)(const struct lsode_error *, void *);
+	void *err_ctx;
+};
+
+static int lsode_f(integer *neq, real *t, real *y, real *ydot)
+{
+	struct lsode_call *call = (struct lsode_call *)neq;
+	call->f(*t, y, ydot, call->ctx);
+	return 0;
+}
+
+static int lsode_jac(integer *neq, real *t, real *y, integer *ml,
+                     integer *mu, real *pd, integer *nrowpd)
+{
+	struct lsode_call *call = (struct lsode_call *)neq;
+	assert(*nrowpd == *neq);
+	call->df(*t, y, pd, call->ctx);
+	return 0;
+}
+
+static int lsode_jac_sparse(integer *neq, real *t, real *y, integer *j,
+                            integer *ian, integer *jan, real *pdj)
+{
+	struct lsode_call *call = (struct lsode_call *)neq;
+	call->dfj(*t, y, *j, pdj, call->ctx);
+	return 0;
+}
+
+static int lsode_psetup(U_fp f, integer *neq, real *t, real *y, real *ysv,
+                        real *rewt, real *fty, real *v, real *hl0, real *wp,
+                        integer *iwp, integer *ier)
+{
+	struct lsode_call *call = (struct lsode_call *)neq;
+	*ier = call->psetup(*t, y, fty, *hl0, call->ctx);
+	return 0;
+}
+
+static int lsode_psolve(integer *neq, real *t, real *y, real *fty, real *wk,
+                        real *hl0, real *wp, integer *iwp, real *b,
+                        integer *lr, integer *ier)
+{
+	struct lsode_call *call = (struct lsode_call *)neq;
+	*ier = call->psolve(*t, y, fty, *hl0, b, call->ctx);
+	return 0;
+}
+
+static void lsode_xerrwv(void *ctx, const char *msg, integer nerr,
+                         integer level, integer ni, integer i1, integer i2,
+                         integer nr, real r1, real r2)
+{
+	struct lsode_workspace *ws = (struct lsode_workspace *)ctx;
+	struct lsode_error e = { msg, nerr, level, ni, i1, i2, nr, r1, r2 };
+	ws->err(&e, ws->err_ctx);
+}
+
+/*
+ * Sizes of RWORK and IWORK, from the documentation of each solver. The
+ * length given for SLSODES is only a crude lower bound, since the fill-in
+ * of the sparse LU factors is not known in advance: twice that much is
+ * reserved.
+ */
+static integer lsode_lrw(uint n, uint nnz, enum lsode_method method)
+{
+	switch (method) {
+	case LSODE_ADAMS:
+		return 20 + 16 * n;
+	case LSODE_BDF:
+		return 22 + 9 * n + n * n;
+	case LSODE_SPARSE:
+		return 2 * (20 + 21 * n + 3 * nnz);
+	case LSODE_KRYLOV:
+		return 61 + 17 * n;
+	default:
+		return 22 + n * (n + 9 > 16 ? n + 9 : 16);
+	}
+}
+
+static integer lsode_liw(uint n, uint nnz, enum lsode_method method)
+{
+	switch (method) {
+	case LSODE_ADAMS:
+		return 20;
+	case LSODE_SPARSE:
+		return 31 + n + nnz;
+	case LSODE_KRYLOV:
+		return 30;
+	default:
+		return 20 + n;
+	}
+}
+
+static size_t workspace_size(uint n, uint nnz, enum lsode_method method)
+{
+	return sizeof(struct lsode_workspace)
+	       + sizeof(integer) * (lsode_liw(n, nnz, method) + LSODE_ISAV)
+	       + sizeof(real) * (lsode_lrw(n, nnz, method) + LSODE_RSAV + n);
+}
+
+static struct lsode_workspace *workspace_create(uint n, uint nnz,
+                                                enum lsode_method method)
+{
+	assert(n > 0);
+
+	struct lsode_workspace *ws = (struct lsode_workspace *)
+		malloc(workspace_size(n, nnz, method));
+	assert(ws);
+
+	ws->n = n;
+	ws->method = method;
+	ws->nnz = nnz;
+	ws->structure = 0;
+	ws->lrw = lsode_lrw(n, nnz, method);
+	ws->liw = lsode_liw(n, nnz, method);
+	ws->call.f = NULL;
+	ws->call.dfj = NULL;
+	ws->call.psetup = NULL;
+	ws->call.psolve = NULL;
+	ws->err = NULL;
+	ws->err_ctx = NULL;
+	ws->istate = 0;
+	ws->iwork = (integer *)(ws + 1);
+	ws->isav = ws->iwork + ws->liw;
+	ws->rwork = (real *)(ws->isav + LSODE_ISAV);
+	ws->rsav = ws->rwork + ws->lrw;
+	ws->y = ws->rsav + LSODE_RSAV;
+
+	return ws;
+}
+
+/**
+ * lsode_workspace_size() - memory needed by a workspace
+ * @n:                     Dimension of the problem.
+ * @method:                Integration method, other than LSODE_SPARSE.
+ *
+ * Return: the size in bytes of a workspace created by
+ * lsode_workspace_create() for the same arguments.
+ */
+size_t lsode_workspace_size(uint n, enum lsode_method method)
+{
+	assert(method != LSODE_SPARSE);
+	return workspace_size(n, 0, method);
+}
+
+/**
+ * lsode_workspace_create() - allocate the work arrays of lsode()
+ * @n:                       Dimension of the problem.
+ * @method:                  Integration method, other than LSODE_SPARSE
+ *                           (see lsode_workspace_create_sparse()).
+ *
+ * RWORK, IWORK and the solver state are carved out of a single
+ * allocation, which can be reused for any number of calls to lsode() with
+ * the same dimension, or driven step by step with lsode_init() and
+ * lsode_advance().
+ *
+ * Return: a workspace, to be released with lsode_workspace_destroy().
+ */
+struct lsode_workspace *lsode_workspace_create(uint n,
+                                               enum lsode_method method)
+{
+	assert(method != LSODE_SPARSE);
+	return workspace_create(n, 0, method);
+}
+
+/**
+ * lsode_workspace_size_sparse() - memory needed by a sparse workspace
+ * @n:                            Dimension of the problem.
+ * @nnz:                          Number of nonzeros of the Jacobian.
+ *
+ * Return: the size in bytes of a workspace created by
+ * lsode_workspace_create_sparse() for the same arguments.
+ */
+size_t lsode_workspace_size_sparse(uint n, uint nnz)
+{
+	return workspace_size(n, nnz, LSODE_SPARSE);
+}
+
+/**
+ * lsode_workspace_create_sparse() - allocate the work arrays of SLSODES
+ * @n:                              Dimension of the problem.
+ * @nnz:                            Number of nonzeros of the Jacobian, or
+ *                                  an upper bound.
+ *
+ * Same as lsode_workspace_create() for LSODE_SPARSE. The work arrays grow
+ * linearly with n and nnz, instead of n^2 for LSODE_BDF. The sparsity
+ * structure is given by lsode_set_sparsity(), or else determined by
+ * SLSODES itself.
+ *
+ * Return: a workspace, to be released with lsode_workspace_destroy().
+ */
+struct lsode_workspace *lsode_workspace_create_sparse(uint n, uint nnz)
+{
+	assert(nnz > 0);
+	return workspace_create(n, nnz, LSODE_SPARSE);
+}
+
+/**
+ * lsode_workspace_destroy() - release a workspace
+ * @ws:                        Workspace created by lsode_workspace_create().
+ */
+void lsode_workspace_destroy(struct lsode_workspace *ws)
+{
+	free(ws);
+}
+
+/**
+ * lsode_init() - start a new problem
+ * @ws:            Workspace, which fixes the dimension n and the method.
+ * @f:             f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @df:            The Jacobian of f, called as df(t, y, Df(t,y), ctx), or
+ *                 NULL to let ODEPACK approximate it by finite differences.
+ *                 Unused by LSODE_ADAMS, LSODE_SPARSE (see
+ *                 lsode_set_sparsity()) and LSODE_KRYLOV (see
+ *                 lsode_set_precond()).
+ * @ctx:           User data passed to f and df.
+ * @t0:            Initial time.
+ * @y0:            Initial state, a vector of size n.
+ * @rtol:          Relative tolerance.
+ * @atol:          Absolute tolerance.
+ *
+ * The integration itself is done by lsode_advance().
+ */
+void lsode_init(struct lsode_workspace *ws,
+                void (*f)(float, float *, float *, void *),
+                void (*df)(float, float *, float *, void *), void *ctx,
+                float t0, float *y0, float rtol, float atol)
+{
+	ws->call.neq = ws->n;
+	ws->call.f = f;
+	ws->call.df = df;
+	ws->call.ctx = ctx;
+	ws->rtol = rtol;
+	ws->atol = atol;
+
+	switch (ws->method) {
+	case LSODE_ADAMS:
+		ws->mf = 10;
+		break;
+	case LSODE_BDF:
+		ws->mf = (df ? 21 : 22);
+		break;
+	case LSODE_SPARSE:
+		/* MF = 100 * MOSS + 20 + MITER */
+		if (ws->structure) {
+			ws->mf = (ws->call.dfj ? 21 : 22);
+		} else {
+			ws->mf = (ws->call.dfj ? 121 : 222);
+		}
+		break;
+	case LSODE_KRYLOV:
+		/* SPIGMR */
+		ws->mf = 22;
+		break;
+	default:
+		/* JT for SLSODA */
+		ws->mf = (df ? 1 : 2);
+		break;
+	}
+
+	lsode_reset(ws, t0, y0);
+}
+
+/**
+ * lsode_reset() - restart from a new initial value
+ * @ws:             Workspace set up by lsode_init().
+ * @t0:             Initial time.
+ * @y0:             Initial state, a vector of size n.
+ *
+ * The step size and order history is discarded; the callbacks and the
+ * tolerances are kept.
+ */
+void lsode_reset(struct lsode_workspace *ws, float t0, float *y0)
+{
+	assert(ws->call.f);
+
+	uint n = ws->n;
+	ws->t = t0;
+	ws->istate = 1;
+	m_copy(n, 1, n, ws->y, n, y0);
+
+	/* optional inputs: defaults, except for the step limit */
+	memset(ws->rwork, 0, sizeof(real) * 10);
+	if (ws->method == LSODE_SPARSE) {
+		/* keep the sparsity structure in IWORK(31..) */
+		memset(ws->iwork, 0, sizeof(integer) * LSODE_IOPT);
+	} else {
+		memset(ws->iwork, 0, sizeof(integer) * ws->liw);
+	}
+	V_IDX(ws->iwork, 6) = LSODE_MAXSTEPS;
+
+	if (ws->method == LSODE_KRYLOV) {
+		/* LWP = LIWP = 0: the preconditioner keeps its own data */
+		V_IDX(ws->iwork, 3) = (ws->call.psolve ? 1 : 0);
+		V_IDX(ws->iwork, 4) = (ws->call.psetup ? 1 : 0);
+	}
+}
+
+/**
+ * lsode_advance() - continue the integration up to a given time
+ * @ws:               Workspace set up by lsode_init().
+ * @tout:             Time to reach, not before the current time.
+ * @y:                Output, y(tout), a vector of size n.
+ *
+ * Successive calls continue the integration with ISTATE = 2: the step
+ * size, the order and the Jacobian are carried over, and ODEPACK may
+ * step past tout and interpolate back.
+ *
+ * Return: 0 on success, -1 if ODEPACK gave up (ISTATE < 0). A handle
+ * that failed must be restarted with lsode_reset().
+ */
+int lsode_advance(struct lsode_workspace *ws, float tout, float *y)
+{
+	assert(ws->istate != 0);
+	assert(tout >= ws->t);
+
+	uint n = ws->n;
+	if (ws->istate < 0) {
+		return -1;
+	}
+	if (tout > ws->t) {
+		integer itol = 1;
+		integer itask = 1;
+		integer iopt = 1;
+		integer job = 2;
+		real to = tout;
+		int (*srcom)(real *, integer *, integer *);
+
+		switch (ws->method) {
+		case LSODE_AUTO:
+			srcom = ssrcma_;
+			break;
+		case LSODE_SPARSE:
+			srcom = ssrcms_;
+			break;
+		case LSODE_KRYLOV:
+			srcom = ssrcpk_;
+			break;
+		default:
+			srcom = ssrcom_;
+			break;
+		}
+
+		lsode_xerrwv_hook = (ws->err ? lsode_xerrwv : NULL);
+		lsode_xerrwv_ctx = ws;
+
+		/* another handle may have run on this thread in between */
+		if (ws->istate == 2) {
+			srcom(ws->rsav, ws->isav, &job);
+		}
+
+		switch (ws->method) {
+		case LSODE_AUTO:
+			slsoda_((U_fp)lsode_f, &ws->call.neq, ws->y, &ws->t,
+			        &to, &itol, &ws->rtol, &ws->atol, &itask,
+			        &ws->istate, &iopt, ws->rwork, &ws->lrw,
+			        ws->iwork, &ws->liw, (U_fp)lsode_jac, &ws->mf);
+			break;
+		case LSODE_SPARSE:
+			slsodes_((U_fp)lsode_f, &ws->call.neq, ws->y, &ws->t,
+			         &to, &itol, &ws->rtol, &ws->atol, &itask,
+			         &ws->istate, &iopt, ws->rwork, &ws->lrw,
+			         ws->iwork, &ws->liw, (U_fp)lsode_jac_sparse,
+			         &ws->mf);
+			break;
+		case LSODE_KRYLOV:
+			slsodpk_((U_fp)lsode_f, &ws->call.neq, ws->y, &ws->t,
+			         &to, &itol, &ws->rtol, &ws->atol, &itask,
+			         &ws->istate, &iopt, ws->rwork, &ws->lrw,
+			         ws->iwork, &ws->liw, (U_fp)lsode_psetup,
+			         (U_fp)lsode_psolve, &ws->mf);
+			break;
+		default:
+			slsode_((U_fp)lsode_f, &ws->call.neq, ws->y, &ws->t,
+			        &to, &itol, &ws->rtol, &ws->atol, &itask,
+			        &ws->istate, &iopt, ws->rwork, &ws->lrw,
+			        ws->iwork, &ws->liw, (U_fp)lsode_jac, &ws->mf);
+			break;
+		}
+
+		job = 1;
+		srcom(ws->rsav, ws->isav, &job);
+		lsode_xerrwv_hook = NULL;
+		if (ws->istate < 0) {
+			return -1;
+		}
+	}
+	m_copy(n, 1, n, y, n, ws->y);
+
+	return 0;
+}
+
+/**
+ * lsode_stats() - work done since the last lsode_reset()
+ * @ws:             Workspace set up by lsode_init().
+ * @stats:          Output.
+ */
+void lsode_stats(struct lsode_workspace *ws, struct ode_stats *stats)
+{
+	/* IWORK(11..13) = NST, NFE, NJE */
+	stats->nsteps = V_IDX(ws->iwork, 11);
+	stats->nreject = 0;
+	stats->nfev = V_IDX(ws->iwork, 12);
+	stats->njev = V_IDX(ws->iwork, 13);
+	switch (ws->method) {
+	case LSODE_SPARSE:
+		/* NLU */
+		stats->ndecomp = V_IDX(ws->iwork, 21);
+		stats->nniter = 0;
+		break;
+	case LSODE_KRYLOV:
+		/* no LU, NNI */
+		stats->ndecomp = 0;
+		stats->nniter = V_IDX(ws->iwork, 19);
+		break;
+	default:
+		stats->ndecomp = V_IDX(ws->iwork, 13);
+		stats->nniter = 0;
+		break;
+	}
+}
+
+/**
+ * lsode_set_sparsity() - describe the Jacobian for LSODE_SPARSE
+ * @ws:                    Workspace created by
+ *                         lsode_workspace_create_sparse().
+ * @ia:                    Vector of size n + 1, or NULL. Column j of the
+ *                         Jacobian has its nonzeros in the rows ja(k), for
+ *                         ia(j) <= k < ia(j + 1), with ia(1) = 1 (1-based
+ *                         compressed columns).
+ * @ja:                    Row indices, a vector of size ia(n + 1) - 1, at
+ *                         most the nnz of the workspace.
+ * @dfj:                   Called as dfj(t, y, j, col, ctx) to load column j
+ *                         of the Jacobian into col, a vector of size n set
+ *                         to zero beforehand, or NULL to let SLSODES
+ *                         approximate it by grouped finite differences.
+ *
+ * Without ia and ja, SLSODES finds the structure itself, from dfj or by
+ * perturbing f. The structure is copied into the workspace and kept by
+ * lsode_reset(); it must be set before lsode_init() or lsode().
+ */
+void lsode_set_sparsity(struct lsode_workspace *ws, const int *ia,
+                        const int *ja,
+                        void (*dfj)(float, float *, uint, float *, void *))
+{
+	assert(ws->method == LSODE_SPARSE);
+
+	uint n = ws->n;
+	ws->call.dfj = dfj;
+	ws->structure = (ia != NULL);
+	if (ia) {
+		uint nnz = V_IDX(ia, n + 1) - 1;
+		assert(V_IDX(ia, 1) == 1);
+		assert(nnz <= ws->nnz);
+
+		/* IWORK(31..31+n) = IA, IWORK(32+n..) = JA */
+		for (uint j = 1; j <= n + 1; j++) {
+			V_IDX(ws->iwork, LSODE_IOPT + j) = V_IDX(ia, j);
+		}
+		for (uint k = 1; k <= nnz; k++) {
+			V_IDX(ws->iwork, LSODE_IOPT + n + 1 + k) = V_IDX(ja, k);
+		}
+	}
+}
+
+/**
+ * lsode_set_precond() - preconditioner for LSODE_KRYLOV
+ * @ws:                   Workspace created for LSODE_KRYLOV.
+ * @psetup:               Called as psetup(t, y, f(t,y), hl0, ctx) to build
+ *                        an approximation P of I - hl0 * Df(t,y), or NULL
+ *                        if P needs no setup. Returns 0 on success, or
+ *                        nonzero to make SLSODPK retry with a smaller step.
+ * @psolve:               Called as psolve(t, y, f(t,y), hl0, b, ctx) to
+ *                        overwrite b, a vector of size n, with P^-1 b, or
+ *                        NULL for no preconditioning. Returns 0 on success,
+ *                        a positive value to retry the step, or a negative
+ *                        value to give up.
+ *
+ * SLSODPK solves the Newton systems (I - hl0 * Df) x = b by GMRES, with
+ * products Df(t,y) v approximated by differences of f, so that the
+ * Jacobian is never formed. P is applied on the left. It must be set
+ * before lsode_init() or lsode().
+ */
+void lsode_set_precond(struct lsode_workspace *ws,
+                       int (*psetup)(float, float *, float *, float, void *),
+                       int (*psolve)(float, float *, float *, float, float *,
+                                     void *))
+{
+	assert(ws->method == LSODE_KRYLOV);
+	assert(psolve || !psetup);
+
+	ws->call.psetup = psetup;
+	ws->call.psolve = psolve;
+}
+
+/**
+ * lsode_set_error_handler() - receive the messages of ODEPACK
+ * @ws:                         A workspace.
+ * @err:                        Called with each error or warning raised
+ *                              while the workspace integrates, or NULL to
+ *                              drop them (the default).
+ * @ctx:                        User data passed to err.
+ *
+ * Errors are also reported by the return value of lsode_advance() and
+ * lsode(); the handler only gives their details.
+ */
+void lsode_set_error_handler(struct lsode_workspace *ws,
+                             void (*err)(const struct lsode_error *, void *),
+                             void *ctx)
+{
+	ws->err = err;
+	ws->err_ctx = ctx;
+}
+
+/**
+ * lsode() - integrate with SLSODE or SLSODA
+ * @ws:        Workspace, which fixes the dimension n and the method.
+ * @f:         f : R x R^n -> R^n, called as f(t, y, f(t,y), ctx).
+ * @df:        The Jacobian of f, or NULL. See lsode_init().
+ * @ctx:       User data passed to f and df.
+ * @t0:        Initial time.
+ * @y:         Vector of size n. Input: y(t0). Output: y(tout(nout)), or
+ *             the last state reached on failure.
+ * @nout:      Number of output times.
+ * @tout:      Output times, sorted, with t0 <= tout(1) and
+ *             t0 < tout(nout).
+ * @Yout:      n-by-nout matrix. Output: y(tout(k)) in column k.
+ * @rtol:      Relative tolerance.
+ * @atol:      Absolute tolerance.
+ * @stats:     If not NULL, receives the work statistics.
+ *
+ * Same interface as dopri5() and bdf(), on top of the variable-order
+ * solvers of ODEPACK. With LSODE_AUTO, SLSODA starts with the Adams
+ * methods and switches to BDF when the problem turns out to be stiff.
+ * LSODE_SPARSE and LSODE_KRYLOV are meant for large systems, such as
+ * discretized PDEs, and are configured beforehand with
+ * lsode_set_sparsity() and lsode_set_precond().
+ * A single integration covers all the output times.
+ *
+ * Return: 0 on success, -1 if ODEPACK gave up (ISTATE < 0). Outputs
+ * beyond the point of failure are left untouched.
+ */
+int lsode(struct lsode_workspace *ws,
+          void (*f)(float, float *, float *, void *),
+          void (*df)(float, float *, float *, void *), void *ctx,
+          float t0, float *y, uint nout, const float *tout, float *Yout,
+          float rtol, float atol, struct ode_stats *stats)
+{
+	assert(nout > 0);
+	assert(t0 <= V_IDX(tout, 1));
+	assert(V_IDX(tout, 1) <= V_IDX(tout, nout));
+	assert(t0 < V_IDX(tout, nout));
+
+	uint n = ws->n;
+	int status = 0;
+
+	lsode_init(ws, f, df, ctx, t0, y, rtol, atol);
+	for (uint o = 1; o <= nout; o++) {
+		status = lsode_advance(ws, V_IDX(tout, o), M_COL(Yout, n, o));
+		if (status) {
+			break;
+		}
+	}
+	m_copy(n, 1, n, y, n, ws->y);
+
+	if (stats) {
+		lsode_stats(ws, stats);
+	}
+
+	return status;
+}
+
+#endif /* HAVE_LSODE */
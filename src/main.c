@@ -18,6 +18,7 @@
 #include "integrate.h"
 
 #include <math.h>
+#include <string.h>
 #include <unistd.h>
 
 void f(float *in, float *out)
@@ -25,14 +26,30 @@ void f(float *in, float *out)
 	float x1 = V_IDX(in, 1);
 	float x2 = V_IDX(in, 2);
 	V_IDX(out, 1) = (x1 * x1 + x2 * x2);
-	V_IDX(out, 1) += sin(10000. * x1) * sin(10000. * x2) / 100.;
+	V_IDX(out, 1) += sinf(10000.f * x1) * sinf(10000.f * x2) / 100.f;
 	//usleep(370000);
 }
 
+extern void f_batch(uint, float *, float *, void *);
+#ifdef HAVE_CUDA
+extern void f_batch_gpu(uint, float *, float *, void *);
+#endif
+
 extern void influenza();
 
-int main(void)
+int main(int argc, char **argv)
 {
+	/* -b selects the batched model, -g its GPU version */
+	void (*fb)(uint, float *, float *, void *) = NULL;
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		fb = f_batch;
+	}
+#ifdef HAVE_CUDA
+	if (argc > 1 && !strcmp(argv[1], "-g")) {
+		fb = f_batch_gpu;
+	}
+#endif
+
 	influenza();
 
 	srand(1429874166);
@@ -50,7 +67,14 @@ int main(void)
 	float *X = create_matrix(m, l);
 	float *r = create_vector(l);
 	//printf("m=%u, n=%u, l=%u, K=%u\n", m, n, l, K);
-	cluster_newton(m, n, f, ys, xh, v, l, eta, K, X, r);
+	if (fb) {
+		struct cn_workspace *ws = cn_workspace_create(m, n, l);
+		cn_workspace_set_batch(ws, fb, 16);
+		cluster_newton_ws(ws, NULL, NULL, ys, xh, v, eta, K, X, r);
+		cn_workspace_destroy(ws);
+	} else {
+		cluster_newton(m, n, f, ys, xh, v, l, eta, K, X, r);
+	}
 
 	print_vector(l, r);
 	//print_matrix(m, l, X);
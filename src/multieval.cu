@@ -18,46 +18,46 @@ extern "C" {
 #include "common.h"
 }
 
-void multi_eval_sequential(uint m, uint n, void (*f)(float *, float *),
-                           uint l, float *X, float *Y)
+__global__ void eval_fct_kernel(const float *X, float *Y, uint count)
 {
-	for (uint j = 1; j <= l; j++) {
-		f(M_COL(X, m + 1, j), M_COL(Y, n, j));
-	}
-}
-
-__global__ void eval_fct_kernel(const float *X, float *Y,
-                                uint m, uint n, uint l)
-{
-	int i = blockDim.x * blockIdx.x + threadIdx.x;
+	uint j = blockDim.x * blockIdx.x + threadIdx.x + 1;
 
-	if (i <= l) {
-		const float *in = &X[(m + 1) * i];
-		float *out = &Y[n * i];
-		float x1 = V_IDX(in, 1);
-		float x2 = V_IDX(in, 2);
-		V_IDX(out, 1) = (x1 * x1 + x2 * x2);
-		V_IDX(out, 1) += sin(10000.f * x1) * sin(10000.f * x2) / 100.f;
+	if (j <= count) {
+		float x1 = M_IDX(X, 3, 1, j);
+		float x2 = M_IDX(X, 3, 2, j);
+		V_IDX(Y, j) = (x1 * x1 + x2 * x2);
+		V_IDX(Y, j) += sinf(10000.f * x1) * sinf(10000.f * x2) / 100.f;
 	}
 }
 
-void multi_eval_gpu(uint m, uint n, uint l, float *X, float *Y)
+/**
+ * f_batch_gpu() - batched version of f(), evaluated on the GPU
+ * @count:         Number of points.
+ * @X:             The points, with leading dimension 3.
+ * @Y:             Output, the images of the points.
+ * @ctx:           Unused.
+ *
+ * Same as f_batch(), with one CUDA thread per point. Select it at runtime
+ * with cn_workspace_set_batch(), with a tile large enough to amortize the
+ * transfers. This function assumes COLUMN-MAJOR ORDER.
+ */
+extern "C" void f_batch_gpu(uint count, float *X, float *Y, void *ctx)
 {
 	// Load X to device memory
-	uint sizeX = (m + 1) * l * sizeof(float);
+	size_t sizeX = 3 * count * sizeof(float);
 	float *devX = NULL;
-	cudaMalloc(&devX, sizeX);	
+	cudaMalloc(&devX, sizeX);
 	cudaMemcpy(devX, X, sizeX, cudaMemcpyHostToDevice);
 
 	// Allocate Y in device memory
-	uint sizeY = n * l * sizeof(float);
+	size_t sizeY = count * sizeof(float);
 	float *devY = NULL;
 	cudaMalloc(&devY, sizeY);
 
 	// Invoke kernel
 	int threadsPerBlock = 256;
-	int blocksPerGrid = (l + threadsPerBlock - 1) / threadsPerBlock;
-	eval_fct_kernel<<<blocksPerGrid, threadsPerBlock>>>(devX, devY, m, n, l);
+	int blocksPerGrid = (count + threadsPerBlock - 1) / threadsPerBlock;
+	eval_fct_kernel<<<blocksPerGrid, threadsPerBlock>>>(devX, devY, count);
 
 	// Read Y from device memory
 	cudaMemcpy(Y, devY, sizeY, cudaMemcpyDeviceToHost);
@@ -66,20 +66,3 @@ void multi_eval_gpu(uint m, uint n, uint l, float *X, float *Y)
 	cudaFree(devX);
 	cudaFree(devY);
 }
-
-/**
- * multi_eval() - evaluates a function at multiple points
- * @m:              Number of parameters of the function.
- * @f:              The function to evaluate.
- * @l:              Number of points.
- * @X:              Coordinates of the points, one point per column.
- * @y:              Vector in which to store the result.
- *
- * This function assumes COLUMN-MAJOR ORDER.
- */
-extern "C" void multi_eval(uint m, uint n, void (*f)(float *, float *),
-                           uint l, float *X, float *Y)
-{
-	multi_eval_sequential(m, n, f, l, X, Y);
-	//multi_eval_gpu(m, n, l, X, Y);
-}
@@ -0,0 +1,317 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "pool.h"
+
+#include "common.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/**
+ * struct cn_range - the share of a job owned by one worker
+ * @lock:           Protects @next and @end.
+ * @next:           First index that has not been claimed yet.
+ * @end:            One past the last index of the range.
+ *
+ * The owner claims chunks from the front of its range, thieves claim them
+ * from the back.
+ */
+struct cn_range {
+	pthread_mutex_t lock;
+	uint next;
+	uint end;
+	char pad[64];
+};
+
+/**
+ * struct cn_pool - persistent pool of worker threads
+ * @size:          Number of workers, the calling thread included.
+ * @threads:       The size - 1 spawned threads.
+ * @ranges:        One range per worker.
+ * @lock:          Protects everything below.
+ * @start:         Signaled when a job is posted, or on shutdown.
+ * @done:          Signaled when the last worker finishes a job.
+ * @generation:    Incremented each time a job is posted.
+ * @active:        Number of spawned workers still busy with the job.
+ * @shutdown:      Set by cn_pool_destroy().
+ * @fn, @arg:      The current job. See cn_pool_run().
+ */
+struct cn_pool {
+	uint size;
+	pthread_t *threads;
+	struct cn_range *ranges;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned long generation;
+	uint active;
+	int shutdown;
+
+	void (*fn)(void *, uint, uint, uint);
+	void *arg;
+};
+
+struct cn_worker {
+	struct cn_pool *pool;
+	uint id;
+};
+
+/*
+ * claim_own() - take a chunk from the front of a worker's own range
+ *
+ * Chunks shrink as the range empties (a quarter of what is left), so
+ * that the tail of the job is split finely enough to balance the load.
+ */
+static int claim_own(struct cn_range *r, uint *begin, uint *end)
+{
+	int ok = 0;
+	pthread_mutex_lock(&r->lock);
+	if (r->next < r->end) {
+		uint chunk = (r->end - r->next + 3) / 4;
+		*begin = r->next;
+		*end = r->next + chunk;
+		r->next = *end;
+		ok = 1;
+	}
+	pthread_mutex_unlock(&r->lock);
+	return ok;
+}
+
+/*
+ * steal() - take the back half of another worker's range
+ *
+ * The stolen indices are moved to the thief's own range, so that it can
+ * keep on claiming small chunks from them.
+ */
+static int steal(struct cn_pool *pool, uint id)
+{
+	for (uint k = 1; k < pool->size; k++) {
+		struct cn_range *victim = &pool->ranges[(id + k) % pool->size];
+		uint begin = 0, end = 0;
+
+		pthread_mutex_lock(&victim->lock);
+		if (victim->next < victim->end) {
+			uint half = (victim->end - victim->next) / 2;
+			end = victim->end;
+			begin = end - (half > 0 ? half : 1);
+			victim->end = begin;
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if (begin < end) {
+			struct cn_range *own = &pool->ranges[id];
+			pthread_mutex_lock(&own->lock);
+			own->next = begin;
+			own->end = end;
+			pthread_mutex_unlock(&own->lock);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void work(struct cn_pool *pool, uint id)
+{
+	uint begin, end;
+	do {
+		while (claim_own(&pool->ranges[id], &begin, &end)) {
+			pool->fn(pool->arg, begin, end, id);
+		}
+	} while (steal(pool, id));
+}
+
+static void *worker_main(void *p)
+{
+	struct cn_worker *w = (struct cn_worker *)p;
+	struct cn_pool *pool = w->pool;
+	uint id = w->id;
+	unsigned long seen = 0;
+	free(w);
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (pool->generation == seen && !pool->shutdown) {
+			pthread_cond_wait(&pool->start, &pool->lock);
+		}
+		if (pool->shutdown) {
+			break;
+		}
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		work(pool, id);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->active == 0) {
+			pthread_cond_signal(&pool->done);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/**
+ * cn_pool_create() - start a pool of worker threads
+ * @size:             Number of workers, the calling thread included. Zero
+ *                    means one worker per online processor.
+ *
+ * Return: a pool, to be released with cn_pool_destroy().
+ */
+struct cn_pool *cn_pool_create(uint size)
+{
+	if (size == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		size = (ncpu > 0 ? (uint)ncpu : 1);
+	}
+
+	struct cn_pool *pool = (struct cn_pool *)malloc(sizeof(*pool));
+	assert(pool);
+	pool->size = size;
+	pool->ranges = (struct cn_range *)malloc(sizeof(struct cn_range)
+	                                         * size);
+	assert(pool->ranges);
+	for (uint k = 0; k < size; k++) {
+		pthread_mutex_init(&pool->ranges[k].lock, NULL);
+		pool->ranges[k].next = 0;
+		pool->ranges[k].end = 0;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pool->generation = 0;
+	pool->active = 0;
+	pool->shutdown = 0;
+	pool->fn = NULL;
+	pool->arg = NULL;
+
+	pool->threads = NULL;
+	if (size > 1) {
+		pool->threads = (pthread_t *)malloc(sizeof(pthread_t)
+		                                    * (size - 1));
+		assert(pool->threads);
+	}
+	for (uint k = 1; k < size; k++) {
+		struct cn_worker *w = (struct cn_worker *)malloc(sizeof(*w));
+		assert(w);
+		w->pool = pool;
+		w->id = k;
+		int err = pthread_create(&pool->threads[k - 1], NULL,
+		                         worker_main, w);
+		assert(!err);
+		(void)err;
+	}
+
+	return pool;
+}
+
+/**
+ * cn_pool_destroy() - stop the workers and release a pool
+ * @pool:               Pool created by cn_pool_create(). Can be NULL.
+ */
+void cn_pool_destroy(struct cn_pool *pool)
+{
+	if (!pool) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (uint k = 1; k < pool->size; k++) {
+		pthread_join(pool->threads[k - 1], NULL);
+	}
+
+	for (uint k = 0; k < pool->size; k++) {
+		pthread_mutex_destroy(&pool->ranges[k].lock);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool->ranges);
+	free(pool);
+}
+
+/**
+ * cn_pool_size() - number of workers in a pool
+ * @pool:            A pool, or NULL.
+ *
+ * Return: the number of workers, the calling thread included. A NULL
+ * pool has a single worker: the calling thread.
+ */
+uint cn_pool_size(struct cn_pool *pool)
+{
+	return (pool ? pool->size : 1);
+}
+
+/**
+ * cn_pool_run() - run a job on a pool
+ * @pool:           Pool created by cn_pool_create(), or NULL to run the
+ *                  whole job on the calling thread.
+ * @l:              Number of indices in the job.
+ * @fn:             Called as fn(arg, begin, end, id) on disjoint chunks
+ *                  [begin, end) that together cover [1, l + 1). id is the
+ *                  number of the worker, with 0 <= id < cn_pool_size().
+ * @arg:            Passed to fn.
+ *
+ * The indices are first split evenly between the workers, which then
+ * claim chunks of decreasing size from their own share and steal from
+ * the others when they run out. Returns once every index has been
+ * processed. The calling thread takes part in the job as worker 0.
+ *
+ * Jobs must not be posted concurrently on the same pool.
+ */
+void cn_pool_run(struct cn_pool *pool, uint l,
+                 void (*fn)(void *, uint, uint, uint), void *arg)
+{
+	if (!pool || pool->size == 1 || l <= 1) {
+		if (l > 0) {
+			fn(arg, 1, l + 1, 0);
+		}
+		return;
+	}
+
+	/* split the indices evenly between the workers */
+	uint size = pool->size;
+	for (uint k = 0; k < size; k++) {
+		struct cn_range *r = &pool->ranges[k];
+		pthread_mutex_lock(&r->lock);
+		r->next = 1 + (uint)((unsigned long)l * k / size);
+		r->end = 1 + (uint)((unsigned long)l * (k + 1) / size);
+		pthread_mutex_unlock(&r->lock);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->active = size - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	work(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->active > 0) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -20,7 +20,7 @@
 
 #include <math.h>
 
-void f_cos(float t, float *y, float *F)
+void f_cos(float t, float *y, float *F, void *ctx)
 {
 	F[0] = y[1];
 	F[1] = -y[0];
@@ -29,7 +29,7 @@ void f_cos(float t, float *y, float *F)
 int main(void)
 {
 	float y0[2] = { 1.0f, 0.0f };
-	rk4(2, f_cos, 0.0f, y0, 3.14157f, 20);
+	rk4(2, f_cos, NULL, 0.0f, y0, 3.14157f, 20);
 	printf("RK4: %f, %f\n", y0[0], y0[1]);
 
 	assert(fabs(y0[0] + 1.0f) < 0.01f);
@@ -23,7 +23,7 @@
 static const float a = 4.0f;
 static const float c = 1.0f;
 
-void f_volt(float t, float *x, float *y)
+void f_volt(float t, float *x, float *y, void *ctx)
 {
 	float x1 = V_IDX(x, 1);
 	float x2 = V_IDX(x, 2);
@@ -31,10 +31,15 @@ void f_volt(float t, float *x, float *y)
 	V_IDX(y, 2) = -c * (x2 - x1 * x2);
 }
 
-void df_volt(float t, float *x, float *J)
+/* ctx, if not NULL, counts the evaluations, one per factorization of
+ * 1 - hJ in bdf1() */
+void df_volt(float t, float *x, float *J, void *ctx)
 {
 	float x1 = V_IDX(x, 1);
 	float x2 = V_IDX(x, 2);
+	if (ctx) {
+		(*(uint *)ctx)++;
+	}
 
 	M_IDX(J, 2, 1, 1) = a * (1.0f - x2);
 	M_IDX(J, 2, 2, 1) = c * x2;
@@ -45,11 +50,45 @@ void df_volt(float t, float *x, float *J)
 int main(void)
 {
 	float y0[2] = { 2.0f, 1.0f };
-	bdf1(2, f_volt, df_volt, 0.0f, y0, 10.0f, 1000, 0.0001f);
+	bdf1(2, f_volt, df_volt, NULL, 0.0f, y0, 10.0f, 1000, 0.0001f);
 	printf("BDF1: %f, %f\n", y0[0], y0[1]);
 
 	//assert(fabs(y0[0] + 1.0f) < 0.01f);
 	//assert(fabs(y0[1]) < 0.01f);
+
+	/* work-precision of bdf1() and rosenbrock() against dopri5() */
+	float T[1] = { 10.0f };
+	float Y[2];
+	float ref[2] = { 2.0f, 1.0f };
+	assert(dopri5(2, f_volt, NULL, 0.0f, ref, 1, T, Y,
+	              1e-7f, 1e-7f, NULL) == 0);
+
+	float err_bdf1 = 0.0f;
+	uint lu_bdf1 = 0;
+	for (uint N = 250; N <= 16000; N *= 4) {
+		float y[2] = { 2.0f, 1.0f };
+		lu_bdf1 = 0;
+		bdf1(2, f_volt, df_volt, &lu_bdf1, 0.0f, y, 10.0f, N, 0.0001f);
+		err_bdf1 = fmaxf(fabsf(y[0] - ref[0]), fabsf(y[1] - ref[1]));
+		assert(lu_bdf1 >= N);
+		printf("BDF1, %5u steps: error %e, %5u LU\n", N, err_bdf1,
+		       lu_bdf1);
+	}
+
+	float err_ros = 0.0f;
+	struct ode_stats st;
+	for (float tol = 1e-3f; tol > 1e-6f; tol *= 0.1f) {
+		float y[2] = { 2.0f, 1.0f };
+		assert(rosenbrock(2, f_volt, df_volt, NULL, 0.0f, y, 1, T, Y,
+		                  tol, tol, &st) == 0);
+		err_ros = fmaxf(fabsf(y[0] - ref[0]), fabsf(y[1] - ref[1]));
+		printf("Rosenbrock, tol %.0e: error %e, %5u LU, %5u f\n",
+		       tol, err_ros, st.ndecomp, st.nfev);
+	}
+	/* a tighter solution than the finest bdf1() run, at a fraction
+	 * of the linear algebra */
+	assert(err_ros < err_bdf1);
+	assert(st.ndecomp < lu_bdf1 / 10);
 	return 0;
 }
 
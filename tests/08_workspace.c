@@ -0,0 +1,73 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "tsttools.h"
+
+void f(float *in, float *out)
+{
+	float x1 = V_IDX(in, 1);
+	float x2 = V_IDX(in, 2);
+	V_IDX(out, 1) = x1 * x1 + x2 * x2;
+}
+
+void f_ctx(float *in, float *out, void *ctx)
+{
+	f(in, out);
+}
+
+int main(void)
+{
+	uint m = 2;
+	uint n = 1;
+	uint l = 10;
+	float ys[1] = { 100.0f };
+	float xh[2] = { 2.5f, 2.5f };
+	float v[2] = { 1.0f, 1.0f };
+	float eta = 0.01f;
+	uint K = 10;
+
+	float *X1 = create_matrix(m, l);
+	float *X2 = create_matrix(m, l);
+	float *r1 = create_vector(l);
+	float *r2 = create_vector(l);
+
+	srand(1429874166);
+	cluster_newton(m, n, f, ys, xh, v, l, eta, K, X1, r1);
+
+	/* the same workspace must give the same result every time */
+	struct cn_workspace *ws = cn_workspace_create(m, n, l);
+	for (uint k = 0; k < 3; k++) {
+		srand(1429874166);
+		cluster_newton_ws(ws, f_ctx, NULL, ys, xh, v, eta, K, X2, r2);
+
+		for (uint j = 1; j <= l; j++) {
+			assert(V_IDX(r1, j) == V_IDX(r2, j));
+			for (uint i = 1; i <= m; i++) {
+				assert(M_IDX(X1, m, i, j) == M_IDX(X2, m, i, j));
+			}
+		}
+	}
+	cn_workspace_destroy(ws);
+	print_vector(l, r2);
+
+	free(r2);
+	free(r1);
+	free(X2);
+	free(X1);
+
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "pool.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+extern void fwd_influenza(float *, float *, void *);
+
+/* uneven cost, so that the workers have to steal from each other */
+void f(float *in, float *out, void *ctx)
+{
+	float *scale = (float *)ctx;
+	uint reps = (uint)fabs(V_IDX(in, 1)) % 2000;
+	float acc = 0.0f;
+	for (uint k = 0; k < reps; k++) {
+		acc += sin(V_IDX(in, 1) + k);
+	}
+	V_IDX(out, 1) = *scale * V_IDX(in, 1) * V_IDX(in, 2);
+	V_IDX(out, 2) = acc;
+}
+
+int main(void)
+{
+	init_prg();
+
+	struct cn_pool *pool = cn_pool_create(4);
+	assert(cn_pool_size(pool) == 4);
+
+	/* every point is evaluated, and only once */
+	uint l = random_dim();
+	float scale = 3.0f;
+	float *X = random_matrix(3, l);
+	float *Y1 = create_matrix(2, l);
+	float *Y2 = create_matrix(2, l);
+	for (uint k = 0; k < 3; k++) {
+		for (uint j = 1; j <= l; j++) {
+			M_IDX(Y2, 2, 1, j) = NAN;
+		}
+		multi_eval_pool(NULL, 2, 2, f, &scale, l, X, Y1);
+		multi_eval_pool(pool, 2, 2, f, &scale, l, X, Y2);
+		for (uint j = 1; j <= l; j++) {
+			assert(M_IDX(Y1, 2, 1, j) == M_IDX(Y2, 2, 1, j));
+			assert(M_IDX(Y1, 2, 2, j) == M_IDX(Y2, 2, 2, j));
+		}
+	}
+	free(Y2);
+	free(Y1);
+	free(X);
+
+	/* the influenza model is reentrant */
+	float x[8] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f, 1.0f };
+	l = 32;
+	X = create_matrix(8, l);
+	for (uint j = 1; j <= l; j++) {
+		for (uint i = 1; i <= 8; i++) {
+			M_IDX(X, 8, i, j) = V_IDX(x, i) * (1.0f + 0.01f * j);
+		}
+	}
+	Y1 = create_matrix(22, l);
+	Y2 = create_matrix(22, l);
+	multi_eval_pool(NULL, 7, 22, fwd_influenza, NULL, l, X, Y1);
+	multi_eval_pool(pool, 7, 22, fwd_influenza, NULL, l, X, Y2);
+	for (uint j = 1; j <= l; j++) {
+		for (uint i = 1; i <= 22; i++) {
+			assert(M_IDX(Y1, 22, i, j) == M_IDX(Y2, 22, i, j));
+		}
+	}
+	free(Y2);
+	free(Y1);
+	free(X);
+
+	cn_pool_destroy(pool);
+
+	return 0;
+}
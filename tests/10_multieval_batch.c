@@ -0,0 +1,72 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "pool.h"
+#include "tsttools.h"
+
+void f(float *in, float *out, void *ctx)
+{
+	V_IDX(out, 1) = V_IDX(in, 1) * V_IDX(in, 2);
+	V_IDX(out, 2) = V_IDX(in, 1) + V_IDX(in, 2);
+}
+
+void f_batch(uint count, float *X, float *Y, void *ctx)
+{
+	#pragma omp simd
+	for (uint j = 1; j <= count; j++) {
+		float x1 = M_IDX(X, 3, 1, j);
+		float x2 = M_IDX(X, 3, 2, j);
+		M_IDX(Y, 2, 1, j) = x1 * x2;
+		M_IDX(Y, 2, 2, j) = x1 + x2;
+	}
+}
+
+int main(void)
+{
+	init_prg();
+
+	struct cn_pool *pool = cn_pool_create(3);
+
+	uint l = random_dim();
+	float *X = random_matrix(3, l);
+	float *Y1 = create_matrix(2, l);
+	float *Y2 = create_matrix(2, l);
+
+	multi_eval_pool(NULL, 2, 2, f, NULL, l, X, Y1);
+
+	uint tiles[] = { 1, 7, 16, 4096 };
+	for (uint k = 0; k < 4; k++) {
+		multi_eval_batch(NULL, 2, 2, f_batch, NULL, tiles[k], l, X, Y2);
+		for (uint j = 1; j <= l; j++) {
+			assert(M_IDX(Y1, 2, 1, j) == M_IDX(Y2, 2, 1, j));
+			assert(M_IDX(Y1, 2, 2, j) == M_IDX(Y2, 2, 2, j));
+		}
+
+		multi_eval_batch(pool, 2, 2, f_batch, NULL, tiles[k], l, X, Y2);
+		for (uint j = 1; j <= l; j++) {
+			assert(M_IDX(Y1, 2, 1, j) == M_IDX(Y2, 2, 1, j));
+			assert(M_IDX(Y1, 2, 2, j) == M_IDX(Y2, 2, 2, j));
+		}
+	}
+
+	free(Y2);
+	free(Y1);
+	free(X);
+	cn_pool_destroy(pool);
+
+	return 0;
+}
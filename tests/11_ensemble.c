@@ -0,0 +1,130 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+extern void fwd_influenza(float *, float *, void *);
+extern void fwd_influenza_batch(uint, float *, float *, void *);
+
+/* Lotka-Volterra, with one value of a per system */
+void f_volt(float t, float *x, float *y, void *ctx)
+{
+	float a = *(float *)ctx;
+	float x1 = V_IDX(x, 1);
+	float x2 = V_IDX(x, 2);
+	V_IDX(y, 1) = a * (x1 - x1 * x2);
+	V_IDX(y, 2) = -(x2 - x1 * x2);
+}
+
+void df_volt(float t, float *x, float *J, void *ctx)
+{
+	float a = *(float *)ctx;
+	float x1 = V_IDX(x, 1);
+	float x2 = V_IDX(x, 2);
+	M_IDX(J, 2, 1, 1) = a * (1.0f - x2);
+	M_IDX(J, 2, 2, 1) = x2;
+	M_IDX(J, 2, 1, 2) = -a * x1;
+	M_IDX(J, 2, 2, 2) = -(1.0f - x1);
+}
+
+void f_volt_ens(uint W, float t, float *X, float *Y, void *ctx)
+{
+	for (uint w = 1; w <= W; w++) {
+		float x[2] = { M_IDX(X, W, w, 1), M_IDX(X, W, w, 2) };
+		float y[2];
+		f_volt(t, x, y, &V_IDX((float *)ctx, w));
+		M_IDX(Y, W, w, 1) = V_IDX(y, 1);
+		M_IDX(Y, W, w, 2) = V_IDX(y, 2);
+	}
+}
+
+void df_volt_ens(uint W, float t, float *X, float *J, void *ctx)
+{
+	for (uint w = 1; w <= W; w++) {
+		float x[2] = { M_IDX(X, W, w, 1), M_IDX(X, W, w, 2) };
+		float j[4];
+		df_volt(t, x, j, &V_IDX((float *)ctx, w));
+		for (uint k = 1; k <= 4; k++) {
+			M_IDX(J, W, w, k) = V_IDX(j, k);
+		}
+	}
+}
+
+int main(void)
+{
+	uint W = 11;
+	float a[11];
+	float Y1[22], Y2[22];
+	for (uint w = 1; w <= W; w++) {
+		V_IDX(a, w) = 1.0f + 0.5f * w;
+		M_IDX(Y1, W, w, 1) = 2.0f;
+		M_IDX(Y1, W, w, 2) = 1.0f;
+	}
+
+	/* rk4_ens() matches rk4() lane by lane */
+	m_copy(2 * W, 1, 2 * W, Y2, 2 * W, Y1);
+	rk4_ens(2, W, f_volt_ens, a, 0.0f, Y2, 10.0f, 1000);
+	for (uint w = 1; w <= W; w++) {
+		float y[2] = { M_IDX(Y1, W, w, 1), M_IDX(Y1, W, w, 2) };
+		rk4(2, f_volt, &V_IDX(a, w), 0.0f, y, 10.0f, 1000);
+		assert(V_IDX(y, 1) == M_IDX(Y2, W, w, 1));
+		assert(V_IDX(y, 2) == M_IDX(Y2, W, w, 2));
+	}
+
+	/* bdf1_ens() matches bdf1() lane by lane */
+	m_copy(2 * W, 1, 2 * W, Y2, 2 * W, Y1);
+	bdf1_ens(2, W, f_volt_ens, df_volt_ens, a, 0.0f, Y2, 10.0f, 1000,
+	         0.0001f);
+	for (uint w = 1; w <= W; w++) {
+		float y[2] = { M_IDX(Y1, W, w, 1), M_IDX(Y1, W, w, 2) };
+		bdf1(2, f_volt, df_volt, &V_IDX(a, w), 0.0f, y, 10.0f, 1000,
+		     0.0001f);
+		assert(fabs(V_IDX(y, 1) - M_IDX(Y2, W, w, 1)) < 1e-4f);
+		assert(fabs(V_IDX(y, 2) - M_IDX(Y2, W, w, 2)) < 1e-4f);
+	}
+
+	/* the batched influenza model matches the point-wise one */
+	uint l = 16;
+	float x[8] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f, 1.0f };
+	float *X = create_matrix(8, l);
+	for (uint j = 1; j <= l; j++) {
+		for (uint i = 1; i <= 8; i++) {
+			M_IDX(X, 8, i, j) = V_IDX(x, i) * (1.0f + 0.02f * j);
+		}
+	}
+	float *Z1 = create_matrix(22, l);
+	float *Z2 = create_matrix(22, l);
+	for (uint j = 1; j <= l; j++) {
+		fwd_influenza(M_COL(X, 8, j), M_COL(Z1, 22, j), NULL);
+	}
+	fwd_influenza_batch(l, X, Z2, NULL);
+	for (uint j = 1; j <= l; j++) {
+		for (uint i = 1; i <= 22; i++) {
+			float z = M_IDX(Z1, 22, i, j);
+			assert(fabs(z - M_IDX(Z2, 22, i, j))
+			       <= 1e-4f * (1.0f + fabs(z)));
+		}
+	}
+	free(Z2);
+	free(Z1);
+	free(X);
+
+	return 0;
+}
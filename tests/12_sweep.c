@@ -0,0 +1,73 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+void f_cos(float t, float *y, float *F, void *ctx)
+{
+	F[0] = y[1];
+	F[1] = -y[0];
+}
+
+void df_cos(float t, float *y, float *J, void *ctx)
+{
+	M_IDX(J, 2, 1, 1) = 0.0f;
+	M_IDX(J, 2, 2, 1) = -1.0f;
+	M_IDX(J, 2, 1, 2) = 1.0f;
+	M_IDX(J, 2, 2, 2) = 0.0f;
+}
+
+int main(void)
+{
+	/* output times that do not fall on step boundaries */
+	float tout[6] = { 0.0f, 0.33f, 1.0f, 1.71f, 2.5f, 3.14157f };
+	float Y[2 * 6];
+
+	float y0[2] = { 1.0f, 0.0f };
+	rk4_sweep(2, f_cos, NULL, 0.0f, y0, 6, tout, Y, 20);
+	print_matrix(2, 6, Y);
+	for (uint k = 1; k <= 6; k++) {
+		float t = V_IDX(tout, k);
+		assert(fabs(M_IDX(Y, 2, 1, k) - cos(t)) < 0.001f);
+		assert(fabs(M_IDX(Y, 2, 2, k) + sin(t)) < 0.001f);
+	}
+	assert(V_IDX(y0, 1) == M_IDX(Y, 2, 1, 6));
+	assert(V_IDX(y0, 2) == M_IDX(Y, 2, 2, 6));
+
+	/* ending on a step boundary gives the same result as rk4() */
+	float y1[2] = { 1.0f, 0.0f };
+	rk4(2, f_cos, NULL, 0.0f, y1, 3.14157f, 20);
+	assert(fabs(V_IDX(y1, 1) - V_IDX(y0, 1)) < 1e-5f);
+	assert(fabs(V_IDX(y1, 2) - V_IDX(y0, 2)) < 1e-5f);
+
+	/* backwards Euler is only first order, and damps the oscillation */
+	V_IDX(y0, 1) = 1.0f;
+	V_IDX(y0, 2) = 0.0f;
+	bdf1_sweep(2, f_cos, df_cos, NULL, 0.0f, y0, 6, tout, Y, 1000,
+	           0.0001f);
+	print_matrix(2, 6, Y);
+	for (uint k = 1; k <= 6; k++) {
+		float t = V_IDX(tout, k);
+		assert(fabs(M_IDX(Y, 2, 1, k) - cos(t)) < 0.01f);
+		assert(fabs(M_IDX(Y, 2, 2, k) + sin(t)) < 0.01f);
+	}
+
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+void f_cos(float t, float *y, float *F, void *ctx)
+{
+	float w = *(float *)ctx;
+	F[0] = w * y[1];
+	F[1] = -w * y[0];
+}
+
+int main(void)
+{
+	float tout[5] = { 0.5f, 1.0f, 2.0f, 3.5f, 10.0f };
+	float Y[2 * 5];
+	struct ode_stats st;
+
+	/* accuracy, at output times inside the steps */
+	float w = 1.0f;
+	float y[2] = { 1.0f, 0.0f };
+	assert(dopri5(2, f_cos, &w, 0.0f, y, 5, tout, Y, 1e-5f, 1e-7f,
+	              &st) == 0);
+	printf("w=%g: %u steps, %u rejected, %u evaluations\n",
+	       w, st.nsteps, st.nreject, st.nfev);
+	for (uint k = 1; k <= 5; k++) {
+		float t = V_IDX(tout, k);
+		assert(fabs(M_IDX(Y, 2, 1, k) - cos(t)) < 1e-3f);
+		assert(fabs(M_IDX(Y, 2, 2, k) + sin(t)) < 1e-3f);
+	}
+	uint slow = st.nsteps;
+
+	/* a faster oscillation takes more steps for the same tolerance */
+	w = 10.0f;
+	V_IDX(y, 1) = 1.0f;
+	V_IDX(y, 2) = 0.0f;
+	assert(dopri5(2, f_cos, &w, 0.0f, y, 5, tout, Y, 1e-5f, 1e-7f,
+	              &st) == 0);
+	printf("w=%g: %u steps, %u rejected, %u evaluations\n",
+	       w, st.nsteps, st.nreject, st.nfev);
+	assert(st.nsteps > 5 * slow);
+	for (uint k = 1; k <= 5; k++) {
+		float t = V_IDX(tout, k);
+		assert(fabs(M_IDX(Y, 2, 1, k) - cos(w * t)) < 1e-2f);
+		assert(fabs(M_IDX(Y, 2, 2, k) + sin(w * t)) < 1e-2f);
+	}
+
+	/* loose tolerances take fewer steps */
+	V_IDX(y, 1) = 1.0f;
+	V_IDX(y, 2) = 0.0f;
+	struct ode_stats loose;
+	assert(dopri5(2, f_cos, &w, 0.0f, y, 5, tout, Y, 1e-2f, 1e-4f,
+	              &loose) == 0);
+	assert(loose.nsteps < st.nsteps);
+
+	return 0;
+}
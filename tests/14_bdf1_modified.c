@@ -0,0 +1,88 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+static const float a = 4.0f;
+static const float c = 1.0f;
+
+void f_volt(float t, float *x, float *y, void *ctx)
+{
+	float x1 = V_IDX(x, 1);
+	float x2 = V_IDX(x, 2);
+	V_IDX(y, 1) = a * (x1 - x1 * x2);
+	V_IDX(y, 2) = -c * (x2 - x1 * x2);
+}
+
+void df_volt(float t, float *x, float *J, void *ctx)
+{
+	float x1 = V_IDX(x, 1);
+	float x2 = V_IDX(x, 2);
+
+	M_IDX(J, 2, 1, 1) = a * (1.0f - x2);
+	M_IDX(J, 2, 2, 1) = c * x2;
+	M_IDX(J, 2, 1, 2) = -a * x1;
+	M_IDX(J, 2, 2, 2) = -c * (1.0f - x1);
+}
+
+/* y' = y^2 blows up at t = 1 */
+void f_sq(float t, float *y, float *F, void *ctx)
+{
+	V_IDX(F, 1) = V_IDX(y, 1) * V_IDX(y, 1);
+}
+
+void df_sq(float t, float *y, float *J, void *ctx)
+{
+	V_IDX(J, 1) = 2.0f * V_IDX(y, 1);
+}
+
+int main(void)
+{
+	float tout[1] = { 10.0f };
+	float Y[2];
+	struct ode_stats st;
+
+	/* same solution as bdf1(), with far fewer Jacobians */
+	float y0[2] = { 2.0f, 1.0f };
+	float y1[2] = { 2.0f, 1.0f };
+	bdf1(2, f_volt, df_volt, NULL, 0.0f, y0, 10.0f, 1000, 0.0001f);
+	assert(bdf1_modified(2, f_volt, df_volt, NULL, 0.0f, y1, 1, tout, Y,
+	                     1000, 0.0001f, 10, &st) == 0);
+	printf("BDF1: %f, %f\n", y0[0], y0[1]);
+	printf("BDF1 (modified Newton): %f, %f\n", y1[0], y1[1]);
+	printf("%u steps, %u Newton iterations, %u Jacobians, %u LU\n",
+	       st.nsteps, st.nniter, st.njev, st.ndecomp);
+	assert(st.nsteps == 1000);
+	assert(st.njev < st.nsteps / 2);
+	assert(fabs(y0[0] - y1[0]) < 0.01f);
+	assert(fabs(y0[1] - y1[1]) < 0.01f);
+	assert(V_IDX(Y, 1) == V_IDX(y1, 1));
+
+	/* x = 1 + 0.9 x^2 has no real solution: Newton must fail */
+	float u[1] = { 1.0f };
+	float tf[1] = { 0.9f };
+	float U[1];
+	assert(bdf1_modified(1, f_sq, df_sq, NULL, 0.0f, u, 1, tf, U,
+	                     1, 0.0001f, 20, &st) == -1);
+	assert(st.njev == 1);
+	assert(V_IDX(u, 1) == 1.0f);
+
+	return 0;
+}
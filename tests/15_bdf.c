@@ -0,0 +1,112 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+void F_influenza(float, float *, float *, void *);
+void dF_influenza(float, float *, float *, void *);
+
+static const float a = 4.0f;
+static const float c = 1.0f;
+
+void f_volt(float t, float *x, float *y, void *ctx)
+{
+	float x1 = V_IDX(x, 1);
+	float x2 = V_IDX(x, 2);
+	V_IDX(y, 1) = a * (x1 - x1 * x2);
+	V_IDX(y, 2) = -c * (x2 - x1 * x2);
+}
+
+void df_volt(float t, float *x, float *J, void *ctx)
+{
+	float x1 = V_IDX(x, 1);
+	float x2 = V_IDX(x, 2);
+
+	M_IDX(J, 2, 1, 1) = a * (1.0f - x2);
+	M_IDX(J, 2, 2, 1) = c * x2;
+	M_IDX(J, 2, 1, 2) = -a * x1;
+	M_IDX(J, 2, 2, 2) = -c * (1.0f - x1);
+}
+
+/* y' = -k (y - cos t), stiff for large k */
+static const float k = 10000.0f;
+
+void f_stiff(float t, float *y, float *F, void *ctx)
+{
+	V_IDX(F, 1) = -k * (V_IDX(y, 1) - cosf(t));
+}
+
+void df_stiff(float t, float *y, float *J, void *ctx)
+{
+	V_IDX(J, 1) = -k;
+}
+
+int main(void)
+{
+	struct ode_stats st;
+
+	/* Lotka-Volterra: compare with a tight dopri5() solution */
+	float tv[4] = { 1.0f, 2.5f, 5.0f, 10.0f };
+	float Yr[8], Yb[8];
+	float y0[2] = { 2.0f, 1.0f };
+	float y1[2] = { 2.0f, 1.0f };
+	assert(dopri5(2, f_volt, NULL, 0.0f, y0, 4, tv, Yr,
+	              1e-7f, 1e-7f, NULL) == 0);
+	assert(bdf(2, f_volt, df_volt, NULL, 0.0f, y1, 4, tv, Yb,
+	           1e-5f, 1e-5f, &st) == 0);
+	printf("BDF: %f, %f (%u steps, %u rejected, %u Jacobians)\n",
+	       y1[0], y1[1], st.nsteps, st.nreject, st.njev);
+	for (uint i = 1; i <= 8; i++) {
+		assert(fabs(V_IDX(Yr, i) - V_IDX(Yb, i)) < 0.01f);
+	}
+	assert(V_IDX(y1, 1) == M_IDX(Yb, 2, 1, 4));
+
+	/* a stiff problem takes a handful of steps */
+	float u[1] = { 0.0f };
+	float tf[1] = { 10.0f };
+	float U[1];
+	assert(bdf(1, f_stiff, df_stiff, NULL, 0.0f, u, 1, tf, U,
+	           1e-4f, 1e-6f, &st) == 0);
+	printf("stiff: %f (%u steps, %u Jacobians)\n", V_IDX(u, 1),
+	       st.nsteps, st.njev);
+	assert(fabs(V_IDX(u, 1) - cosf(10.0f)) < 1e-3f);
+	assert(st.nsteps < 1000);
+
+	/* influenza: far fewer steps than bdf1() for the same accuracy */
+	float X[7] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f };
+	float ti[3] = { 4.5f, 51.0f, 166.0f };
+	float v0[4] = { 0.4f, 0.0f, 0.0f, 1.1f };
+	float v1[4] = { 0.4f, 0.0f, 0.0f, 1.1f };
+	float V0[12], V1[12];
+	uint N = 20000;
+	bdf1_sweep(4, F_influenza, dF_influenza, X, 0.0f, v0, 3, ti, V0,
+	           N, 0.0001f);
+	assert(bdf(4, F_influenza, dF_influenza, X, 0.0f, v1, 3, ti, V1,
+	           1e-5f, 1e-6f, &st) == 0);
+	printf("influenza: %u steps for BDF1, %u for BDF\n", N, st.nsteps);
+	for (uint i = 1; i <= 12; i++) {
+		assert(fabs(V_IDX(V0, i) - V_IDX(V1, i))
+		       < 1e-3f * (1.0f + fabs(V_IDX(V0, i))));
+	}
+	assert(st.nsteps < N / 20);
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+#ifdef HAVE_LSODE
+
+/* Robertson's chemical kinetics, the example of the SLSODE documentation */
+void f_rober(float t, float *y, float *d, void *ctx)
+{
+	V_IDX(d, 1) = -0.04f * V_IDX(y, 1) + 1e4f * V_IDX(y, 2) * V_IDX(y, 3);
+	V_IDX(d, 3) = 3e7f * V_IDX(y, 2) * V_IDX(y, 2);
+	V_IDX(d, 2) = -V_IDX(d, 1) - V_IDX(d, 3);
+}
+
+void df_rober(float t, float *y, float *J, void *ctx)
+{
+	M_IDX(J, 3, 1, 1) = -0.04f;
+	M_IDX(J, 3, 2, 1) = 0.04f;
+	M_IDX(J, 3, 3, 1) = 0.0f;
+	M_IDX(J, 3, 1, 2) = 1e4f * V_IDX(y, 3);
+	M_IDX(J, 3, 3, 2) = 6e7f * V_IDX(y, 2);
+	M_IDX(J, 3, 2, 2) = -M_IDX(J, 3, 1, 2) - M_IDX(J, 3, 3, 2);
+	M_IDX(J, 3, 1, 3) = 1e4f * V_IDX(y, 2);
+	M_IDX(J, 3, 2, 3) = -M_IDX(J, 3, 1, 3);
+	M_IDX(J, 3, 3, 3) = 0.0f;
+}
+
+/* y at the output times, from the SLSODE documentation */
+static const float ref[12] = {
+	9.851726e-01f, 3.386406e-05f, 1.479357e-02f,
+	9.055142e-01f, 2.240418e-05f, 9.446344e-02f,
+	7.158050e-01f, 9.184616e-06f, 2.841858e-01f,
+	4.504846e-01f, 3.222434e-06f, 5.495122e-01f
+};
+
+static void check(uint o, float *y)
+{
+	for (uint i = 1; i <= 3; i++) {
+		float r = M_IDX(ref, 3, i, o);
+		assert(fabs(V_IDX(y, i) - r) < 1e-2f * fabs(r) + 1e-7f);
+	}
+}
+
+static void count(const struct lsode_error *e, void *ctx)
+{
+	printf("ODEPACK: %s\n", e->msg);
+	(*(uint *)ctx)++;
+}
+
+int main(void)
+{
+	float tout[4] = { 0.4f, 4.0f, 40.0f, 400.0f };
+	float Y[12];
+	struct ode_stats st;
+
+	enum lsode_method methods[2] = { LSODE_BDF, LSODE_AUTO };
+	for (uint k = 0; k < 2; k++) {
+		struct lsode_workspace *ws =
+			lsode_workspace_create(3, methods[k]);
+
+		/* the workspace is reused across calls */
+		for (uint r = 0; r < 2; r++) {
+			float y[3] = { 1.0f, 0.0f, 0.0f };
+			assert(lsode(ws, f_rober, (r ? NULL : df_rober), NULL,
+			             0.0f, y, 4, tout, Y, 1e-4f, 1e-8f,
+			             &st) == 0);
+			printf("method %u: y(400) = %e, %e, %e (%u steps)\n",
+			       k, y[0], y[1], y[2], st.nsteps);
+
+			for (uint o = 1; o <= 4; o++) {
+				check(o, M_COL(Y, 3, o));
+			}
+			assert(fabs(y[0] + y[1] + y[2] - 1.0f) < 1e-4f);
+		}
+
+		lsode_workspace_destroy(ws);
+	}
+
+	/* two interleaved handles continue where they stopped */
+	struct lsode_workspace *a = lsode_workspace_create(3, LSODE_BDF);
+	struct lsode_workspace *b = lsode_workspace_create(3, LSODE_AUTO);
+	float y0[3] = { 1.0f, 0.0f, 0.0f };
+	float ya[3], yb[3];
+	lsode_init(a, f_rober, df_rober, NULL, 0.0f, y0, 1e-4f, 1e-8f);
+	lsode_init(b, f_rober, NULL, NULL, 0.0f, y0, 1e-4f, 1e-8f);
+	for (uint o = 1; o <= 4; o++) {
+		assert(lsode_advance(a, V_IDX(tout, o), ya) == 0);
+		assert(lsode_advance(b, V_IDX(tout, o), yb) == 0);
+		check(o, ya);
+		check(o, yb);
+	}
+
+	/* restarting at every output time costs more steps */
+	struct ode_stats sr = { 0 };
+	lsode_stats(a, &st);
+	float t = 0.0f;
+	for (uint o = 1; o <= 4; o++) {
+		lsode_reset(a, t, y0);
+		assert(lsode_advance(a, V_IDX(tout, o), y0) == 0);
+		t = V_IDX(tout, o);
+		struct ode_stats so;
+		lsode_stats(a, &so);
+		sr.nsteps += so.nsteps;
+	}
+	printf("%u steps when continuing, %u when restarting\n",
+	       st.nsteps, sr.nsteps);
+	assert(st.nsteps < sr.nsteps);
+
+	/* illegal input is reported through the error handler */
+	uint nerr = 0;
+	float y1[3] = { 1.0f, 0.0f, 0.0f };
+	lsode_set_error_handler(a, count, &nerr);
+	assert(lsode(a, f_rober, df_rober, NULL, 0.0f, y1, 4, tout, Y,
+	             -1.0f, 1e-8f, NULL) == -1);
+	assert(nerr > 0);
+
+	lsode_workspace_destroy(b);
+	lsode_workspace_destroy(a);
+
+	return 0;
+}
+
+#else
+
+int main(void)
+{
+	printf("Built without LSODE=1, nothing to test\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cn.h"
+#include "integrate.h"
+#include "pool.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+#ifdef HAVE_LSODE
+
+void F_influenza(float, float *, float *, void *);
+void dF_influenza(float, float *, float *, void *);
+
+static const float tout[3] = { 4.5f, 51.0f, 166.0f };
+
+/* one workspace per worker, since a workspace holds the solver state */
+struct job {
+	struct lsode_workspace **ws;
+	enum lsode_method method;
+	float *X;
+	float *Y;
+};
+
+static void solve(struct lsode_workspace *ws, enum lsode_method method,
+                  float *x, float *y)
+{
+	float u[4] = { V_IDX(x, 5), 0.0f, 0.0f, V_IDX(x, 7) };
+	assert(lsode(ws, F_influenza,
+	             (method == LSODE_BDF ? dF_influenza : NULL), x,
+	             0.0f, u, 3, tout, y, 1e-5f, 1e-7f, NULL) == 0);
+}
+
+static void run(void *arg, uint begin, uint end, uint id)
+{
+	struct job *job = (struct job *)arg;
+	for (uint j = begin; j < end; j++) {
+		solve(job->ws[id], job->method, M_COL(job->X, 7, j),
+		      M_COL(job->Y, 12, j));
+	}
+}
+
+int main(void)
+{
+	init_prg();
+
+	struct cn_pool *pool = cn_pool_create(8);
+	uint size = cn_pool_size(pool);
+	uint l = 1000;
+
+	/* perturbations of the parameters of influenza() */
+	float x0[7] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f };
+	float *X = create_matrix(7, l);
+	for (uint j = 1; j <= l; j++) {
+		for (uint i = 1; i <= 7; i++) {
+			M_IDX(X, 7, i, j) = V_IDX(x0, i)
+			                    * (0.75f + 0.5f * rand() / RAND_MAX);
+		}
+	}
+	float *Y1 = create_matrix(12, l);
+	float *Y2 = create_matrix(12, l);
+
+	enum lsode_method methods[3] = { LSODE_ADAMS, LSODE_BDF, LSODE_AUTO };
+	for (uint k = 0; k < 3; k++) {
+		struct lsode_workspace **ws = (struct lsode_workspace **)
+			malloc(sizeof(*ws) * size);
+		assert(ws);
+		for (uint w = 0; w < size; w++) {
+			ws[w] = lsode_workspace_create(4, methods[k]);
+		}
+
+		/* serial runs */
+		for (uint j = 1; j <= l; j++) {
+			solve(ws[0], methods[k], M_COL(X, 7, j), M_COL(Y1, 12, j));
+		}
+
+		/* concurrent runs must give the same bits */
+		struct job job = { ws, methods[k], X, Y2 };
+		for (uint r = 0; r < 5; r++) {
+			for (uint j = 1; j <= 12 * l; j++) {
+				V_IDX(Y2, j) = NAN;
+			}
+			cn_pool_run(pool, l, run, &job);
+			for (uint j = 1; j <= 12 * l; j++) {
+				assert(V_IDX(Y1, j) == V_IDX(Y2, j));
+			}
+		}
+
+		for (uint w = 0; w < size; w++) {
+			lsode_workspace_destroy(ws[w]);
+		}
+		free(ws);
+	}
+
+	free(Y2);
+	free(Y1);
+	free(X);
+	cn_pool_destroy(pool);
+
+	return 0;
+}
+
+#else
+
+int main(void)
+{
+	printf("Built without LSODE=1, nothing to test\n");
+	return 0;
+}
+
+#endif
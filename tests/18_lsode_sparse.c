@@ -0,0 +1,200 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+#define PI 3.14159265358979f
+
+#ifdef HAVE_LSODE
+
+/*
+ * Heat equation u_t = u_xx on (0, 1), u = 0 on the boundary, discretized
+ * by centered differences on n interior points.
+ */
+struct heat {
+	uint n;
+	float c;
+	float hl0;
+	float *w;
+};
+
+void f_heat(float t, float *u, float *d, void *ctx)
+{
+	struct heat *p = (struct heat *)ctx;
+	uint n = p->n;
+	for (uint i = 1; i <= n; i++) {
+		float l = (i > 1 ? V_IDX(u, i - 1) : 0.0f);
+		float r = (i < n ? V_IDX(u, i + 1) : 0.0f);
+		V_IDX(d, i) = p->c * (l - 2.0f * V_IDX(u, i) + r);
+	}
+}
+
+void dfj_heat(float t, float *u, uint j, float *col, void *ctx)
+{
+	struct heat *p = (struct heat *)ctx;
+	if (j > 1) {
+		V_IDX(col, j - 1) = p->c;
+	}
+	V_IDX(col, j) = -2.0f * p->c;
+	if (j < p->n) {
+		V_IDX(col, j + 1) = p->c;
+	}
+}
+
+/* P = I - hl0 * J is tridiagonal, and exact here */
+int psetup_heat(float t, float *u, float *fu, float hl0, void *ctx)
+{
+	struct heat *p = (struct heat *)ctx;
+	p->hl0 = hl0;
+	return 0;
+}
+
+int psolve_heat(float t, float *u, float *fu, float hl0, float *b, void *ctx)
+{
+	struct heat *p = (struct heat *)ctx;
+	uint n = p->n;
+	float a = -p->hl0 * p->c;
+	float d = 1.0f + 2.0f * p->hl0 * p->c;
+
+	/* Thomas algorithm, w holds the modified superdiagonal */
+	V_IDX(p->w, 1) = a / d;
+	V_IDX(b, 1) /= d;
+	for (uint i = 2; i <= n; i++) {
+		float m = d - a * V_IDX(p->w, i - 1);
+		V_IDX(p->w, i) = a / m;
+		V_IDX(b, i) = (V_IDX(b, i) - a * V_IDX(b, i - 1)) / m;
+	}
+	for (uint i = n - 1; i >= 1; i--) {
+		V_IDX(b, i) -= V_IDX(p->w, i) * V_IDX(b, i + 1);
+	}
+	return 0;
+}
+
+/* the semi-discrete solution from u(0, x) = sin(pi x) */
+static void check(uint n, float t, float *u)
+{
+	float h = 1.0f / (n + 1);
+	float s = sin(PI * h / 2.0f);
+	float lambda = -4.0f * s * s / (h * h);
+	for (uint i = 1; i <= n; i++) {
+		float e = exp(lambda * t) * sin(PI * i * h);
+		assert(fabs(V_IDX(u, i) - e) < 1e-3f);
+	}
+}
+
+int main(void)
+{
+	uint n = 1000;
+	uint nnz = 3 * n - 2;
+	float h = 1.0f / (n + 1);
+	struct heat p = { n, 1.0f / (h * h), 0.0f, create_vector(n) };
+	float tout[2] = { 0.05f, 0.1f };
+	float *u0 = create_vector(n);
+	float *u = create_vector(n);
+	float *U = create_matrix(n, 2);
+	struct ode_stats st;
+
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(u0, i) = sin(PI * i * h);
+	}
+
+	/* the sparse work arrays are much smaller than the dense ones */
+	printf("workspace: %zu bytes sparse, %zu dense\n",
+	       lsode_workspace_size_sparse(n, nnz),
+	       lsode_workspace_size(n, LSODE_BDF));
+	assert(10 * lsode_workspace_size_sparse(n, nnz)
+	       < lsode_workspace_size(n, LSODE_BDF));
+
+	/* tridiagonal structure in compressed columns */
+	int *ia = (int *)malloc(sizeof(int) * (n + 1));
+	int *ja = (int *)malloc(sizeof(int) * nnz);
+	assert(ia && ja);
+	uint k = 1;
+	for (uint j = 1; j <= n; j++) {
+		V_IDX(ia, j) = k;
+		for (uint i = (j > 1 ? j - 1 : 1); i <= j + 1 && i <= n; i++) {
+			V_IDX(ja, k++) = i;
+		}
+	}
+	V_IDX(ia, n + 1) = k;
+	assert(k == nnz + 1);
+
+	struct lsode_workspace *ws = lsode_workspace_create_sparse(n, nnz);
+
+	/* given structure and columns */
+	lsode_set_sparsity(ws, ia, ja, dfj_heat);
+	m_copy(n, 1, n, u, n, u0);
+	assert(lsode(ws, f_heat, NULL, &p, 0.0f, u, 2, tout, U,
+	             1e-4f, 1e-6f, &st) == 0);
+	printf("sparse, given Jacobian: %u steps, %u f, %u LU\n",
+	       st.nsteps, st.nfev, st.ndecomp);
+	check(n, 0.05f, M_COL(U, n, 1));
+	check(n, 0.1f, u);
+
+	/* the columns are grouped for the finite differences (3 groups) */
+	lsode_set_sparsity(ws, ia, ja, NULL);
+	m_copy(n, 1, n, u, n, u0);
+	assert(lsode(ws, f_heat, NULL, &p, 0.0f, u, 2, tout, U,
+	             1e-4f, 1e-6f, &st) == 0);
+	printf("sparse, approximated Jacobian: %u steps, %u f, %u LU\n",
+	       st.nsteps, st.nfev, st.ndecomp);
+	assert(st.nfev < n);
+	check(n, 0.1f, u);
+
+	/* structure found by SLSODES */
+	lsode_set_sparsity(ws, NULL, NULL, NULL);
+	m_copy(n, 1, n, u, n, u0);
+	assert(lsode(ws, f_heat, NULL, &p, 0.0f, u, 2, tout, U,
+	             1e-4f, 1e-6f, &st) == 0);
+	check(n, 0.1f, u);
+	lsode_workspace_destroy(ws);
+
+	/* matrix-free, preconditioned */
+	ws = lsode_workspace_create(n, LSODE_KRYLOV);
+	lsode_set_precond(ws, psetup_heat, psolve_heat);
+	m_copy(n, 1, n, u, n, u0);
+	assert(lsode(ws, f_heat, NULL, &p, 0.0f, u, 2, tout, U,
+	             1e-4f, 1e-6f, &st) == 0);
+	printf("Krylov: %u steps, %u f, %u Newton iterations\n",
+	       st.nsteps, st.nfev, st.nniter);
+	assert(st.nniter > 0);
+	check(n, 0.05f, M_COL(U, n, 1));
+	check(n, 0.1f, u);
+	lsode_workspace_destroy(ws);
+
+	free(ja);
+	free(ia);
+	free(U);
+	free(u);
+	free(u0);
+	free(p.w);
+
+	return 0;
+}
+
+#else
+
+int main(void)
+{
+	printf("Built without LSODE=1, nothing to test\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+/*
+ * Reaction-diffusion u_t = c u_xx - u^2 on a line or a ring of n points.
+ * The value at grid point i is stored in y(sigma(i)), so that the same
+ * problem can be numbered arbitrarily.
+ */
+struct chain {
+	uint n;
+	float c;
+	int ring;
+	uint *sigma;
+	uint *isigma;
+	const int *ia;
+	const int *ja;
+};
+
+static uint left(const struct chain *p, uint i)
+{
+	return (i > 1 ? i - 1 : (p->ring ? p->n : 0));
+}
+
+static uint right(const struct chain *p, uint i)
+{
+	return (i < p->n ? i + 1 : (p->ring ? 1 : 0));
+}
+
+void f_chain(float t, float *y, float *d, void *ctx)
+{
+	struct chain *p = (struct chain *)ctx;
+	for (uint i = 1; i <= p->n; i++) {
+		uint l = left(p, i);
+		uint r = right(p, i);
+		float u = V_IDX(y, V_IDX(p->sigma, i));
+		float ul = (l ? V_IDX(y, V_IDX(p->sigma, l)) : 0.0f);
+		float ur = (r ? V_IDX(y, V_IDX(p->sigma, r)) : 0.0f);
+		V_IDX(d, V_IDX(p->sigma, i)) =
+			p->c * (ul - 2.0f * u + ur) - u * u;
+	}
+}
+
+/* entry (a,b) of the Jacobian */
+static float jac_entry(const struct chain *p, float *y, uint a, uint b)
+{
+	uint i = V_IDX(p->isigma, a);
+	uint j = V_IDX(p->isigma, b);
+	if (i == j) {
+		return -2.0f * p->c - 2.0f * V_IDX(y, a);
+	}
+	return (j == left(p, i) || j == right(p, i) ? p->c : 0.0f);
+}
+
+void df_dense(float t, float *y, float *J, void *ctx)
+{
+	struct chain *p = (struct chain *)ctx;
+	for (uint b = 1; b <= p->n; b++) {
+		for (uint a = 1; a <= p->n; a++) {
+			M_IDX(J, p->n, a, b) = jac_entry(p, y, a, b);
+		}
+	}
+}
+
+void df_banded(float t, float *y, float *J, void *ctx)
+{
+	struct chain *p = (struct chain *)ctx;
+	for (uint b = 1; b <= p->n; b++) {
+		for (uint a = (b > 1 ? b - 1 : 1); a <= b + 1 && a <= p->n;
+		     a++) {
+			M_IDX(J, 3, 2 + a - b, b) = jac_entry(p, y, a, b);
+		}
+	}
+}
+
+void df_sparse(float t, float *y, float *J, void *ctx)
+{
+	struct chain *p = (struct chain *)ctx;
+	for (uint b = 1; b <= p->n; b++) {
+		for (int k = V_IDX(p->ia, b); k < V_IDX(p->ia, b + 1); k++) {
+			V_IDX(J, k) = jac_entry(p, y, V_IDX(p->ja, k), b);
+		}
+	}
+}
+
+/* numbering of the unknowns, and the sparsity pattern that goes with it */
+static void number(struct chain *p, int *ia, int *ja, int scramble)
+{
+	uint n = p->n;
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(p->sigma, i) = i;
+	}
+	for (uint i = n; scramble && i > 1; i--) {
+		uint k = 1 + rand() % i;
+		uint s = V_IDX(p->sigma, i);
+		V_IDX(p->sigma, i) = V_IDX(p->sigma, k);
+		V_IDX(p->sigma, k) = s;
+	}
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(p->isigma, V_IDX(p->sigma, i)) = i;
+	}
+
+	uint k = 1;
+	for (uint b = 1; b <= n; b++) {
+		uint j = V_IDX(p->isigma, b);
+		V_IDX(ia, b) = k;
+		V_IDX(ja, k++) = b;
+		if (left(p, j)) {
+			V_IDX(ja, k++) = V_IDX(p->sigma, left(p, j));
+		}
+		if (right(p, j)) {
+			V_IDX(ja, k++) = V_IDX(p->sigma, right(p, j));
+		}
+	}
+	V_IDX(ia, n + 1) = k;
+	p->ia = ia;
+	p->ja = ja;
+}
+
+static void initial(const struct chain *p, float *y)
+{
+	for (uint i = 1; i <= p->n; i++) {
+		V_IDX(y, V_IDX(p->sigma, i)) = 1.0f + sin(0.1f * i);
+	}
+}
+
+/* max |y1(sigma1(i)) - y2(sigma2(i))| */
+static float dist(uint n, const uint *s1, float *y1, const uint *s2,
+                  float *y2)
+{
+	float d = 0.0f;
+	for (uint i = 1; i <= n; i++) {
+		d = fmaxf(d, fabsf(V_IDX(y1, V_IDX(s1, i))
+		                   - V_IDX(y2, V_IDX(s2, i))));
+	}
+	return d;
+}
+
+int main(void)
+{
+	init_prg();
+
+	uint n = 100;
+	uint N = 50;
+	float tout[2] = { 0.5f, 1.0f };
+	uint *sigma = (uint *)malloc(sizeof(uint) * n);
+	uint *isigma = (uint *)malloc(sizeof(uint) * n);
+	uint *sigma2 = (uint *)malloc(sizeof(uint) * n);
+	int *ia = (int *)malloc(sizeof(int) * (n + 1));
+	int *ja = (int *)malloc(sizeof(int) * 3 * n);
+	float *y1 = create_vector(n);
+	float *y2 = create_vector(n);
+	float *Y = create_matrix(n, 2);
+	struct chain p = { n, 10.0f, 0, sigma, isigma, NULL, NULL };
+
+	/* banded and sparse against dense, on a line */
+	struct jac_structure band = { JAC_BANDED, 1, 1, NULL, NULL };
+	number(&p, ia, ja, 0);
+	initial(&p, y1);
+	bdf1(n, f_chain, df_dense, &p, 0.0f, y1, 1.0f, N, 1e-5f);
+	initial(&p, y2);
+	bdf1_structured(n, f_chain, df_banded, &band, &p,
+	                0.0f, y2, 1.0f, N, 1e-5f);
+	printf("banded: %e\n", dist(n, sigma, y1, sigma, y2));
+	assert(dist(n, sigma, y1, sigma, y2) < 1e-5f);
+
+	struct jac_structure sp = { JAC_SPARSE, 0, 0, ia, ja };
+	initial(&p, y2);
+	bdf1_structured_sweep(n, f_chain, df_sparse, &sp, &p,
+	                      0.0f, y2, 2, tout, Y, N, 1e-5f);
+	printf("sparse: %e\n", dist(n, sigma, y1, sigma, y2));
+	assert(dist(n, sigma, y1, sigma, y2) < 1e-5f);
+	assert(dist(n, sigma, y2, sigma, M_COL(Y, n, 2)) == 0.0f);
+
+	/* on a ring numbered at random, the ordering brings the band back */
+	p.ring = 1;
+	number(&p, ia, ja, 0);
+	initial(&p, y1);
+	bdf1(n, f_chain, df_dense, &p, 0.0f, y1, 1.0f, N, 1e-5f);
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(sigma2, i) = V_IDX(sigma, i);
+	}
+	number(&p, ia, ja, 1);
+	initial(&p, y2);
+	bdf1_structured(n, f_chain, df_sparse, &sp, &p,
+	                0.0f, y2, 1.0f, N, 1e-5f);
+	printf("sparse, random numbering: %e\n",
+	       dist(n, sigma2, y1, sigma, y2));
+	assert(dist(n, sigma2, y1, sigma, y2) < 1e-5f);
+
+	free(Y);
+	free(y2);
+	free(y1);
+	free(ja);
+	free(ia);
+	free(sigma2);
+	free(isigma);
+	free(sigma);
+
+	/* a size the dense path could not afford */
+	n = 100000;
+	p.n = n;
+	p.ring = 0;
+	p.sigma = sigma = (uint *)malloc(sizeof(uint) * n);
+	p.isigma = isigma = (uint *)malloc(sizeof(uint) * n);
+	ia = (int *)malloc(sizeof(int) * (n + 1));
+	ja = (int *)malloc(sizeof(int) * 3 * n);
+	sp.ia = ia;
+	sp.ja = ja;
+	y1 = create_vector(n);
+	y2 = create_vector(n);
+	number(&p, ia, ja, 0);
+	initial(&p, y1);
+	bdf1_structured(n, f_chain, df_banded, &band, &p,
+	                0.0f, y1, 1.0f, 10, 1e-4f);
+	initial(&p, y2);
+	bdf1_structured(n, f_chain, df_sparse, &sp, &p,
+	                0.0f, y2, 1.0f, 10, 1e-4f);
+	printf("n = %u, banded vs sparse: %e\n", n,
+	       dist(n, sigma, y1, sigma, y2));
+	assert(dist(n, sigma, y1, sigma, y2) < 1e-5f);
+
+	free(y2);
+	free(y1);
+	free(ja);
+	free(ia);
+	free(isigma);
+	free(sigma);
+
+	return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+/* Reaction-diffusion u_t = c u_xx - u^2 on n points, u = 0 outside */
+struct rd {
+	uint n;
+	float c;
+	uint nfev;
+	float *w;
+};
+
+void f_rd(float t, float *u, float *d, void *ctx)
+{
+	struct rd *p = (struct rd *)ctx;
+	uint n = p->n;
+	for (uint i = 1; i <= n; i++) {
+		float l = (i > 1 ? V_IDX(u, i - 1) : 0.0f);
+		float r = (i < n ? V_IDX(u, i + 1) : 0.0f);
+		float ui = V_IDX(u, i);
+		V_IDX(d, i) = p->c * (l - 2.0f * ui + r) - ui * ui;
+	}
+	p->nfev++;
+}
+
+void df_rd_dense(float t, float *u, float *J, void *ctx)
+{
+	struct rd *p = (struct rd *)ctx;
+	uint n = p->n;
+	for (uint j = 1; j <= n; j++) {
+		for (uint i = 1; i <= n; i++) {
+			M_IDX(J, n, i, j) = 0.0f;
+		}
+		M_IDX(J, n, j, j) = -2.0f * p->c - 2.0f * V_IDX(u, j);
+		if (j > 1) {
+			M_IDX(J, n, j - 1, j) = p->c;
+		}
+		if (j < n) {
+			M_IDX(J, n, j + 1, j) = p->c;
+		}
+	}
+}
+
+void df_rd_banded(float t, float *u, float *J, void *ctx)
+{
+	struct rd *p = (struct rd *)ctx;
+	for (uint j = 1; j <= p->n; j++) {
+		M_IDX(J, 3, 1, j) = p->c;
+		M_IDX(J, 3, 2, j) = -2.0f * p->c - 2.0f * V_IDX(u, j);
+		M_IDX(J, 3, 3, j) = p->c;
+	}
+}
+
+/* (1 - hcL)^-1 b, the diffusion part only, by the Thomas algorithm */
+void psolve_rd(float t, float *u, float h, float *b, void *ctx)
+{
+	struct rd *p = (struct rd *)ctx;
+	uint n = p->n;
+	float a = -h * p->c;
+	float d = 1.0f + 2.0f * h * p->c;
+
+	V_IDX(p->w, 1) = a / d;
+	V_IDX(b, 1) /= d;
+	for (uint i = 2; i <= n; i++) {
+		float m = d - a * V_IDX(p->w, i - 1);
+		V_IDX(p->w, i) = a / m;
+		V_IDX(b, i) = (V_IDX(b, i) - a * V_IDX(b, i - 1)) / m;
+	}
+	for (uint i = n - 1; i >= 1; i--) {
+		V_IDX(b, i) -= V_IDX(p->w, i) * V_IDX(b, i + 1);
+	}
+}
+
+/* (1 + 2hc)^-1 b, the diagonal of the diffusion only */
+void psolve_jacobi(float t, float *u, float h, float *b, void *ctx)
+{
+	struct rd *p = (struct rd *)ctx;
+	for (uint i = 1; i <= p->n; i++) {
+		V_IDX(b, i) /= 1.0f + 2.0f * h * p->c;
+	}
+}
+
+static void initial(uint n, float *u)
+{
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(u, i) = 1.0f + sin(0.01f * i);
+	}
+}
+
+/* max |u - v|, NaN if either is */
+static float dist(uint n, float *u, float *v)
+{
+	float d = 0.0f;
+	for (uint i = 1; i <= n; i++) {
+		float e = fabsf(V_IDX(u, i) - V_IDX(v, i));
+		d = (e <= d ? d : e);
+	}
+	return d;
+}
+
+int main(void)
+{
+	/* small and mildly stiff: no preconditioner needed */
+	uint n = 200;
+	struct rd p = { n, 10.0f, 0, create_vector(n) };
+	float *u1 = create_vector(n);
+	float *u2 = create_vector(n);
+
+	initial(n, u1);
+	bdf1(n, f_rd, df_rd_dense, &p, 0.0f, u1, 1.0f, 50, 1e-5f);
+	struct jac_structure mf = { JAC_MATRIX_FREE };
+	initial(n, u2);
+	bdf1_structured(n, f_rd, NULL, &mf, &p, 0.0f, u2, 1.0f, 50, 1e-5f);
+	printf("n = %u, matrix-free vs dense: %e\n", n, dist(n, u1, u2));
+	assert(dist(n, u1, u2) < 1e-4f);
+
+	free(u2);
+	free(u1);
+	free(p.w);
+
+	/* large and stiff, preconditioned by the diffusion */
+	n = 20000;
+	p.n = n;
+	p.c = 1e4f;
+	p.w = create_vector(n);
+	u1 = create_vector(n);
+	u2 = create_vector(n);
+
+	struct jac_structure band = { JAC_BANDED, 1, 1 };
+	initial(n, u1);
+	p.nfev = 0;
+	bdf1_structured(n, f_rd, df_rd_banded, &band, &p,
+	                0.0f, u1, 1.0f, 20, 1e-4f);
+	printf("n = %u, banded: %u f\n", n, p.nfev);
+
+	mf.psolve = psolve_rd;
+	initial(n, u2);
+	p.nfev = 0;
+	bdf1_structured(n, f_rd, NULL, &mf, &p, 0.0f, u2, 1.0f, 20, 1e-4f);
+	printf("n = %u, matrix-free: %u f, %e from banded\n", n, p.nfev,
+	       dist(n, u1, u2));
+	assert(dist(n, u1, u2) < 1e-4f);
+
+	free(u2);
+	free(u1);
+	free(p.w);
+
+	/* a weak preconditioner and a small Krylov space: GMRES restarts */
+	n = 200;
+	p.n = n;
+	p.c = 1e3f;
+	p.w = create_vector(n);
+	u1 = create_vector(n);
+	u2 = create_vector(n);
+
+	initial(n, u1);
+	bdf1_structured(n, f_rd, df_rd_banded, &band, &p,
+	                0.0f, u1, 1.0f, 20, 1e-5f);
+	struct jac_structure rs = { JAC_MATRIX_FREE };
+	rs.psolve = psolve_jacobi;
+	rs.krylov = 4;
+	initial(n, u2);
+	p.nfev = 0;
+	bdf1_structured(n, f_rd, NULL, &rs, &p, 0.0f, u2, 1.0f, 20, 1e-5f);
+	printf("n = %u, restarted: %u f, %e from banded\n", n, p.nfev,
+	       dist(n, u1, u2));
+	assert(dist(n, u1, u2) < 1e-4f);
+
+	free(u2);
+	free(u1);
+	free(p.w);
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "dual.hpp"
+
+#include <math.h>
+
+extern "C" {
+void F_influenza(float, float *, float *, void *);
+void dF_influenza(float, float *, float *, void *);
+}
+
+/* the models of influenza.c and hiv.c, written once for any number type */
+struct influenza {
+	static const uint n = 4;
+	static const uint np = 7;
+
+	template <typename T, typename P>
+	static void rhs(float t, const T *u, T *d, const P *x)
+	{
+		V_IDX(d, 1) = -V_IDX(x, 1) * V_IDX(u, 1) * V_IDX(u, 4);
+		V_IDX(d, 2) = V_IDX(x, 1) * V_IDX(u, 1) * V_IDX(u, 4)
+		              - V_IDX(u, 2) / V_IDX(x, 2);
+		V_IDX(d, 3) = V_IDX(u, 2) / V_IDX(x, 2)
+		              - V_IDX(u, 3) / V_IDX(x, 3);
+		V_IDX(d, 4) = V_IDX(x, 4) * V_IDX(u, 3) / V_IDX(x, 5)
+		              - V_IDX(x, 6) * V_IDX(u, 4);
+	}
+};
+
+struct hiv {
+	static const uint n = 4;
+	static const uint np = 9;
+
+	template <typename T, typename P>
+	static void rhs(float t, const T *u, T *d, const P *x)
+	{
+		T u1 = V_IDX(u, 1);
+		T u2 = V_IDX(u, 2);
+		T u3 = V_IDX(u, 3);
+		T u4 = V_IDX(u, 4);
+
+		V_IDX(d, 1) = (V_IDX(x, 1) - V_IDX(x, 5) * u2
+		               - V_IDX(x, 6) * u3 - V_IDX(x, 7) * u4) * u1;
+		V_IDX(d, 2) = (V_IDX(x, 2) + V_IDX(x, 5) * u1
+		               - V_IDX(x, 8) * u3) * u2
+		              + V_IDX(x, 7) * u4 * u1 / 4.0f;
+		V_IDX(d, 3) = (V_IDX(x, 3) + V_IDX(x, 6) * u1
+		               - V_IDX(x, 9) * u2) * u3
+		              + V_IDX(x, 7) * u4 * u1 / 4.0f;
+		V_IDX(d, 4) = (V_IDX(x, 4) + V_IDX(x, 7) * u1 / 2.0f) * u4
+		              + (V_IDX(x, 8) + V_IDX(x, 9)) * u3 * u2;
+	}
+};
+
+/* a model using the elementary functions */
+struct pendulum {
+	static const uint n = 2;
+	static const uint np = 2;
+
+	template <typename T, typename P>
+	static void rhs(float t, const T *u, T *d, const P *x)
+	{
+		V_IDX(d, 1) = V_IDX(u, 2);
+		V_IDX(d, 2) = -V_IDX(x, 1) * sin(V_IDX(u, 1))
+		              - V_IDX(x, 2) * sqrt(1.0f + V_IDX(u, 2)
+		                                   * V_IDX(u, 2))
+		              + exp(-V_IDX(u, 1)) * log(2.0f + cos(V_IDX(u, 2)))
+		              / pow(1.0f + fabs(V_IDX(u, 1)), 2.0f);
+	}
+};
+
+/* centered differences of f in the state (m = 0) or the parameters */
+template <class M>
+static void fd(float t, float *y, float *x, uint m, float *J)
+{
+	uint n = M::n;
+	float fp[M::n];
+	float fm[M::n];
+	float *v = (m == 0 ? y : x);
+
+	for (uint j = 1; j <= (m == 0 ? n : m); j++) {
+		float vj = V_IDX(v, j);
+		float h = 1e-2f * (1.0f + fabs(vj));
+		V_IDX(v, j) = vj + h;
+		cn::ode_ad<M>::f(t, y, fp, x);
+		V_IDX(v, j) = vj - h;
+		cn::ode_ad<M>::f(t, y, fm, x);
+		V_IDX(v, j) = vj;
+		for (uint i = 1; i <= n; i++) {
+			M_IDX(J, n, i, j) = (V_IDX(fp, i) - V_IDX(fm, i)) / (2 * h);
+		}
+	}
+}
+
+static void check(uint n, uint m, float *A, float *B, float tol)
+{
+	for (uint j = 1; j <= m; j++) {
+		for (uint i = 1; i <= n; i++) {
+			float a = M_IDX(A, n, i, j);
+			float b = M_IDX(B, n, i, j);
+			assert(fabs(a - b) <= tol * (1.0f + fabs(b)));
+		}
+	}
+}
+
+int main(void)
+{
+	/* the generated Jacobian is the hand-written one */
+	float xi[7] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f };
+	float u[4] = { 0.4f, 0.2f, 0.1f, 1.1f };
+	float d1[4];
+	float d2[4];
+	float J1[4 * 4];
+	float J2[4 * 4];
+	F_influenza(0.0f, u, d1, xi);
+	cn::ode_ad<influenza>::f(0.0f, u, d2, xi);
+	check(4, 1, d2, d1, 0.0f);
+	dF_influenza(0.0f, u, J1, xi);
+	cn::ode_ad<influenza>::df(0.0f, u, J2, xi);
+	check(4, 4, J2, J1, 1e-6f);
+
+	/* and matches finite differences, also in the parameters */
+	float xh[9] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f, 0.5f, 3.3f };
+	float uh[4] = { 0.2f, 1.4f, 0.1f, 3.7f };
+	float Jx1[4 * 9];
+	float Jx2[4 * 9];
+	fd<hiv>(0.0f, uh, xh, 0, J1);
+	cn::ode_ad<hiv>::df(0.0f, uh, J2, xh);
+	check(4, 4, J2, J1, 1e-3f);
+	fd<hiv>(0.0f, uh, xh, 9, Jx1);
+	cn::ode_ad<hiv>::dfdx(0.0f, uh, Jx2, xh);
+	check(4, 9, Jx2, Jx1, 1e-3f);
+
+	float xp[2] = { 9.8f, 0.3f };
+	float up[2] = { 0.7f, -0.4f };
+	float Jp1[2 * 2];
+	float Jp2[2 * 2];
+	fd<pendulum>(0.0f, up, xp, 0, Jp1);
+	cn::ode_ad<pendulum>::df(0.0f, up, Jp2, xp);
+	check(2, 2, Jp2, Jp1, 1e-3f);
+	fd<pendulum>(0.0f, up, xp, 2, Jp1);
+	cn::ode_ad<pendulum>::dfdx(0.0f, up, Jp2, xp);
+	check(2, 2, Jp2, Jp1, 1e-3f);
+
+	/* comparisons look at the values, with duals or scalars either side */
+	typedef cn::dual<float, 2> D2;
+	D2 a = D2::variable(1.0f, 1);
+	D2 b = D2::variable(2.0f, 2);
+	assert(a < b && a <= b && !(a > b) && !(a >= b));
+	assert(a != b && !(a == b) && a == a && a <= a && a >= a);
+	assert(a < 2.0f && a <= 1.0f && a > 0.0f && a >= 1.0f);
+	assert(a == 1.0f && a != 2.0f);
+	assert(0.0f < a && 1.0f <= a && 2.0f > a && 1.0f >= a);
+	assert(1.0f == a && 2.0f != a);
+
+	/* the callbacks plug into the integrators */
+	float tf[4] = { 10.0f, 20.0f, 40.0f, 80.0f };
+	float Y1[4 * 4];
+	float Y2[4 * 4];
+	float y[4] = { 0.4f, 0.0f, 0.0f, 1.1f };
+	bdf1_sweep(4, F_influenza, dF_influenza, xi, 0.0f, y, 4, tf, Y1,
+	           800, 0.001f);
+	V_IDX(y, 1) = 0.4f;
+	V_IDX(y, 2) = 0.0f;
+	V_IDX(y, 3) = 0.0f;
+	V_IDX(y, 4) = 1.1f;
+	bdf1_sweep(4, cn::ode_ad<influenza>::f, cn::ode_ad<influenza>::df, xi,
+	           0.0f, y, 4, tf, Y2, 800, 0.001f);
+	check(4, 4, Y2, Y1, 1e-5f);
+
+	return 0;
+}
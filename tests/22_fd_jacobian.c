@@ -0,0 +1,173 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+extern void F_influenza(float, float *, float *, void *);
+extern void dF_influenza(float, float *, float *, void *);
+
+/* reaction-diffusion u_t = c u_xx - u^2 on a line, counting evaluations */
+struct chain {
+	uint n;
+	float c;
+	uint nfev;
+};
+
+void f_chain(float t, float *y, float *d, void *ctx)
+{
+	struct chain *p = (struct chain *)ctx;
+	uint n = p->n;
+	for (uint i = 1; i <= n; i++) {
+		float u = V_IDX(y, i);
+		float ul = (i > 1 ? V_IDX(y, i - 1) : 0.0f);
+		float ur = (i < n ? V_IDX(y, i + 1) : 0.0f);
+		V_IDX(d, i) = p->c * (ul - 2.0f * u + ur) - u * u;
+	}
+	p->nfev++;
+}
+
+void df_chain(float t, float *y, float *J, void *ctx)
+{
+	struct chain *p = (struct chain *)ctx;
+	uint n = p->n;
+	for (uint j = 1; j <= n; j++) {
+		for (uint i = 1; i <= n; i++) {
+			M_IDX(J, n, i, j) = 0.0f;
+		}
+		M_IDX(J, n, j, j) = -2.0f * p->c - 2.0f * V_IDX(y, j);
+		if (j > 1) {
+			M_IDX(J, n, j - 1, j) = p->c;
+		}
+		if (j < n) {
+			M_IDX(J, n, j + 1, j) = p->c;
+		}
+	}
+}
+
+static void init_chain(uint n, float *y)
+{
+	for (uint i = 1; i <= n; i++) {
+		V_IDX(y, i) = sinf(3.14159265f * i / (n + 1));
+	}
+}
+
+static float max_diff(uint n, float *a, float *b)
+{
+	float d = 0.0f;
+	for (uint i = 1; i <= n; i++) {
+		d = fmaxf(d, fabsf(V_IDX(a, i) - V_IDX(b, i)));
+	}
+	return d;
+}
+
+int main(void)
+{
+	const uint n = 60;
+	const uint N = 50;
+	struct chain p = { n, 100.0f, 0 };
+	float *ref = create_vector(n);
+	float *y = create_vector(n);
+
+	/* the tridiagonal pattern, columnwise */
+	int *ia = (int *)malloc(sizeof(int) * (n + 1));
+	int *ja = (int *)malloc(sizeof(int) * 3 * n);
+	assert(ia && ja);
+	V_IDX(ia, 1) = 1;
+	for (uint j = 1; j <= n; j++) {
+		int k = V_IDX(ia, j);
+		for (uint i = (j > 1 ? j - 1 : 1); i <= j + 1 && i <= n; i++) {
+			V_IDX(ja, k++) = i;
+		}
+		V_IDX(ia, j + 1) = k;
+	}
+
+	/* exact Jacobian: one evaluation of f per Newton iteration */
+	init_chain(n, ref);
+	bdf1(n, f_chain, df_chain, &p, 0.0f, ref, 0.1f, N, 1e-4f);
+	uint iters = p.nfev;
+
+	/* dense differences: n more, from the f(x) of the residual */
+	p.nfev = 0;
+	init_chain(n, y);
+	bdf1(n, f_chain, NULL, &p, 0.0f, y, 0.1f, N, 1e-4f);
+	assert(max_diff(n, y, ref) < 1e-3f);
+	printf("dense: %u evaluations for %u iterations\n", p.nfev, iters);
+	assert(p.nfev == (n + 1) * iters);
+	uint dense = p.nfev;
+
+	/* grouped differences: 3 groups, whatever the storage */
+	struct jac_structure js[3] = {
+		{ .kind = JAC_DENSE, .ia = ia, .ja = ja },
+		{ .kind = JAC_BANDED, .ml = 1, .mu = 1 },
+		{ .kind = JAC_SPARSE, .ia = ia, .ja = ja }
+	};
+	for (uint k = 0; k < 3; k++) {
+		p.nfev = 0;
+		init_chain(n, y);
+		bdf1_structured(n, f_chain, NULL, &js[k], &p,
+		                0.0f, y, 0.1f, N, 1e-4f);
+		printf("kind %u: %u evaluations\n", k, p.nfev);
+		assert(max_diff(n, y, ref) < 1e-3f);
+		assert(p.nfev == 4 * iters);
+		assert(10 * p.nfev < dense);
+	}
+
+	/* the adaptive integrators, on the influenza model */
+	float x[7] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f };
+	float tout[3] = { 5.0f, 10.0f, 20.0f };
+	float u0[4] = { 0.4f, 0.0f, 0.0f, 1.1f };
+	float u[4];
+	float Y1[4 * 3];
+	float Y2[4 * 3];
+	struct ode_stats st1;
+	struct ode_stats st2;
+
+	m_copy(4, 1, 4, u, 4, u0);
+	assert(bdf(4, F_influenza, dF_influenza, x, 0.0f, u, 3, tout, Y1,
+	           1e-4f, 1e-6f, &st1) == 0);
+	m_copy(4, 1, 4, u, 4, u0);
+	assert(bdf(4, F_influenza, NULL, x, 0.0f, u, 3, tout, Y2,
+	           1e-4f, 1e-6f, &st2) == 0);
+	assert(max_diff(12, Y1, Y2) < 1e-3f);
+	assert(st2.nfev >= st1.nfev + 5 * st2.njev);
+
+	m_copy(4, 1, 4, u, 4, u0);
+	assert(rosenbrock(4, F_influenza, dF_influenza, x, 0.0f, u, 3, tout,
+	                  Y1, 1e-4f, 1e-6f, &st1) == 0);
+	m_copy(4, 1, 4, u, 4, u0);
+	assert(rosenbrock(4, F_influenza, NULL, x, 0.0f, u, 3, tout, Y2,
+	                  1e-4f, 1e-6f, &st2) == 0);
+	assert(max_diff(12, Y1, Y2) < 1e-3f);
+
+	m_copy(4, 1, 4, u, 4, u0);
+	assert(bdf1_modified(4, F_influenza, dF_influenza, x, 0.0f, u, 3,
+	                     tout, Y1, 200, 1e-5f, 10, &st1) == 0);
+	m_copy(4, 1, 4, u, 4, u0);
+	assert(bdf1_modified(4, F_influenza, NULL, x, 0.0f, u, 3, tout, Y2,
+	                     200, 1e-5f, 10, &st2) == 0);
+	assert(max_diff(12, Y1, Y2) < 1e-3f);
+
+	free(ja);
+	free(ia);
+	free(y);
+	free(ref);
+
+	return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+extern void F_influenza(float, float *, float *, void *);
+extern void dF_influenza(float, float *, float *, void *);
+
+/* y' = -a y, y(0) = b, with p = (a, b) */
+void f_decay(float t, float *y, float *d, void *ctx)
+{
+	float *p = (float *)ctx;
+	V_IDX(d, 1) = -V_IDX(p, 1) * V_IDX(y, 1);
+}
+
+void df_decay(float t, float *y, float *J, void *ctx)
+{
+	float *p = (float *)ctx;
+	M_IDX(J, 1, 1, 1) = -V_IDX(p, 1);
+}
+
+void dfdp_decay(float t, float *y, float *Jp, void *ctx)
+{
+	M_IDX(Jp, 1, 1, 1) = -V_IDX(y, 1);
+	M_IDX(Jp, 1, 1, 2) = 0.0f;
+}
+
+/* derivatives of F_influenza() with respect to x1, ..., x7 */
+void dfdx_influenza(float t, float *u, float *Jp, void *ctx)
+{
+	float *x = (float *)ctx;
+	float x2 = V_IDX(x, 2);
+	float x3 = V_IDX(x, 3);
+	float x4 = V_IDX(x, 4);
+	float x5 = V_IDX(x, 5);
+
+	for (uint j = 1; j <= 7; j++) {
+		for (uint i = 1; i <= 4; i++) {
+			M_IDX(Jp, 4, i, j) = 0.0f;
+		}
+	}
+	float u1 = V_IDX(u, 1);
+	float u2 = V_IDX(u, 2);
+	float u3 = V_IDX(u, 3);
+	float u4 = V_IDX(u, 4);
+	M_IDX(Jp, 4, 1, 1) = -u1 * u4;
+	M_IDX(Jp, 4, 2, 1) = u1 * u4;
+	M_IDX(Jp, 4, 2, 2) = u2 / (x2 * x2);
+	M_IDX(Jp, 4, 3, 2) = -u2 / (x2 * x2);
+	M_IDX(Jp, 4, 3, 3) = u3 / (x3 * x3);
+	M_IDX(Jp, 4, 4, 4) = u3 / x5;
+	M_IDX(Jp, 4, 4, 5) = -x4 * u3 / (x5 * x5);
+	M_IDX(Jp, 4, 4, 6) = -u4;
+}
+
+/* the initial state of the influenza model, and its derivatives */
+static void init_influenza(float *x, float *u, float *S)
+{
+	V_IDX(u, 1) = V_IDX(x, 5);
+	V_IDX(u, 2) = 0.0f;
+	V_IDX(u, 3) = 0.0f;
+	V_IDX(u, 4) = V_IDX(x, 7);
+	if (S) {
+		for (uint j = 1; j <= 7; j++) {
+			for (uint i = 1; i <= 4; i++) {
+				M_IDX(S, 4, i, j) = 0.0f;
+			}
+		}
+		M_IDX(S, 4, 1, 5) = 1.0f;
+		M_IDX(S, 4, 4, 7) = 1.0f;
+	}
+}
+
+int main(void)
+{
+	/* exact sensitivities of the decay */
+	float p[2] = { 0.7f, 2.0f };
+	float tout[3] = { 0.5f, 1.0f, 2.0f };
+	float y[1];
+	float S[2];
+	float Y[3];
+	float Sout[2 * 3];
+
+	V_IDX(y, 1) = V_IDX(p, 2);
+	V_IDX(S, 1) = 0.0f;
+	V_IDX(S, 2) = 1.0f;
+	rk4_sens_sweep(1, 2, f_decay, df_decay, dfdp_decay, p, 0.0f, y, S,
+	               3, tout, Y, Sout, 100);
+	for (uint k = 1; k <= 3; k++) {
+		float t = V_IDX(tout, k);
+		float e = expf(-V_IDX(p, 1) * t);
+		assert(fabsf(V_IDX(Y, k) - V_IDX(p, 2) * e) < 1e-5f);
+		assert(fabsf(M_IDX(Sout, 1, 1, 2 * k - 1)
+		             + t * V_IDX(p, 2) * e) < 1e-4f);
+		assert(fabsf(M_IDX(Sout, 1, 1, 2 * k) - e) < 1e-5f);
+	}
+	assert(V_IDX(S, 1) == M_IDX(Sout, 1, 1, 5));
+
+	V_IDX(y, 1) = V_IDX(p, 2);
+	V_IDX(S, 1) = 0.0f;
+	V_IDX(S, 2) = 1.0f;
+	assert(bdf1_sens_sweep(1, 2, f_decay, df_decay, dfdp_decay, p, 0.0f,
+	                       y, S, 3, tout, Y, Sout, 2000, 1e-6f) == 0);
+	for (uint k = 1; k <= 3; k++) {
+		float t = V_IDX(tout, k);
+		float e = expf(-V_IDX(p, 1) * t);
+		assert(fabsf(V_IDX(Y, k) - V_IDX(p, 2) * e) < 1e-3f);
+		assert(fabsf(M_IDX(Sout, 1, 1, 2 * k - 1)
+		             + t * V_IDX(p, 2) * e) < 1e-3f);
+		assert(fabsf(M_IDX(Sout, 1, 1, 2 * k) - e) < 1e-3f);
+	}
+
+	/* with a = -1 and h = 1, 1 - hJ = 0: the outputs after the failed
+	 * step are NaN, rather than carried on from the last state */
+	V_IDX(p, 1) = -1.0f;
+	V_IDX(y, 1) = V_IDX(p, 2);
+	V_IDX(S, 1) = 0.0f;
+	V_IDX(S, 2) = 1.0f;
+	assert(bdf1_sens_sweep(1, 2, f_decay, df_decay, dfdp_decay, p, 0.0f,
+	                       y, S, 3, tout, Y, Sout, 2, 1e-6f) == -2);
+	for (uint k = 1; k <= 3; k++) {
+		assert(isnan(V_IDX(Y, k)));
+		assert(isnan(M_IDX(Sout, 1, 1, 2 * k - 1)));
+		assert(isnan(M_IDX(Sout, 1, 1, 2 * k)));
+	}
+
+	/* the influenza model, against differences of the solutions */
+	float x[7] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f };
+	float tf[4] = { 2.0f, 5.0f, 10.0f, 20.0f };
+	float u[4];
+	float Su[4 * 7];
+	float U[4 * 4];
+	float Up[4 * 4];
+	float Um[4 * 4];
+	float SU[4 * 7 * 4];
+
+	for (uint method = 0; method < 3; method++) {
+		init_influenza(x, u, Su);
+		if (method == 0) {
+			rk4_sens_sweep(4, 7, F_influenza, dF_influenza,
+			               dfdx_influenza, x, 0.0f, u, Su, 4, tf,
+			               U, SU, 400);
+		} else {
+			assert(bdf1_sens_sweep(4, 7, F_influenza,
+			                       method == 1 ? dF_influenza : NULL,
+			                       dfdx_influenza, x, 0.0f, u, Su, 4,
+			                       tf, U, SU, 400, 1e-6f) == 0);
+		}
+
+		for (uint j = 1; j <= 7; j++) {
+			float xj = V_IDX(x, j);
+			float e = 1e-2f * xj;
+			V_IDX(x, j) = xj + e;
+			init_influenza(x, u, NULL);
+			if (method == 0) {
+				rk4_sweep(4, F_influenza, x, 0.0f, u, 4, tf,
+				          Up, 400);
+			} else {
+				bdf1_sweep(4, F_influenza, dF_influenza, x,
+				           0.0f, u, 4, tf, Up, 400, 1e-6f);
+			}
+			V_IDX(x, j) = xj - e;
+			init_influenza(x, u, NULL);
+			if (method == 0) {
+				rk4_sweep(4, F_influenza, x, 0.0f, u, 4, tf,
+				          Um, 400);
+			} else {
+				bdf1_sweep(4, F_influenza, dF_influenza, x,
+				           0.0f, u, 4, tf, Um, 400, 1e-6f);
+			}
+			V_IDX(x, j) = xj;
+
+			for (uint k = 1; k <= 4; k++) {
+				for (uint i = 1; i <= 4; i++) {
+					float d = (M_IDX(Up, 4, i, k)
+					           - M_IDX(Um, 4, i, k)) / (2 * e);
+					float s = M_IDX(SU, 4, i, 7 * (k - 1) + j);
+					assert(fabsf(s - d)
+					       < 2e-2f * (1.0f + fabsf(d)));
+				}
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+static uint nfev;
+
+/* y' = y^2 blows up at t = 1 / y0 */
+void f_blowup(float t, float *y, float *d, void *ctx)
+{
+	V_IDX(d, 1) = V_IDX(y, 1) * V_IDX(y, 1);
+	nfev++;
+}
+
+void df_blowup(float t, float *y, float *J, void *ctx)
+{
+	M_IDX(J, 1, 1, 1) = 2.0f * V_IDX(y, 1);
+}
+
+/* y' = c (1 - y) settles at 1 */
+void f_relax(float t, float *y, float *d, void *ctx)
+{
+	float c = *(float *)ctx;
+	V_IDX(d, 1) = c * (1.0f - V_IDX(y, 1));
+	V_IDX(d, 2) = -c * V_IDX(y, 2);
+	nfev++;
+}
+
+void df_relax(float t, float *y, float *J, void *ctx)
+{
+	float c = *(float *)ctx;
+	M_IDX(J, 2, 1, 1) = -c;
+	M_IDX(J, 2, 2, 1) = 0.0f;
+	M_IDX(J, 2, 1, 2) = 0.0f;
+	M_IDX(J, 2, 2, 2) = -c;
+}
+
+/* backward Euler from y = 0 with h = 1 solves x^3 - 2x + 2 = 0, on which
+ * Newton's method cycles between 0 and 1 without ever failing */
+void f_cycle(float t, float *y, float *d, void *ctx)
+{
+	float x = V_IDX(y, 1);
+	V_IDX(d, 1) = -x * x * x + 3.0f * x - 2.0f;
+}
+
+void df_cycle(float t, float *y, float *J, void *ctx)
+{
+	float x = V_IDX(y, 1);
+	M_IDX(J, 1, 1, 1) = -3.0f * x * x + 3.0f;
+}
+
+void f_cycle_ens(uint W, float t, float *Y, float *D, void *ctx)
+{
+	for (uint w = 1; w <= W; w++) {
+		f_cycle(t, &V_IDX(Y, w), &V_IDX(D, w), ctx);
+	}
+}
+
+void df_cycle_ens(uint W, float t, float *Y, float *J, void *ctx)
+{
+	for (uint w = 1; w <= W; w++) {
+		df_cycle(t, &V_IDX(Y, w), &V_IDX(J, w), ctx);
+	}
+}
+
+/* y' = y: with h = 1, 1 - hJ = 0 */
+void f_id(float t, float *y, float *d, void *ctx)
+{
+	V_IDX(d, 1) = V_IDX(y, 1);
+}
+
+void df_id(float t, float *y, float *J, void *ctx)
+{
+	M_IDX(J, 1, 1, 1) = 1.0f;
+}
+
+int main(void)
+{
+	float tout[4] = { 0.5f, 1.0f, 5.0f, 10.0f };
+	float y[2];
+	float Y1[2 * 4];
+	float Y2[2 * 4];
+	const uint N = 1000;
+
+	/* without conditions, the same as rk4_sweep() */
+	float c = 2.0f;
+	struct ode_guard none = { 0 };
+	V_IDX(y, 1) = 0.0f;
+	V_IDX(y, 2) = 1.0f;
+	rk4_sweep(2, f_relax, &c, 0.0f, y, 4, tout, Y1, N);
+	V_IDX(y, 1) = 0.0f;
+	V_IDX(y, 2) = 1.0f;
+	assert(rk4_guarded(2, f_relax, &none, &c, 0.0f, y, 4, tout, Y2,
+	                   N) == 0);
+	for (uint k = 1; k <= 8; k++) {
+		assert(V_IDX(Y1, k) == V_IDX(Y2, k));
+	}
+
+	/* divergence: stopped by the bounds, or when it overflows */
+	float ymax = 1e3f;
+	struct ode_guard bounds = { NULL, &ymax, 0.0f, 0 };
+	nfev = 0;
+	V_IDX(y, 1) = 1.0f;
+	assert(rk4_guarded(1, f_blowup, &bounds, NULL, 0.0f, y, 4, tout,
+	                   Y1, N) == -3);
+	assert(V_IDX(y, 1) > ymax && nfev < 4 * N / 5);
+	assert(fabsf(V_IDX(Y1, 1) - 2.0f) < 1e-3f);
+	nfev = 0;
+	V_IDX(y, 1) = 1.0f;
+	assert(rk4_guarded(1, f_blowup, &none, NULL, 0.0f, y, 4, tout,
+	                   Y1, N) == -2);
+	assert(nfev < 4 * N / 5);
+
+	struct ode_guard capped = { NULL, NULL, 0.0f, 20 };
+	nfev = 0;
+	V_IDX(y, 1) = 1.0f;
+	int status = bdf1_guarded(1, f_blowup, df_blowup, NULL, &capped, NULL,
+	                          0.0f, y, 4, tout, Y1, N, 1e-5f);
+	assert(status == -1 || status == -2);
+	assert(nfev < 20 * N / 5);
+	/* backward Euler has no solution past y = 1 / (4h) */
+	ymax = 10.0f;
+	bounds.maxit = 50;
+	nfev = 0;
+	V_IDX(y, 1) = 1.0f;
+	assert(bdf1_guarded(1, f_blowup, df_blowup, NULL, &bounds, NULL,
+	                    0.0f, y, 4, tout, Y1, N, 1e-5f) == -3);
+	assert(V_IDX(y, 1) > ymax);
+
+	/* steady states fill the remaining outputs */
+	struct ode_guard steady = { NULL, NULL, 1e-3f, 50 };
+	c = 5.0f;
+	nfev = 0;
+	V_IDX(y, 1) = 0.0f;
+	V_IDX(y, 2) = 1.0f;
+	assert(rk4_guarded(2, f_relax, &steady, &c, 0.0f, y, 4, tout, Y1,
+	                   N) == 1);
+	assert(nfev < 4 * N / 2);
+	for (uint k = 3; k <= 4; k++) {
+		assert(M_IDX(Y1, 2, 1, k) == V_IDX(y, 1));
+		assert(M_IDX(Y1, 2, 2, k) == V_IDX(y, 2));
+		assert(fabsf(M_IDX(Y1, 2, 1, k) - 1.0f) < 1e-3f);
+	}
+
+	nfev = 0;
+	V_IDX(y, 1) = 0.0f;
+	V_IDX(y, 2) = 1.0f;
+	assert(bdf1_guarded(2, f_relax, df_relax, NULL, &steady, &c, 0.0f, y,
+	                    4, tout, Y1, N, 1e-6f) == 1);
+	for (uint k = 3; k <= 4; k++) {
+		assert(M_IDX(Y1, 2, 1, k) == V_IDX(y, 1));
+		assert(fabsf(M_IDX(Y1, 2, 1, k) - 1.0f) < 1e-2f);
+	}
+	V_IDX(y, 1) = 0.0f;
+	V_IDX(y, 2) = 1.0f;
+	bdf1_sweep(2, f_relax, df_relax, &c, 0.0f, y, 4, tout, Y2, N, 1e-6f);
+	assert(fabsf(M_IDX(Y1, 2, 1, 2) - M_IDX(Y2, 2, 1, 2)) < 1e-6f);
+
+	/* without a guard, Newton's method is still capped */
+	float t1[2] = { 1.0f, 2.0f };
+	float work[BDF1_WORK_SIZE(1)];
+	int iwork[BDF1_IWORK_SIZE(1)];
+	V_IDX(y, 1) = 0.0f;
+	bdf1(1, f_cycle, df_cycle, NULL, 0.0f, y, 1.0f, 1, 1e-6f);
+	assert(isnan(V_IDX(y, 1)));
+	V_IDX(y, 1) = 0.0f;
+	assert(bdf1_sweep_work(1, f_cycle, df_cycle, NULL, 0.0f, y, 2, t1,
+	                       Y1, 2, 1e-6f, work, iwork) == -1);
+	assert(isnan(V_IDX(Y1, 1)) && isnan(V_IDX(Y1, 2)));
+	float u[2] = { 0.0f, 0.0f };
+	float U[2 * 2];
+	bdf1_ens_sweep(1, 2, f_cycle_ens, df_cycle_ens, NULL, 0.0f, u, 2, t1,
+	               U, 2, 1e-6f);
+	for (uint k = 1; k <= 4; k++) {
+		assert(isnan(V_IDX(U, k)));
+	}
+
+	/* a singular Newton matrix fails the step */
+	V_IDX(y, 1) = 1.0f;
+	assert(bdf1_sweep_work(1, f_id, df_id, NULL, 0.0f, y, 2, t1, Y1, 2,
+	                       1e-6f, work, iwork) == -2);
+	assert(V_IDX(y, 1) == 1.0f && isnan(V_IDX(Y1, 2)));
+
+	return 0;
+}
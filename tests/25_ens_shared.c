@@ -0,0 +1,139 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+extern void F_influenza_ens(uint, float, float *, float *, void *);
+extern void dF_influenza_ens(uint, float, float *, float *, void *);
+extern void fwd_influenza_batch(uint, float *, float *, void *);
+extern void fwd_influenza_batch_shared(uint, float *, float *, void *);
+
+static uint nf;
+
+/* a stiff linear system u' = -A u, with one scale a per lane */
+void f_stiff(uint W, float t, float *U, float *D, void *ctx)
+{
+	float *a = (float *)ctx;
+	nf++;
+	for (uint w = 1; w <= W; w++) {
+		float u1 = M_IDX(U, W, w, 1);
+		float u2 = M_IDX(U, W, w, 2);
+		M_IDX(D, W, w, 1) = -V_IDX(a, w) * (u1 - u2);
+		M_IDX(D, W, w, 2) = -u2;
+	}
+}
+
+void df_stiff(uint W, float t, float *U, float *J, void *ctx)
+{
+	float *a = (float *)ctx;
+	for (uint w = 1; w <= W; w++) {
+		M_IDX(J, W, w, 1) = -V_IDX(a, w);
+		M_IDX(J, W, w, 2) = 0.0f;
+		M_IDX(J, W, w, 3) = V_IDX(a, w);
+		M_IDX(J, W, w, 4) = -1.0f;
+	}
+}
+
+static void check(uint size, float *A, float *B, float tol)
+{
+	for (uint j = 1; j <= size; j++) {
+		float b = V_IDX(B, j);
+		assert(fabsf(V_IDX(A, j) - b) <= tol * (1.0f + fabsf(b)));
+	}
+}
+
+int main(void)
+{
+	const uint N = 400;
+	float tout[3] = { 1.0f, 2.0f, 4.0f };
+	struct ode_stats st;
+
+	/* a cluster of close points shares a handful of factorizations */
+	uint l = 16;
+	float x[8] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f, 1.0f };
+	float *X = create_matrix(8, l);
+	for (uint j = 1; j <= l; j++) {
+		for (uint i = 1; i <= 8; i++) {
+			M_IDX(X, 8, i, j) = V_IDX(x, i) * (1.0f + 0.01f * j);
+		}
+	}
+	float *U1 = create_matrix(l, 4);
+	float *U2 = create_matrix(l, 4);
+	for (uint w = 1; w <= l; w++) {
+		M_IDX(U1, l, w, 1) = M_IDX(X, 8, 5, w);
+		M_IDX(U1, l, w, 2) = 0.0f;
+		M_IDX(U1, l, w, 3) = 0.0f;
+		M_IDX(U1, l, w, 4) = M_IDX(X, 8, 7, w);
+	}
+	m_copy(4 * l, 1, 4 * l, U2, 4 * l, U1);
+	float *Y1 = create_matrix(4 * l, 3);
+	float *Y2 = create_matrix(4 * l, 3);
+	bdf1_ens_sweep(4, l, F_influenza_ens, dF_influenza_ens, X, 0.0f, U1,
+	               3, tout, Y1, N, 1e-5f);
+	bdf1_ens_shared_sweep(4, l, F_influenza_ens, dF_influenza_ens, X,
+	                      0.0f, U2, 3, tout, Y2, N, 1e-5f, &st);
+	printf("%u steps: %u factorizations, %u iterations, %u fallbacks\n",
+	       st.nsteps, st.ndecomp, st.nniter, st.nreject);
+	check(4 * l * 3, Y2, Y1, 1e-3f);
+	assert(st.nsteps == N);
+	assert(st.ndecomp < N / 4);
+	free(Y2);
+	free(Y1);
+	free(U2);
+	free(U1);
+
+	/* the batched model gives the same outputs */
+	float *Z1 = create_matrix(22, l);
+	float *Z2 = create_matrix(22, l);
+	fwd_influenza_batch(l, X, Z1, NULL);
+	fwd_influenza_batch_shared(l, X, Z2, NULL);
+	check(22 * l, Z2, Z1, 1e-2f);
+	free(Z2);
+	free(Z1);
+	free(X);
+
+	/* lanes too far apart for one matrix fall back to their own */
+	uint W = 8;
+	float a[8];
+	float V1[2 * 8];
+	float V2[2 * 8];
+	float Yv1[2 * 8 * 3];
+	float Yv2[2 * 8 * 3];
+	for (uint w = 1; w <= W; w++) {
+		V_IDX(a, w) = powf(10.0f, (float)w - 1.0f);
+		M_IDX(V1, W, w, 1) = 1.0f;
+		M_IDX(V1, W, w, 2) = 2.0f;
+	}
+	m_copy(2 * W, 1, 2 * W, V2, 2 * W, V1);
+	bdf1_ens_sweep(2, W, f_stiff, df_stiff, a, 0.0f, V1, 3, tout, Yv1,
+	               100, 1e-5f);
+	nf = 0;
+	bdf1_ens_shared_sweep(2, W, f_stiff, df_stiff, a, 0.0f, V2, 3, tout,
+	                      Yv2, 100, 1e-5f, &st);
+	printf("%u steps: %u factorizations, %u iterations, %u fallbacks\n",
+	       st.nsteps, st.ndecomp, st.nniter, st.nreject);
+	assert(st.nreject > 0);
+	assert(st.nfev == nf && st.nniter == nf);
+	check(2 * W * 3, Yv2, Yv1, 1e-3f);
+	/* without retrying the shared matrix at every step */
+	assert(st.njev < st.nsteps / 4);
+
+	return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "tsttools.h"
+
+#include <math.h>
+#include <string.h>
+
+extern void F_influenza(float, float *, float *, void *);
+extern void dF_influenza(float, float *, float *, void *);
+extern size_t fwd_HIV_warm_size(void);
+extern void fwd_HIV_warm(float *, float *, void *, void *);
+
+/* u' = -a u, with a = (x1 + x2) / 4 */
+void f_decay(float t, float *u, float *d, void *ctx)
+{
+	float *x = (float *)ctx;
+	float a = (V_IDX(x, 1) + V_IDX(x, 2)) / 4.0f;
+	V_IDX(d, 1) = -a * V_IDX(u, 1);
+}
+
+/* number of evaluations that were handed a valid state */
+static uint nwarm;
+
+struct decay_warm {
+	struct ode_warm w;
+	float h[1];
+};
+
+void fwd_decay(float *x, float *y, void *state, void *ctx)
+{
+	struct decay_warm *s = (struct decay_warm *)state;
+	const float tout[1] = { 1.0f };
+	s->w.h = s->h;
+	nwarm += s->w.valid;
+	float u[1] = { 1.0f };
+	assert(!dopri5_warm(1, f_decay, x, 0.0f, u, 1, tout, y, 1e-5f, 1e-7f,
+	                    &s->w, NULL));
+}
+
+void fwd_decay_cold(float *x, float *y, void *ctx)
+{
+	const float tout[1] = { 1.0f };
+	float u[1] = { 1.0f };
+	assert(!dopri5(1, f_decay, x, 0.0f, u, 1, tout, y, 1e-5f, 1e-7f,
+	               NULL));
+}
+
+static void influenza_init(float *x, float *u)
+{
+	V_IDX(u, 1) = V_IDX(x, 5);
+	V_IDX(u, 2) = 0.0f;
+	V_IDX(u, 3) = 0.0f;
+	V_IDX(u, 4) = V_IDX(x, 7);
+}
+
+static void check(uint size, float *A, float *B, float tol)
+{
+	for (uint j = 1; j <= size; j++) {
+		float b = V_IDX(B, j);
+		assert(fabsf(V_IDX(A, j) - b) <= tol * (1.0f + fabsf(b)));
+	}
+}
+
+int main(void)
+{
+	float tout[5] = { 4.5f, 20.0f, 51.0f, 105.0f, 166.0f };
+	float x[7] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f };
+	float u[4];
+	float Y1[4 * 5];
+	float Y2[4 * 5];
+	float h[5];
+	float J[4 * 4];
+	struct ode_stats cold, hot;
+
+	/* dopri5: the second solve, at a nearby point, is cheaper */
+	struct ode_warm w = { 0 };
+	w.h = h;
+	influenza_init(x, u);
+	assert(!dopri5_warm(4, F_influenza, x, 0.0f, u, 5, tout, Y1,
+	                    1e-5f, 1e-7f, &w, &cold));
+	assert(w.valid);
+	V_IDX(x, 1) *= 1.01f;
+	influenza_init(x, u);
+	assert(!dopri5(4, F_influenza, x, 0.0f, u, 5, tout, Y1,
+	               1e-5f, 1e-7f, &cold));
+	influenza_init(x, u);
+	assert(!dopri5_warm(4, F_influenza, x, 0.0f, u, 5, tout, Y2,
+	                    1e-5f, 1e-7f, &w, &hot));
+	check(4 * 5, Y2, Y1, 1e-3f);
+	assert(hot.nfev < cold.nfev);
+	assert(hot.nreject <= cold.nreject);
+
+	/* bdf: the Jacobian of the previous solve is reused */
+	memset(&w, 0, sizeof(w));
+	w.h = h;
+	w.J = J;
+	V_IDX(x, 1) = 0.3f;
+	influenza_init(x, u);
+	assert(!bdf_warm(4, F_influenza, dF_influenza, x, 0.0f, u, 5, tout, Y1,
+	                 1e-5f, 1e-7f, &w, &cold));
+	assert(w.valid && w.jac_age == 0 && w.order >= 1);
+	V_IDX(x, 1) *= 1.01f;
+	influenza_init(x, u);
+	assert(!bdf(4, F_influenza, dF_influenza, x, 0.0f, u, 5, tout, Y1,
+	            1e-5f, 1e-7f, &cold));
+	influenza_init(x, u);
+	assert(!bdf_warm(4, F_influenza, dF_influenza, x, 0.0f, u, 5, tout, Y2,
+	                 1e-5f, 1e-7f, &w, &hot));
+	check(4 * 5, Y2, Y1, 1e-3f);
+	assert(hot.nfev < cold.nfev);
+	assert(hot.njev <= cold.njev);
+	assert(w.jac_age <= 1);
+
+	/* cluster_newton_ws() hands each point its state back */
+	uint m = 2;
+	uint n = 1;
+	uint l = 10;
+	uint K = 5;
+	float ys[1] = { expf(-0.5f) };
+	float xh[2] = { 1.0f, 1.0f };
+	float v[2] = { 0.5f, 0.5f };
+	float *Xf1 = create_matrix(m, l);
+	float *Xf2 = create_matrix(m, l);
+	float *r1 = create_vector(l);
+	float *r2 = create_vector(l);
+	struct cn_workspace *ws = cn_workspace_create(m, n, l);
+	for (uint k = 0; k < 2; k++) {
+		srand(1429874166 + k);
+		cn_workspace_set_warm(ws, NULL, 0);
+		cluster_newton_ws(ws, fwd_decay_cold, NULL, ys, xh, v, 0.01f,
+		                  K, Xf1, r1);
+
+		/* the states are reset with each new cluster */
+		srand(1429874166 + k);
+		cn_workspace_set_warm(ws, fwd_decay, sizeof(struct decay_warm));
+		nwarm = 0;
+		cluster_newton_ws(ws, NULL, NULL, ys, xh, v, 0.01f, K, Xf2, r2);
+		assert(nwarm == K * l);
+		check(m * l, Xf2, Xf1, 1e-3f);
+		check(l, r2, r1, 1e-2f);
+	}
+	cn_workspace_destroy(ws);
+	free(r2);
+	free(r1);
+	free(Xf2);
+	free(Xf1);
+
+	/* the HIV model can be evaluated warm */
+	float X[13] = {
+		-0.02f, -0.03f, -0.01f, -0.02f, 1e-3f, 1e-3f, 1e-3f,
+		1e-3f, 1e-3f, 1.0f, 1.0f, 1.0f, 1.0f
+	};
+	float Z1[4 * 5];
+	float Z2[4 * 5];
+	void *state = calloc(1, fwd_HIV_warm_size());
+	assert(state);
+	fwd_HIV_warm(X, Z1, state, NULL);
+	fwd_HIV_warm(X, Z2, state, NULL);
+	check(4 * 5, Z2, Z1, 1e-2f);
+	free(state);
+
+	return 0;
+}
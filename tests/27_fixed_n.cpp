@@ -0,0 +1,180 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "integrate.h"
+#include "integrate.hpp"
+
+#include <math.h>
+
+extern "C" {
+void F_influenza(float, float *, float *, void *);
+void dF_influenza(float, float *, float *, void *);
+}
+
+struct influenza {
+	static const uint n = 4;
+	static const uint np = 7;
+
+	template <typename T, typename P>
+	static void rhs(float t, const T *u, T *d, const P *x)
+	{
+		V_IDX(d, 1) = -V_IDX(x, 1) * V_IDX(u, 1) * V_IDX(u, 4);
+		V_IDX(d, 2) = V_IDX(x, 1) * V_IDX(u, 1) * V_IDX(u, 4)
+		              - V_IDX(u, 2) / V_IDX(x, 2);
+		V_IDX(d, 3) = V_IDX(u, 2) / V_IDX(x, 2)
+		              - V_IDX(u, 3) / V_IDX(x, 3);
+		V_IDX(d, 4) = V_IDX(x, 4) * V_IDX(u, 3) / V_IDX(x, 5)
+		              - V_IDX(x, 6) * V_IDX(u, 4);
+	}
+};
+
+/* from u = 0 with h = 1, Newton's method cycles between 0 and 1 */
+struct cycle {
+	static const uint n = 1;
+	static const uint np = 1;
+
+	template <typename T, typename P>
+	static void rhs(float t, const T *u, T *d, const P *x)
+	{
+		V_IDX(d, 1) = (3.0f - V_IDX(u, 1) * V_IDX(u, 1)) * V_IDX(u, 1)
+		              - 2.0f;
+	}
+};
+
+/* u' = x u: with x = h = 1, 1 - hDf = 0 */
+struct linear {
+	static const uint n = 1;
+	static const uint np = 1;
+
+	template <typename T, typename P>
+	static void rhs(float t, const T *u, T *d, const P *x)
+	{
+		V_IDX(d, 1) = V_IDX(u, 1) * V_IDX(x, 1);
+	}
+};
+
+/* u' = -A u, with A lower bidiagonal */
+static void f_chain(float t, float *u, float *d, void *ctx)
+{
+	V_IDX(d, 1) = -V_IDX(u, 1);
+	for (uint i = 2; i <= 6; i++) {
+		V_IDX(d, i) = V_IDX(u, i - 1) - i * V_IDX(u, i);
+	}
+}
+
+static void df_chain(float t, float *u, float *J, void *ctx)
+{
+	for (uint j = 1; j <= 6; j++) {
+		for (uint i = 1; i <= 6; i++) {
+			M_IDX(J, 6, i, j) = (i == j ? -(float)i
+			                     : i == j + 1 ? 1.0f : 0.0f);
+		}
+	}
+}
+
+static void init(float *x, float *u)
+{
+	V_IDX(u, 1) = V_IDX(x, 5);
+	V_IDX(u, 2) = 0.0f;
+	V_IDX(u, 3) = 0.0f;
+	V_IDX(u, 4) = V_IDX(x, 7);
+}
+
+static void check(uint size, float *A, float *B, float tol)
+{
+	for (uint j = 1; j <= size; j++) {
+		float b = V_IDX(B, j);
+		assert(fabs(V_IDX(A, j) - b) <= tol * (1.0f + fabs(b)));
+	}
+}
+
+int main(void)
+{
+	float x[7] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f };
+	float tf[6] = { 0.0f, 4.5f, 12.0f, 51.0f, 105.0f, 166.0f };
+	float u1[4], u2[4];
+	float Y1[4 * 6], Y2[4 * 6];
+	float work[BDF1_WORK_SIZE(4)];
+	int iwork[BDF1_IWORK_SIZE(4)];
+
+	/* the caller's workspace gives the same results */
+	init(x, u1);
+	init(x, u2);
+	rk4(4, F_influenza, x, 0.0f, u1, 40.0f, 300);
+	rk4_work(4, F_influenza, x, 0.0f, u2, 40.0f, 300, work);
+	check(4, u2, u1, 0.0f);
+
+	init(x, u1);
+	init(x, u2);
+	rk4_sweep(4, F_influenza, x, 0.0f, u1, 6, tf, Y1, 800);
+	rk4_sweep_work(4, F_influenza, x, 0.0f, u2, 6, tf, Y2, 800, work);
+	check(4 * 6, Y2, Y1, 0.0f);
+
+	init(x, u1);
+	init(x, u2);
+	bdf1(4, F_influenza, dF_influenza, x, 0.0f, u1, 40.0f, 300, 1e-4f);
+	bdf1_work(4, F_influenza, dF_influenza, x, 0.0f, u2, 40.0f, 300, 1e-4f,
+	          work, iwork);
+	check(4, u2, u1, 0.0f);
+
+	init(x, u1);
+	init(x, u2);
+	bdf1_sweep(4, F_influenza, dF_influenza, x, 0.0f, u1, 6, tf, Y1,
+	           800, 1e-3f);
+	bdf1_sweep_work(4, F_influenza, dF_influenza, x, 0.0f, u2, 6, tf, Y2,
+	                800, 1e-3f, work, iwork);
+	check(4 * 6, Y2, Y1, 0.0f);
+
+	/* and so do the specializations for a fixed model */
+	init(x, u2);
+	assert(cn::bdf1_sweep<influenza>(x, 0.0f, u2, 6, tf, Y2, 800,
+	                                 1e-3f) == 0);
+	check(4 * 6, Y2, Y1, 1e-4f);
+
+	/* which fail, rather than hang or divide by zero */
+	float one = 1.0f;
+	float t2[2] = { 1.0f, 2.0f };
+	float w[1], W2[2];
+	V_IDX(w, 1) = 0.0f;
+	assert(cn::bdf1_sweep<cycle>(&one, 0.0f, w, 2, t2, W2, 2, 1e-6f)
+	       == -1);
+	assert(isnan(V_IDX(W2, 1)) && isnan(V_IDX(W2, 2)));
+	V_IDX(w, 1) = 1.0f;
+	assert(cn::bdf1_sweep<linear>(&one, 0.0f, w, 2, t2, W2, 2, 1e-6f)
+	       == -2);
+	assert(V_IDX(w, 1) == 1.0f && isnan(V_IDX(W2, 2)));
+
+	init(x, u1);
+	init(x, u2);
+	rk4_sweep(4, F_influenza, x, 0.0f, u1, 6, tf, Y1, 800);
+	cn::rk4_sweep<influenza>(x, 0.0f, u2, 6, tf, Y2, 800);
+	check(4 * 6, Y2, Y1, 1e-5f);
+
+	/* larger systems are factored by LAPACK, in the same workspace */
+	float v1[6], v2[6];
+	float work6[BDF1_WORK_SIZE(6)];
+	int iwork6[BDF1_IWORK_SIZE(6)];
+	for (uint i = 1; i <= 6; i++) {
+		V_IDX(v1, i) = V_IDX(v2, i) = 1.0f;
+	}
+	bdf1(6, f_chain, df_chain, NULL, 0.0f, v1, 2.0f, 50, 1e-5f);
+	bdf1_work(6, f_chain, df_chain, NULL, 0.0f, v2, 2.0f, 50, 1e-5f,
+	          work6, iwork6);
+	check(6, v2, v1, 0.0f);
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+extern void fwd_influenza(float *, float *, void *);
+
+/* fidelity seen by each evaluation of the model */
+static float seen[256];
+static uint ncalls;
+
+/* a coarse model is off by up to (1 - fidelity) / 2 */
+void f(float *in, float *out, void *ctx)
+{
+	float fid = *(float *)ctx;
+	float x1 = V_IDX(in, 1);
+	float x2 = V_IDX(in, 2);
+	V_IDX(out, 1) = x1 * x1 + x2 * x2
+	                + 0.5f * (1.0f - fid) * sinf(40.0f * x1);
+	seen[ncalls++] = fid;
+}
+
+int main(void)
+{
+	uint m = 2;
+	uint n = 1;
+	uint l = 10;
+	uint K = 10;
+	float ys[1] = { 100.0f };
+	float xh[2] = { 2.5f, 2.5f };
+	float v[2] = { 1.0f, 1.0f };
+	float eta = 0.01f;
+	float *X = create_matrix(m, l);
+	float *r = create_vector(l);
+	float *r1 = create_vector(l);
+	float fid = 1.0f;
+
+	/* reference, at full fidelity */
+	struct cn_workspace *ws = cn_workspace_create(m, n, l);
+	srand(1429874166);
+	cluster_newton_ws(ws, f, &fid, ys, xh, v, eta, K, X, r1);
+
+	/* the fidelity follows the schedule, and ends at the top level */
+	float levels[3] = { 0.25f, 0.5f, 1.0f };
+	uint start[3] = { 0, 3, 20 };
+	struct cn_fidelity fs = { 3, levels, start, 0.0f, &fid };
+	cn_workspace_set_fidelity(ws, &fs);
+	srand(1429874166);
+	ncalls = 0;
+	cluster_newton_ws(ws, f, &fid, ys, xh, v, eta, K, X, r);
+	assert(ncalls == (K + 1) * l);
+	for (uint k = 0; k <= K; k++) {
+		float expect = (k < 3 ? 0.25f : k < K ? 0.5f : 1.0f);
+		for (uint j = 0; j < l; j++) {
+			assert(seen[k * l + j] == expect);
+		}
+	}
+	for (uint j = 1; j <= l; j++) {
+		assert(fabsf(V_IDX(r, j) - V_IDX(r1, j))
+		       <= 0.05f * V_IDX(r1, j) + 1e-3f);
+	}
+
+	/* a stalling linear fit moves to the next level early */
+	uint late[2] = { 0, 20 };
+	struct cn_fidelity fe = { 2, levels + 1, late, 0.9f, &fid };
+	cn_workspace_set_fidelity(ws, &fe);
+	srand(1429874166);
+	ncalls = 0;
+	cluster_newton_ws(ws, f, &fid, ys, xh, v, eta, K, X, r);
+	uint first = 0;
+	while (seen[first * l] < 1.0f) {
+		first++;
+	}
+	assert(first < K);
+	for (uint c = first * l; c < ncalls; c++) {
+		assert(seen[c] == 1.0f);
+	}
+
+	/* without a schedule, the model is not told anything */
+	cn_workspace_set_fidelity(ws, NULL);
+	fid = 1.0f;
+	cluster_newton_ws(ws, f, &fid, ys, xh, v, eta, K, X, r);
+	assert(fid == 1.0f);
+	cn_workspace_destroy(ws);
+	free(r1);
+	free(r);
+	free(X);
+
+	/* the influenza model takes fewer steps at a lower fidelity */
+	float x[7] = { 0.3f, 1.2f, 0.7f, 3.3f, 0.4f, 0.7f, 1.1f };
+	float Y1[22];
+	float Y2[22];
+	fwd_influenza(x, Y1, NULL);
+	fid = 1.0f;
+	fwd_influenza(x, Y2, &fid);
+	for (uint i = 1; i <= 22; i++) {
+		assert(V_IDX(Y2, i) == V_IDX(Y1, i));
+	}
+	fid = 0.25f;
+	fwd_influenza(x, Y2, &fid);
+	float ymax = 0.0f;
+	for (uint i = 1; i <= 22; i++) {
+		ymax = fmaxf(ymax, fabsf(V_IDX(Y1, i)));
+	}
+	for (uint i = 1; i <= 22; i++) {
+		assert(fabsf(V_IDX(Y2, i) - V_IDX(Y1, i)) <= 0.05f * ymax);
+	}
+
+	return 0;
+}
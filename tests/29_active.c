@@ -0,0 +1,145 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+static uint evals;
+
+void f(float *in, float *out, void *ctx)
+{
+	float x1 = V_IDX(in, 1);
+	float x2 = V_IDX(in, 2);
+	V_IDX(out, 1) = x1 * x1 + x2 * x2;
+	evals++;
+}
+
+/* in three dimensions, with a second component whose target is zero */
+void g(float *in, float *out, void *ctx)
+{
+	float x1 = V_IDX(in, 1);
+	float x2 = V_IDX(in, 2);
+	float x3 = V_IDX(in, 3);
+	V_IDX(out, 1) = x1 * x1 + x2 * x2 + x3 * x3;
+	V_IDX(out, 2) = x1 - x2;
+	evals++;
+}
+
+int main(void)
+{
+	uint m = 2;
+	uint n = 1;
+	uint l = 10;
+	float ys[1] = { 100.0f };
+	float xh[2] = { 2.5f, 2.5f };
+	float v[2] = { 1.0f, 1.0f };
+	float eta = 0.01f;
+	uint K = 40;
+
+	float *X1 = create_matrix(m, l);
+	float *X2 = create_matrix(m, l);
+	float *r1 = create_vector(l);
+	float *r2 = create_vector(l);
+	uint iters[10];
+
+	struct cn_workspace *ws = cn_workspace_create(m, n, l);
+
+	/* without an active set, every point is evaluated every time */
+	srand(1429874166);
+	evals = 0;
+	cluster_newton_ws(ws, f, NULL, ys, xh, v, eta, K, X1, r1);
+	assert(evals == (K + 1) * l);
+
+	/* frozen points are no longer evaluated, nor moved */
+	struct cn_active as = { 2.0f * eta, 0.0f, iters };
+	cn_workspace_set_active(ws, &as);
+	srand(1429874166);
+	evals = 0;
+	cluster_newton_ws(ws, f, NULL, ys, xh, v, eta, K, X2, r2);
+	assert(evals < (K + 1) * l);
+	uint sum = 0;
+	for (uint j = 1; j <= l; j++) {
+		assert(V_IDX(iters, j) >= 1 && V_IDX(iters, j) <= K + 1);
+		sum += V_IDX(iters, j);
+		assert(V_IDX(r2, j) <= 3.1f * eta);
+		float y = M_IDX(X2, m, 1, j) * M_IDX(X2, m, 1, j)
+		        + M_IDX(X2, m, 2, j) * M_IDX(X2, m, 2, j);
+		assert(fabs(y / ys[0] - 1.0f) <= 3.1f * eta);
+	}
+	assert(sum == evals);
+	print_vector(l, r2);
+
+	/* stop as soon as half of the points have converged */
+	as.frac = 0.5f;
+	srand(1429874166);
+	evals = 0;
+	cluster_newton_ws(ws, f, NULL, ys, xh, v, eta, K, X2, r2);
+	uint done = 0;
+	uint last = 0;
+	for (uint j = 1; j <= l; j++) {
+		last = (V_IDX(iters, j) > last ? V_IDX(iters, j) : last);
+	}
+	for (uint j = 1; j <= l; j++) {
+		done += (V_IDX(r2, j) <= 3.1f * eta);
+	}
+	assert(done >= l / 2);
+	assert(last < K + 1);
+
+	/* unset, the results are those of a plain run */
+	cn_workspace_set_active(ws, NULL);
+	srand(1429874166);
+	cluster_newton_ws(ws, f, NULL, ys, xh, v, eta, K, X2, r2);
+	for (uint j = 1; j <= l; j++) {
+		assert(V_IDX(r1, j) == V_IDX(r2, j));
+		for (uint i = 1; i <= m; i++) {
+			assert(M_IDX(X1, m, i, j) == M_IDX(X2, m, i, j));
+		}
+	}
+	cn_workspace_destroy(ws);
+
+	/* a zero target does not keep the points from converging */
+	float zs[2] = { 3.0f, 0.0f };
+	float xz[3] = { 1.0f, 1.0f, 1.0f };
+	float vz[3] = { 0.2f, 0.2f, 0.2f };
+	float *X3 = create_matrix(3, l);
+	as.frac = 0.0f;
+	ws = cn_workspace_create(3, 2, l);
+	cn_workspace_set_active(ws, &as);
+	srand(1429874166);
+	evals = 0;
+	cluster_newton_ws(ws, g, NULL, zs, xz, vz, eta, K, X3, r2);
+	assert(evals < (K + 1) * l);
+	for (uint j = 1; j <= l; j++) {
+		float x1 = M_IDX(X3, 3, 1, j);
+		float x2 = M_IDX(X3, 3, 2, j);
+		float x3 = M_IDX(X3, 3, 3, j);
+		float y = x1 * x1 + x2 * x2 + x3 * x3;
+		assert(V_IDX(r2, j) <= 3.1f * eta);
+		assert(fabs(y / zs[0] - 1.0f) <= 3.1f * eta);
+		assert(fabs(x1 - x2) <= 3.1f * eta);
+	}
+	cn_workspace_destroy(ws);
+	free(X3);
+
+	free(r2);
+	free(r1);
+	free(X2);
+	free(X1);
+
+	return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ *    This file is part of CNewt.
+ *
+ *    CNewt is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    CNewt is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with CNewt.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cn.h"
+#include "tsttools.h"
+
+#include <math.h>
+
+extern void fwd_HIV(float *, float *, void *);
+extern size_t fwd_HIV_warm_size(void);
+extern void fwd_HIV_warm(float *, float *, void *, void *);
+
+/* u1 grows as exp(0.7 t): it overflows between the third and fourth
+ * observation times, 115 and 140 */
+static float X[13] = {
+	0.7f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+	0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f
+};
+
+static void check(const float *Y)
+{
+	for (uint j = 1; j <= 3; j++) {
+		float t = (j == 1 ? 70.0f : (j == 2 ? 95.0f : 115.0f));
+		float y = M_IDX(Y, 4, 1, j);
+		assert(isfinite(y));
+		assert(fabs(log(y) / t - 0.7f) <= 1e-3f);
+	}
+	for (uint j = 4; j <= 5; j++) {
+		for (uint i = 1; i <= 4; i++) {
+			assert(isnan(M_IDX(Y, 4, i, j)));
+		}
+	}
+}
+
+int main(void)
+{
+	/* the observations past the failure are not left stale */
+	float Y[4 * 5];
+	for (uint i = 1; i <= 4 * 5; i++) {
+		V_IDX(Y, i) = 1.0f;
+	}
+	fwd_HIV(X, Y, NULL);
+	check(Y);
+
+	for (uint i = 1; i <= 4 * 5; i++) {
+		V_IDX(Y, i) = 1.0f;
+	}
+	void *state = calloc(1, fwd_HIV_warm_size());
+	assert(state);
+	fwd_HIV_warm(X, Y, state, NULL);
+	check(Y);
+	free(state);
+
+	return 0;
+}